@@ -0,0 +1,268 @@
+#include "actor.h"
+#include "lfqueue.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Actor states, as seen by the scheduler after the actor switched out
+#define ACTOR_RUNNING  0
+#define ACTOR_YIELDING 1
+#define ACTOR_PARKING  2
+#define ACTOR_SLEEPING 3
+#define ACTOR_DONE     4
+
+// Worker spins before parking on an empty run queue
+#define ACTOR_SPIN_LIMIT 2000
+
+/*
+ * Run queue and worker pool of the runtime.
+ * Side effects:
+ * - Shared by every worker thread and by the threads waking actors.
+ */
+static LFQueue run_queue;
+static int idle_workers = 0;
+static pthread_mutex_t idle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static int num_workers;
+static int max_actors_allowed;
+static int num_actors = 0;
+static unsigned long switches = 0;
+
+// Scheduler context of the worker and the actor it runs
+static __thread ucontext_t scheduler_context;
+static __thread Actor *current_actor = NULL;
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Make an actor runnable.
+ * Side effects:
+ * - Wakes an idle worker if there is one.
+ */
+static void actor_ready(Actor *actor) {
+    actor->state = ACTOR_RUNNING;
+    // The run queue is sized for every actor, each of which is queued at most once
+    while (lfq_push(&run_queue, actor) < 0) {
+        cpu_relax();
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&idle_workers, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&idle_mutex);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_mutex);
+    }
+}
+
+static Actor *run_queue_pop(void) {
+    Actor *actor;
+    for (int spin = 0; spin < ACTOR_SPIN_LIMIT; spin++) {
+        if ((actor = lfq_pop(&run_queue)) != NULL) {
+            return actor;
+        }
+        cpu_relax();
+    }
+
+    pthread_mutex_lock(&idle_mutex);
+    __atomic_add_fetch(&idle_workers, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while ((actor = lfq_pop(&run_queue)) == NULL) {
+        pthread_cond_wait(&idle_cond, &idle_mutex);
+    }
+    __atomic_sub_fetch(&idle_workers, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&idle_mutex);
+    return actor;
+}
+
+// Timer callback: a sleeping actor is due
+static void actor_wake_timer(Timer *timer) {
+    actor_ready((Actor *)((char *)timer - offsetof(Actor, timer)));
+}
+
+/*
+ * Worker thread: runs actors until they block, then finishes what they asked for.
+ * Side effects:
+ * - Parking, sleeping and freeing happen here, after the actor's stack is no
+ *   longer in use, so another worker can never resume an actor still switching out.
+ */
+static void *worker_thread(void *arg) {
+    while (1) {
+        Actor *actor = run_queue_pop();
+        current_actor = actor;
+        swapcontext(&scheduler_context, &actor->context);
+        current_actor = NULL;
+        __atomic_add_fetch(&switches, 1, __ATOMIC_RELAXED);
+
+        switch (actor->state) {
+        case ACTOR_YIELDING:
+            actor_ready(actor);
+            break;
+        case ACTOR_PARKING:
+            pthread_mutex_unlock(actor->park_lock);
+            break;
+        case ACTOR_SLEEPING:
+            timer_schedule(&actor->timer, actor->sleep_ms, actor_wake_timer);
+            break;
+        case ACTOR_DONE:
+            munmap(actor->stack, actor->stack_size);
+            free(actor);
+            __atomic_sub_fetch(&num_actors, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Start the scheduler.
+ * Side effects:
+ * - Allocates the run queue and creates 'workers' detached threads.
+ */
+void actor_runtime_start(int workers, int max_actors) {
+    if (lfq_init(&run_queue, max_actors) < 0) {
+        handle_error("Failed to allocate actor run queue");
+    }
+    num_workers = workers;
+    max_actors_allowed = max_actors;
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker_thread, NULL) != 0) {
+            handle_error("Failed to create actor worker thread");
+        }
+        pthread_detach(thread);
+    }
+    printf("Actor runtime started with %d worker thread(s)\n", workers);
+}
+
+// First frame of every actor
+static void actor_entry(void) {
+    Actor *self = current_actor;
+    self->fn(self->arg);
+    self->state = ACTOR_DONE;
+    swapcontext(&self->context, &scheduler_context);
+}
+
+/*
+ * Create a runnable actor.
+ * Side effects:
+ * - Maps its stack; pages are only committed as the actor touches them.
+ * Returns NULL if memory is short or the runtime already holds 'max_actors'.
+ */
+Actor *actor_spawn(ActorFn fn, void *arg, size_t stack_size) {
+    if (__atomic_add_fetch(&num_actors, 1, __ATOMIC_RELAXED) > max_actors_allowed) {
+        __atomic_sub_fetch(&num_actors, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    Actor *actor = calloc(1, sizeof(Actor));
+    if (!actor) {
+        __atomic_sub_fetch(&num_actors, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    actor->stack_size = stack_size ? stack_size : ACTOR_STACK_SIZE;
+    actor->stack = mmap(NULL, actor->stack_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (actor->stack == MAP_FAILED) {
+        free(actor);
+        __atomic_sub_fetch(&num_actors, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    actor->fn = fn;
+    actor->arg = arg;
+
+    getcontext(&actor->context);
+    actor->context.uc_stack.ss_sp = actor->stack;
+    actor->context.uc_stack.ss_size = actor->stack_size;
+    actor->context.uc_link = NULL;
+    makecontext(&actor->context, actor_entry, 0);
+
+    actor_ready(actor);
+    return actor;
+}
+
+Actor *actor_self(void) {
+    return current_actor;
+}
+
+// Give the worker back to the scheduler; it acts on 'state' once we are switched out
+static void actor_switch(Actor *self, int state) {
+    self->state = state;
+    swapcontext(&self->context, &scheduler_context);
+}
+
+void actor_yield(void) {
+    actor_switch(current_actor, ACTOR_YIELDING);
+}
+
+void actor_sleep_ms(unsigned long ms) {
+    Actor *self = current_actor;
+    if (!self) {
+        usleep(ms * 1000);
+        return;
+    }
+    self->sleep_ms = ms;
+    actor_switch(self, ACTOR_SLEEPING);
+}
+
+void actor_park(ActorWaitQueue *q, int (*ready)(void *), void *arg) {
+    Actor *self = current_actor;
+    pthread_mutex_lock(&q->mutex);
+    __atomic_add_fetch(&q->count, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (ready(arg)) {
+        __atomic_sub_fetch(&q->count, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&q->mutex);
+        return;
+    }
+    self->next = NULL;
+    if (q->tail) {
+        q->tail->next = self;
+    } else {
+        q->head = self;
+    }
+    q->tail = self;
+    self->park_lock = &q->mutex; // Unlocked by the worker after the switch
+    actor_switch(self, ACTOR_PARKING);
+}
+
+/*
+ * Wake the oldest actor parked on 'q'.
+ * Side effects:
+ * - Cheap when nobody is parked: only an atomic load after the caller's fence.
+ */
+void actor_wake_one(ActorWaitQueue *q) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->count, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    pthread_mutex_lock(&q->mutex);
+    Actor *actor = q->head;
+    if (actor) {
+        q->head = actor->next;
+        if (!q->head) {
+            q->tail = NULL;
+        }
+        __atomic_sub_fetch(&q->count, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    if (actor) {
+        actor_ready(actor);
+    }
+}
+
+/*
+ * Log the size and activity of the runtime.
+ * Side effects:
+ * - Logs one line.
+ */
+void actor_report(void) {
+    char message[256];
+    snprintf(message, sizeof(message), "Actor runtime: %d actors on %d workers, %lu context switches, %zu runnable",
+             __atomic_load_n(&num_actors, __ATOMIC_RELAXED), num_workers,
+             __atomic_load_n(&switches, __ATOMIC_RELAXED), lfq_size(&run_queue));
+    log_message(message);
+}
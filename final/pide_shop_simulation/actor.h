@@ -0,0 +1,70 @@
+#ifndef ACTOR_H
+#define ACTOR_H
+
+#include "timerwheel.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <ucontext.h>
+
+/*
+ * Lightweight actor runtime.
+ * Each actor is a coroutine with its own small stack, scheduled M:N over a few
+ * worker threads. Blocking points (an empty stage, a timed wait) park the actor
+ * and give the worker back to the scheduler instead of blocking the thread, so
+ * a fleet of many thousands of cooks and couriers fits in a handful of threads.
+ */
+
+#define ACTOR_STACK_SIZE (32 * 1024)
+
+typedef void (*ActorFn)(void *arg);
+
+typedef struct Actor Actor;
+
+struct Actor {
+    ucontext_t context;
+    void *stack;
+    size_t stack_size;
+    ActorFn fn;
+    void *arg;
+    int state;
+    unsigned long sleep_ms;         // Pending timed wait
+    pthread_mutex_t *park_lock;     // Released by the scheduler once the actor is switched out
+    Actor *next;                    // Link in a wait queue
+    Timer timer;
+};
+
+// Actors parked until an event; the lock-free producer side checks 'count' first
+typedef struct {
+    pthread_mutex_t mutex;
+    Actor *head;
+    Actor *tail;
+    int count;
+} ActorWaitQueue;
+
+#define ACTOR_WAIT_QUEUE_INITIALIZER {PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0}
+
+// Start 'workers' scheduler threads for at most 'max_actors' actors
+void actor_runtime_start(int workers, int max_actors);
+
+// Create an actor with a stack of 'stack_size' bytes (0 for ACTOR_STACK_SIZE); NULL on failure
+Actor *actor_spawn(ActorFn fn, void *arg, size_t stack_size);
+
+// Actor running on the calling thread, NULL outside the runtime
+Actor *actor_self(void);
+
+void actor_yield(void);
+
+// Sleep on a timer; blocks the thread with usleep() when not called from an actor
+void actor_sleep_ms(unsigned long ms);
+
+/*
+ * Park the calling actor on 'q' unless 'ready(arg)' already holds.
+ * The check runs after the actor is counted in 'q', so a producer that makes
+ * the condition true and then sees 'count' > 0 calls actor_wake_one().
+ */
+void actor_park(ActorWaitQueue *q, int (*ready)(void *), void *arg);
+void actor_wake_one(ActorWaitQueue *q);
+
+void actor_report(void);
+
+#endif // ACTOR_H
@@ -1,5 +1,8 @@
 #include "common.h"
 #include "utils.h"
+#include "menu.h"
+#include "control.h"
+#include "order_client.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,6 +10,10 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/un.h>
 
 /*
  * Global socket descriptor for the client.
@@ -57,19 +64,356 @@ void handle_eof() {
 }
 
 
-int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s [server_ip] [numberOfClients] [townWidth] [townHeight]\n", argv[0]);
+/*
+ * Open a connection to the pide server.
+ * Side effects:
+ * - Creates a socket; returns -1 if the connection fails.
+ */
+static int connect_to_server(const char *server_ip) {
+    struct sockaddr_in server;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("Could not create socket");
+        return -1;
+    }
+    server.sin_addr.s_addr = inet_addr(server_ip);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(8000);
+    if (connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        perror("Connection Failed");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Ask the server for its order and I/O syscall counters.
+ * Side effects:
+ * - Opens and closes a short-lived connection.
+ */
+static int query_server_stats(const char *server_ip, char *backend, unsigned long *orders, unsigned long *syscalls) {
+    int fd = connect_to_server(server_ip);
+    if (fd < 0) {
+        return -1;
+    }
+    char reply[256];
+    const char request[] = "Stats request";
+    send(fd, request, strlen(request), 0);
+    int len = recv(fd, reply, sizeof(reply) - 1, 0);
+    close(fd);
+    if (len <= 0) {
+        return -1;
+    }
+    reply[len] = '\0';
+    if (sscanf(reply, "Stats backend=%31s orders=%lu syscalls=%lu", backend, orders, syscalls) != 3) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Format an order for a random location in the town and a random pide of the menu.
+ * No side effects other than advancing rand().
+ */
+static int format_order(char *message, size_t size, int client_id, int town_width, int town_height) {
+    float posX = (float)(rand() % (town_width + 1));
+    float posY = (float)(rand() % (town_height + 1));
+    const char *pide = menu[menu_pick(rand() / (RAND_MAX + 1.0))].name;
+    return snprintf(message, size, "Order from client %d at position (%.2f, %.2f) pide %s", client_id, posX, posY, pide);
+}
+
+static double elapsed_seconds(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Load generator: keeps one order outstanding on each of 'num_conns' connections
+ * until 'num_orders' replies have arrived, then reports throughput and the server's
+ * I/O syscalls per order.
+ * Side effects:
+ * - Opens 'num_conns' connections to the server.
+ * - Prints the results to standard output.
+ */
+static void run_load_generator(const char *server_ip, int num_orders, int num_conns, int town_width, int town_height) {
+    char backend[32];
+    unsigned long orders_before, syscalls_before, orders_after, syscalls_after;
+    if (query_server_stats(server_ip, backend, &orders_before, &syscalls_before) < 0) {
+        fprintf(stderr, "Load: failed to query server statistics\n");
         exit(EXIT_FAILURE);
     }
 
-    printf("Client Step 1: Connecting to server...\n");
-    const char *server_ip = argv[1];
-    int num_clients = atoi(argv[2]);
-    int town_width = atoi(argv[3]);
-    int town_height = atoi(argv[4]);
+    struct pollfd *fds = calloc(num_conns, sizeof(struct pollfd));
+    if (!fds) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    int sent = 0, completed = 0, open_conns = 0;
+    for (int i = 0; i < num_conns; i++) {
+        fds[i].fd = connect_to_server(server_ip);
+        fds[i].events = POLLIN;
+        if (fds[i].fd >= 0) {
+            open_conns++;
+        }
+    }
+    if (open_conns == 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Prime every connection with one order
+    for (int i = 0; i < num_conns && sent < num_orders; i++) {
+        if (fds[i].fd < 0) {
+            continue;
+        }
+        char message[256];
+        int len = format_order(message, sizeof(message), sent + 1, town_width, town_height);
+        send(fds[i].fd, message, len, 0);
+        sent++;
+    }
+
+    while (completed < sent) {
+        if (poll(fds, num_conns, -1) < 0) {
+            perror("poll failed");
+            break;
+        }
+        for (int i = 0; i < num_conns; i++) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+                continue;
+            }
+            char reply[2000];
+            int len = recv(fds[i].fd, reply, sizeof(reply) - 1, 0);
+            if (len <= 0) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                sent--; // The outstanding order on this connection is lost
+                continue;
+            }
+            completed++;
+            if (sent < num_orders) {
+                char message[256];
+                int mlen = format_order(message, sizeof(message), sent + 1, town_width, town_height);
+                send(fds[i].fd, message, mlen, 0);
+                sent++;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int i = 0; i < num_conns; i++) {
+        if (fds[i].fd >= 0) {
+            close(fds[i].fd);
+        }
+    }
+    free(fds);
+
+    if (query_server_stats(server_ip, backend, &orders_after, &syscalls_after) < 0) {
+        fprintf(stderr, "Load: failed to query server statistics\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double seconds = elapsed_seconds(&start, &end);
+    unsigned long orders = orders_after - orders_before;
+    printf("Load: backend=%s connections=%d orders=%d time=%.3fs throughput=%.1f orders/s syscalls/order=%.2f\n",
+           backend, open_conns, completed, seconds, seconds > 0 ? completed / seconds : 0.0,
+           orders ? (double)(syscalls_after - syscalls_before) / orders : 0.0);
+}
+
+/*
+ * Progress of the orders of the async mode.
+ * Side effects:
+ * - Updated by the order callbacks, from inside order_client_poll().
+ */
+typedef struct {
+    OrderClient *client;
+    int cancel_every;             // Cancel every Nth order once accepted, 0 for none
+    int accepted;
+    int finished[3];              // Delivered, cancelled, failed
+    double total_eta;             // Minutes, over the accepted orders
+} AsyncRun;
+
+static void async_order_update(OrderHandle *handle, int status, void *user) {
+    AsyncRun *run = user;
+    if (status == ORDER_ACCEPTED) {
+        run->accepted++;
+        run->total_eta += order_handle_eta(handle);
+        if (run->cancel_every > 0 && run->accepted % run->cancel_every == 0) {
+            order_client_cancel(run->client, handle);
+        }
+    }
+    if (order_status_final(status)) {
+        run->finished[status == ORDER_DELIVERED ? 0 : status == ORDER_CANCELLED ? 1 : 2]++;
+    }
+}
+
+// Stops the async mode; the outstanding orders are then cancelled one by one
+static void async_signal_handler(int sig) {
+    keep_running = 0;
+}
+
+/*
+ * Async mode: submits every order at once through the order client library,
+ * multiplexed over 'num_conns' connections, and follows them until delivery.
+ * Side effects:
+ * - Opens 'num_conns' connections to the server.
+ * - SIGINT cancels the orders still outstanding instead of all orders of the shop.
+ * - Prints the results to standard output.
+ */
+static void run_async_orders(const char *server_ip, int num_orders, int num_conns, int cancel_every,
+                             int town_width, int town_height) {
+    AsyncRun run = {0};
+    run.cancel_every = cancel_every;
+    run.client = order_client_open(server_ip, ORDER_CLIENT_PORT, num_conns);
+    if (!run.client) {
+        exit(EXIT_FAILURE);
+    }
+    signal(SIGINT, async_signal_handler);
+    signal(SIGTERM, async_signal_handler);
+
+    OrderHandle **handles = calloc(num_orders, sizeof(OrderHandle *));
+    if (!handles) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_orders; i++) {
+        float posX = (float)(rand() % (town_width + 1));
+        float posY = (float)(rand() % (town_height + 1));
+        const char *pide = menu[menu_pick(rand() / (RAND_MAX + 1.0))].name;
+        handles[i] = order_client_submit(run.client, posX, posY, pide, async_order_update, &run);
+    }
+    printf("Async: %d orders submitted over %d connection(s)\n", num_orders, num_conns);
+
+    int outstanding, cancelled_all = 0;
+    while ((outstanding = order_client_poll(run.client, 1000)) > 0) {
+        if (!keep_running && !cancelled_all) {
+            printf("Async: cancelling %d outstanding order(s)\n", outstanding);
+            for (int i = 0; i < num_orders; i++) {
+                if (handles[i]) {
+                    order_client_cancel(run.client, handles[i]);
+                }
+            }
+            cancelled_all = 1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (outstanding < 0) {
+        fprintf(stderr, "Async: lost every connection with %d order(s) outstanding\n",
+                order_client_outstanding(run.client));
+    }
+    order_client_close(run.client); // Frees the handles as well
+    free(handles);
+
+    printf("Async: accepted=%d delivered=%d cancelled=%d failed=%d avg eta=%.2f min time=%.3fs\n",
+           run.accepted, run.finished[0], run.finished[1], run.finished[2],
+           run.accepted ? run.total_eta / run.accepted : 0.0, elapsed_seconds(&start, &end));
+}
+
+/*
+ * Send one admin command to the server's control socket and print the reply.
+ * Side effects:
+ * - Returns -1 if the server cannot be reached.
+ */
+static int run_admin_command(const char *path, const char *command) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Could not create socket");
+        return -1;
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        perror("Control connection failed");
+        close(fd);
+        return -1;
+    }
+    if (write(fd, command, strlen(command)) < 0) {
+        perror("Control command failed");
+        close(fd);
+        return -1;
+    }
+    char reply[CONTROL_BUFFER_SIZE];
+    ssize_t n;
+    while ((n = read(fd, reply, sizeof(reply))) > 0) {
+        fwrite(reply, 1, n, stdout);
+    }
+    close(fd);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c connections] [-A connections [-X cancelEveryN]] [server_ip] [numberOfClients] [townWidth] [townHeight]\n"
+                    "       %s [-S ControlSocket] -a \"status|cooks N|couriers N|autoscale on|off\"\n", prog, prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int load_conns = 0;
+    int async_conns = 0;
+    int cancel_every = 0;
+    const char *admin_command = NULL;
+    const char *control_path = CONTROL_SOCKET_PATH;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:a:S:A:X:")) != -1) {
+        switch (opt) {
+        case 'a':
+            admin_command = optarg;
+            break;
+        case 'S':
+            control_path = optarg;
+            break;
+        case 'A':
+            async_conns = atoi(optarg);
+            if (async_conns <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'X':
+            cancel_every = atoi(optarg);
+            break;
+        case 'c':
+            load_conns = atoi(optarg);
+            if (load_conns <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    // Admin mode: one command to the local control socket
+    if (admin_command) {
+        return run_admin_command(control_path, admin_command) < 0 ? EXIT_FAILURE : 0;
+    }
+    if (argc - optind != 4) {
+        usage(argv[0]);
+    }
+
+    const char *server_ip = argv[optind];
+    int num_clients = atoi(argv[optind + 1]);
+    int town_width = atoi(argv[optind + 2]);
+    int town_height = atoi(argv[optind + 3]);
     struct sockaddr_in server;
 
+    // Load generator mode, used to compare the server's network backends
+    if (load_conns > 0) {
+        run_load_generator(server_ip, num_clients, load_conns, town_width, town_height);
+        return 0;
+    }
+
+    // Async mode: every order outstanding at once through the order client library
+    if (async_conns > 0) {
+        run_async_orders(server_ip, num_clients, async_conns, cancel_every, town_width, town_height);
+        return 0;
+    }
+
+    printf("Client Step 1: Connecting to server...\n");
+
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
 
@@ -95,11 +439,9 @@ int main(int argc, char *argv[]) {
     printf("Client Step 5: Connected to server. Starting to send messages...\n");
 
     for (int i = 0; i < num_clients; i++) {
-        // Generate random position within the town
-        float posX = (float)(rand() % (town_width + 1));
-        float posY = (float)(rand() % (town_height + 1));
+        // Generate random position within the town and a random pide
         char message[256];
-        snprintf(message, sizeof(message), "Order from client %d at position (%.2f, %.2f)", i + 1, posX, posY);
+        format_order(message, sizeof(message), i + 1, town_width, town_height);
         send(sock, message, strlen(message), 0);
         printf("Message sent to server from client %d\n", i + 1);
 
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <complex.h>
+#include "pipeline.h"
 
 // Constants defining the limits and operational parameters
 #define MAX_COOKS 3
@@ -12,9 +13,24 @@
 #define MAX_OVEN_CAPACITY 6
 #define OVEN_OPENINGS 2
 
+// Execution model of the cooks and couriers
+#define SHOP_MODEL_THREADS 0 // One thread per cook, dispatcher threads and timers for the couriers
+#define SHOP_MODEL_ACTORS 1  // One actor per cook and per courier on the actor runtime
+
 // Function prototypes
 void log_message(const char *message);
-void notify_manager();
+void notify_manager(ShopOrder *order);
+int signal_cooks(ShopOrder *order);
+void signal_delivery_personnel(ShopOrder *order);
+void delivery_report(ShopOrder *order);
+void oven_report(void);
+long long oven_expected_wait_ns(void);
+
+// Pool resizing at runtime; return -1 if a pool could not grow
+int resize_cooks(int size);
+int resize_couriers(int size);
+int cook_pool_size(void);
+int courier_pool_size(void);
 void svd_pseudo_inverse(int m, int n, double complex A[m][n], double complex B[n][m]);
 
 // Debugging helper macros
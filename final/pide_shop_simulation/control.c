@@ -0,0 +1,233 @@
+#include "control.h"
+#include "common.h"
+#include "utils.h"
+#include "eta.h"
+#include "lockprof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Autoscaling state
+ * Side effects:
+ * - Read by the autoscaler thread, changed by control commands under 'control_mutex'.
+ */
+static AutoscaleConfig autoscale_config;
+static pthread_mutex_t control_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LockProfile control_profile = LOCK_PROFILE_INITIALIZER("control_mutex");
+
+typedef struct {
+    const char *name;
+    AutoscaleBounds *bounds;
+    Stage *stage;
+    int (*size)(void);
+    int (*resize)(int size);
+    int grow_periods;     // Consecutive periods above the grow threshold
+    int shrink_periods;   // Consecutive periods below the shrink threshold
+    int cooldown;
+} AutoscaledPool;
+
+static AutoscaledPool pools[2] = {
+    {"cooks", &autoscale_config.cooks, &cook_stage, cook_pool_size, resize_cooks},
+    {"couriers", &autoscale_config.couriers, &courier_stage, courier_pool_size, resize_couriers},
+};
+
+int autoscale_parse_bounds(const char *text, AutoscaleBounds *bounds) {
+    if (sscanf(text, "%d:%d", &bounds->min, &bounds->max) != 2 || bounds->min <= 0 || bounds->max < bounds->min) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Resize a pool and keep the ETA model in step.
+ * Side effects:
+ * - Logs the change.
+ */
+static int pool_resize(AutoscaledPool *pool, int size, const char *reason) {
+    int old = pool->size();
+    int status = pool->resize(size);
+    eta_set_pools(cook_pool_size(), courier_pool_size());
+
+    char message[256];
+    snprintf(message, sizeof(message), "Pool %s resized from %d to %d (%s)%s", pool->name, old, pool->size(),
+             reason, status < 0 ? ", could not grow further" : "");
+    log_message(message);
+    return status;
+}
+
+/*
+ * One autoscaling decision for 'pool', with 'busy' of its workers taken.
+ * Grows by a quarter after sustained queueing, shrinks by one after a sustained
+ * idle spell; the gap between the two thresholds, the period counts and the
+ * cooldown keep it from oscillating.
+ */
+static void autoscale_pool(AutoscaledPool *pool, int busy) {
+    if (pool->bounds->max == 0) {
+        return;
+    }
+    if (pool->cooldown > 0) {
+        pool->cooldown--;
+        return;
+    }
+    int size = pool->size();
+    size_t queued = lfq_size(&pool->stage->queue);
+
+    pool->grow_periods = queued > AUTOSCALE_GROW_QUEUE * size ? pool->grow_periods + 1 : 0;
+    pool->shrink_periods = queued == 0 && busy <= AUTOSCALE_SHRINK_BUSY * size ? pool->shrink_periods + 1 : 0;
+
+    int target = size;
+    if (pool->grow_periods >= AUTOSCALE_GROW_PERIODS) {
+        target = size + (size + 3) / 4;
+    } else if (pool->shrink_periods >= AUTOSCALE_SHRINK_PERIODS) {
+        target = size - 1;
+    }
+    if (target > pool->bounds->max) {
+        target = pool->bounds->max;
+    }
+    if (target < pool->bounds->min) {
+        target = pool->bounds->min;
+    }
+    if (target != size) {
+        pool_resize(pool, target, "autoscale");
+        pool->grow_periods = pool->shrink_periods = 0;
+        pool->cooldown = AUTOSCALE_COOLDOWN_PERIODS;
+    }
+}
+
+/*
+ * Autoscaler thread
+ * Side effects:
+ * - Resizes the pools once per period while autoscaling is enabled.
+ */
+static void *autoscale_thread(void *arg) {
+    while (1) {
+        usleep(AUTOSCALE_PERIOD_MS * 1000);
+        PROFILED_LOCK(&control_mutex, &control_profile);
+        if (autoscale_config.enabled) {
+            int busy_cooks, busy_couriers;
+            eta_busy(&busy_cooks, &busy_couriers);
+            autoscale_pool(&pools[0], busy_cooks);
+            autoscale_pool(&pools[1], busy_couriers);
+        }
+        PROFILED_UNLOCK(&control_mutex, &control_profile);
+    }
+    return NULL;
+}
+
+/*
+ * Execute one admin command.
+ * Side effects:
+ * - May resize a pool or switch autoscaling; writes a one-line reply.
+ */
+static void control_execute(char *command, char *reply, size_t reply_size) {
+    char verb[32] = "";
+    char argument[32] = "";
+    sscanf(command, "%31s %31s", verb, argument);
+
+    PROFILED_LOCK(&control_mutex, &control_profile);
+    AutoscaledPool *pool = NULL;
+    for (int i = 0; i < 2; i++) {
+        if (strcmp(verb, pools[i].name) == 0) {
+            pool = &pools[i];
+        }
+    }
+
+    if (pool) {
+        int size = atoi(argument);
+        if (size <= 0) {
+            snprintf(reply, reply_size, "error: %s needs a positive size", verb);
+        } else {
+            autoscale_config.enabled = 0; // The admin takes over
+            int status = pool_resize(pool, size, "admin");
+            snprintf(reply, reply_size, "%s %s=%d%s", status < 0 ? "error:" : "ok", pool->name, pool->size(),
+                     status < 0 ? " (could not grow further)" : "");
+        }
+    } else if (strcmp(verb, "autoscale") == 0 && (strcmp(argument, "on") == 0 || strcmp(argument, "off") == 0)) {
+        int on = strcmp(argument, "on") == 0;
+        if (on && autoscale_config.cooks.max == 0 && autoscale_config.couriers.max == 0) {
+            snprintf(reply, reply_size, "error: no autoscaling bounds given at startup");
+        } else {
+            autoscale_config.enabled = on;
+            snprintf(reply, reply_size, "ok autoscale=%s", argument);
+        }
+    } else if (strcmp(verb, "status") == 0) {
+        int busy_cooks, busy_couriers;
+        eta_busy(&busy_cooks, &busy_couriers);
+        snprintf(reply, reply_size, "cooks=%d busy=%d queued=%zu couriers=%d busy=%d queued=%zu autoscale=%s",
+                 cook_pool_size(), busy_cooks, lfq_size(&cook_stage.queue),
+                 courier_pool_size(), busy_couriers, lfq_size(&courier_stage.queue),
+                 autoscale_config.enabled ? "on" : "off");
+    } else {
+        snprintf(reply, reply_size, "error: unknown command");
+    }
+    PROFILED_UNLOCK(&control_mutex, &control_profile);
+}
+
+/*
+ * Control socket thread
+ * Side effects:
+ * - Serves one command per connection, one connection at a time.
+ */
+static void *control_thread(void *arg) {
+    int listen_fd = (int)(long)arg;
+    while (1) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        char command[CONTROL_BUFFER_SIZE];
+        ssize_t n = read(fd, command, sizeof(command) - 1);
+        if (n > 0) {
+            command[n] = '\0';
+            command[strcspn(command, "\r\n")] = '\0';
+            char reply[CONTROL_BUFFER_SIZE];
+            control_execute(command, reply, sizeof(reply));
+            size_t len = strlen(reply);
+            reply[len++] = '\n';
+            if (write(fd, reply, len) < 0) {
+                perror("Control reply failed");
+            }
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+/*
+ * Start the control socket and the autoscaler.
+ * Side effects:
+ * - Replaces a stale socket file at 'path'.
+ * - Creates two detached threads.
+ */
+void start_control(const char *path, const AutoscaleConfig *autoscale) {
+    autoscale_config = *autoscale;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        handle_error("Control socket creation failed");
+    }
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 8) < 0) {
+        handle_error("Control socket bind failed");
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, control_thread, (void *)(long)fd) != 0) {
+        handle_error("Failed to create control thread");
+    }
+    pthread_detach(thread);
+    if (pthread_create(&thread, NULL, autoscale_thread, NULL) != 0) {
+        handle_error("Failed to create autoscale thread");
+    }
+    pthread_detach(thread);
+    printf("Control socket listening on %s%s\n", path, autoscale_config.enabled ? ", autoscaling on" : "");
+}
@@ -0,0 +1,42 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+/*
+ * Local admin interface of the server.
+ * A Unix domain socket accepts one-line commands and answers with one line:
+ *   status                 pool sizes, queue depths and autoscaling state
+ *   cooks N                resize the cook pool
+ *   couriers N             resize the courier pool
+ *   autoscale on|off       start or stop queue-driven autoscaling
+ * A manual resize turns autoscaling off so the two do not fight.
+ */
+
+#define CONTROL_SOCKET_PATH "pide_shop.sock"
+#define CONTROL_BUFFER_SIZE 256
+
+// Autoscaling: one decision per period, thresholds in queued orders per worker
+#define AUTOSCALE_PERIOD_MS 1000
+#define AUTOSCALE_GROW_QUEUE 1.0      // Grow above this many queued orders per worker...
+#define AUTOSCALE_GROW_PERIODS 2      // ...for this many periods in a row
+#define AUTOSCALE_SHRINK_BUSY 0.5     // Shrink with an empty queue and at most this share busy...
+#define AUTOSCALE_SHRINK_PERIODS 5    // ...for this many periods in a row
+#define AUTOSCALE_COOLDOWN_PERIODS 3  // No decision right after a resize
+
+typedef struct {
+    int min;
+    int max;                          // 0: the pool is not autoscaled
+} AutoscaleBounds;
+
+typedef struct {
+    int enabled;
+    AutoscaleBounds cooks;
+    AutoscaleBounds couriers;
+} AutoscaleConfig;
+
+// Start the control socket and the autoscaler
+void start_control(const char *path, const AutoscaleConfig *autoscale);
+
+// Parse "min:max"; returns -1 if malformed
+int autoscale_parse_bounds(const char *text, AutoscaleBounds *bounds);
+
+#endif // CONTROL_H
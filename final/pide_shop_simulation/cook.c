@@ -1,7 +1,15 @@
 #include "common.h"
 #include "protocol.h"
 #include "utils.h"
+#include "menu.h"
+#include "oven.h"
+#include "timerwheel.h"
+#include "actor.h"
+#include "eta.h"
+#include "lockprof.h"
+#include "trace.h"
 #include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <complex.h>
@@ -13,59 +21,207 @@ typedef struct {
     int id;
 } Cook;
 
+/*
+ * Oven of the pool; loading decisions are taken by the scheduler in oven.c.
+ * 'load' is republished after every change under the mutex and read without
+ * it by the cooks choosing an oven. Loading and baking are timers on the
+ * timer wheel, so no thread waits on an oven.
+ */
 typedef struct {
-    int num_aparatus; // Number of available oven aparatus
-    int num_meals;    // Number of meals currently in the oven
+    OvenState state;
+    OvenLoad load;
     pthread_mutex_t mutex;
-    pthread_cond_t cond_aparatus;
-    pthread_cond_t cond_meals;
 } Oven;
 
-#define MAX_APARATUS 3
-#define MAX_MEALS 6
+/*
+ * Pool of cooks
+ * Side effects:
+ * - Resized at runtime by resize_cooks() under 'cook_pool_mutex'; cooks claim
+ *   pending retirements without the lock, between two orders.
+ */
+static int num_cooks;                // Target size of the pool
+static int next_cook_id = 0;
+static int cook_retire_pending = 0;
+static int cook_model;
+static pthread_mutex_t cook_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LockProfile cook_pool_profile = LOCK_PROFILE_INITIALIZER("cook_pool_mutex");
 
-// Array to hold all cooks
-static Cook *cooks;
-static int num_cooks;
-static pthread_mutex_t cook_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cook_cond = PTHREAD_COND_INITIALIZER;
-static int order_available = 0;
-static int order_count = 0;
+// Pool of ovens; their mutexes share one profile
+static Oven *ovens;
+static LockProfile oven_profile = LOCK_PROFILE_INITIALIZER("oven.mutex");
+static int num_ovens;
+static int oven_placement;
+static int oven_affinity;
 
-// Oven structure
-static Oven oven = {MAX_APARATUS, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+// Stack of a cook actor: compute_pseudo_inverse() keeps two 30x40 complex matrices on it
+#define COOK_ACTOR_STACK_SIZE (64 * 1024)
 
 // Prototype for cook thread function
 void *cook_thread(void *arg);
+static void cook_actor(void *arg);
 void compute_pseudo_inverse(void);
+static void oven_schedule(Oven *oven);
+static void oven_loaded(Timer *timer);
+static void oven_baked(Timer *timer);
 
-// Initialize cooks
-void start_cooks(int num_cooks_param) {
-    printf("Initializing cooks...\n");
-    num_cooks = num_cooks_param;
-    cooks = malloc(num_cooks * sizeof(Cook));
-    for (int i = 0; i < num_cooks; i++) {
-        cooks[i].id = i;
-        if (pthread_create(&cooks[i].thread, NULL, cook_thread, (void *)&cooks[i]) != 0) {
-            perror("Failed to create cook thread");
-            exit(EXIT_FAILURE);
+// Order owning an oven timer
+#define TIMER_ORDER(t) ((ShopOrder *)((char *)(t) - offsetof(ShopOrder, timer)))
+
+// Initialize the oven pool
+static void start_ovens(const OvenPoolConfig *config, int cooks_count) {
+    num_ovens = config->ovens > 0 ? config->ovens : oven_pool_default_size(cooks_count);
+    oven_placement = config->placement;
+    oven_affinity = config->affinity;
+    ovens = calloc(num_ovens, sizeof(Oven));
+    if (!ovens) {
+        handle_error("Failed to allocate ovens");
+    }
+    for (int i = 0; i < num_ovens; i++) {
+        if (oven_state_init(&ovens[i].state, config->capacity, config->openings, config->policy, (long long)now_ns()) < 0) {
+            handle_error("Failed to initialize oven");
         }
+        pthread_mutex_init(&ovens[i].mutex, NULL);
+        oven_state_load(&ovens[i].state, (long long)now_ns(), &ovens[i].load);
+    }
+    printf("%d oven(s) with capacity %d and %d openings, %s placement%s\n", num_ovens,
+           config->capacity, config->openings, oven_placement_name(oven_placement),
+           oven_affinity ? " with cook affinity" : "");
+}
+
+/*
+ * Choose the oven for a pide of 'cook' from the published loads.
+ * No locks are taken; a slightly stale load only costs a worse choice.
+ */
+static Oven *choose_oven(const Cook *cook) {
+    if (num_ovens == 1) {
+        return &ovens[0];
+    }
+    OvenLoad loads[num_ovens];
+    for (int i = 0; i < num_ovens; i++) {
+        loads[i].capacity = ovens[i].load.capacity;
+        loads[i].units = __atomic_load_n(&ovens[i].load.units, __ATOMIC_RELAXED);
+        loads[i].wait_ns = __atomic_load_n(&ovens[i].load.wait_ns, __ATOMIC_RELAXED);
+    }
+    int preferred = oven_affinity ? cook->id % num_ovens : -1;
+    return &ovens[oven_place(loads, num_ovens, oven_placement, preferred)];
+}
+
+// Initialize cooks, as threads or as actors of the actor runtime
+void start_cooks(int num_cooks_param, const OvenPoolConfig *oven_config, int model) {
+    printf("Initializing cooks...\n");
+    start_ovens(oven_config, num_cooks_param);
+    cook_model = model;
+    if (resize_cooks(num_cooks_param) < 0) {
+        perror("Failed to create cook thread");
+        exit(EXIT_FAILURE);
     }
     printf("Cooks initialized...\n");
 }
 
-// Thread function for each cook
+// Start one more cook. Must be called with 'cook_pool_mutex' held. Returns -1 on failure.
+static int cook_hire(void) {
+    Cook *cook = malloc(sizeof(Cook));
+    if (!cook) {
+        return -1;
+    }
+    cook->id = next_cook_id++;
+    if (cook_model == SHOP_MODEL_ACTORS) {
+        if (!actor_spawn(cook_actor, cook, COOK_ACTOR_STACK_SIZE)) {
+            free(cook);
+            return -1;
+        }
+        return 0;
+    }
+    if (pthread_create(&cook->thread, NULL, cook_thread, cook) != 0) {
+        free(cook);
+        return -1;
+    }
+    pthread_detach(cook->thread);
+    return 0;
+}
+
+// Claim one pending retirement
+static int cook_should_retire(void) {
+    int pending = __atomic_load_n(&cook_retire_pending, __ATOMIC_RELAXED);
+    while (pending > 0) {
+        if (__atomic_compare_exchange_n(&cook_retire_pending, &pending, pending - 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Grow or shrink the cook pool to 'size' cooks
+ * Side effects:
+ * - Growing first cancels pending retirements, then starts new cooks.
+ * - Shrinking asks cooks to retire between two orders: a cook finishes the
+ *   pide in its hands, and parked cooks are woken by tokens on the cook stage.
+ * - The tokens are pushed after the pool lock is released, since a full stage
+ *   makes the push wait for the cooks.
+ * Returns 0 on success, -1 if the pool could not grow.
+ */
+int resize_cooks(int size) {
+    int status = 0;
+    int tokens = 0;
+    PROFILED_LOCK(&cook_pool_mutex, &cook_pool_profile);
+    if (size > num_cooks) {
+        int grow = size - num_cooks;
+        int reuse = 0;
+        while (reuse < grow && cook_should_retire()) {
+            reuse++;
+        }
+        for (int i = reuse; i < grow; i++) {
+            if (cook_hire() < 0) {
+                size = num_cooks + i;
+                status = -1;
+                break;
+            }
+        }
+    } else if (size < num_cooks) {
+        tokens = num_cooks - size;
+        __atomic_add_fetch(&cook_retire_pending, tokens, __ATOMIC_ACQ_REL);
+    }
+    num_cooks = size;
+    PROFILED_UNLOCK(&cook_pool_mutex, &cook_pool_profile);
+
+    for (int i = 0; i < tokens; i++) {
+        stage_push_wait(&cook_stage, &stage_retire_token);
+    }
+    return status;
+}
+
+int cook_pool_size(void) {
+    PROFILED_LOCK(&cook_pool_mutex, &cook_pool_profile);
+    int size = num_cooks;
+    PROFILED_UNLOCK(&cook_pool_mutex, &cook_pool_profile);
+    return size;
+}
+
+// Cook running as an actor: the same loop, its blocking points park the actor
+static void cook_actor(void *arg) {
+    cook_thread(arg);
+}
+
+// Thread function for each cook; returns when the cook retires
 void *cook_thread(void *arg) {
     Cook *cook = (Cook *)arg;
 
-    while (1) {
-        pthread_mutex_lock(&cook_mutex);
-        while (!order_available) {
-            pthread_cond_wait(&cook_cond, &cook_mutex);
+    while (!cook_should_retire()) {
+        // Take the next order from the cook stage queue
+        ShopOrder *order = stage_pop(&cook_stage);
+        if (order == &stage_retire_token) {
+            continue; // Retire if a retirement is still pending
+        }
+        if (order_is_cancelled(order)) {
+            order_destroy(order);
+            continue;
         }
-        order_available--;
-        int order_id = ++order_count;
-        pthread_mutex_unlock(&cook_mutex);
+        int order_id = order->order.order_id;
+        order->order.status = ORDER_IN_PROGRESS;
+        eta_cook_started();
+        unsigned long long prep_start = now_ns();
 
         char message[256];
         snprintf(message, sizeof(message), "Preparing order %d by cooker %d", order_id, cook->id);
@@ -73,39 +229,144 @@ void *cook_thread(void *arg) {
 
         // Simulate cooking by computing pseudo-inverse
         compute_pseudo_inverse();
+        trace_phase(order, "prep", "cook", cook->id);
 
-        // Simulate oven usage
-        pthread_mutex_lock(&oven.mutex);
-        while (oven.num_aparatus == 0) {
-            pthread_cond_wait(&oven.cond_aparatus, &oven.mutex);
-        }
-        oven.num_aparatus--;
-        while (oven.num_meals == MAX_MEALS) {
-            pthread_cond_wait(&oven.cond_meals, &oven.mutex);
+        // Hand the pide to the oven; the timer wheel takes it from there
+        const PideType *pide = &menu[order->pide_type];
+        OvenJob job = {order, order->pide_type, pide->footprint,
+                       (long long)pide->bake_ms * 1000000LL, (long long)now_ns()};
+        Oven *oven = choose_oven(cook);
+        order->cook_id = cook->id;
+        order->oven_id = (int)(oven - ovens);
+        PROFILED_LOCK(&oven->mutex, &oven_profile);
+        int added = oven_state_add(&oven->state, &job);
+        oven_schedule(oven);
+        PROFILED_UNLOCK(&oven->mutex, &oven_profile);
+        eta_cook_finished(now_ns() - prep_start);
+        if (added < 0) {
+            // No room left in the oven's waiting list: the order fails instead of being lost
+            snprintf(message, sizeof(message), "Order %d failed: out of memory queueing it for oven %d",
+                     order_id, order->oven_id);
+            log_message(message);
+            order->order.status = ORDER_FAILED;
+            order_destroy(order);
         }
-        oven.num_meals++;
-        oven.num_aparatus++;
-        pthread_cond_signal(&oven.cond_aparatus);
-        pthread_mutex_unlock(&oven.mutex);
+    }
 
-        snprintf(message, sizeof(message), "Order %d is being cooked by cooker %d", order_id, cook->id);
-        log_message(message);
+    free(cook);
+    return NULL;
+}
 
-        sleep(1); // Simulate cooking time in the oven
+/*
+ * Load every pide the scheduler lets in. Must be called with the oven mutex held.
+ * Side effects:
+ * - Starts a loading timer for every admitted pide.
+ * - Republishes the oven load for the placement.
+ */
+static void oven_schedule(Oven *oven) {
+    OvenJob job;
+    OvenLoad load;
+    long long now = (long long)now_ns();
+    while (oven_state_admit(&oven->state, now, &job)) {
+        ShopOrder *order = job.ref;
+        trace_phase(order, "oven wait", "oven", order->oven_id);
+        timer_schedule(&order->timer, OVEN_LOAD_MS, oven_loaded);
+    }
+    oven_state_load(&oven->state, now, &load);
+    __atomic_store_n(&oven->load.units, load.units, __ATOMIC_RELAXED);
+    __atomic_store_n(&oven->load.wait_ns, load.wait_ns, __ATOMIC_RELAXED);
+}
 
-        pthread_mutex_lock(&oven.mutex);
-        oven.num_meals--;
-        pthread_cond_signal(&oven.cond_meals);
-        pthread_mutex_unlock(&oven.mutex);
+/*
+ * Timer callback: a pide went through the opening and starts baking.
+ * Side effects:
+ * - Frees the opening and lets the scheduler load the next pides.
+ * - Starts the baking timer of the pide.
+ */
+static void oven_loaded(Timer *timer) {
+    ShopOrder *order = TIMER_ORDER(timer);
+    Oven *oven = &ovens[order->oven_id];
+    const PideType *pide = &menu[order->pide_type];
 
-        snprintf(message, sizeof(message), "Order %d is cooked by cooker %d", order_id, cook->id);
-        log_message(message);
+    PROFILED_LOCK(&oven->mutex, &oven_profile);
+    oven_state_loaded(&oven->state, (long long)now_ns());
+    oven_schedule(oven);
+    PROFILED_UNLOCK(&oven->mutex, &oven_profile);
 
-        // Notify manager that the order is ready
-        notify_manager();
+    trace_phase(order, "loading", "oven", order->oven_id);
+    timer_schedule(&order->timer, pide->bake_ms, oven_baked);
+}
+
+/*
+ * Timer callback: a pide is baked.
+ * Side effects:
+ * - Frees its shelf space and lets the scheduler load the next pides.
+ * - Hands the order to the manager, who logs it, or drops it if it was cancelled.
+ */
+static void oven_baked(Timer *timer) {
+    ShopOrder *order = TIMER_ORDER(timer);
+    Oven *oven = &ovens[order->oven_id];
+    const PideType *pide = &menu[order->pide_type];
+    OvenJob job = {order, order->pide_type, pide->footprint, (long long)pide->bake_ms * 1000000LL, 0};
+
+    PROFILED_LOCK(&oven->mutex, &oven_profile);
+    oven_state_done(&oven->state, &job, (long long)now_ns());
+    oven_schedule(oven);
+    PROFILED_UNLOCK(&oven->mutex, &oven_profile);
+    trace_phase(order, "baking", "oven", order->oven_id);
+
+    if (order_is_cancelled(order)) {
+        order_destroy(order);
+        return;
     }
 
-    return NULL;
+    // Hand the order to the manager
+    order->order.status = ORDER_COMPLETED;
+    notify_manager(order);
+}
+
+/*
+ * Expected wait for an opening of a pide handed in now, from the published loads.
+ * No locks are taken.
+ */
+long long oven_expected_wait_ns(void) {
+    long long best = -1;
+    for (int i = 0; i < num_ovens; i++) {
+        long long wait = __atomic_load_n(&ovens[i].load.wait_ns, __ATOMIC_RELAXED);
+        if (best < 0 || wait < best) {
+            best = wait;
+        }
+    }
+    return best < 0 ? 0 : best;
+}
+
+/*
+ * Log utilisation and throughput of every oven and of the pool.
+ * Side effects:
+ * - Logs one line per oven and one for the pool.
+ */
+void oven_report(void) {
+    unsigned long total_baked = 0;
+    double seconds = 0;
+    char message[256];
+    for (int i = 0; i < num_ovens; i++) {
+        Oven *oven = &ovens[i];
+        PROFILED_LOCK(&oven->mutex, &oven_profile);
+        long long now = (long long)now_ns();
+        seconds = (now - oven->state.start_ns) / 1e9;
+        total_baked += oven->state.baked;
+        snprintf(message, sizeof(message),
+                 "Oven %d (%s): %lu pides baked, %.2f pides/s, utilisation %.1f%%, avg wait for opening %.1f ms",
+                 i, oven_policy_name(oven->state.policy), oven->state.baked,
+                 seconds > 0 ? oven->state.baked / seconds : 0.0,
+                 100.0 * oven_state_utilisation(&oven->state, now),
+                 oven->state.loaded ? oven->state.total_wait_ns / 1e6 / oven->state.loaded : 0.0);
+        PROFILED_UNLOCK(&oven->mutex, &oven_profile);
+        log_message(message);
+    }
+    snprintf(message, sizeof(message), "Oven pool: %d ovens, %lu pides baked, %.2f pides/s",
+             num_ovens, total_baked, seconds > 0 ? total_baked / seconds : 0.0);
+    log_message(message);
 }
 
 // Function to compute the pseudo-inverse of a 30x40 matrix with complex elements
@@ -128,13 +389,10 @@ void compute_pseudo_inverse(void) {
 // Singular Value Decomposition (SVD) based pseudo-inverse computation
 void svd_pseudo_inverse(int m, int n, double complex A[m][n], double complex B[n][m]) {
 
-    sleep(2); // Simulate time taken for SVD computation
+    actor_sleep_ms(2000); // Simulate time taken for SVD computation
 }
 
-// Function to signal cooks when an order is available
-void signal_cooks() {
-    pthread_mutex_lock(&cook_mutex);
-    order_available++;
-    pthread_cond_signal(&cook_cond);
-    pthread_mutex_unlock(&cook_mutex);
+// Function to hand a new order to the cooks; -1 if the cook queue is full
+int signal_cooks(ShopOrder *order) {
+    return stage_push(&cook_stage, order);
 }
@@ -1,14 +1,21 @@
 #include "common.h"
 #include "protocol.h"
 #include "utils.h"
+#include "timerwheel.h"
+#include "actor.h"
+#include "eta.h"
+#include "lockprof.h"
+#include "trace.h"
 #include <pthread.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <math.h>
+#include <string.h>
 
 /*
  * Global variables to define the town dimensions
  * Side effects:
- * - These are used by the delivery threads to generate random delivery locations.
+ * - These bound the town; couriers deliver to the customer location carried by each order.
  */
 static int town_width;
 static int town_height;
@@ -16,10 +23,10 @@ static int town_height;
 /*
  * Structure representing a delivery person
  * Side effects:
- * - Contains thread information and delivery status.
+ * - Contains the delivery status; a courier is not a thread. Its trips are
+ *   timers on the timer wheel, or timed waits of its actor in the actor model.
  */
 typedef struct {
-    pthread_t thread;
     int id;
     int capacity;
     int load;
@@ -36,106 +43,322 @@ typedef struct {
 /*
  * Global variables to manage delivery personnel and synchronization
  * Side effects:
- * - Used to control delivery threads and manage order delivery.
+ * - Used by the dispatcher threads, the timer thread and the control thread;
+ *   everything below is guarded by 'courier_mutex'. Couriers are indexed by id,
+ *   ids of retired couriers are reused.
  */
-static DeliveryPerson *delivery_personnel;
-static int num_delivery_personnel;
-static pthread_mutex_t delivery_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t delivery_cond = PTHREAD_COND_INITIALIZER;
-static int delivery_order_available = 0;
-static int delivery_order_id = 0;
+static DeliveryPerson **delivery_personnel;
+static int personnel_capacity;
+static int num_delivery_personnel;     // Target size of the pool
+static int courier_retire_pending = 0; // Couriers to retire as they come back
+static DeliveryPerson **idle_couriers;
+static int num_idle_couriers;
+static int courier_model;
+static float courier_velocity;
+static pthread_mutex_t courier_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LockProfile courier_profile = LOCK_PROFILE_INITIALIZER("courier_mutex");
+static pthread_cond_t courier_idle_cond = PTHREAD_COND_INITIALIZER;
+
+// Order owning a delivery timer
+#define TIMER_ORDER(t) ((ShopOrder *)((char *)(t) - offsetof(ShopOrder, timer)))
 
 /*
  * Function prototypes for internal use
  */
 void *delivery_thread(void *arg);
-void simulate_delivery(float x, float y, float velocity);
+static void courier_actor(void *arg);
+unsigned long delivery_time_ms(float x, float y, float velocity);
+static void delivery_done(Timer *timer);
+
+/*
+ * Hire a courier. Must be called with 'courier_mutex' held.
+ * Side effects:
+ * - Grows the id table if no id is free; starts the courier's actor in the actor model.
+ * Returns NULL on allocation failure.
+ */
+static DeliveryPerson *courier_hire(void) {
+    int id = 0;
+    while (id < personnel_capacity && delivery_personnel[id]) {
+        id++;
+    }
+    if (id == personnel_capacity) {
+        int capacity = personnel_capacity ? personnel_capacity * 2 : 16;
+        DeliveryPerson **table = realloc(delivery_personnel, capacity * sizeof(DeliveryPerson *));
+        if (!table) {
+            return NULL;
+        }
+        memset(table + personnel_capacity, 0, (capacity - personnel_capacity) * sizeof(DeliveryPerson *));
+        delivery_personnel = table;
+        DeliveryPerson **idle = realloc(idle_couriers, capacity * sizeof(DeliveryPerson *));
+        if (!idle) {
+            return NULL;
+        }
+        idle_couriers = idle;
+        personnel_capacity = capacity;
+    }
+
+    DeliveryPerson *person = malloc(sizeof(DeliveryPerson));
+    if (!person) {
+        return NULL;
+    }
+    person->id = id;
+    person->capacity = DELIVERY_CAPACITY;
+    person->load = 0;
+    person->velocity = courier_velocity;
+    if (courier_model == SHOP_MODEL_ACTORS) {
+        if (!actor_spawn(courier_actor, person, 0)) {
+            free(person);
+            return NULL;
+        }
+    } else {
+        idle_couriers[num_idle_couriers++] = person;
+        pthread_cond_signal(&courier_idle_cond);
+    }
+    delivery_personnel[id] = person;
+    return person;
+}
+
+// Free the id of a courier leaving the pool. Must be called with 'courier_mutex' held.
+static void courier_retire(DeliveryPerson *person) {
+    delivery_personnel[person->id] = NULL;
+    free(person);
+}
 
 /*
- * Initialize delivery personnel and create their threads
+ * Initialize delivery personnel and the dispatcher threads
  * Side effects:
  * - Allocates memory for delivery personnel structures.
- * - Starts threads for each delivery person.
+ * - Starts 'num_dispatchers' threads handing orders to idle couriers, or one
+ *   actor per courier in the actor model.
  */
-void start_delivery_system(int num_deliveries, int delivery_speed, int width, int height) {
+void start_delivery_system(int num_deliveries, int num_dispatchers, int model, int delivery_speed, int width, int height) {
     printf("Initializing delivery personnel...\n");
-    delivery_personnel = malloc(num_deliveries * sizeof(DeliveryPerson));
-    num_delivery_personnel = num_deliveries;
+    courier_model = model;
+    courier_velocity = (float)delivery_speed / 60.0;
     town_width = width;
     town_height = height;
 
-    for (int i = 0; i < num_deliveries; i++) {
-        delivery_personnel[i].id = i;
-        delivery_personnel[i].capacity = DELIVERY_CAPACITY;
-        delivery_personnel[i].load = 0;
-        delivery_personnel[i].velocity = (float)delivery_speed / 60.0;
-        if (pthread_create(&delivery_personnel[i].thread, NULL, delivery_thread, (void *)&delivery_personnel[i]) != 0) {
-            perror("Failed to create delivery thread");
-            exit(EXIT_FAILURE);
+    if (resize_couriers(num_deliveries) < 0) {
+        handle_error("Failed to allocate delivery personnel");
+    }
+
+    if (model == SHOP_MODEL_THREADS) {
+        for (int i = 0; i < num_dispatchers; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, delivery_thread, NULL) != 0) {
+                perror("Failed to create delivery thread");
+                exit(EXIT_FAILURE);
+            }
+            pthread_detach(thread);
         }
     }
     printf("Delivery personnel initialized...\n");
 }
 
 /*
- * Function representing the delivery thread for each delivery person
+ * Grow or shrink the courier pool to 'size' couriers
+ * Side effects:
+ * - Growing first cancels pending retirements, then hires.
+ * - Shrinking retires idle couriers at once; busy ones retire when they come
+ *   back from their trip, so no order in flight is lost. In the actor model the
+ *   courier actors are asked to retire through tokens on the courier stage,
+ *   pushed once 'courier_mutex' is released since the actors take it to retire.
+ * Returns 0 on success, -1 if the pool could not grow.
+ */
+int resize_couriers(int size) {
+    int status = 0;
+    int tokens = 0;
+    PROFILED_LOCK(&courier_mutex, &courier_profile);
+    if (size > num_delivery_personnel) {
+        int grow = size - num_delivery_personnel;
+        int reuse = grow < courier_retire_pending ? grow : courier_retire_pending;
+        courier_retire_pending -= reuse;
+        for (int i = reuse; i < grow; i++) {
+            if (!courier_hire()) {
+                size = num_delivery_personnel + i;
+                status = -1;
+                break;
+            }
+        }
+    } else {
+        int shrink = num_delivery_personnel - size;
+        if (courier_model == SHOP_MODEL_THREADS) {
+            while (shrink > 0 && num_idle_couriers > 0) {
+                courier_retire(idle_couriers[--num_idle_couriers]);
+                shrink--;
+            }
+        } else {
+            tokens = shrink;
+        }
+        courier_retire_pending += shrink;
+    }
+    num_delivery_personnel = size;
+    PROFILED_UNLOCK(&courier_mutex, &courier_profile);
+
+    for (int i = 0; i < tokens; i++) {
+        stage_push_wait(&courier_stage, &stage_retire_token);
+    }
+    return status;
+}
+
+int courier_pool_size(void) {
+    PROFILED_LOCK(&courier_mutex, &courier_profile);
+    int size = num_delivery_personnel;
+    PROFILED_UNLOCK(&courier_mutex, &courier_profile);
+    return size;
+}
+
+// Claim one pending retirement. Must be called with 'courier_mutex' held.
+static int courier_should_retire(void) {
+    if (courier_retire_pending > 0) {
+        courier_retire_pending--;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Function representing a dispatcher thread
  * Side effects:
- * - Continuously checks for available orders and processes them.
+ * - Continuously takes ready orders, waits for an idle courier and starts its trip.
  */
 void *delivery_thread(void *arg) {
+    while (1) {
+        // Take the next order from the courier stage queue
+        ShopOrder *order = stage_pop(&courier_stage);
+        if (!order_dispatch(order)) {
+            order_destroy(order);
+            continue;
+        }
+
+        PROFILED_LOCK(&courier_mutex, &courier_profile);
+        while (num_idle_couriers == 0) {
+            PROFILED_COND_WAIT(&courier_idle_cond, &courier_mutex, &courier_profile);
+        }
+        DeliveryPerson *person = idle_couriers[--num_idle_couriers];
+        person->load = 1;
+        PROFILED_UNLOCK(&courier_mutex, &courier_profile);
+
+        // Deliver to the customer location carried by the order
+        char message[256];
+        float posX = order->order.x;
+        float posY = order->order.y;
+        snprintf(message, sizeof(message), "Order %d is delivering by deliver %d to address (%.2f, %.2f)", order->order.order_id, person->id, posX, posY);
+        log_message(message);
+
+        order->courier_id = person->id;
+        trace_phase(order, "courier wait", "courier", person->id);
+        order->dispatched_ns = now_ns();
+        eta_courier_started();
+        timer_schedule(&order->timer, delivery_time_ms(posX, posY, person->velocity), delivery_done);
+    }
+
+    return NULL;
+}
+
+/*
+ * Courier running as an actor: takes ready orders itself and waits out the trip
+ * Side effects:
+ * - Parks on the courier stage and on the timer wheel, never blocking a worker thread.
+ * - Returns, ending the actor, when it claims a retirement at a stage boundary.
+ */
+static void courier_actor(void *arg) {
     DeliveryPerson *person = (DeliveryPerson *)arg;
 
     while (1) {
-        pthread_mutex_lock(&delivery_mutex);
-        while (!delivery_order_available) {
-            pthread_cond_wait(&delivery_cond, &delivery_mutex);
+        ShopOrder *order = stage_pop(&courier_stage);
+        if (order == &stage_retire_token) {
+            PROFILED_LOCK(&courier_mutex, &courier_profile);
+            if (courier_should_retire()) {
+                courier_retire(person);
+                PROFILED_UNLOCK(&courier_mutex, &courier_profile);
+                return;
+            }
+            PROFILED_UNLOCK(&courier_mutex, &courier_profile);
+            continue;
+        }
+        if (!order_dispatch(order)) {
+            order_destroy(order);
+            continue;
         }
-        delivery_order_available--;
-        int order_id = ++delivery_order_id;
-        pthread_mutex_unlock(&delivery_mutex);
+        int order_id = order->order.order_id;
+        float posX = order->order.x;
+        float posY = order->order.y;
+        person->load = 1;
 
         char message[256];
-        // Generate random position within the town
-        float posX = (float)(rand() % (town_width + 1));
-        float posY = (float)(rand() % (town_height + 1));
         snprintf(message, sizeof(message), "Order %d is delivering by deliver %d to address (%.2f, %.2f)", order_id, person->id, posX, posY);
         log_message(message);
 
-        // Simulate delivery
-        simulate_delivery(posX, posY, person->velocity);
+        order->courier_id = person->id;
+        order->dispatched_ns = now_ns();
+        eta_courier_started();
+        actor_sleep_ms(delivery_time_ms(posX, posY, person->velocity));
+        trace_phase(order, "delivery", "courier", person->id);
+        eta_courier_finished(order, now_ns() - order->dispatched_ns);
+        person->load = 0;
+        delivery_report(order);
+    }
+}
 
-        snprintf(message, sizeof(message), "Order %d is delivered by deliver %d to address (%.2f, %.2f)", order_id, person->id, posX, posY);
-        log_message(message);
+/*
+ * Log a delivered order and release it
+ * Side effects:
+ * - Logs and prints the delivery; called by the courier actor, or by the
+ *   manager for deliveries timed on the timer wheel.
+ */
+void delivery_report(ShopOrder *order) {
+    char message[256];
+    snprintf(message, sizeof(message), "Order %d is delivered by deliver %d to address (%.2f, %.2f)", order->order.order_id, order->courier_id, order->order.x, order->order.y);
+    log_message(message);
+    printf("Delivery person %d completed delivery.\n", order->courier_id);
 
-        pthread_mutex_lock(&delivery_mutex);
-        person->load = 0;
-        pthread_mutex_unlock(&delivery_mutex);
+    order->order.status = ORDER_DELIVERED;
+    order_destroy(order);
+}
+
+/*
+ * Timer callback: a courier reached the customer
+ * Side effects:
+ * - Returns the courier to the idle stack, or retires it if the pool shrank.
+ * - Hands the delivered order to the manager, who logs and frees it.
+ */
+static void delivery_done(Timer *timer) {
+    ShopOrder *order = TIMER_ORDER(timer);
+    int courier_id = order->courier_id;
+    trace_phase(order, "delivery", "courier", courier_id);
+    eta_courier_finished(order, now_ns() - order->dispatched_ns);
 
-        printf("Delivery person %d completed delivery.\n", person->id);
+    PROFILED_LOCK(&courier_mutex, &courier_profile);
+    DeliveryPerson *person = delivery_personnel[courier_id];
+    person->load = 0;
+    if (courier_should_retire()) {
+        courier_retire(person);
+    } else {
+        idle_couriers[num_idle_couriers++] = person;
+        pthread_cond_signal(&courier_idle_cond);
     }
+    PROFILED_UNLOCK(&courier_mutex, &courier_profile);
 
-    return NULL;
+    order->order.status = ORDER_DELIVERED;
+    notify_manager(order);
 }
 
 /*
- * Simulate the delivery process by sleeping for the calculated time based on distance
+ * Travel time to the customer, in milliseconds, from the distance and speed (m/s)
  * Side effects:
- * - Uses sleep to simulate delivery time.
+ * - None.
  */
-void simulate_delivery(float x, float y, float velocity) {
+unsigned long delivery_time_ms(float x, float y, float velocity) {
     float distance = sqrt(x * x + y * y);
-    int sleepTime = (int)(distance / velocity);
-    sleep(sleepTime);
+    return (unsigned long)(distance / velocity * 1000.0f);
 }
 
 /*
  * Signal delivery personnel that an order is available
  * Side effects:
- * - Updates the condition variable to wake up a delivery thread.
+ * - Queues the order on the courier stage, waking a parked delivery thread.
  */
-void signal_delivery_personnel() {
-    pthread_mutex_lock(&delivery_mutex);
-    delivery_order_available++;
-    pthread_cond_signal(&delivery_cond);
-    pthread_mutex_unlock(&delivery_mutex);
+void signal_delivery_personnel(ShopOrder *order) {
+    stage_push_wait(&courier_stage, order);
 }
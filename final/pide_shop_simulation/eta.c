@@ -0,0 +1,178 @@
+#include "eta.h"
+#include "common.h"
+#include "utils.h"
+#include "menu.h"
+#include "oven.h"
+#include "lockprof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/*
+ * Incrementally maintained shop statistics.
+ * Side effects:
+ * - Updated by the cooks, the couriers and the timer thread without locks;
+ *   a lost EWMA update only delays convergence by one sample.
+ */
+static int pool_cooks;
+static int pool_couriers;
+static float courier_velocity;           // m/s
+static int busy_cooks = 0;
+static int busy_couriers = 0;
+static long long prep_ewma_ns = 2000000000LL; // compute_pseudo_inverse() takes two seconds
+static long long trip_ewma_ns = 0;
+static long long bias_ewma_ns = 0;       // Actual minus predicted, folded into predictions
+
+// Recent prediction errors (actual - predicted), guarded by 'error_mutex'
+static long long *errors;
+static unsigned long error_count = 0;
+static pthread_mutex_t error_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LockProfile error_profile = LOCK_PROFILE_INITIALIZER("eta error_mutex");
+
+static void ewma_update(long long *ewma, long long sample) {
+    long long old = __atomic_load_n(ewma, __ATOMIC_RELAXED);
+    __atomic_store_n(ewma, old + ((sample - old) >> ETA_EWMA_SHIFT), __ATOMIC_RELAXED);
+}
+
+/*
+ * Initialise the model for the configured pools.
+ * Side effects:
+ * - Allocates the error sample buffer.
+ */
+void eta_init(int cooks, int couriers, float speed) {
+    pool_cooks = cooks;
+    pool_couriers = couriers;
+    courier_velocity = speed / 60.0f;
+    errors = malloc(ETA_ERROR_SAMPLES * sizeof(long long));
+    if (!errors) {
+        handle_error("Failed to allocate ETA error samples");
+    }
+}
+
+void eta_set_pools(int cooks, int couriers) {
+    __atomic_store_n(&pool_cooks, cooks, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool_couriers, couriers, __ATOMIC_RELAXED);
+}
+
+/*
+ * Expected wait for one of 'servers' when 'busy' of them are taken and 'queued'
+ * orders are ahead: nothing while a server is free, otherwise the residual of the
+ * current services plus one service per full round of the queue.
+ */
+static long long expected_wait(int queued, int busy, int servers, long long service_ns) {
+    if (servers <= 0) {
+        return 0;
+    }
+    int ahead = queued + busy - servers;
+    if (ahead < 0) {
+        return 0;
+    }
+    return service_ns / 2 + (long long)ahead * service_ns / servers;
+}
+
+/*
+ * Predict the delivery time of a new order.
+ * Side effects:
+ * - Stores the prediction in the order for the calibration at delivery.
+ */
+long long eta_predict(ShopOrder *order) {
+    const PideType *pide = &menu[order->pide_type];
+    int cooks = __atomic_load_n(&pool_cooks, __ATOMIC_RELAXED);
+    int couriers = __atomic_load_n(&pool_couriers, __ATOMIC_RELAXED);
+    long long prep = __atomic_load_n(&prep_ewma_ns, __ATOMIC_RELAXED);
+    long long trip = __atomic_load_n(&trip_ewma_ns, __ATOMIC_RELAXED);
+
+    long long eta = expected_wait((int)lfq_size(&cook_stage.queue), __atomic_load_n(&busy_cooks, __ATOMIC_RELAXED),
+                                  cooks, prep);
+    eta += prep;
+    eta += oven_expected_wait_ns();
+    eta += (long long)(OVEN_LOAD_MS + pide->bake_ms) * 1000000LL;
+    eta += expected_wait((int)lfq_size(&courier_stage.queue), __atomic_load_n(&busy_couriers, __ATOMIC_RELAXED),
+                         couriers, trip);
+    float distance = sqrtf(order->order.x * order->order.x + order->order.y * order->order.y);
+    eta += (long long)(distance / courier_velocity * 1e9);
+    eta += __atomic_load_n(&bias_ewma_ns, __ATOMIC_RELAXED);
+    if (eta < 0) {
+        eta = 0;
+    }
+    order->eta_ns = eta;
+    return eta;
+}
+
+void eta_cook_started(void) {
+    __atomic_add_fetch(&busy_cooks, 1, __ATOMIC_RELAXED);
+}
+
+void eta_cook_finished(unsigned long long prep_ns) {
+    ewma_update(&prep_ewma_ns, (long long)prep_ns);
+    __atomic_sub_fetch(&busy_cooks, 1, __ATOMIC_RELAXED);
+}
+
+void eta_courier_started(void) {
+    __atomic_add_fetch(&busy_couriers, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * A courier delivered 'order' after a trip of 'trip_ns'.
+ * Side effects:
+ * - Updates the trip EWMA and the bias, records the prediction error.
+ */
+void eta_courier_finished(const ShopOrder *order, unsigned long long trip_ns) {
+    __atomic_sub_fetch(&busy_couriers, 1, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&trip_ewma_ns, __ATOMIC_RELAXED) == 0) {
+        __atomic_store_n(&trip_ewma_ns, (long long)trip_ns, __ATOMIC_RELAXED);
+    } else {
+        ewma_update(&trip_ewma_ns, (long long)trip_ns);
+    }
+
+    long long actual = (long long)(now_ns() - order->created_ns);
+    long long error = actual - order->eta_ns;
+    // The prediction already contained the bias of its time: learn the residual
+    ewma_update(&bias_ewma_ns, __atomic_load_n(&bias_ewma_ns, __ATOMIC_RELAXED) + error);
+
+    PROFILED_LOCK(&error_mutex, &error_profile);
+    errors[error_count++ % ETA_ERROR_SAMPLES] = error;
+    PROFILED_UNLOCK(&error_mutex, &error_profile);
+}
+
+void eta_busy(int *cooks, int *couriers) {
+    *cooks = __atomic_load_n(&busy_cooks, __ATOMIC_RELAXED);
+    *couriers = __atomic_load_n(&busy_couriers, __ATOMIC_RELAXED);
+}
+
+static int compare_long_long(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Log the accuracy of the predictions.
+ * Side effects:
+ * - Logs one line with the signed mean and the percentiles of the absolute error.
+ */
+void eta_report(void) {
+    PROFILED_LOCK(&error_mutex, &error_profile);
+    unsigned long total = error_count;
+    size_t n = total < ETA_ERROR_SAMPLES ? total : ETA_ERROR_SAMPLES;
+    long long *sorted = malloc((n ? n : 1) * sizeof(long long));
+    double mean = 0;
+    for (size_t i = 0; sorted && i < n; i++) {
+        mean += errors[i];
+        sorted[i] = llabs(errors[i]);
+    }
+    PROFILED_UNLOCK(&error_mutex, &error_profile);
+
+    char message[256];
+    if (!sorted || n == 0) {
+        snprintf(message, sizeof(message), "ETA: no deliveries to calibrate against");
+    } else {
+        qsort(sorted, n, sizeof(long long), compare_long_long);
+        snprintf(message, sizeof(message),
+                 "ETA: %lu deliveries, mean error %+.2f s, absolute error p50 %.2f s p90 %.2f s p99 %.2f s, "
+                 "bias correction %+.2f s",
+                 total, mean / n / 1e9, sorted[n / 2] / 1e9, sorted[n * 90 / 100] / 1e9,
+                 sorted[n * 99 / 100] / 1e9, __atomic_load_n(&bias_ewma_ns, __ATOMIC_RELAXED) / 1e9);
+    }
+    free(sorted);
+    log_message(message);
+}
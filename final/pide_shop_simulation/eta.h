@@ -0,0 +1,38 @@
+#ifndef ETA_H
+#define ETA_H
+
+#include "pipeline.h"
+
+/*
+ * Delivery time prediction from the live state of the shop.
+ * An order's ETA is the sum of its expected waits and service times along the
+ * pipeline: cook backlog, preparation, oven wait, loading and baking, courier
+ * wait and travel. The stages report their starts and completions here, which
+ * keeps queue occupancy and EWMA service times up to date, so a prediction is
+ * O(1). Every delivery is compared with its prediction; the running bias is
+ * folded back into later predictions and the errors are kept for percentiles.
+ */
+
+#define ETA_EWMA_SHIFT 3          // EWMA weight of a new sample: 1/8
+#define ETA_ERROR_SAMPLES 65536   // Most recent errors kept for the percentiles
+
+void eta_init(int cooks, int couriers, float speed);
+
+// Pool sizes changed at runtime
+void eta_set_pools(int cooks, int couriers);
+
+// Predict the delivery time of a new order; stored in the order and returned in nanoseconds
+long long eta_predict(ShopOrder *order);
+
+// Stage events
+void eta_cook_started(void);
+void eta_cook_finished(unsigned long long prep_ns);
+void eta_courier_started(void);
+void eta_courier_finished(const ShopOrder *order, unsigned long long trip_ns);
+
+// Cooks and couriers currently busy with an order
+void eta_busy(int *cooks, int *couriers);
+
+void eta_report(void);
+
+#endif // ETA_H
@@ -0,0 +1,249 @@
+#include "fleet.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FLEET_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FLEET_WIDTH 4
+#else
+#define FLEET_WIDTH 1
+#endif
+
+#define FLEET_ALIGN 32
+
+static float *fleet_alloc_floats(int n, float value) {
+    float *a = aligned_alloc(FLEET_ALIGN, n * sizeof(float));
+    if (a) {
+        for (int i = 0; i < n; i++) {
+            a[i] = value;
+        }
+    }
+    return a;
+}
+
+/*
+ * Allocate the fleet arrays.
+ * Side effects:
+ * - The padding entries up to the SIMD width are parked busy at (x, y), so the
+ *   kernels can run whole vectors without a scalar tail.
+ */
+int fleet_init(Fleet *fleet, int size, float x, float y, float velocity) {
+    memset(fleet, 0, sizeof(*fleet));
+    // aligned_alloc() wants a multiple of the alignment, which 8 floats are
+    int capacity = (size + 7) & ~7;
+    fleet->size = size;
+    fleet->capacity = capacity;
+    fleet->x = fleet_alloc_floats(capacity, x);
+    fleet->y = fleet_alloc_floats(capacity, y);
+    fleet->target_x = fleet_alloc_floats(capacity, x);
+    fleet->target_y = fleet_alloc_floats(capacity, y);
+    fleet->velocity = fleet_alloc_floats(capacity, velocity);
+    fleet->eta = fleet_alloc_floats(capacity, 0.0f);
+    fleet->load = aligned_alloc(FLEET_ALIGN, capacity * sizeof(int));
+    if (!fleet->x || !fleet->y || !fleet->target_x || !fleet->target_y || !fleet->velocity ||
+        !fleet->eta || !fleet->load) {
+        fleet_destroy(fleet);
+        return -1;
+    }
+    for (int i = 0; i < capacity; i++) {
+        fleet->load[i] = i < size ? 0 : 1;
+    }
+    return 0;
+}
+
+void fleet_destroy(Fleet *fleet) {
+    free(fleet->x);
+    free(fleet->y);
+    free(fleet->target_x);
+    free(fleet->target_y);
+    free(fleet->velocity);
+    free(fleet->eta);
+    free(fleet->load);
+    memset(fleet, 0, sizeof(*fleet));
+}
+
+void fleet_assign(Fleet *fleet, int i, float x, float y) {
+    float dx = x - fleet->x[i];
+    float dy = y - fleet->y[i];
+    fleet->target_x[i] = x;
+    fleet->target_y[i] = y;
+    fleet->eta[i] = sqrtf(dx * dx + dy * dy) / fleet->velocity[i];
+    fleet->load[i]++;
+}
+
+const char *fleet_kernel_name(void) {
+#if defined(__AVX__)
+    return "avx";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+/*
+ * Scalar reference kernels; kept out of the auto-vectoriser so that they
+ * measure what the SIMD kernels replace.
+ */
+__attribute__((optimize("no-tree-vectorize")))
+void fleet_tick_scalar(Fleet *fleet, float dt) {
+    for (int i = 0; i < fleet->capacity; i++) {
+        float dx = fleet->target_x[i] - fleet->x[i];
+        float dy = fleet->target_y[i] - fleet->y[i];
+        float dist = sqrtf(dx * dx + dy * dy);
+        float step = fleet->velocity[i] * dt;
+        if (step > dist) {
+            step = dist;
+        }
+        float ratio = dist > 0.0f ? step / dist : 0.0f;
+        fleet->x[i] += dx * ratio;
+        fleet->y[i] += dy * ratio;
+        fleet->eta[i] = (dist - step) / fleet->velocity[i];
+    }
+}
+
+__attribute__((optimize("no-tree-vectorize")))
+int fleet_nearest_idle_scalar(const Fleet *fleet, float x, float y) {
+    int best = -1;
+    float best_d2 = FLT_MAX;
+    for (int i = 0; i < fleet->size; i++) {
+        if (fleet->load[i] != 0) {
+            continue;
+        }
+        float dx = fleet->x[i] - x;
+        float dy = fleet->y[i] - y;
+        float d2 = dx * dx + dy * dy;
+        if (d2 < best_d2) {
+            best_d2 = d2;
+            best = i;
+        }
+    }
+    return best;
+}
+
+#if FLEET_WIDTH > 1
+// Pick the lane with the smallest distance, the lowest index on ties
+static int fleet_reduce(const float *d2, const float *index, int lanes) {
+    int best = -1;
+    float best_d2 = FLT_MAX;
+    for (int lane = 0; lane < lanes; lane++) {
+        if (index[lane] < 0) {
+            continue;
+        }
+        if (d2[lane] < best_d2 || (d2[lane] == best_d2 && (int)index[lane] < best)) {
+            best_d2 = d2[lane];
+            best = (int)index[lane];
+        }
+    }
+    return best;
+}
+#endif
+
+#if defined(__AVX__)
+
+void fleet_tick(Fleet *fleet, float dt) {
+    const __m256 vdt = _mm256_set1_ps(dt);
+    const __m256 zero = _mm256_setzero_ps();
+    for (int i = 0; i < fleet->capacity; i += 8) {
+        __m256 x = _mm256_load_ps(fleet->x + i);
+        __m256 y = _mm256_load_ps(fleet->y + i);
+        __m256 v = _mm256_load_ps(fleet->velocity + i);
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(fleet->target_x + i), x);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(fleet->target_y + i), y);
+        __m256 dist = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        __m256 step = _mm256_min_ps(_mm256_mul_ps(v, vdt), dist);
+        // 0/0 for couriers at their target is masked to a zero ratio
+        __m256 ratio = _mm256_and_ps(_mm256_div_ps(step, dist), _mm256_cmp_ps(dist, zero, _CMP_GT_OQ));
+        _mm256_store_ps(fleet->x + i, _mm256_add_ps(x, _mm256_mul_ps(dx, ratio)));
+        _mm256_store_ps(fleet->y + i, _mm256_add_ps(y, _mm256_mul_ps(dy, ratio)));
+        _mm256_store_ps(fleet->eta + i, _mm256_div_ps(_mm256_sub_ps(dist, step), v));
+    }
+}
+
+int fleet_nearest_idle(const Fleet *fleet, float x, float y) {
+    const __m256 px = _mm256_set1_ps(x);
+    const __m256 py = _mm256_set1_ps(y);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 eight = _mm256_set1_ps(8.0f);
+    __m256 best_d2 = _mm256_set1_ps(FLT_MAX);
+    __m256 best_index = _mm256_set1_ps(-1.0f);
+    // Indices are carried as floats: exact up to 2^24 couriers
+    __m256 index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int i = 0; i < fleet->capacity; i += 8) {
+        __m256 dx = _mm256_sub_ps(_mm256_load_ps(fleet->x + i), px);
+        __m256 dy = _mm256_sub_ps(_mm256_load_ps(fleet->y + i), py);
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+        __m256 load = _mm256_cvtepi32_ps(_mm256_load_si256((const __m256i *)(fleet->load + i)));
+        __m256 better = _mm256_and_ps(_mm256_cmp_ps(load, zero, _CMP_EQ_OQ), _mm256_cmp_ps(d2, best_d2, _CMP_LT_OQ));
+        best_d2 = _mm256_blendv_ps(best_d2, d2, better);
+        best_index = _mm256_blendv_ps(best_index, index, better);
+        index = _mm256_add_ps(index, eight);
+    }
+    float d2[8], lanes[8];
+    _mm256_storeu_ps(d2, best_d2);
+    _mm256_storeu_ps(lanes, best_index);
+    return fleet_reduce(d2, lanes, 8);
+}
+
+#elif defined(__SSE2__)
+
+void fleet_tick(Fleet *fleet, float dt) {
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < fleet->capacity; i += 4) {
+        __m128 x = _mm_load_ps(fleet->x + i);
+        __m128 y = _mm_load_ps(fleet->y + i);
+        __m128 v = _mm_load_ps(fleet->velocity + i);
+        __m128 dx = _mm_sub_ps(_mm_load_ps(fleet->target_x + i), x);
+        __m128 dy = _mm_sub_ps(_mm_load_ps(fleet->target_y + i), y);
+        __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        __m128 step = _mm_min_ps(_mm_mul_ps(v, vdt), dist);
+        // 0/0 for couriers at their target is masked to a zero ratio
+        __m128 ratio = _mm_and_ps(_mm_div_ps(step, dist), _mm_cmpgt_ps(dist, zero));
+        _mm_store_ps(fleet->x + i, _mm_add_ps(x, _mm_mul_ps(dx, ratio)));
+        _mm_store_ps(fleet->y + i, _mm_add_ps(y, _mm_mul_ps(dy, ratio)));
+        _mm_store_ps(fleet->eta + i, _mm_div_ps(_mm_sub_ps(dist, step), v));
+    }
+}
+
+int fleet_nearest_idle(const Fleet *fleet, float x, float y) {
+    const __m128 px = _mm_set1_ps(x);
+    const __m128 py = _mm_set1_ps(y);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 four = _mm_set1_ps(4.0f);
+    __m128 best_d2 = _mm_set1_ps(FLT_MAX);
+    __m128 best_index = _mm_set1_ps(-1.0f);
+    // Indices are carried as floats: exact up to 2^24 couriers
+    __m128 index = _mm_setr_ps(0, 1, 2, 3);
+    for (int i = 0; i < fleet->capacity; i += 4) {
+        __m128 dx = _mm_sub_ps(_mm_load_ps(fleet->x + i), px);
+        __m128 dy = _mm_sub_ps(_mm_load_ps(fleet->y + i), py);
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+        __m128 idle = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(fleet->load + i)), zero));
+        __m128 better = _mm_and_ps(idle, _mm_cmplt_ps(d2, best_d2));
+        best_d2 = _mm_or_ps(_mm_and_ps(better, d2), _mm_andnot_ps(better, best_d2));
+        best_index = _mm_or_ps(_mm_and_ps(better, index), _mm_andnot_ps(better, best_index));
+        index = _mm_add_ps(index, four);
+    }
+    float d2[4], lanes[4];
+    _mm_storeu_ps(d2, best_d2);
+    _mm_storeu_ps(lanes, best_index);
+    return fleet_reduce(d2, lanes, 4);
+}
+
+#else
+
+void fleet_tick(Fleet *fleet, float dt) {
+    fleet_tick_scalar(fleet, dt);
+}
+
+int fleet_nearest_idle(const Fleet *fleet, float x, float y) {
+    return fleet_nearest_idle_scalar(fleet, x, y);
+}
+
+#endif
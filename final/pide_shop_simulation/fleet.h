@@ -0,0 +1,43 @@
+#ifndef FLEET_H
+#define FLEET_H
+
+/*
+ * Courier fleet state for large what-if runs, stored as a structure of arrays
+ * so the per-tick update and the nearest-courier scan stream through memory
+ * and run as SIMD kernels over the whole fleet (AVX, SSE2 or scalar, chosen
+ * at compile time). Positions are in metres, velocities in m/s, ETAs in seconds.
+ */
+
+typedef struct {
+    int size;        // Couriers in use
+    int capacity;    // Allocated entries, a multiple of the SIMD width
+    float *x;
+    float *y;
+    float *target_x;
+    float *target_y;
+    float *velocity;
+    float *eta;      // Seconds to the target at the current velocity
+    int *load;       // Orders carried; 0 means idle
+} Fleet;
+
+// Couriers start idle at (x, y) with the given velocity. Returns -1 if allocation fails.
+int fleet_init(Fleet *fleet, int size, float x, float y, float velocity);
+void fleet_destroy(Fleet *fleet);
+
+// Send courier 'i' with one more order to (x, y)
+void fleet_assign(Fleet *fleet, int i, float x, float y);
+
+// Move every courier towards its target for 'dt' seconds and update the ETAs
+void fleet_tick(Fleet *fleet, float dt);
+
+// Index of the idle courier closest to (x, y), or -1 if every courier is busy
+int fleet_nearest_idle(const Fleet *fleet, float x, float y);
+
+// Scalar versions of the kernels, as a reference for the SIMD ones
+void fleet_tick_scalar(Fleet *fleet, float dt);
+int fleet_nearest_idle_scalar(const Fleet *fleet, float x, float y);
+
+// Instruction set the SIMD kernels were built for
+const char *fleet_kernel_name(void);
+
+#endif // FLEET_H
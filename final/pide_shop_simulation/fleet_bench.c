@@ -0,0 +1,158 @@
+#include "fleet.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+
+/*
+ * Benchmark of the fleet kernels: ticks per second and nearest-courier scans
+ * per second for fleets of increasing size, SIMD against the scalar reference.
+ * Side effects:
+ * - Prints one line per fleet size to standard output.
+ */
+
+#define CITY_SIZE 10000.0f  // Metres
+#define COURIER_SPEED 1000  // m/min, as given to the server
+#define TICK_SECONDS 1.0f
+
+static unsigned long long rng = 88172645463325252ULL;
+
+static float random_float(float max) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (float)((rng * 2685821657736338717ULL) >> 40) / (float)(1 << 24) * max;
+}
+
+// Scatter the couriers over the city and send half of them towards a customer
+static int fleet_populate(Fleet *fleet, int size) {
+    if (fleet_init(fleet, size, 0.0f, 0.0f, COURIER_SPEED / 60.0f) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < size; i++) {
+        fleet->x[i] = fleet->target_x[i] = random_float(CITY_SIZE);
+        fleet->y[i] = fleet->target_y[i] = random_float(CITY_SIZE);
+        if (i % 2) {
+            fleet_assign(fleet, i, random_float(CITY_SIZE), random_float(CITY_SIZE));
+        }
+    }
+    return 0;
+}
+
+// Repeat 'kernel' for about 'seconds' and return the calls per second
+static double measure_ticks(Fleet *fleet, void (*kernel)(Fleet *, float), double seconds) {
+    unsigned long long start = now_ns();
+    unsigned long long end = start + (unsigned long long)(seconds * 1e9);
+    unsigned long calls = 0;
+    do {
+        kernel(fleet, TICK_SECONDS);
+        calls++;
+    } while (now_ns() < end);
+    return calls / ((now_ns() - start) / 1e9);
+}
+
+static double measure_scans(Fleet *fleet, int (*kernel)(const Fleet *, float, float), double seconds) {
+    unsigned long long start = now_ns();
+    unsigned long long end = start + (unsigned long long)(seconds * 1e9);
+    unsigned long calls = 0;
+    volatile int sink = 0;
+    do {
+        sink += kernel(fleet, random_float(CITY_SIZE), random_float(CITY_SIZE));
+        calls++;
+    } while (now_ns() < end);
+    (void)sink;
+    return calls / ((now_ns() - start) / 1e9);
+}
+
+/*
+ * Check that the SIMD kernels agree with the scalar ones on 'fleet'.
+ * Returns the largest position difference after a few ticks, or -1 if a nearest courier differs.
+ */
+static double check_kernels(int size) {
+    Fleet a, b;
+    unsigned long long seed = rng;
+    if (fleet_populate(&a, size) < 0) {
+        return -1;
+    }
+    rng = seed;
+    if (fleet_populate(&b, size) < 0) {
+        fleet_destroy(&a);
+        return -1;
+    }
+    double max_diff = 0;
+    for (int t = 0; t < 10; t++) {
+        fleet_tick(&a, TICK_SECONDS);
+        fleet_tick_scalar(&b, TICK_SECONDS);
+    }
+    for (int i = 0; i < size; i++) {
+        double diff = fabs(a.x[i] - b.x[i]) + fabs(a.y[i] - b.y[i]);
+        if (diff > max_diff) {
+            max_diff = diff;
+        }
+    }
+    for (int q = 0; q < 100 && max_diff >= 0; q++) {
+        float x = random_float(CITY_SIZE), y = random_float(CITY_SIZE);
+        if (fleet_nearest_idle(&a, x, y) != fleet_nearest_idle_scalar(&a, x, y)) {
+            max_diff = -1;
+        }
+    }
+    fleet_destroy(&a);
+    fleet_destroy(&b);
+    return max_diff;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t secondsPerMeasurement] [fleetSize ...]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    double seconds = 1.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atof(optarg);
+            if (seconds <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    int default_sizes[] = {10000, 100000, 1000000};
+    int num_sizes = argc - optind > 0 ? argc - optind : 3;
+    printf("Fleet kernels: %s\n", fleet_kernel_name());
+    for (int s = 0; s < num_sizes; s++) {
+        int size = argc - optind > 0 ? atoi(argv[optind + s]) : default_sizes[s];
+        if (size <= 0) {
+            usage(argv[0]);
+        }
+
+        double diff = check_kernels(size > 100000 ? 100000 : size);
+        if (diff < 0) {
+            fprintf(stderr, "Fleet of %d: SIMD and scalar kernels disagree\n", size);
+            return EXIT_FAILURE;
+        }
+
+        Fleet fleet;
+        if (fleet_populate(&fleet, size) < 0) {
+            perror("Failed to allocate fleet");
+            return EXIT_FAILURE;
+        }
+        double ticks = measure_ticks(&fleet, fleet_tick, seconds);
+        double ticks_scalar = measure_ticks(&fleet, fleet_tick_scalar, seconds);
+        double scans = measure_scans(&fleet, fleet_nearest_idle, seconds);
+        double scans_scalar = measure_scans(&fleet, fleet_nearest_idle_scalar, seconds);
+        fleet_destroy(&fleet);
+
+        printf("couriers=%d: tick %.0f/s (%.0f M couriers/s, scalar %.0f/s, x%.1f), "
+               "nearest %.0f/s (scalar %.0f/s, x%.1f), max drift vs scalar %.2g m\n",
+               size, ticks, ticks * size / 1e6, ticks_scalar, ticks / ticks_scalar,
+               scans, scans_scalar, scans / scans_scalar, diff);
+    }
+    return 0;
+}
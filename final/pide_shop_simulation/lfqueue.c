@@ -0,0 +1,81 @@
+#include "lfqueue.h"
+#include <stdlib.h>
+
+int lfq_init(LFQueue *q, size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    q->cells = malloc(size * sizeof(LFQueueCell));
+    if (!q->cells) {
+        return -1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        q->cells[i].sequence = i;
+        q->cells[i].item = NULL;
+    }
+    q->mask = size - 1;
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    return 0;
+}
+
+void lfq_destroy(LFQueue *q) {
+    free(q->cells);
+    q->cells = NULL;
+}
+
+int lfq_push(LFQueue *q, void *item) {
+    unsigned long pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    LFQueueCell *cell;
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        unsigned long seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)pos;
+        if (diff == 0) {
+            // Cell is free in this lap, try to claim it
+            if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // Consumers have not freed this cell yet: full
+        } else {
+            pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->item = item;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void *lfq_pop(LFQueue *q) {
+    unsigned long pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    LFQueueCell *cell;
+    while (1) {
+        cell = &q->cells[pos & q->mask];
+        unsigned long seq = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long)seq - (long)(pos + 1);
+        if (diff == 0) {
+            // Cell was filled in this lap, try to claim it
+            if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL; // Producer has not filled this cell yet: empty
+        } else {
+            pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    void *item = cell->item;
+    // Free the cell for the producers of the next lap
+    __atomic_store_n(&cell->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+size_t lfq_size(const LFQueue *q) {
+    unsigned long tail = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+    unsigned long head = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+    return tail > head ? tail - head : 0;
+}
@@ -0,0 +1,41 @@
+#ifndef LFQUEUE_H
+#define LFQUEUE_H
+
+#include <stddef.h>
+
+/*
+ * Bounded lock-free queue of pointers (Vyukov's array queue).
+ * Any number of producers and consumers may use it concurrently, so the same
+ * structure serves the SPSC, MPSC and MPMC boundaries of the pipeline.
+ * Each cell carries a sequence number telling whether it is ready to be written
+ * or read in the current lap, so push and pop cost a single CAS on the fast path.
+ */
+typedef struct {
+    unsigned long sequence;
+    void *item;
+} LFQueueCell;
+
+typedef struct {
+    LFQueueCell *cells;
+    unsigned long mask;
+    char pad0[64];
+    unsigned long enqueue_pos; // Kept on its own cache line, written by producers
+    char pad1[64];
+    unsigned long dequeue_pos; // Kept on its own cache line, written by consumers
+    char pad2[64];
+} LFQueue;
+
+// Capacity is rounded up to a power of two. Returns -1 if allocation fails.
+int lfq_init(LFQueue *q, size_t capacity);
+void lfq_destroy(LFQueue *q);
+
+// Returns 0 on success, -1 if the queue is full
+int lfq_push(LFQueue *q, void *item);
+
+// Returns NULL if the queue is empty
+void *lfq_pop(LFQueue *q);
+
+// Approximate number of queued items
+size_t lfq_size(const LFQueue *q);
+
+#endif // LFQUEUE_H
@@ -0,0 +1,206 @@
+#include "lockprof.h"
+
+#ifdef LOCK_PROFILE
+
+#include "utils.h"
+#include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Locks held by a thread at once, for the hold times
+#define LOCKPROF_MAX_HELD 8
+
+/*
+ * Profiles seen so far, linked on their first acquisition.
+ * Side effects:
+ * - The list only grows; 'registry_mutex' serialises the insertions.
+ */
+static LockProfile *profiles = NULL;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// TSC and clock at start, to convert cycles to nanoseconds in the report
+static unsigned long long start_cycles;
+static unsigned long long start_ns;
+
+// Locks held by the calling thread and when it got them; those past the table go untimed
+static __thread struct {
+    pthread_mutex_t *mutex;
+    unsigned long long since;
+} held[LOCKPROF_MAX_HELD];
+static __thread int num_held = 0;
+static __thread int num_untracked = 0;
+
+static inline unsigned long long cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+static void record(unsigned long *hist, unsigned long long *total, unsigned long long duration) {
+    int bucket = duration ? 63 - __builtin_clzll(duration) : 0;
+    if (bucket >= LOCKPROF_BUCKETS) {
+        bucket = LOCKPROF_BUCKETS - 1;
+    }
+    __atomic_add_fetch(&hist[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(total, duration, __ATOMIC_RELAXED);
+}
+
+static void lockprof_register(LockProfile *profile) {
+    if (__atomic_load_n(&profile->registered, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&registry_mutex);
+    if (!profile->registered) {
+        profile->next = profiles;
+        profiles = profile;
+        __atomic_store_n(&profile->registered, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void hold_begin(pthread_mutex_t *mutex) {
+    if (num_held == LOCKPROF_MAX_HELD) {
+        num_untracked++;
+        return;
+    }
+    held[num_held].mutex = mutex;
+    held[num_held].since = cycles();
+    num_held++;
+}
+
+static void hold_end(pthread_mutex_t *mutex, LockProfile *profile) {
+    // Locks are almost always released in reverse order: search from the top
+    for (int i = num_held - 1; i >= 0; i--) {
+        if (held[i].mutex == mutex) {
+            record(profile->hold_hist, &profile->hold_cycles, cycles() - held[i].since);
+            held[i] = held[--num_held];
+            return;
+        }
+    }
+    // Acquired while the table was full: its hold was not timed
+    if (num_untracked > 0) {
+        num_untracked--;
+    }
+}
+
+/*
+ * Acquire 'mutex', counting the acquisition.
+ * Side effects:
+ * - Only a failed trylock reads the TSC for the wait, so uncontended
+ *   acquisitions cost one trylock and the hold timestamp.
+ */
+void lockprof_lock(pthread_mutex_t *mutex, LockProfile *profile) {
+    lockprof_register(profile);
+    if (pthread_mutex_trylock(mutex) != 0) {
+        unsigned long long begin = cycles();
+        pthread_mutex_lock(mutex);
+        record(profile->wait_hist, &profile->wait_cycles, cycles() - begin);
+        __atomic_add_fetch(&profile->contended, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&profile->acquisitions, 1, __ATOMIC_RELAXED);
+    hold_begin(mutex);
+}
+
+void lockprof_unlock(pthread_mutex_t *mutex, LockProfile *profile) {
+    hold_end(mutex, profile);
+    pthread_mutex_unlock(mutex);
+}
+
+// The mutex is not held while waiting: the wait ends one hold and starts the next
+int lockprof_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, LockProfile *profile) {
+    hold_end(mutex, profile);
+    unsigned long long begin = cycles();
+    int status = pthread_cond_wait(cond, mutex);
+    record(profile->cond_hist, &profile->cond_cycles, cycles() - begin);
+    __atomic_add_fetch(&profile->cond_waits, 1, __ATOMIC_RELAXED);
+    hold_begin(mutex);
+    return status;
+}
+
+// Upper bound of the bucket holding quantile 'q' of 'hist', in nanoseconds
+static double hist_quantile_ns(const unsigned long *hist, unsigned long count, double q, double ns_per_cycle) {
+    unsigned long target = (unsigned long)(q * count);
+    unsigned long seen = 0;
+    for (int b = 0; b < LOCKPROF_BUCKETS; b++) {
+        seen += __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+        if (seen > target) {
+            return (double)(2ULL << b) * ns_per_cycle;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Log one line per profiled lock.
+ * Side effects:
+ * - Reads the counters without stopping the shop, so the figures of a lock
+ *   may be a few acquisitions apart.
+ */
+void lockprof_report(void) {
+    unsigned long long elapsed_cycles = cycles() - start_cycles;
+    double ns_per_cycle = elapsed_cycles ? (double)(now_ns() - start_ns) / elapsed_cycles : 1.0;
+
+    pthread_mutex_lock(&registry_mutex);
+    LockProfile *list = profiles;
+    pthread_mutex_unlock(&registry_mutex);
+
+    log_message("Lock profile (wait and hold percentiles are histogram bucket bounds):");
+    for (LockProfile *p = list; p; p = p->next) {
+        unsigned long acquisitions = __atomic_load_n(&p->acquisitions, __ATOMIC_RELAXED);
+        unsigned long contended = __atomic_load_n(&p->contended, __ATOMIC_RELAXED);
+        unsigned long cond_waits = __atomic_load_n(&p->cond_waits, __ATOMIC_RELAXED);
+        unsigned long holds = acquisitions + cond_waits; // A condvar wait splits a hold in two
+        double wait_ms = __atomic_load_n(&p->wait_cycles, __ATOMIC_RELAXED) * ns_per_cycle / 1e6;
+        double hold_ms = __atomic_load_n(&p->hold_cycles, __ATOMIC_RELAXED) * ns_per_cycle / 1e6;
+        double cond_ms = __atomic_load_n(&p->cond_cycles, __ATOMIC_RELAXED) * ns_per_cycle / 1e6;
+
+        char message[512];
+        snprintf(message, sizeof(message),
+                 "Lock %s: %lu acquisitions, %lu contended (%.2f%%), wait %.3f ms total p50 %.0f ns p99 %.0f ns, "
+                 "hold %.3f ms total mean %.0f ns p99 %.0f ns, %lu condvar waits %.3f ms total p99 %.0f ns",
+                 p->name, acquisitions, contended, acquisitions ? 100.0 * contended / acquisitions : 0.0,
+                 wait_ms, hist_quantile_ns(p->wait_hist, contended, 0.5, ns_per_cycle),
+                 hist_quantile_ns(p->wait_hist, contended, 0.99, ns_per_cycle),
+                 hold_ms, holds ? hold_ms * 1e6 / holds : 0.0,
+                 hist_quantile_ns(p->hold_hist, holds, 0.99, ns_per_cycle),
+                 cond_waits, cond_ms, hist_quantile_ns(p->cond_hist, cond_waits, 0.99, ns_per_cycle));
+        log_message(message);
+    }
+}
+
+/*
+ * Report thread: waits for SIGUSR1 and logs the profile.
+ * Side effects:
+ * - SIGUSR1 is blocked in every thread, so only this one receives it.
+ */
+static void *report_thread(void *arg) {
+    sigset_t *signals = arg;
+    int sig;
+    while (sigwait(signals, &sig) == 0) {
+        lockprof_report();
+    }
+    return NULL;
+}
+
+void lockprof_start(void) {
+    start_cycles = cycles();
+    start_ns = now_ns();
+
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, report_thread, &signals) != 0) {
+        handle_error("Failed to create lock profile thread");
+    }
+    pthread_detach(thread);
+    printf("Lock profiling on: kill -USR1 %d for a report\n", (int)getpid());
+}
+
+#endif // LOCK_PROFILE
@@ -0,0 +1,58 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#include <pthread.h>
+
+/*
+ * Lock contention profiler.
+ * The shop's mutexes and condition variables are taken through the PROFILED_*
+ * macros with a named LockProfile. Built with -DLOCK_PROFILE (make
+ * LOCK_PROFILE=1), every acquisition is counted, and the TSC is read to time
+ * the contended waits, the hold times and the condition variable waits into
+ * log2 histograms. Otherwise the macros are the plain pthread calls and the
+ * profiles hold only their name.
+ * The report is logged at shutdown and whenever the server receives SIGUSR1.
+ */
+
+#define LOCKPROF_BUCKETS 40 // Histogram bucket b counts durations of [2^b, 2^(b+1)) cycles
+
+typedef struct LockProfile {
+    const char *name;
+#ifdef LOCK_PROFILE
+    int registered;
+    struct LockProfile *next;
+    unsigned long acquisitions;
+    unsigned long contended;
+    unsigned long cond_waits;
+    unsigned long long wait_cycles;
+    unsigned long long hold_cycles;
+    unsigned long long cond_cycles;
+    unsigned long wait_hist[LOCKPROF_BUCKETS];
+    unsigned long hold_hist[LOCKPROF_BUCKETS];
+    unsigned long cond_hist[LOCKPROF_BUCKETS];
+#endif
+} LockProfile;
+
+#define LOCK_PROFILE_INITIALIZER(name) {name}
+
+#ifdef LOCK_PROFILE
+void lockprof_lock(pthread_mutex_t *mutex, LockProfile *profile);
+void lockprof_unlock(pthread_mutex_t *mutex, LockProfile *profile);
+int lockprof_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, LockProfile *profile);
+
+// Calibrate the TSC and start the SIGUSR1 report thread; call before creating any other thread
+void lockprof_start(void);
+void lockprof_report(void);
+
+#define PROFILED_LOCK(mutex, profile) lockprof_lock(mutex, profile)
+#define PROFILED_UNLOCK(mutex, profile) lockprof_unlock(mutex, profile)
+#define PROFILED_COND_WAIT(cond, mutex, profile) lockprof_cond_wait(cond, mutex, profile)
+#else
+#define PROFILED_LOCK(mutex, profile) ((void)(profile), pthread_mutex_lock(mutex))
+#define PROFILED_UNLOCK(mutex, profile) ((void)(profile), pthread_mutex_unlock(mutex))
+#define PROFILED_COND_WAIT(cond, mutex, profile) ((void)(profile), pthread_cond_wait(cond, mutex))
+#define lockprof_start() ((void)0)
+#define lockprof_report() ((void)0)
+#endif
+
+#endif // LOCKPROF_H
@@ -1,7 +1,11 @@
 #include "common.h"
 #include "protocol.h"
 #include "utils.h"
+#include "menu.h"
+#include "trace.h"
+#include "timerwheel.h"
 #include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -10,97 +14,101 @@
  * Function prototypes for internal use
  */
 void *manager_thread(void *arg);
-void signal_cooks();
-void signal_delivery_personnel();
 
 /*
- * Global variables for managing order states and synchronization
+ * Global counter of orders received by the manager
  * Side effects:
- * - These variables are shared between the manager and other threads to manage orders and synchronize their processing.
+ * - Updated by every client handler.
  */
-static pthread_mutex_t manager_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t manager_cond = PTHREAD_COND_INITIALIZER;
-static int order_received = 0;
-static int order_ready = 0;
+static unsigned long order_received = 0;
 
 /*
- * Start the manager thread
+ * Start the manager threads
  * Side effects:
- * - Creates and detaches a new thread for the manager.
+ * - Creates and detaches 'num_managers' threads relaying orders from cooks to couriers.
  * - Logs the initialization status.
  */
-void start_manager(void) {
+void start_manager(int num_managers) {
     printf("Initializing manager...\n");
-    pthread_t thread;
-    if (pthread_create(&thread, NULL, manager_thread, NULL) != 0) {
-        perror("Failed to create manager thread");
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < num_managers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, manager_thread, NULL) != 0) {
+            perror("Failed to create manager thread");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
     }
-    pthread_detach(thread);
     printf("Manager initialized...\n");
 }
 
 /*
  * Function representing the manager thread
  * Side effects:
- * - Continuously checks for ready orders and signals delivery personnel.
+ * - Continuously takes cooked orders and hands them to the delivery personnel.
+ * - Logs the baking and the delivery of orders for the timer thread, which must not block.
  */
 void *manager_thread(void *arg) {
     while (1) {
-        pthread_mutex_lock(&manager_mutex);
-        while (!order_ready) {
-            pthread_cond_wait(&manager_cond, &manager_mutex);
+        ShopOrder *order = stage_pop(&manager_stage);
+        if (order->order.status == ORDER_DELIVERED) {
+            delivery_report(order);
+            continue;
+        }
+        if (order_is_cancelled(order)) {
+            order_destroy(order);
+            continue;
         }
-        order_ready--;
-        pthread_mutex_unlock(&manager_mutex);
 
-        log_message("Manager: Order is ready for delivery");
-        signal_delivery_personnel();
+        char message[256];
+        snprintf(message, sizeof(message), "Order %d (%s) is cooked by cooker %d in oven %d", order->order.order_id,
+                 menu[order->pide_type].name, order->cook_id, order->oven_id);
+        log_message(message);
+        snprintf(message, sizeof(message), "Manager: Order %d is ready for delivery", order->order.order_id);
+        log_message(message);
+        order->order.status = ORDER_READY_FOR_DELIVERY;
+        trace_phase(order, "manager relay", NULL, 0);
+        signal_delivery_personnel(order);
     }
     return NULL;
 }
 
+static void notify_manager_retry(Timer *timer) {
+    notify_manager((ShopOrder *)((char *)timer - offsetof(ShopOrder, timer)));
+}
+
 /*
- * Notify the manager that an order is ready
+ * Notify the manager that an order is baked or delivered
  * Side effects:
- * - Updates the condition variable to wake up the manager thread.
+ * - Queues the order on the manager stage, waking a parked manager thread.
+ * - Called from timer callbacks, so it never waits: while the stage is full,
+ *   the order's timer retries on the next tick.
  */
-void notify_manager() {
-    pthread_mutex_lock(&manager_mutex);
-    order_ready++;
-    pthread_cond_signal(&manager_cond);
-    pthread_mutex_unlock(&manager_mutex);
+void notify_manager(ShopOrder *order) {
+    if (stage_push(&manager_stage, order) < 0) {
+        timer_schedule(&order->timer, 1, notify_manager_retry);
+    }
 }
 
 /*
  * Manager receives a new order
  * Side effects:
- * - Updates the condition variable to wake up the manager thread.
- * - Logs the order received message.
+ * - Counts the order and logs the order received message.
  */
-void manager_receive_order() {
-    pthread_mutex_lock(&manager_mutex);
-    order_received++;
-    pthread_cond_signal(&manager_cond);
-    pthread_mutex_unlock(&manager_mutex);
+void manager_receive_order(ShopOrder *order) {
+    __atomic_add_fetch(&order_received, 1, __ATOMIC_RELAXED);
 
     char message[256];
-    snprintf(message, sizeof(message), "Manager received an order");
+    snprintf(message, sizeof(message), "Manager received order %d", order->order.order_id);
     log_message(message);
 }
 
 /*
- * Cancel all orders and notify all waiting threads
+ * Cancel all orders
  * Side effects:
- * - Resets order counters and signals all waiting threads.
+ * - Every stage drops the orders accepted before the cancellation.
  * - Logs the cancellation message.
  */
 void cancel_order() {
-    pthread_mutex_lock(&manager_mutex);
-    order_received = 0;
-    order_ready = 0;
-    pthread_cond_broadcast(&manager_cond);
-    pthread_mutex_unlock(&manager_mutex);
-
+    order_cancel_all();
     log_message("All orders cancelled");
 }
@@ -0,0 +1,52 @@
+#include "menu.h"
+#include <string.h>
+
+/*
+ * Pide types served by the shop.
+ * The first entry is the default used for orders that do not name a type,
+ * and matches the original one second bake of a single shelf slot.
+ */
+const PideType menu[] = {
+    {"kiymali",    1000, 1, 30},
+    {"kasarli",     800, 1, 20},
+    {"lahmacun",    600, 1, 15},
+    {"kusbasili",  1400, 2, 20},
+    {"karisik",    1600, 2, 10},
+    {"aile",       2000, 3,  5}, // Family size pide
+};
+
+const int menu_size = sizeof(menu) / sizeof(menu[0]);
+
+int menu_lookup(const char *name) {
+    for (int i = 0; i < menu_size; i++) {
+        if (strcmp(menu[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+int menu_max_footprint(void) {
+    int max = 0;
+    for (int i = 0; i < menu_size; i++) {
+        if (menu[i].footprint > max) {
+            max = menu[i].footprint;
+        }
+    }
+    return max;
+}
+
+int menu_pick(double r) {
+    int total = 0;
+    for (int i = 0; i < menu_size; i++) {
+        total += menu[i].weight;
+    }
+    double target = r * total;
+    for (int i = 0; i < menu_size; i++) {
+        target -= menu[i].weight;
+        if (target < 0) {
+            return i;
+        }
+    }
+    return menu_size - 1;
+}
@@ -0,0 +1,27 @@
+#ifndef MENU_H
+#define MENU_H
+
+/*
+ * Menu of the shop. Each pide type bakes for its own time and takes its own
+ * share of the oven shelves (footprint, in oven capacity units).
+ */
+typedef struct {
+    const char *name;
+    int bake_ms;     // Time in the oven
+    int footprint;   // Oven capacity units taken while baking
+    int weight;      // Relative popularity, used to draw random orders
+} PideType;
+
+extern const PideType menu[];
+extern const int menu_size;
+
+// Index of the type named 'name', or 0 (the default pide) if unknown
+int menu_lookup(const char *name);
+
+// Largest footprint on the menu: an oven must be at least this big
+int menu_max_footprint(void);
+
+// Index of a type drawn by popularity, 'r' uniform in [0, 1)
+int menu_pick(double r);
+
+#endif // MENU_H
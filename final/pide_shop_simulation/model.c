@@ -0,0 +1,129 @@
+#include "model.h"
+#include "menu.h"
+#include "oven.h"
+#include <string.h>
+#include <math.h>
+
+static const char *station_names[MODEL_STATIONS] = {"cooks", "oven shelf", "oven openings", "couriers"};
+
+const char *model_station_name(int station) {
+    return station_names[station];
+}
+
+/*
+ * Erlang C through the Erlang B recurrence, which stays finite for large
+ * server counts where the closed form overflows.
+ */
+double model_erlang_c(int servers, double a) {
+    double rho = a / servers;
+    if (rho >= 1.0) {
+        return 1.0;
+    }
+    double b = 1.0;
+    for (int k = 1; k <= servers; k++) {
+        b = a * b / (k + a * b);
+    }
+    return b / (1.0 - rho * (1.0 - b));
+}
+
+/*
+ * Mean queueing wait of a station with arrival rate 'lambda' (per second),
+ * Allen-Cunneen approximation with Poisson arrivals.
+ */
+static void station_solve(ModelStation *s, double lambda) {
+    double service_s = s->service_us / 1e6;
+    double a = lambda * service_s;
+    s->utilisation = s->servers > 0 ? a / s->servers : INFINITY;
+    if (s->utilisation >= 1.0) {
+        s->wait_us = INFINITY;
+        return;
+    }
+    double mmc_wait_s = model_erlang_c(s->servers, a) / (s->servers / service_s - lambda);
+    s->wait_us = mmc_wait_s * (1.0 + s->scv) / 2.0 * 1e6;
+}
+
+static void station_set(ModelStation *s, int servers, double mean_us, double second_moment_us2) {
+    s->servers = servers;
+    s->service_us = mean_us;
+    s->scv = mean_us > 0 ? second_moment_us2 / (mean_us * mean_us) - 1.0 : 0.0;
+    if (s->scv < 0) {
+        s->scv = 0; // Rounding on a deterministic service
+    }
+}
+
+/*
+ * Predict the steady state of the shop for 'config'.
+ * The menu mix and the town grid give the service time moments exactly; the
+ * approximations are the Poisson flow between stations, the pooling of the
+ * ovens into one station (placement balances them) and the shelf seen as
+ * slots of the mean footprint, which ignores packing losses. Waits are those of
+ * first-come service: the packing policy shortens the oven wait below this.
+ */
+void model_predict(const SimConfig *config, ModelResult *r) {
+    memset(r, 0, sizeof(*r));
+    double lambda = config->arrival_rate;
+    int ovens = config->ovens > 0 ? config->ovens : oven_pool_default_size(config->cooks);
+
+    // Menu moments: footprint, and shelf time weighted by footprint
+    double total_weight = 0, footprint = 0, unit_time = 0, unit_time2 = 0;
+    for (int i = 0; i < menu_size; i++) {
+        total_weight += menu[i].weight;
+    }
+    for (int i = 0; i < menu_size; i++) {
+        double p = menu[i].weight / total_weight;
+        double shelf_us = (OVEN_LOAD_MS + menu[i].bake_ms) * 1e3;
+        footprint += p * menu[i].footprint;
+        unit_time += p * menu[i].footprint * shelf_us;
+        unit_time2 += p * menu[i].footprint * shelf_us * shelf_us;
+    }
+
+    // Trip moments over the town grid, as the orders are drawn in sim.c
+    double velocity = config->speed / 60.0;
+    double trip = 0, trip2 = 0;
+    int points = (config->town_width + 1) * (config->town_height + 1);
+    for (int x = 0; x <= config->town_width; x++) {
+        for (int y = 0; y <= config->town_height; y++) {
+            double us = sqrt((double)x * x + (double)y * y) / velocity * 1e6;
+            trip += us / points;
+            trip2 += us * us / points;
+        }
+    }
+
+    ModelStation *s = r->stations;
+    double prep_us = SIM_PREP_MS * 1e3;
+    station_set(&s[MODEL_COOKS], config->cooks, prep_us, prep_us * prep_us);
+    int slots = (int)(ovens * config->oven_capacity / footprint);
+    station_set(&s[MODEL_SHELF], slots > 0 ? slots : 1, unit_time / footprint, unit_time2 / footprint);
+    double load_us = OVEN_LOAD_MS * 1e3;
+    station_set(&s[MODEL_OPENINGS], ovens * config->oven_openings, load_us, load_us * load_us);
+    station_set(&s[MODEL_COURIERS], config->couriers, trip, trip2);
+
+    // The station with the least capacity limits the shop, and caps the flow into the others when overloaded
+    double capacity = INFINITY;
+    for (int i = 0; i < MODEL_STATIONS; i++) {
+        double station_capacity = s[i].servers / (s[i].service_us / 1e6);
+        if (station_capacity < capacity) {
+            capacity = station_capacity;
+            r->bottleneck = i;
+        }
+    }
+    r->stable = lambda < capacity;
+    r->throughput = r->stable ? lambda : capacity;
+    r->oven_utilisation = r->throughput * unit_time / 1e6 / (ovens * config->oven_capacity);
+    for (int i = 0; i < MODEL_STATIONS; i++) {
+        station_solve(&s[i], r->throughput);
+    }
+    r->oven_wait_us = s[MODEL_SHELF].wait_us + s[MODEL_OPENINGS].wait_us;
+    if (!r->stable) {
+        r->latency_mean_us = INFINITY;
+        return;
+    }
+
+    // The loading time is part of the shelf time; the latency counts it once
+    double bake_us = 0;
+    for (int i = 0; i < menu_size; i++) {
+        bake_us += menu[i].weight / total_weight * (OVEN_LOAD_MS + menu[i].bake_ms) * 1e3;
+    }
+    r->latency_mean_us = s[MODEL_COOKS].wait_us + prep_us + r->oven_wait_us + bake_us +
+                         s[MODEL_COURIERS].wait_us + trip;
+}
@@ -0,0 +1,38 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stddef.h>
+
+// Network I/O backends selectable at server startup
+#define NET_BACKEND_THREADS 0 // One blocking thread per client connection
+#define NET_BACKEND_EPOLL   1 // Single event loop on epoll
+#define NET_BACKEND_URING   2 // Single event loop on io_uring
+
+// Size of the receive buffers used by every backend
+#define NET_BUFFER_SIZE 1024
+
+/*
+ * Counters shared by all backends.
+ * net_syscalls counts the system calls issued on the accept/recv/send path,
+ * net_orders counts the orders handled, so that syscalls/order can be reported.
+ */
+extern unsigned long net_syscalls;
+extern unsigned long net_orders;
+#define NET_COUNT_SYSCALLS(n) __atomic_add_fetch(&net_syscalls, (n), __ATOMIC_RELAXED)
+
+// Backend name helpers
+int net_backend_from_name(const char *name);
+const char *net_backend_name(int backend);
+
+// Event loops. Each takes ownership of a bound, listening socket.
+void net_run_epoll(int listen_fd);
+int net_run_uring(int listen_fd); // Returns -1 before serving if io_uring is unusable
+
+/*
+ * Handles one message received from a client and builds the reply.
+ * Implemented by the server; shared by all backends.
+ * Returns the length of the reply written to 'reply', 0 if there is none.
+ */
+size_t server_handle_message(char *buffer, int length, char *reply, size_t reply_size);
+
+#endif // NET_H
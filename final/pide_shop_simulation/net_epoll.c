@@ -0,0 +1,130 @@
+#define _GNU_SOURCE // accept4
+#include "net.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#define EPOLL_MAX_EVENTS 256
+
+/*
+ * Accept every pending connection on the listening socket and register it with epoll.
+ * Side effects:
+ * - Adds the new client sockets to the epoll interest list.
+ */
+static void epoll_accept_all(int epoll_fd, int listen_fd) {
+    while (1) {
+        int client_sock = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        NET_COUNT_SYSCALLS(1);
+        if (client_sock < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("accept failed");
+            }
+            return;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = client_sock;
+        NET_COUNT_SYSCALLS(1);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_sock, &ev) < 0) {
+            perror("epoll_ctl failed");
+            close(client_sock);
+            continue;
+        }
+        log_message("Connection accepted");
+    }
+}
+
+/*
+ * Serve one readable client socket: a single recv, then the reply.
+ * Returns -1 when the connection has to be closed.
+ * Side effects:
+ * - Sends the reply on the client socket.
+ */
+static int epoll_serve_client(int sock) {
+    char buffer[NET_BUFFER_SIZE];
+    char reply[NET_BUFFER_SIZE];
+
+    NET_COUNT_SYSCALLS(1);
+    ssize_t read_size = recv(sock, buffer, sizeof(buffer) - 1, 0);
+    if (read_size == 0) {
+        log_message("Client disconnected");
+        return -1;
+    }
+    if (read_size < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return 0;
+        }
+        perror("recv failed");
+        return -1;
+    }
+
+    buffer[read_size] = '\0';
+    size_t reply_len = server_handle_message(buffer, read_size, reply, sizeof(reply));
+    if (reply_len > 0) {
+        // Replies are a few dozen bytes, so they always fit in an empty socket buffer
+        NET_COUNT_SYSCALLS(1);
+        if (send(sock, reply, reply_len, MSG_NOSIGNAL) < 0) {
+            perror("send failed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Event loop serving every client connection from a single thread with epoll.
+ * Side effects:
+ * - Takes ownership of the listening socket and never returns unless epoll fails.
+ */
+void net_run_epoll(int listen_fd) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        handle_error("epoll_create1 failed");
+    }
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0) {
+        handle_error("epoll_ctl failed");
+    }
+
+    log_message("Waiting for incoming connections (epoll)...");
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    while (1) {
+        NET_COUNT_SYSCALLS(1);
+        int n = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) {
+                epoll_accept_all(epoll_fd, listen_fd);
+            } else if (epoll_serve_client(fd) < 0) {
+                // Closing the socket also removes it from the interest list
+                NET_COUNT_SYSCALLS(1);
+                close(fd);
+            }
+        }
+    }
+
+    close(epoll_fd);
+    close(listen_fd);
+}
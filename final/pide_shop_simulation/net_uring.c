@@ -0,0 +1,437 @@
+#include "net.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+ * io_uring backend for the accept/recv/send path.
+ * - One multishot accept produces a completion for every new connection.
+ * - Each connection has a multishot recv that picks its buffer from a provided buffer ring.
+ * - Replies queued back to back for the same connection are linked so they go out in
+ *   order, and a closing connection has its close hard-linked behind its last send.
+ * The ring is driven by the raw system calls, so no extra library is needed.
+ */
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES (URING_ENTRIES * 8)
+#define URING_BUF_COUNT 256          // Provided buffers, must be a power of two
+#define URING_BUF_GROUP 0
+
+// Operation tag stored in the top byte of the user_data of every request
+#define UD_ACCEPT 1ULL
+#define UD_RECV   2ULL
+#define UD_SEND   3ULL
+#define UD_CLOSE  4ULL
+#define UD_MAKE(op, val) (((op) << 56) | (unsigned long long)(val))
+#define UD_OP(ud) ((ud) >> 56)
+#define UD_VAL(ud) ((ud) & ((1ULL << 56) - 1))
+
+typedef struct {
+    int ring_fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned to_submit;
+    struct io_uring_sqe *prev_sqe;   // Requests queued just before and at the current tail,
+    struct io_uring_sqe *cur_sqe;    // reset on submission since links never cross it
+    unsigned long generation;        // Submissions so far
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned short buf_tail;
+} Uring;
+
+// Per connection state, indexed by socket descriptor
+typedef struct {
+    int open;
+    struct io_uring_sqe *last_sqe;   // Last request queued for this connection,
+    unsigned long last_generation;   // valid only in the submission it was queued in
+} UringConn;
+
+// Reply kept alive until its send completes
+typedef struct {
+    int fd;
+    size_t len;
+    char data[];
+} UringSend;
+
+static UringConn *conns;
+static int conns_size;
+static int recv_multishot = 1;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void uring_destroy(Uring *r);
+
+/*
+ * Create the ring, map its queues and register the provided buffer ring.
+ * Returns -1 if the kernel lacks any of the required features.
+ */
+static int uring_init(Uring *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_CQ_ENTRIES;
+
+    r->ring_fd = sys_io_uring_setup(URING_ENTRIES, &p);
+    if (r->ring_fd < 0) {
+        perror("io_uring_setup failed");
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        log_message("io_uring: kernel is too old for the io_uring backend");
+        close(r->ring_fd);
+        return -1;
+    }
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_size > r->sq_size) {
+        r->sq_size = r->cq_size;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->ring_fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        perror("io_uring mmap failed");
+        close(r->ring_fd);
+        return -1;
+    }
+    r->cq_ptr = r->sq_ptr; // Single mmap covers both rings
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->ring_fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        perror("io_uring mmap failed");
+        munmap(r->sq_ptr, r->sq_size);
+        close(r->ring_fd);
+        return -1;
+    }
+
+    char *sq = r->sq_ptr;
+    char *cq = r->cq_ptr;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // Provided buffer ring for recv
+    r->buf_ring_size = URING_BUF_COUNT * sizeof(struct io_uring_buf);
+    r->buf_ring = mmap(NULL, r->buf_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    r->buffers = malloc((size_t)URING_BUF_COUNT * NET_BUFFER_SIZE);
+    if (r->buf_ring == MAP_FAILED || r->buffers == NULL) {
+        perror("io_uring buffer allocation failed");
+        uring_destroy(r);
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)r->buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+    if (sys_io_uring_register(r->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring buffer ring registration failed");
+        uring_destroy(r);
+        return -1;
+    }
+    return 0;
+}
+
+static void uring_destroy(Uring *r) {
+    if (r->buffers) {
+        free(r->buffers);
+    }
+    if (r->buf_ring && r->buf_ring != MAP_FAILED) {
+        munmap(r->buf_ring, r->buf_ring_size);
+    }
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->sq_ptr, r->sq_size);
+    close(r->ring_fd);
+}
+
+// Hand buffer 'bid' back to the kernel
+static void uring_recycle_buffer(Uring *r, unsigned short bid) {
+    struct io_uring_buf *buf = &r->buf_ring->bufs[r->buf_tail & (URING_BUF_COUNT - 1)];
+    buf->addr = (unsigned long)(r->buffers + (size_t)bid * NET_BUFFER_SIZE);
+    buf->len = NET_BUFFER_SIZE - 1; // Leave room for the terminating NUL
+    buf->bid = bid;
+    r->buf_tail++;
+    __atomic_store_n(&r->buf_ring->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
+
+// Submit the queued requests and optionally wait for one completion
+static int uring_submit(Uring *r, unsigned wait) {
+    int ret;
+    do {
+        NET_COUNT_SYSCALLS(1);
+        ret = sys_io_uring_enter(r->ring_fd, r->to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret >= 0) {
+        r->to_submit = 0;
+    }
+    r->prev_sqe = NULL;
+    r->cur_sqe = NULL;
+    r->generation++;
+    return ret;
+}
+
+// Get a free submission entry, flushing the queue when it is full
+static struct io_uring_sqe *uring_get_sqe(Uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+    if (tail - head >= r->sq_entries) {
+        uring_submit(r, 0);
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= r->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+    r->prev_sqe = r->cur_sqe;
+    r->cur_sqe = sqe;
+    return sqe;
+}
+
+static UringConn *uring_conn(int fd) {
+    if (fd >= conns_size) {
+        int new_size = conns_size ? conns_size : 1024;
+        while (new_size <= fd) {
+            new_size *= 2;
+        }
+        conns = realloc(conns, new_size * sizeof(UringConn));
+        if (!conns) {
+            handle_error("Failed to grow connection table");
+        }
+        memset(conns + conns_size, 0, (new_size - conns_size) * sizeof(UringConn));
+        conns_size = new_size;
+    }
+    return &conns[fd];
+}
+
+static void uring_queue_accept(Uring *r, int listen_fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UD_MAKE(UD_ACCEPT, listen_fd);
+}
+
+static void uring_queue_recv(Uring *r, int fd) {
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (!sqe) {
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = recv_multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = UD_MAKE(UD_RECV, fd);
+}
+
+/*
+ * Link 'sqe' behind the previous request of the same connection.
+ * A link always chains to the next entry of the submission queue, so this is only
+ * possible when both requests were queued back to back in the same submission.
+ * The slot of a request from an earlier submission may have been reused by another
+ * connection, so the generation is compared as well as the pointer.
+ */
+static void uring_link_conn(Uring *r, UringConn *conn, struct io_uring_sqe *sqe, unsigned link_flag) {
+    if (conn->last_sqe && conn->last_sqe == r->prev_sqe && conn->last_generation == r->generation) {
+        conn->last_sqe->flags |= link_flag;
+    }
+    conn->last_sqe = sqe;
+    conn->last_generation = r->generation;
+}
+
+static void uring_queue_send(Uring *r, int fd, const char *data, size_t len) {
+    UringSend *send_ctx = malloc(sizeof(UringSend) + len);
+    if (!send_ctx) {
+        return;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (!sqe) {
+        free(send_ctx);
+        return;
+    }
+    send_ctx->fd = fd;
+    send_ctx->len = len;
+    memcpy(send_ctx->data, data, len);
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)send_ctx->data;
+    sqe->len = len;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = UD_MAKE(UD_SEND, (unsigned long)send_ctx);
+    uring_link_conn(r, uring_conn(fd), sqe, IOSQE_IO_LINK);
+}
+
+static void uring_queue_close(Uring *r, int fd) {
+    UringConn *conn = uring_conn(fd);
+    if (!conn->open) {
+        return;
+    }
+    conn->open = 0;
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (!sqe) {
+        close(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = UD_MAKE(UD_CLOSE, fd);
+    // Close must run after the replies even if one of them fails
+    uring_link_conn(r, conn, sqe, IOSQE_IO_HARDLINK);
+    conn->last_sqe = NULL;
+}
+
+/*
+ * Handle one recv completion.
+ * Side effects:
+ * - Recycles the provided buffer, queues the reply and re-arms recv when needed.
+ */
+static void uring_handle_recv(Uring *r, int fd, int res, unsigned flags) {
+    UringConn *conn = uring_conn(fd);
+
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        char *buffer = r->buffers + (size_t)bid * NET_BUFFER_SIZE;
+        char reply[NET_BUFFER_SIZE];
+        buffer[res] = '\0';
+        size_t reply_len = server_handle_message(buffer, res, reply, sizeof(reply));
+        uring_recycle_buffer(r, bid);
+        if (reply_len > 0 && conn->open) {
+            uring_queue_send(r, fd, reply, reply_len);
+        }
+    } else if (res == 0) {
+        log_message("Client disconnected");
+        uring_queue_close(r, fd);
+        return;
+    } else if (res == -EINVAL && recv_multishot) {
+        // Multishot recv is not supported by this kernel, use one recv per message
+        recv_multishot = 0;
+    } else if (res < 0 && res != -ENOBUFS) {
+        errno = -res;
+        perror("recv failed");
+        uring_queue_close(r, fd);
+        return;
+    }
+
+    if (!(flags & IORING_CQE_F_MORE) && conn->open) {
+        uring_queue_recv(r, fd);
+    }
+}
+
+/*
+ * Event loop serving every client connection from a single thread with io_uring.
+ * Side effects:
+ * - Takes ownership of the listening socket.
+ * - Returns -1 without closing it if io_uring cannot be used, so the caller can fall back.
+ */
+int net_run_uring(int listen_fd) {
+    Uring ring;
+    if (uring_init(&ring) < 0) {
+        return -1;
+    }
+    for (unsigned short bid = 0; bid < URING_BUF_COUNT; bid++) {
+        uring_recycle_buffer(&ring, bid);
+    }
+
+    log_message("Waiting for incoming connections (io_uring)...");
+    uring_queue_accept(&ring, listen_fd);
+    int served = 0;
+
+    while (1) {
+        if (uring_submit(&ring, 1) < 0) {
+            perror("io_uring_enter failed");
+            break;
+        }
+
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            unsigned long long ud = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            head++;
+
+            switch (UD_OP(ud)) {
+            case UD_ACCEPT:
+                if (res >= 0) {
+                    served = 1;
+                    uring_conn(res)->open = 1;
+                    uring_conn(res)->last_sqe = NULL;
+                    log_message("Connection accepted");
+                    uring_queue_recv(&ring, res);
+                } else if (!served && (res == -EINVAL || res == -EOPNOTSUPP)) {
+                    log_message("io_uring: multishot accept not supported");
+                    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+                    uring_destroy(&ring);
+                    return -1;
+                } else {
+                    errno = -res;
+                    perror("accept failed");
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    uring_queue_accept(&ring, listen_fd);
+                }
+                break;
+            case UD_RECV:
+                uring_handle_recv(&ring, (int)UD_VAL(ud), res, flags);
+                break;
+            case UD_SEND:
+                free((UringSend *)(unsigned long)UD_VAL(ud));
+                break;
+            case UD_CLOSE:
+            default:
+                break;
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    uring_destroy(&ring);
+    close(listen_fd);
+    return 0;
+}
@@ -0,0 +1,498 @@
+#include "order_client.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define REQUEST_NONE   0
+#define REQUEST_SUBMIT 1
+#define REQUEST_CANCEL 2
+#define REQUEST_STATUS 3
+
+#define ORDER_CLIENT_BUFFER_SIZE 1024
+
+struct OrderHandle {
+    int order_id;
+    int status;
+    float eta_minutes;
+    float x, y;
+    char pide[32];
+    OrderCallback callback;
+    void *user;
+    int cancel_wanted;            // Cancel once the server knows the order
+    int in_flight;                // Requests and queued cancels still referring to the handle
+    int released;
+    OrderHandle *prev, *next;     // Submit queue or active list
+    OrderHandle *cancel_next;     // Cancel queue
+    OrderHandle *all_prev, *all_next;
+};
+
+typedef struct {
+    OrderHandle *head;
+    OrderHandle *tail;
+} HandleList;
+
+typedef struct {
+    int fd;
+    int request;                  // Request awaiting its reply
+    OrderHandle *batch[ORDER_CLIENT_STATUS_BATCH];
+    int batch_size;
+} Connection;
+
+struct OrderClient {
+    Connection *conns;
+    int num_conns;
+    int open_conns;
+    HandleList submits;           // Not sent yet
+    HandleList active;            // Accepted, polled for status
+    OrderHandle *cancel_head, *cancel_tail;
+    OrderHandle *all;
+    OrderHandle *cursor;          // Next active order of the current polling round
+    unsigned long long next_round_ns;
+    int outstanding;
+};
+
+int order_status_final(int status) {
+    return status == ORDER_DELIVERED || status == ORDER_CANCELLED || status == ORDER_FAILED;
+}
+
+const char *order_status_name(int status) {
+    switch (status) {
+    case ORDER_CLIENT_PENDING: return "pending";
+    case ORDER_ACCEPTED: return "accepted";
+    case ORDER_IN_PROGRESS: return "in progress";
+    case ORDER_COMPLETED: return "baked";
+    case ORDER_READY_FOR_DELIVERY: return "out for delivery";
+    case ORDER_DELIVERED: return "delivered";
+    case ORDER_CANCELLED: return "cancelled";
+    default: return "failed";
+    }
+}
+
+static void list_append(HandleList *list, OrderHandle *h) {
+    h->next = NULL;
+    h->prev = list->tail;
+    if (list->tail) {
+        list->tail->next = h;
+    } else {
+        list->head = h;
+    }
+    list->tail = h;
+}
+
+static void list_remove(HandleList *list, OrderHandle *h) {
+    if (h->prev) {
+        h->prev->next = h->next;
+    } else {
+        list->head = h->next;
+    }
+    if (h->next) {
+        h->next->prev = h->prev;
+    } else {
+        list->tail = h->prev;
+    }
+    h->prev = h->next = NULL;
+}
+
+// Free a released handle nothing refers to any more
+static void handle_maybe_free(OrderClient *client, OrderHandle *h) {
+    if (!h->released || !order_status_final(h->status) || h->in_flight > 0) {
+        return;
+    }
+    if (h->all_prev) {
+        h->all_prev->all_next = h->all_next;
+    } else {
+        client->all = h->all_next;
+    }
+    if (h->all_next) {
+        h->all_next->all_prev = h->all_prev;
+    }
+    free(h);
+}
+
+/*
+ * Record a new status of an order.
+ * Side effects:
+ * - A final status takes the order off the active list.
+ * - Calls the order's callback, which may release the handle: 'h' must not be
+ *   touched afterwards.
+ */
+static void handle_update(OrderClient *client, OrderHandle *h, int status) {
+    if (status == h->status || order_status_final(h->status)) {
+        return;
+    }
+    int was_active = h->status != ORDER_CLIENT_PENDING;
+    h->status = status;
+    if (order_status_final(status)) {
+        if (was_active) {
+            if (client->cursor == h) {
+                client->cursor = h->next;
+            }
+            list_remove(&client->active, h);
+        }
+        client->outstanding--;
+    }
+    if (h->released) {
+        handle_maybe_free(client, h);
+    } else if (h->callback) {
+        h->callback(h, status, h->user);
+    }
+}
+
+static void cancel_enqueue(OrderClient *client, OrderHandle *h) {
+    h->in_flight++;
+    h->cancel_next = NULL;
+    if (client->cancel_tail) {
+        client->cancel_tail->cancel_next = h;
+    } else {
+        client->cancel_head = h;
+    }
+    client->cancel_tail = h;
+}
+
+static OrderHandle *cancel_dequeue(OrderClient *client) {
+    OrderHandle *h = client->cancel_head;
+    if (h) {
+        client->cancel_head = h->cancel_next;
+        if (!client->cancel_head) {
+            client->cancel_tail = NULL;
+        }
+        h->in_flight--;
+    }
+    return h;
+}
+
+/*
+ * Open the connections.
+ * Side effects:
+ * - Allocates the client; connections that fail are left closed.
+ */
+OrderClient *order_client_open(const char *server_ip, int port, int connections) {
+    OrderClient *client = calloc(1, sizeof(OrderClient));
+    if (!client) {
+        return NULL;
+    }
+    client->conns = calloc(connections, sizeof(Connection));
+    if (!client->conns) {
+        free(client);
+        return NULL;
+    }
+    client->num_conns = connections;
+
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_addr.s_addr = inet_addr(server_ip);
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    for (int i = 0; i < connections; i++) {
+        Connection *conn = &client->conns[i];
+        conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conn->fd < 0) {
+            perror("Could not create socket");
+            continue;
+        }
+        if (connect(conn->fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+            perror("Connection Failed");
+            close(conn->fd);
+            conn->fd = -1;
+            continue;
+        }
+        client->open_conns++;
+    }
+    if (client->open_conns == 0) {
+        free(client->conns);
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+void order_client_close(OrderClient *client) {
+    for (int i = 0; i < client->num_conns; i++) {
+        if (client->conns[i].fd >= 0) {
+            close(client->conns[i].fd);
+        }
+    }
+    while (client->all) {
+        OrderHandle *next = client->all->all_next;
+        free(client->all);
+        client->all = next;
+    }
+    free(client->conns);
+    free(client);
+}
+
+OrderHandle *order_client_submit(OrderClient *client, float x, float y, const char *pide,
+                                 OrderCallback callback, void *user) {
+    OrderHandle *h = calloc(1, sizeof(OrderHandle));
+    if (!h) {
+        return NULL;
+    }
+    h->x = x;
+    h->y = y;
+    snprintf(h->pide, sizeof(h->pide), "%s", pide);
+    h->callback = callback;
+    h->user = user;
+    h->status = ORDER_CLIENT_PENDING;
+    h->all_next = client->all;
+    if (client->all) {
+        client->all->all_prev = h;
+    }
+    client->all = h;
+    list_append(&client->submits, h);
+    client->outstanding++;
+    return h;
+}
+
+/*
+ * Cancel an order.
+ * Side effects:
+ * - An order still queued here is cancelled at once; otherwise the server is asked
+ *   and polling reports the outcome, which is "delivered" if the courier already left.
+ */
+int order_client_cancel(OrderClient *client, OrderHandle *h) {
+    if (order_status_final(h->status) || h->cancel_wanted) {
+        return order_status_final(h->status) ? -1 : 0;
+    }
+    h->cancel_wanted = 1;
+    if (h->status == ORDER_CLIENT_PENDING) {
+        if (h->in_flight == 0) { // Never sent
+            list_remove(&client->submits, h);
+            handle_update(client, h, ORDER_CANCELLED);
+        }
+        // Otherwise the submission is in flight: cancelled once its id is known
+        return 0;
+    }
+    cancel_enqueue(client, h);
+    return 0;
+}
+
+int order_client_outstanding(const OrderClient *client) {
+    return client->outstanding;
+}
+
+int order_handle_status(const OrderHandle *handle) {
+    return handle->status;
+}
+
+int order_handle_id(const OrderHandle *handle) {
+    return handle->order_id;
+}
+
+float order_handle_eta(const OrderHandle *handle) {
+    return handle->eta_minutes;
+}
+
+void *order_handle_user(const OrderHandle *handle) {
+    return handle->user;
+}
+
+void order_handle_release(OrderClient *client, OrderHandle *handle) {
+    handle->released = 1;
+    handle->callback = NULL;
+    handle_maybe_free(client, handle);
+}
+
+/*
+ * Fill a status request with the next active orders of the polling round.
+ * A new round starts every ORDER_CLIENT_POLL_MS; orders already referenced by a
+ * request in flight are skipped. Returns the request length, 0 if there is nothing to poll.
+ */
+static int build_status_request(OrderClient *client, Connection *conn, char *message, size_t size) {
+    if (!client->cursor) {
+        unsigned long long now = now_ns();
+        if (!client->active.head || now < client->next_round_ns) {
+            return 0;
+        }
+        client->cursor = client->active.head;
+        client->next_round_ns = now + ORDER_CLIENT_POLL_MS * 1000000ULL;
+    }
+    int len = snprintf(message, size, "Status");
+    conn->batch_size = 0;
+    while (client->cursor && conn->batch_size < ORDER_CLIENT_STATUS_BATCH) {
+        OrderHandle *h = client->cursor;
+        client->cursor = h->next;
+        if (h->in_flight > 0) {
+            continue;
+        }
+        len += snprintf(message + len, size - len, " %d", h->order_id);
+        conn->batch[conn->batch_size++] = h;
+    }
+    return conn->batch_size > 0 ? len : 0;
+}
+
+static void connection_lost(OrderClient *client, Connection *conn);
+
+/*
+ * Give an idle connection its next request: cancellations first, then new orders,
+ * then status polls.
+ * Side effects:
+ * - Sends one message; the handles it refers to stay referenced until the reply.
+ */
+static void dispatch(OrderClient *client, Connection *conn) {
+    char message[ORDER_CLIENT_BUFFER_SIZE];
+    int len = 0;
+    OrderHandle *h;
+
+    while (!len && (h = cancel_dequeue(client)) != NULL) {
+        if (order_status_final(h->status)) {
+            handle_maybe_free(client, h);
+            continue;
+        }
+        len = snprintf(message, sizeof(message), "Cancel order %d", h->order_id);
+        conn->request = REQUEST_CANCEL;
+        conn->batch[0] = h;
+        conn->batch_size = 1;
+    }
+    if (!len && (h = client->submits.head) != NULL) {
+        list_remove(&client->submits, h);
+        len = snprintf(message, sizeof(message), "Order from client %d at position (%.2f, %.2f) pide %s",
+                       (int)(conn - client->conns) + 1, h->x, h->y, h->pide);
+        conn->request = REQUEST_SUBMIT;
+        conn->batch[0] = h;
+        conn->batch_size = 1;
+    }
+    if (!len && (len = build_status_request(client, conn, message, sizeof(message))) > 0) {
+        conn->request = REQUEST_STATUS;
+    }
+    if (!len) {
+        return;
+    }
+
+    for (int i = 0; i < conn->batch_size; i++) {
+        conn->batch[i]->in_flight++;
+    }
+    if (send(conn->fd, message, len, 0) != len) {
+        perror("Order client send failed");
+        connection_lost(client, conn);
+    }
+}
+
+/*
+ * Act on the reply to a connection's request, or on its loss ('reply' NULL).
+ * Side effects:
+ * - Updates the orders of the request and calls their callbacks.
+ * - A lost submission fails its order; a lost cancellation is queued again.
+ */
+static void complete_request(OrderClient *client, Connection *conn, const char *reply) {
+    int request = conn->request;
+    int count = conn->batch_size;
+    OrderHandle *batch[ORDER_CLIENT_STATUS_BATCH];
+    memcpy(batch, conn->batch, count * sizeof(OrderHandle *));
+    conn->request = REQUEST_NONE;
+    conn->batch_size = 0;
+    for (int i = 0; i < count; i++) {
+        batch[i]->in_flight--;
+    }
+
+    if (request == REQUEST_SUBMIT) {
+        OrderHandle *h = batch[0];
+        const char *id = reply ? strstr(reply, "(order ") : NULL;
+        if (!id || sscanf(id, "(order %d)", &h->order_id) != 1) {
+            handle_update(client, h, ORDER_FAILED);
+            return;
+        }
+        sscanf(reply, "Order processed by server. Estimated delivery time: %f", &h->eta_minutes);
+        list_append(&client->active, h);
+        if (h->cancel_wanted) {
+            cancel_enqueue(client, h);
+        }
+        handle_update(client, h, ORDER_ACCEPTED);
+    } else if (request == REQUEST_CANCEL) {
+        OrderHandle *h = batch[0];
+        if (!reply) {
+            cancel_enqueue(client, h);
+        } else if (strstr(reply, " unknown")) { // Too old for the server's order table
+            handle_update(client, h, ORDER_FAILED);
+        } else {
+            handle_maybe_free(client, h); // Polling reports the outcome
+        }
+    } else if (request == REQUEST_STATUS) {
+        // One "id=status" per order of the batch, in order
+        const char *p = reply ? reply + strlen("Status") : "";
+        for (int i = 0; i < count; i++) {
+            int id = 0, status = 0, consumed = 0;
+            if (sscanf(p, " %d=%d%n", &id, &status, &consumed) == 2) {
+                p += consumed;
+            }
+            if (order_status_final(batch[i]->status)) {
+                handle_maybe_free(client, batch[i]); // Finished by a cancellation meanwhile
+            } else if (id == batch[i]->order_id) {
+                handle_update(client, batch[i], status ? status : ORDER_FAILED);
+            }
+        }
+    }
+}
+
+static void connection_lost(OrderClient *client, Connection *conn) {
+    close(conn->fd);
+    conn->fd = -1;
+    client->open_conns--;
+    complete_request(client, conn, NULL);
+}
+
+/*
+ * One turn of the event loop.
+ * Side effects:
+ * - Sends queued requests on idle connections, waits for replies and handles them.
+ * - Calls the callbacks of the orders whose status changed.
+ */
+int order_client_poll(OrderClient *client, int timeout_ms) {
+    if (client->open_conns == 0) {
+        return -1;
+    }
+    for (int i = 0; i < client->num_conns; i++) {
+        if (client->conns[i].fd >= 0 && client->conns[i].request == REQUEST_NONE) {
+            dispatch(client, &client->conns[i]);
+        }
+    }
+
+    // Wake up for the next polling round if nothing else happens first
+    if (client->active.head && !client->cursor) {
+        long long wait_ms = ((long long)client->next_round_ns - (long long)now_ns()) / 1000000 + 1;
+        if (wait_ms < 0) {
+            wait_ms = 0;
+        }
+        if (timeout_ms < 0 || wait_ms < timeout_ms) {
+            timeout_ms = (int)wait_ms;
+        }
+    }
+
+    struct pollfd fds[client->num_conns];
+    Connection *polled[client->num_conns];
+    int nfds = 0;
+    for (int i = 0; i < client->num_conns; i++) {
+        if (client->conns[i].fd >= 0 && client->conns[i].request != REQUEST_NONE) {
+            fds[nfds].fd = client->conns[i].fd;
+            fds[nfds].events = POLLIN;
+            polled[nfds++] = &client->conns[i];
+        }
+    }
+    if (poll(fds, nfds, timeout_ms) < 0) {
+        if (errno != EINTR) {
+            perror("poll failed");
+        }
+        return client->outstanding;
+    }
+
+    for (int i = 0; i < nfds; i++) {
+        if (!(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+            continue;
+        }
+        Connection *conn = polled[i];
+        char reply[ORDER_CLIENT_BUFFER_SIZE];
+        ssize_t len = recv(conn->fd, reply, sizeof(reply) - 1, 0);
+        if (len <= 0) {
+            connection_lost(client, conn);
+            continue;
+        }
+        reply[len] = '\0';
+        complete_request(client, conn, reply);
+    }
+    return client->open_conns > 0 ? client->outstanding : -1;
+}
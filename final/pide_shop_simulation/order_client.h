@@ -0,0 +1,58 @@
+#ifndef ORDER_CLIENT_H
+#define ORDER_CLIENT_H
+
+#include "protocol.h"
+
+/*
+ * Asynchronous client library for the pide shop, for kiosks and apps that keep
+ * many orders in flight.
+ * Orders are multiplexed over a few connections. Each connection carries one
+ * request at a time, as the server expects: submissions, cancellations by order
+ * id, and batched status polls of the accepted orders. order_client_poll() runs
+ * the event loop; it sends what is queued, reads the replies and reports every
+ * status change through the order's callback. The library is single-threaded:
+ * call it from one thread only, callbacks included.
+ */
+
+#define ORDER_CLIENT_PENDING 0        // Status of an order not accepted by the server yet
+#define ORDER_CLIENT_POLL_MS 200      // Status polling period of the accepted orders
+#define ORDER_CLIENT_STATUS_BATCH 64  // Orders per status request, to fit the server's buffer
+#define ORDER_CLIENT_PORT 8000
+
+typedef struct OrderClient OrderClient;
+typedef struct OrderHandle OrderHandle;
+
+// Called on every status change of an order, from inside order_client_poll()
+typedef void (*OrderCallback)(OrderHandle *handle, int status, void *user);
+
+// Connect 'connections' sockets to the server; NULL if none could be opened
+OrderClient *order_client_open(const char *server_ip, int port, int connections);
+
+// Close the connections and free every handle, released or not
+void order_client_close(OrderClient *client);
+
+// Queue an order; the handle stays valid until order_handle_release()
+OrderHandle *order_client_submit(OrderClient *client, float x, float y, const char *pide,
+                                 OrderCallback callback, void *user);
+
+// Ask for the order to be cancelled; -1 if it already reached a final status
+int order_client_cancel(OrderClient *client, OrderHandle *handle);
+
+// Run the event loop for at most 'timeout_ms' (-1: until something happens); outstanding orders, -1 once every connection is lost
+int order_client_poll(OrderClient *client, int timeout_ms);
+
+// Orders not delivered, cancelled or failed yet
+int order_client_outstanding(const OrderClient *client);
+
+int order_handle_status(const OrderHandle *handle);
+int order_handle_id(const OrderHandle *handle);     // Server's order id, 0 until accepted
+float order_handle_eta(const OrderHandle *handle);  // Minutes, as predicted on acceptance
+void *order_handle_user(const OrderHandle *handle);
+
+// Forget a handle: no more callbacks, freed once the order reached a final status
+void order_handle_release(OrderClient *client, OrderHandle *handle);
+
+int order_status_final(int status);
+const char *order_status_name(int status);
+
+#endif // ORDER_CLIENT_H
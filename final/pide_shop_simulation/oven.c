@@ -0,0 +1,219 @@
+#include "oven.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MS_TO_NS(ms) ((long long)(ms) * 1000000LL)
+
+// Jobs finishing within this window of the current batch count as finishing together
+#define OVEN_FINISH_BUCKET_NS MS_TO_NS(100)
+
+int oven_policy_from_name(const char *name) {
+    if (strcmp(name, "fcfs") == 0) return OVEN_POLICY_FCFS;
+    if (strcmp(name, "pack") == 0) return OVEN_POLICY_PACK;
+    return -1;
+}
+
+const char *oven_policy_name(int policy) {
+    return policy == OVEN_POLICY_PACK ? "pack" : "fcfs";
+}
+
+int oven_placement_from_name(const char *name) {
+    if (strcmp(name, "least") == 0) return OVEN_PLACE_LEAST;
+    if (strcmp(name, "wait") == 0) return OVEN_PLACE_WAIT;
+    return -1;
+}
+
+const char *oven_placement_name(int placement) {
+    return placement == OVEN_PLACE_WAIT ? "wait" : "least";
+}
+
+int oven_pool_default_size(int cooks) {
+    int ovens = (cooks + COOKS_PER_OVEN - 1) / COOKS_PER_OVEN;
+    return ovens > 0 ? ovens : 1;
+}
+
+int oven_state_init(OvenState *s, int capacity, int openings, int policy, long long now_ns) {
+    memset(s, 0, sizeof(*s));
+    s->capacity = capacity;
+    s->openings = openings;
+    s->policy = policy;
+    s->start_ns = now_ns;
+    s->last_ns = now_ns;
+    s->waiting_size = 16;
+    s->waiting = malloc(s->waiting_size * sizeof(OvenJob));
+    return s->waiting ? 0 : -1;
+}
+
+void oven_state_destroy(OvenState *s) {
+    free(s->waiting);
+    s->waiting = NULL;
+}
+
+// Integrate the shelf occupancy up to 'now_ns'
+static void oven_state_account(OvenState *s, long long now_ns) {
+    if (now_ns > s->last_ns) {
+        s->busy_area_ns += (long long)s->used * (now_ns - s->last_ns);
+        s->last_ns = now_ns;
+    }
+}
+
+int oven_state_add(OvenState *s, const OvenJob *job) {
+    if (s->num_waiting == s->waiting_size) {
+        OvenJob *grown = realloc(s->waiting, 2 * s->waiting_size * sizeof(OvenJob));
+        if (!grown) {
+            return -1;
+        }
+        s->waiting = grown;
+        s->waiting_size *= 2;
+    }
+    s->waiting[s->num_waiting++] = *job;
+    s->waiting_units += job->footprint;
+    s->waiting_work_ns += job->footprint * job->bake_ns;
+    return 0;
+}
+
+static long long llabs_diff(long long a, long long b) {
+    return a > b ? a - b : b - a;
+}
+
+/*
+ * Packing choice among the waiting pides that fit in 'space'.
+ * - Once the oldest pide waited longer than OVEN_AGING_MS, it goes next: the space
+ *   it needs is kept for it, nothing else is loaded until it fits.
+ * - While the oven holds a batch, prefer the pide finishing closest to the batch,
+ *   then the largest one, so shelves stay full and the batch comes out together.
+ * - On an empty oven, prefer the largest pide, then the shortest bake.
+ * Returns the index in the waiting list, or -1.
+ */
+static int oven_pick_pack(const OvenState *s, long long now_ns, int space) {
+    int best = -1;
+    long long best_gap = 0;
+
+    // Waiting list is in arrival order: the first pide is the oldest
+    if (s->num_waiting > 0 && now_ns - s->waiting[0].ready_ns > MS_TO_NS(OVEN_AGING_MS)) {
+        return s->waiting[0].footprint <= space ? 0 : -1;
+    }
+    for (int i = 0; i < s->num_waiting; i++) {
+        const OvenJob *job = &s->waiting[i];
+        if (job->footprint > space) {
+            continue;
+        }
+        long long finish = now_ns + MS_TO_NS(OVEN_LOAD_MS) + job->bake_ns;
+        long long gap = s->used > 0 ? llabs_diff(finish, s->batch_finish_ns) / OVEN_FINISH_BUCKET_NS : 0;
+        if (best < 0) {
+            best = i;
+            best_gap = gap;
+            continue;
+        }
+        const OvenJob *cur = &s->waiting[best];
+        if (gap != best_gap) {
+            if (gap < best_gap) {
+                best = i;
+                best_gap = gap;
+            }
+        } else if (job->footprint != cur->footprint) {
+            if (job->footprint > cur->footprint) {
+                best = i;
+            }
+        } else if (job->bake_ns < cur->bake_ns) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int oven_state_admit(OvenState *s, long long now_ns, OvenJob *out) {
+    if (s->loading >= s->openings || s->num_waiting == 0) {
+        return 0;
+    }
+    int space = s->capacity - s->used;
+    int index;
+    if (s->policy == OVEN_POLICY_PACK) {
+        index = oven_pick_pack(s, now_ns, space);
+    } else {
+        // First come: the oldest pide blocks the others until it fits
+        index = s->waiting[0].footprint <= space ? 0 : -1;
+    }
+    if (index < 0) {
+        return 0;
+    }
+
+    *out = s->waiting[index];
+    memmove(&s->waiting[index], &s->waiting[index + 1], (s->num_waiting - index - 1) * sizeof(OvenJob));
+    s->num_waiting--;
+    s->waiting_units -= out->footprint;
+    s->waiting_work_ns -= out->footprint * out->bake_ns;
+
+    oven_state_account(s, now_ns);
+    s->used += out->footprint;
+    s->loading++;
+    s->loaded++;
+    s->total_wait_ns += now_ns - out->ready_ns;
+    long long finish = now_ns + MS_TO_NS(OVEN_LOAD_MS) + out->bake_ns;
+    if (s->used == out->footprint || finish > s->batch_finish_ns) {
+        s->batch_finish_ns = finish;
+    }
+    return 1;
+}
+
+void oven_state_loaded(OvenState *s, long long now_ns) {
+    oven_state_account(s, now_ns);
+    s->loading--;
+}
+
+void oven_state_done(OvenState *s, const OvenJob *job, long long now_ns) {
+    oven_state_account(s, now_ns);
+    s->used -= job->footprint;
+    s->baked++;
+}
+
+double oven_state_utilisation(OvenState *s, long long now_ns) {
+    oven_state_account(s, now_ns);
+    long long elapsed = now_ns - s->start_ns;
+    if (elapsed <= 0 || s->capacity <= 0) {
+        return 0.0;
+    }
+    return (double)s->busy_area_ns / ((double)s->capacity * elapsed);
+}
+
+/*
+ * Expected wait is the work ahead of a new pide spread over the shelves:
+ * what is waiting plus what is left of the batch in the oven.
+ */
+void oven_state_load(const OvenState *s, long long now_ns, OvenLoad *load) {
+    long long left = s->batch_finish_ns > now_ns ? s->batch_finish_ns - now_ns : 0;
+    load->capacity = s->capacity;
+    load->units = s->used + s->waiting_units;
+    load->wait_ns = (s->waiting_work_ns + s->used * left) / (s->capacity > 0 ? s->capacity : 1);
+}
+
+// Score of an oven for the placement, lower is better
+static double oven_score(const OvenLoad *load, int placement) {
+    if (placement == OVEN_PLACE_WAIT) {
+        return (double)load->wait_ns;
+    }
+    return (double)load->units / load->capacity;
+}
+
+int oven_place(const OvenLoad *loads, int n, int placement, int preferred) {
+    int best = 0;
+    for (int i = 1; i < n; i++) {
+        if (oven_score(&loads[i], placement) < oven_score(&loads[best], placement)) {
+            best = i;
+        }
+    }
+    if (preferred < 0 || preferred >= n || preferred == best) {
+        return best;
+    }
+
+    // Stay on the cook's own oven while it is not much busier than the best one
+    const OvenLoad *own = &loads[preferred];
+    if (placement == OVEN_PLACE_WAIT) {
+        if (own->wait_ns - loads[best].wait_ns <= MS_TO_NS(OVEN_AFFINITY_SLACK_MS)) {
+            return preferred;
+        }
+    } else if (own->units < own->capacity) {
+        return preferred;
+    }
+    return best;
+}
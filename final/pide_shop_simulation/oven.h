@@ -0,0 +1,112 @@
+#ifndef OVEN_H
+#define OVEN_H
+
+/*
+ * Oven scheduler.
+ * Prepared pides wait in front of the oven until the scheduler loads them
+ * through one of the limited openings. Loading holds an opening for
+ * OVEN_LOAD_MS; baking holds 'footprint' units of the shelf capacity.
+ * The state below has no locking and no clock of its own, so the same code
+ * drives the live oven (under its mutex) and the simulator (in virtual time).
+ */
+
+#define OVEN_POLICY_FCFS 0 // Greedy first-come: only the oldest pide may be loaded
+#define OVEN_POLICY_PACK 1 // Packing: best fit on the shelves, batches finishing together
+
+#define OVEN_LOAD_MS 200
+
+// A pide waiting longer than this is loaded next, its space kept free until it fits, so packing cannot starve it
+#define OVEN_AGING_MS 5000
+
+// Placement of a prepared pide in a pool of ovens
+#define OVEN_PLACE_LEAST 0 // Least loaded oven (capacity units queued or baking)
+#define OVEN_PLACE_WAIT  1 // Shortest expected wait before the pide is loaded
+
+// A cook keeps using its own oven unless another one is this much less busy
+#define OVEN_AFFINITY_SLACK_MS 500
+
+// Default pool size: one oven for this many cooks
+#define COOKS_PER_OVEN 8
+
+typedef struct {
+    void *ref;            // Owner's handle for the pide (order)
+    int type;             // Index in the menu
+    int footprint;
+    long long bake_ns;
+    long long ready_ns;   // When the pide was handed to the oven
+} OvenJob;
+
+typedef struct {
+    int capacity;         // Shelf capacity units
+    int openings;
+    int policy;
+    int used;             // Capacity taken by loading and baking pides
+    int loading;          // Openings in use
+    long long batch_finish_ns; // When the last pide currently in the oven comes out
+
+    OvenJob *waiting;
+    int num_waiting;
+    int waiting_size;
+    int waiting_units;         // Footprint of the waiting pides
+    long long waiting_work_ns; // Sum of footprint * bake time of the waiting pides
+
+    // Statistics
+    long long start_ns;
+    long long last_ns;
+    long long busy_area_ns;    // Integral of 'used' over time
+    long long total_wait_ns;
+    unsigned long loaded;
+    unsigned long baked;
+} OvenState;
+
+// Configuration of the oven pool used by the cooks
+typedef struct {
+    int ovens;            // 0 sizes the pool from the number of cooks
+    int capacity;
+    int openings;
+    int policy;
+    int placement;
+    int affinity;         // Cooks prefer oven (cook id % ovens)
+} OvenPoolConfig;
+
+// Load of one oven as seen by the placement, cheap to publish and copy
+typedef struct {
+    int capacity;
+    int units;            // Capacity units waiting or in the oven
+    long long wait_ns;    // Expected wait before a new pide can be loaded
+} OvenLoad;
+
+int oven_policy_from_name(const char *name);
+const char *oven_policy_name(int policy);
+int oven_placement_from_name(const char *name);
+const char *oven_placement_name(int placement);
+int oven_pool_default_size(int cooks);
+
+int oven_state_init(OvenState *s, int capacity, int openings, int policy, long long now_ns);
+void oven_state_destroy(OvenState *s);
+
+// Queue a prepared pide. Returns -1 if memory runs out.
+int oven_state_add(OvenState *s, const OvenJob *job);
+
+// Pick the next pide to load according to the policy. Returns 1 and fills 'out', or 0.
+int oven_state_admit(OvenState *s, long long now_ns, OvenJob *out);
+
+// Loading finished: the opening is free again
+void oven_state_loaded(OvenState *s, long long now_ns);
+
+// Baking finished: the shelf space is free again
+void oven_state_done(OvenState *s, const OvenJob *job, long long now_ns);
+
+// Fraction of the shelf capacity used since start
+double oven_state_utilisation(OvenState *s, long long now_ns);
+
+// Current load of the oven
+void oven_state_load(const OvenState *s, long long now_ns, OvenLoad *load);
+
+/*
+ * Choose an oven among 'n' for a new pide.
+ * 'preferred' is the cook's own oven when affinity is used, -1 otherwise.
+ */
+int oven_place(const OvenLoad *loads, int n, int placement, int preferred);
+
+#endif // OVEN_H
@@ -0,0 +1,299 @@
+#include "pipeline.h"
+#include "utils.h"
+#include "menu.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+/*
+ * Stage queues between the server, cooks, manager and couriers.
+ * Side effects:
+ * - Shared by every thread of the shop; initialised once by pipeline_init().
+ */
+Stage cook_stage = {"cook", "queued for cook", .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER,
+                    .actors = ACTOR_WAIT_QUEUE_INITIALIZER, .lock_profile = LOCK_PROFILE_INITIALIZER("cook_stage.mutex")};
+Stage manager_stage = {"manager", "waiting for manager", .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER,
+                       .actors = ACTOR_WAIT_QUEUE_INITIALIZER,
+                       .lock_profile = LOCK_PROFILE_INITIALIZER("manager_stage.mutex")};
+Stage courier_stage = {"courier", "queued for courier", .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER,
+                       .actors = ACTOR_WAIT_QUEUE_INITIALIZER,
+                       .lock_profile = LOCK_PROFILE_INITIALIZER("courier_stage.mutex")};
+
+ShopOrder stage_retire_token;
+
+static unsigned long next_order_id = 0;
+static unsigned long cancel_generation = 0;
+static unsigned long long pipeline_start_ns;
+
+/*
+ * Recent orders by id, for per-order status and cancellation.
+ * Side effects:
+ * - An entry points at the live order until order_destroy() records its final status;
+ *   a newer order with the same slot overwrites it.
+ */
+typedef struct {
+    int order_id;
+    int status;
+    ShopOrder *order;
+} OrderSlot;
+
+static OrderSlot order_table[ORDER_TABLE_SIZE];
+static pthread_mutex_t order_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LockProfile order_table_profile = LOCK_PROFILE_INITIALIZER("order_table_mutex");
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/*
+ * Allocate the stage queues.
+ * Side effects:
+ * - Exits the program if the queues cannot be allocated.
+ */
+void pipeline_init(size_t queue_capacity) {
+    Stage *stages[] = {&cook_stage, &manager_stage, &courier_stage};
+    for (int i = 0; i < 3; i++) {
+        if (lfq_init(&stages[i]->queue, queue_capacity) < 0) {
+            handle_error("Failed to allocate stage queue");
+        }
+    }
+    pipeline_start_ns = now_ns();
+}
+
+/*
+ * Log the handoff latency and throughput of every stage.
+ * Side effects:
+ * - Logs one line per stage.
+ */
+void pipeline_report(void) {
+    Stage *stages[] = {&cook_stage, &manager_stage, &courier_stage};
+    double seconds = (now_ns() - pipeline_start_ns) / 1e9;
+    for (int i = 0; i < 3; i++) {
+        Stage *s = stages[i];
+        unsigned long handoffs = __atomic_load_n(&s->handoffs, __ATOMIC_RELAXED);
+        unsigned long long total = __atomic_load_n(&s->total_wait_ns, __ATOMIC_RELAXED);
+        char message[256];
+        snprintf(message, sizeof(message),
+                 "Stage %s: %lu handoffs, %.1f orders/s, avg handoff %.1f us, max handoff %.1f us, queued %zu",
+                 s->name, handoffs, seconds > 0 ? handoffs / seconds : 0.0,
+                 handoffs ? total / 1e3 / handoffs : 0.0, s->max_wait_ns / 1e3, lfq_size(&s->queue));
+        log_message(message);
+    }
+}
+
+/*
+ * Create a new order handle.
+ * Side effects:
+ * - Allocates memory, released by order_destroy() once the order leaves the pipeline.
+ */
+ShopOrder *order_create(float x, float y, const char *details) {
+    ShopOrder *order = calloc(1, sizeof(ShopOrder));
+    if (!order) {
+        return NULL;
+    }
+    order->order.order_id = (int)__atomic_add_fetch(&next_order_id, 1, __ATOMIC_RELAXED);
+    order->order.x = x;
+    order->order.y = y;
+    if (details) {
+        snprintf(order->order.details, sizeof(order->order.details), "%s", details);
+        order->pide_type = menu_lookup(details);
+    }
+    order->order.status = ORDER_ACCEPTED;
+    order->generation = __atomic_load_n(&cancel_generation, __ATOMIC_ACQUIRE);
+    order->created_ns = now_ns();
+    trace_order_start(order);
+
+    OrderSlot *slot = &order_table[order->order.order_id % ORDER_TABLE_SIZE];
+    PROFILED_LOCK(&order_table_mutex, &order_table_profile);
+    slot->order_id = order->order.order_id;
+    slot->status = ORDER_ACCEPTED;
+    slot->order = order;
+    PROFILED_UNLOCK(&order_table_mutex, &order_table_profile);
+    return order;
+}
+
+/*
+ * Release an order handle.
+ * Side effects:
+ * - Records the final status in the order table: delivered, failed, or cancelled
+ *   for an order dropped on the way.
+ */
+void order_destroy(ShopOrder *order) {
+    trace_order_end(order);
+    OrderSlot *slot = &order_table[order->order.order_id % ORDER_TABLE_SIZE];
+    PROFILED_LOCK(&order_table_mutex, &order_table_profile);
+    if (slot->order == order) {
+        int status = order->order.status;
+        slot->status = status == ORDER_DELIVERED || status == ORDER_FAILED ? status : ORDER_CANCELLED;
+        slot->order = NULL;
+    }
+    PROFILED_UNLOCK(&order_table_mutex, &order_table_profile);
+    free(order);
+}
+
+// An order is cancelled on its own, or once a cancellation happened after it was accepted
+int order_is_cancelled(const ShopOrder *order) {
+    return __atomic_load_n(&order->handoff, __ATOMIC_ACQUIRE) == ORDER_CANCEL_REQUESTED ||
+           order->generation != __atomic_load_n(&cancel_generation, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Hand an order to its courier.
+ * Side effects:
+ * - Claims the order against order_cancel(), which then answers CANCEL_TOO_LATE.
+ */
+int order_dispatch(ShopOrder *order) {
+    int expected = 0;
+    if (order->generation != __atomic_load_n(&cancel_generation, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return __atomic_compare_exchange_n(&order->handoff, &expected, ORDER_OUT_WITH_COURIER, 0,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Cancel a single order.
+ * Side effects:
+ * - Flags the order; stages drop it as they reach it. An order already with its
+ *   courier is still delivered, and the result says so.
+ */
+int order_cancel(int order_id) {
+    OrderSlot *slot = &order_table[order_id % ORDER_TABLE_SIZE];
+    int result = CANCEL_UNKNOWN;
+    PROFILED_LOCK(&order_table_mutex, &order_table_profile);
+    if (order_id > 0 && slot->order_id == order_id) {
+        result = CANCEL_FINISHED;
+        if (slot->order) {
+            int expected = 0;
+            if (__atomic_compare_exchange_n(&slot->order->handoff, &expected, ORDER_CANCEL_REQUESTED, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                result = CANCEL_OK;
+            } else {
+                result = expected == ORDER_OUT_WITH_COURIER ? CANCEL_TOO_LATE : CANCEL_OK;
+            }
+        }
+    }
+    PROFILED_UNLOCK(&order_table_mutex, &order_table_profile);
+    return result;
+}
+
+int order_status(int order_id) {
+    OrderSlot *slot = &order_table[order_id % ORDER_TABLE_SIZE];
+    int status = 0;
+    PROFILED_LOCK(&order_table_mutex, &order_table_profile);
+    if (order_id > 0 && slot->order_id == order_id) {
+        status = slot->order ? __atomic_load_n(&slot->order->order.status, __ATOMIC_RELAXED) : slot->status;
+    }
+    PROFILED_UNLOCK(&order_table_mutex, &order_table_profile);
+    return status;
+}
+
+/*
+ * Cancel every order currently in the pipeline.
+ * Side effects:
+ * - Stages drop the cancelled orders as they reach them.
+ */
+void order_cancel_all(void) {
+    __atomic_add_fetch(&cancel_generation, 1, __ATOMIC_ACQ_REL);
+}
+
+// Wake a parked consumer thread or actor of a stage an order was just pushed on
+static void stage_wake(Stage *stage) {
+    // Pairs with the fence in stage_pop(): either the consumer sees the order or we see the waiter
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&stage->waiters, __ATOMIC_RELAXED) > 0) {
+        PROFILED_LOCK(&stage->mutex, &stage->lock_profile);
+        pthread_cond_signal(&stage->cond);
+        PROFILED_UNLOCK(&stage->mutex, &stage->lock_profile);
+    }
+    actor_wake_one(&stage->actors);
+}
+
+/*
+ * Hand an order to a stage.
+ * Side effects:
+ * - Fails at once if the stage queue is full, so the event loop never waits on a stage.
+ * - Wakes a parked consumer thread or actor if there is one.
+ */
+int stage_push(Stage *stage, ShopOrder *order) {
+    order->enqueue_ns = now_ns();
+    if (lfq_push(&stage->queue, order) < 0) {
+        return -1;
+    }
+    stage_wake(stage);
+    return 0;
+}
+
+/*
+ * Hand an order to a stage, waiting for room.
+ * Side effects:
+ * - Yields while the stage queue is full, which throttles the producing stage.
+ * - Wakes a parked consumer thread or actor if there is one.
+ */
+void stage_push_wait(Stage *stage, ShopOrder *order) {
+    order->enqueue_ns = now_ns();
+    while (lfq_push(&stage->queue, order) < 0) {
+        if (actor_self()) {
+            actor_yield();
+        } else {
+            sched_yield();
+        }
+    }
+    stage_wake(stage);
+}
+
+static void stage_account(Stage *stage, ShopOrder *order) {
+    trace_phase(order, stage->queue_span, NULL, 0);
+    unsigned long long wait = now_ns() - order->enqueue_ns;
+    __atomic_add_fetch(&stage->handoffs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stage->total_wait_ns, wait, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&stage->max_wait_ns, __ATOMIC_RELAXED);
+    while (wait > max && !__atomic_compare_exchange_n(&stage->max_wait_ns, &max, wait, 1,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static int stage_has_orders(void *arg) {
+    return lfq_size(&((Stage *)arg)->queue) > 0;
+}
+
+/*
+ * Take the next order of a stage.
+ * Side effects:
+ * - Spins up to STAGE_SPIN_LIMIT times, then parks the calling thread until an order arrives.
+ * - An actor never spins: it parks on the stage and its worker runs other actors.
+ */
+ShopOrder *stage_pop(Stage *stage) {
+    ShopOrder *order;
+    if (actor_self()) {
+        while ((order = lfq_pop(&stage->queue)) == NULL) {
+            actor_park(&stage->actors, stage_has_orders, stage);
+        }
+        stage_account(stage, order);
+        return order;
+    }
+
+    for (int spin = 0; spin < STAGE_SPIN_LIMIT; spin++) {
+        if ((order = lfq_pop(&stage->queue)) != NULL) {
+            stage_account(stage, order);
+            return order;
+        }
+        cpu_relax();
+    }
+
+    PROFILED_LOCK(&stage->mutex, &stage->lock_profile);
+    __atomic_add_fetch(&stage->waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while ((order = lfq_pop(&stage->queue)) == NULL) {
+        PROFILED_COND_WAIT(&stage->cond, &stage->mutex, &stage->lock_profile);
+    }
+    __atomic_sub_fetch(&stage->waiters, 1, __ATOMIC_RELAXED);
+    PROFILED_UNLOCK(&stage->mutex, &stage->lock_profile);
+
+    stage_account(stage, order);
+    return order;
+}
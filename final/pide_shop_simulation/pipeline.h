@@ -0,0 +1,106 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "protocol.h"
+#include "lfqueue.h"
+#include "timerwheel.h"
+#include "actor.h"
+#include "lockprof.h"
+#include <pthread.h>
+
+/*
+ * Staged pipeline of the shop: server -> cooks -> manager -> couriers, and back to
+ * the manager, who logs the orders the timer thread finished baking or delivering.
+ * Each stage owns a bounded lock-free queue of order handles. Producers never take
+ * a lock; consumers spin for a short while and only park on the stage's condition
+ * variable when the queue stays empty. Consumers running as actors park on the
+ * stage's actor wait queue instead, freeing their worker thread.
+ */
+
+// Order handle passed between the stages
+typedef struct {
+    Order order;                   // Order as received from the client
+    int pide_type;                 // Index in the menu, from the order details
+    int cook_id;                   // Cook that prepared it
+    int oven_id;                   // Oven it was placed in
+    int courier_id;                // Courier carrying it
+    Timer timer;                   // Pending oven or delivery timer
+    unsigned long generation;      // Cancellation generation the order belongs to
+    int handoff;                   // ORDER_CANCEL_REQUESTED by order_cancel(), or ORDER_OUT_WITH_COURIER
+    unsigned long long created_ns; // When the server accepted it
+    unsigned long long enqueue_ns; // When it entered the queue of its current stage
+    unsigned long long dispatched_ns; // When a courier left with it
+    long long eta_ns;              // Predicted time from acceptance to delivery
+    int traced;                    // Sampled for span tracing
+    unsigned long long phase_ns;   // Start of the current traced phase
+} ShopOrder;
+
+typedef struct {
+    const char *name;
+    const char *queue_span;        // Traced phase of an order waiting in the queue
+    LFQueue queue;
+    int waiters;                   // Consumers parked on 'cond'
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    LockProfile lock_profile;
+    ActorWaitQueue actors;         // Consumer actors parked on the stage
+    // Handoff statistics, updated by the consumers
+    unsigned long handoffs;
+    unsigned long long total_wait_ns;
+    unsigned long long max_wait_ns;
+} Stage;
+
+extern Stage cook_stage;
+extern Stage manager_stage;
+extern Stage courier_stage;
+
+// Marker pushed on a stage to wake one consumer and ask it to retire
+extern ShopOrder stage_retire_token;
+
+// Handoff of an order: whichever of the cancellation and the courier claims it first wins
+#define ORDER_CANCEL_REQUESTED 1
+#define ORDER_OUT_WITH_COURIER 2
+
+// Results of order_cancel()
+#define CANCEL_UNKNOWN -1              // Never accepted, or too old for the order table
+#define CANCEL_FINISHED 0              // Already delivered, failed or cancelled
+#define CANCEL_OK 1                    // Dropped by the next stage it reaches
+#define CANCEL_TOO_LATE 2              // Already out for delivery, so still delivered
+
+// Orders whose status can still be looked up by id: the most recent ones
+#define ORDER_TABLE_SIZE 65536
+
+// Default capacity of every stage queue
+#define STAGE_QUEUE_CAPACITY 1024
+
+// Consumer spins before parking
+#define STAGE_SPIN_LIMIT 2000
+
+void pipeline_init(size_t queue_capacity);
+void pipeline_report(void);
+
+// Order handles
+ShopOrder *order_create(float x, float y, const char *details);
+void order_destroy(ShopOrder *order);
+int order_is_cancelled(const ShopOrder *order);
+
+// A courier takes the order: 0 if it was cancelled, which it no longer can be after 1
+int order_dispatch(ShopOrder *order);
+void order_cancel_all(void);
+
+// Cancel one order by id; one of the CANCEL_* results
+int order_cancel(int order_id);
+
+// Protocol status of an order by id, 0 if unknown
+int order_status(int order_id);
+
+// Hand an order to a stage without blocking; -1 if the queue is full
+int stage_push(Stage *stage, ShopOrder *order);
+
+// Hand an order to a stage, waiting for room if the queue is full. Worker threads and actors only
+void stage_push_wait(Stage *stage, ShopOrder *order);
+
+// Take the next order of a stage, spinning then parking while the queue is empty
+ShopOrder *stage_pop(Stage *stage);
+
+#endif // PIPELINE_H
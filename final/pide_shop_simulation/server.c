@@ -1,6 +1,15 @@
 #include "common.h"  // Common definitions and declarations shared across multiple files
 #include "protocol.h" // Protocol definitions for message types, order statuses, and error codes
 #include "utils.h"    // Utility functions for logging and error handling
+#include "net.h"      // Network I/O backends (threads, epoll, io_uring)
+#include "oven.h"     // Oven scheduling policies
+#include "menu.h"     // Pide types and their oven footprint
+#include "timerwheel.h" // Timer wheel driving the oven and delivery timers
+#include "actor.h"    // Actor runtime for the cooks and couriers
+#include "eta.h"      // Delivery time prediction
+#include "control.h"  // Admin control socket and pool autoscaling
+#include "lockprof.h" // Lock contention profiling (make LOCK_PROFILE=1)
+#include "trace.h"    // Per-order span tracing
 #include <stdio.h>    // Standard I/O operations
 #include <stdlib.h>   // Standard library functions such as memory allocation
 #include <string.h>   // String handling functions
@@ -10,7 +19,7 @@
 #include <pthread.h>    // POSIX threads for multithreading
 #include <signal.h>     // Signal handling functions
 #include <arpa/inet.h>  // Definitions for internet operations
-#include <math.h>       // Mathematical functions
+#include <getopt.h>     // Parsing of the optional command line flags
 
 /*
  * Side effects:
@@ -23,10 +32,10 @@
  */
 
 // Function to start the server and handle client connections
-void start_server(const char *ip_address, int port);
+void start_server(const char *ip_address, int port, int backend);
 
-// Signal handler to gracefully shut down the server
-void signal_handler(int sig);
+// Waits for SIGINT or SIGTERM to gracefully shut down the server
+void *shutdown_thread(void *arg);
 
 // Function to write final log entries before shutting down
 void write_log_file();
@@ -34,24 +43,44 @@ void write_log_file();
 // Function to cancel all ongoing orders
 void cancel_all_orders();
 
-// Function to calculate delivery time based on distance and velocity
-float calculate_delivery_time(float x, float y, float velocity);
-
 // External function declarations to start various components
-extern void start_cooks(int num_cooks);
-extern void start_delivery_system(int num_deliveries, int delivery_speed, int width, int height);
-extern void start_manager();
+extern void start_cooks(int num_cooks, const OvenPoolConfig *oven_config, int model);
+extern void start_delivery_system(int num_deliveries, int num_dispatchers, int model, int delivery_speed, int width, int height);
+extern void start_manager(int num_managers);
 extern void cancel_order();
 
 // Function prototypes for internal use
-void *client_handler(void *socket);  // Handle individual client connections
-void signal_cooks();                 // Signal cooks to start preparing orders
-void signal_delivery_personnel();    // Signal delivery personnel for delivery
-void notify_manager();               // Notify manager about order status
-void manager_receive_order();        // Manager receives and processes orders
+void *client_handler(void *socket);             // Handle individual client connections
+void manager_receive_order(ShopOrder *order);   // Manager receives and processes orders
+
+// Counters shared by the network backends
+unsigned long net_syscalls = 0;
+unsigned long net_orders = 0;
+static int active_backend = NET_BACKEND_THREADS;
+
+// Execution model of the cooks and couriers (-x)
+static int shop_model = SHOP_MODEL_THREADS;
 
+/*
+ * Map a backend name given on the command line to its identifier.
+ * No side effects. Returns -1 for an unknown name.
+ */
+int net_backend_from_name(const char *name) {
+    if (strcmp(name, "threads") == 0) return NET_BACKEND_THREADS;
+    if (strcmp(name, "epoll") == 0) return NET_BACKEND_EPOLL;
+    if (strcmp(name, "uring") == 0) return NET_BACKEND_URING;
+    return -1;
+}
 
-void start_server(const char *ip_address, int port) {
+const char *net_backend_name(int backend) {
+    switch (backend) {
+    case NET_BACKEND_EPOLL: return "epoll";
+    case NET_BACKEND_URING: return "uring";
+    default: return "threads";
+    }
+}
+
+void start_server(const char *ip_address, int port, int backend) {
     int socket_desc, client_sock, c;
     struct sockaddr_in server, client;
 
@@ -80,16 +109,33 @@ void start_server(const char *ip_address, int port) {
 
     // Step 8: Listening for connections
     printf("Server Step 8: Listening for connections...\n");
-    if (listen(socket_desc, 3) < 0) {
+    if (listen(socket_desc, SOMAXCONN) < 0) {
         perror("listen failed. Error");
         return;
     }
 
+    // Event loop backends take over the listening socket
+    if (backend == NET_BACKEND_URING) {
+        active_backend = NET_BACKEND_URING;
+        if (net_run_uring(socket_desc) == 0) {
+            return;
+        }
+        log_message("io_uring unavailable, falling back to epoll");
+        backend = NET_BACKEND_EPOLL;
+    }
+    if (backend == NET_BACKEND_EPOLL) {
+        active_backend = NET_BACKEND_EPOLL;
+        net_run_epoll(socket_desc);
+        return;
+    }
+    active_backend = NET_BACKEND_THREADS;
+
     log_message("Waiting for incoming connections...");
     c = sizeof(struct sockaddr_in);
     
     // Continuously accept incoming connections
     while ((client_sock = accept(socket_desc, (struct sockaddr *)&client, (socklen_t *)&c))) {
+        NET_COUNT_SYSCALLS(1);
         if (client_sock < 0) {
             perror("accept failed");
             continue;
@@ -128,32 +174,20 @@ void *client_handler(void *socket) {
     int sock = *((int *)socket);
     free(socket);
 
-    char buffer[1024];
+    char buffer[NET_BUFFER_SIZE];
+    char reply[NET_BUFFER_SIZE];
     int read_size;
 
     log_message("New client connected");
 
     // Receive messages from the client
-    while ((read_size = recv(sock, buffer, sizeof(buffer) - 1, 0)) > 0) {
+    while (NET_COUNT_SYSCALLS(1), (read_size = recv(sock, buffer, sizeof(buffer) - 1, 0)) > 0) {
         buffer[read_size] = '\0'; // Null-terminate the received string
-        float posX, posY;
-        sscanf(buffer, "Order from client %*d at position (%f, %f)", &posX, &posY);
-
-        if (strncmp(buffer, "Order cancelled", 15) == 0) {
-            cancel_order();
-            log_message("Order cancelled by client");
-            continue;
+        size_t reply_len = server_handle_message(buffer, read_size, reply, sizeof(reply));
+        if (reply_len > 0) {
+            NET_COUNT_SYSCALLS(1);
+            send(sock, reply, reply_len, 0);
         }
-
-        float delivery_time = calculate_delivery_time(posX, posY, 0.5);
-
-        log_message("Received order from client");
-        snprintf(buffer, sizeof(buffer), "Order processed by server. Estimated delivery time: %.2f minutes", delivery_time);
-        send(sock, buffer, strlen(buffer), 0);
-        log_message("Order processed and response sent to client");
-
-        manager_receive_order();
-        signal_cooks();
     }
 
     if (read_size == 0) {
@@ -166,22 +200,89 @@ void *client_handler(void *socket) {
     return NULL;
 }
 
-/* 
- * Function to calculate the delivery time based on coordinates and velocity.
- * No side effects.
+/*
+ * Handle one message received from a client, whatever backend received it.
+ * Side effects:
+ * - Hands new orders to the manager and the cooks.
+ * - Cancels all orders, or a single one by id, when the client asks for it.
+ * - Logs various messages.
  */
-float calculate_delivery_time(float x, float y, float velocity) {
-    float distance = sqrt(x * x + y * y);
-    return distance / velocity;
+size_t server_handle_message(char *buffer, int length, char *reply, size_t reply_size) {
+    if (strncmp(buffer, "Order cancelled", 15) == 0) {
+        cancel_order();
+        log_message("Order cancelled by client");
+        return 0;
+    }
+
+    int order_id;
+    if (sscanf(buffer, "Cancel order %d", &order_id) == 1) {
+        int result = order_cancel(order_id);
+        return snprintf(reply, reply_size, "Cancel order %d %s", order_id,
+                        result == CANCEL_OK ? "ok" : result == CANCEL_TOO_LATE ? "too-late" :
+                        result == CANCEL_FINISHED ? "finished" : "unknown");
+    }
+
+    // "Status id id ...": one "id=status" per order, 0 for an unknown id
+    if (strncmp(buffer, "Status ", 7) == 0) {
+        size_t len = snprintf(reply, reply_size, "Status");
+        char *p = buffer + 7;
+        char *end;
+        long id;
+        while ((id = strtol(p, &end, 10)) > 0 && end != p && len + 24 < reply_size) {
+            len += snprintf(reply + len, reply_size - len, " %ld=%d", id, order_status((int)id));
+            p = end;
+        }
+        return len;
+    }
+
+    // Counters used by the load generator to compare the backends
+    if (strncmp(buffer, "Stats request", 13) == 0) {
+        return snprintf(reply, reply_size, "Stats backend=%s orders=%lu syscalls=%lu",
+                        net_backend_name(active_backend),
+                        __atomic_load_n(&net_orders, __ATOMIC_RELAXED),
+                        __atomic_load_n(&net_syscalls, __ATOMIC_RELAXED));
+    }
+
+    float posX = 0, posY = 0;
+    char pide[32] = "";
+    sscanf(buffer, "Order from client %*d at position (%f, %f) pide %31s", &posX, &posY, pide);
+
+    log_message("Received order from client");
+    ShopOrder *order = order_create(posX, posY, pide);
+    if (!order) {
+        return snprintf(reply, reply_size, "Order rejected by server");
+    }
+    float delivery_time = eta_predict(order) / 60e9; // Minutes
+    int reply_len = snprintf(reply, reply_size, "Order processed by server. Estimated delivery time: %.2f minutes (order %d)",
+                             delivery_time, order->order.order_id);
+
+    manager_receive_order(order);
+    trace_phase(order, "accepted", NULL, 0);
+    // The order belongs to the cooks once pushed; a full queue rejects it rather than stall the event loop
+    if (signal_cooks(order) < 0) {
+        log_message("Cook queue full, order rejected");
+        order_destroy(order);
+        return snprintf(reply, reply_size, "Order rejected by server");
+    }
+    __atomic_add_fetch(&net_orders, 1, __ATOMIC_RELAXED);
+    return reply_len;
 }
 
 /* 
- * Signal handler for orderly shutdown of the server.
+ * Thread for orderly shutdown of the server.
+ * The signals are blocked in every thread and taken here with sigwait, so the
+ * reports run as ordinary code: a signal handler interrupting a thread that holds
+ * a report's mutex would deadlock on it.
  * Side effects:
  * - Logs various messages.
  * - Calls exit() to terminate the program.
  */
-void signal_handler(int sig) {
+void *shutdown_thread(void *arg) {
+    sigset_t *signals = arg;
+    int sig;
+    if (sigwait(signals, &sig) != 0) {
+        return NULL;
+    }
     log_message("Signal received, shutting down...");
     cancel_all_orders();
     write_log_file();
@@ -196,6 +297,19 @@ void signal_handler(int sig) {
  */
 void write_log_file() {
     log_message("Writing final log entries...");
+    char message[256];
+    snprintf(message, sizeof(message), "Network backend %s: %lu orders, %lu I/O syscalls",
+             net_backend_name(active_backend), net_orders, net_syscalls);
+    log_message(message);
+    pipeline_report();
+    oven_report();
+    timer_service_report();
+    eta_report();
+    lockprof_report();
+    trace_write();
+    if (shop_model == SHOP_MODEL_ACTORS) {
+        actor_report();
+    }
 }
 
 /* 
@@ -209,39 +323,179 @@ void cancel_all_orders() {
     cancel_order();
 }
 
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b threads|epoll|uring] [-m ManagerThreads] [-D DispatcherThreads] [-q StageQueueCapacity] [-o fcfs|pack]\n"
+                    "          [-x threads|actors] [-w ActorWorkers] [-S ControlSocket] [-C minCooks:maxCooks]\n"
+                    "          [-K minCouriers:maxCouriers] [-t TraceOneInN] [-T TraceFile]\n"
+                    "          [-n Ovens] [-k OvenCapacity] [-p OvenOpenings] [-l least|wait] [-a]\n"
+                    "          [IP address] [CookThreadPoolSize] [DeliveryPoolSize] [Speed (m/min)]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr, "Usage: %s [IP address] [CookThreadPoolSize] [DeliveryPoolSize] [Speed (m/min)]\n", argv[0]);
-        exit(EXIT_FAILURE);
+    int backend = NET_BACKEND_THREADS;
+    int manager_thread_pool_size = 1;
+    int dispatcher_thread_pool_size = 1;
+    int actor_workers = 2;
+    const char *control_path = CONTROL_SOCKET_PATH;
+    unsigned long trace_every = 0;
+    const char *trace_path = TRACE_DEFAULT_PATH;
+    AutoscaleConfig autoscale = {0, {0, 0}, {0, 0}};
+    int stage_queue_capacity = STAGE_QUEUE_CAPACITY;
+    OvenPoolConfig oven_config = {0, MAX_OVEN_CAPACITY, OVEN_OPENINGS, OVEN_POLICY_FCFS, OVEN_PLACE_LEAST, 0};
+    int opt;
+    while ((opt = getopt(argc, argv, "b:m:D:x:w:S:C:K:q:o:n:k:p:l:at:T:")) != -1) {
+        switch (opt) {
+        case 'b':
+            backend = net_backend_from_name(optarg);
+            if (backend < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'm':
+            manager_thread_pool_size = atoi(optarg);
+            if (manager_thread_pool_size <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'D':
+            dispatcher_thread_pool_size = atoi(optarg);
+            if (dispatcher_thread_pool_size <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'x':
+            if (strcmp(optarg, "threads") == 0) {
+                shop_model = SHOP_MODEL_THREADS;
+            } else if (strcmp(optarg, "actors") == 0) {
+                shop_model = SHOP_MODEL_ACTORS;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            actor_workers = atoi(optarg);
+            if (actor_workers <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'S':
+            control_path = optarg;
+            break;
+        case 'C':
+            if (autoscale_parse_bounds(optarg, &autoscale.cooks) < 0) {
+                usage(argv[0]);
+            }
+            autoscale.enabled = 1;
+            break;
+        case 'K':
+            if (autoscale_parse_bounds(optarg, &autoscale.couriers) < 0) {
+                usage(argv[0]);
+            }
+            autoscale.enabled = 1;
+            break;
+        case 'o':
+            oven_config.policy = oven_policy_from_name(optarg);
+            if (oven_config.policy < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'n':
+            oven_config.ovens = atoi(optarg);
+            if (oven_config.ovens <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            oven_config.capacity = atoi(optarg);
+            if (oven_config.capacity < menu_max_footprint()) {
+                usage(argv[0]);
+            }
+            break;
+        case 'p':
+            oven_config.openings = atoi(optarg);
+            if (oven_config.openings <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'l':
+            oven_config.placement = oven_placement_from_name(optarg);
+            if (oven_config.placement < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'a':
+            oven_config.affinity = 1;
+            break;
+        case 'q':
+            stage_queue_capacity = atoi(optarg);
+            if (stage_queue_capacity <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 't':
+            trace_every = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            trace_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 4) {
+        usage(argv[0]);
     }
 
     printf("Server Step 1: Parsing arguments...\n");
-    const char *ip_address = argv[1];
-    int cook_thread_pool_size = atoi(argv[2]);
-    int delivery_thread_pool_size = atoi(argv[3]);
-    float delivery_speed = atof(argv[4]);
+    const char *ip_address = argv[optind];
+    int cook_thread_pool_size = atoi(argv[optind + 1]);
+    int delivery_thread_pool_size = atoi(argv[optind + 2]);
+    float delivery_speed = atof(argv[optind + 3]);
     int port = 8000; // Use port 8000
 
     printf("Server Step 2: Setting up signal handlers...\n");
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    static sigset_t shutdown_signals;
+    sigemptyset(&shutdown_signals);
+    sigaddset(&shutdown_signals, SIGINT);
+    sigaddset(&shutdown_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL); // Inherited by every thread created below
+    lockprof_start(); // Blocks SIGUSR1 before its report thread and the shutdown thread exist
+    pthread_t shutdown;
+    if (pthread_create(&shutdown, NULL, shutdown_thread, &shutdown_signals) != 0) {
+        handle_error("Failed to create shutdown thread");
+    }
+    pthread_detach(shutdown);
     signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE signal to prevent crashes on broken pipe
 
     printf("Server Step 3: Starting thread pools...\n");
+    pipeline_init(stage_queue_capacity);
+    trace_init(trace_every, trace_path);
+    timer_service_start();
+    eta_init(cook_thread_pool_size, delivery_thread_pool_size, delivery_speed);
+    if (shop_model == SHOP_MODEL_ACTORS) {
+        // Room for the pools to grow at runtime
+        int max_cooks = autoscale.cooks.max > cook_thread_pool_size ? autoscale.cooks.max : cook_thread_pool_size;
+        int max_couriers = autoscale.couriers.max > delivery_thread_pool_size ? autoscale.couriers.max : delivery_thread_pool_size;
+        actor_runtime_start(actor_workers, 2 * (max_cooks + max_couriers) + 1024);
+    }
     printf("Starting cook threads...\n");
-    start_cooks(cook_thread_pool_size);
+    start_cooks(cook_thread_pool_size, &oven_config, shop_model);
     printf("Cook threads started...\n");
     
     printf("Starting delivery threads...\n");
-    start_delivery_system(delivery_thread_pool_size, delivery_speed, cook_thread_pool_size, delivery_thread_pool_size);
+    start_delivery_system(delivery_thread_pool_size, dispatcher_thread_pool_size, shop_model, delivery_speed, cook_thread_pool_size, delivery_thread_pool_size);
     printf("Delivery threads started...\n");
     
     printf("Starting manager...\n");
-    start_manager();
+    start_manager(manager_thread_pool_size);
     printf("Manager started...\n");
 
+    printf("Starting control socket...\n");
+    start_control(control_path, &autoscale);
+
     printf("Server Step 4: Starting server...\n");
-    start_server(ip_address, port);
+    start_server(ip_address, port, backend);
 
     return 0;
 }
@@ -0,0 +1,666 @@
+#include "sim.h"
+#include "menu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <limits.h>
+
+#define SEC_TO_NS(s) ((long long)((s) * 1e9))
+#define MS_TO_NS(ms) ((long long)(ms) * 1000000LL)
+
+// Event types
+#define SIM_ARRIVAL   0
+#define SIM_PREP_DONE 1
+#define SIM_LOAD_DONE 2
+#define SIM_BAKE_DONE 3
+#define SIM_DELIVERED 4
+
+void sim_default_config(SimConfig *config) {
+    config->cooks = 6;
+    config->couriers = 6;
+    config->ovens = 0;
+    config->oven_capacity = 6;  // MAX_OVEN_CAPACITY
+    config->oven_openings = 2;  // OVEN_OPENINGS
+    config->oven_policy = OVEN_POLICY_FCFS;
+    config->oven_placement = OVEN_PLACE_LEAST;
+    config->oven_affinity = 0;
+    config->arrival_rate = 1.0;
+    config->orders = 1000;
+    config->speed = 1000;
+    config->town_width = 6;
+    config->town_height = 8;
+    config->seed = 1;
+}
+
+// xorshift64*: uniform in [0, 1)
+static double sim_random(Sim *sim) {
+    unsigned long long x = sim->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    sim->rng = x;
+    return ((x * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double sim_exponential(Sim *sim, double mean) {
+    return -mean * log(1.0 - sim_random(sim));
+}
+
+// Event queue: binary min-heap ordered by time
+static int sim_schedule(Sim *sim, long long time_ns, int type, int order) {
+    if (sim->num_events == sim->events_size) {
+        int size = sim->events_size ? sim->events_size * 2 : 256;
+        SimEvent *grown = realloc(sim->events, size * sizeof(SimEvent));
+        if (!grown) {
+            return -1;
+        }
+        sim->events = grown;
+        sim->events_size = size;
+    }
+    int i = sim->num_events++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (sim->events[parent].time_ns <= time_ns) {
+            break;
+        }
+        sim->events[i] = sim->events[parent];
+        i = parent;
+    }
+    sim->events[i].time_ns = time_ns;
+    sim->events[i].type = type;
+    sim->events[i].order = order;
+    return 0;
+}
+
+static SimEvent sim_next_event(Sim *sim) {
+    SimEvent top = sim->events[0];
+    SimEvent last = sim->events[--sim->num_events];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= sim->num_events) {
+            break;
+        }
+        if (child + 1 < sim->num_events && sim->events[child + 1].time_ns < sim->events[child].time_ns) {
+            child++;
+        }
+        if (last.time_ns <= sim->events[child].time_ns) {
+            break;
+        }
+        sim->events[i] = sim->events[child];
+        i = child;
+    }
+    if (sim->num_events > 0) {
+        sim->events[i] = last;
+    }
+    return top;
+}
+
+int sim_init(Sim *sim, const SimConfig *config) {
+    memset(sim, 0, sizeof(*sim));
+    sim->config = *config;
+    sim->rng = config->seed ? config->seed : 0x9E3779B97F4A7C15ULL;
+    sim->orders = calloc(config->orders, sizeof(SimOrder));
+    sim->cook_queue = malloc(config->orders * sizeof(int));
+    sim->courier_queue = malloc(config->orders * sizeof(int));
+    sim->idle_cook_ids = malloc(config->cooks * sizeof(int));
+    sim->free_cook_ids = malloc(config->cooks * sizeof(int));
+    sim->idle_cooks = config->cooks;
+    sim->idle_couriers = config->couriers;
+    sim->num_ovens = config->ovens > 0 ? config->ovens : oven_pool_default_size(config->cooks);
+    sim->ovens = calloc(sim->num_ovens, sizeof(OvenState));
+    if (!sim->orders || !sim->cook_queue || !sim->courier_queue || !sim->idle_cook_ids || !sim->free_cook_ids ||
+        !sim->ovens) {
+        sim_destroy(sim);
+        return -1;
+    }
+    for (int i = 0; i < config->cooks; i++) {
+        sim->idle_cook_ids[i] = config->cooks - 1 - i;
+    }
+    for (int i = 0; i < sim->num_ovens; i++) {
+        if (oven_state_init(&sim->ovens[i], config->oven_capacity, config->oven_openings, config->oven_policy, 0) < 0) {
+            sim_destroy(sim);
+            return -1;
+        }
+    }
+    if (config->orders > 0) {
+        sim_schedule(sim, 0, SIM_ARRIVAL, 0);
+    }
+    return 0;
+}
+
+void sim_destroy(Sim *sim) {
+    if (sim->snapshot) {
+        munmap(sim->snapshot, sim->snapshot_size);
+    } else {
+        free(sim->orders);
+        free(sim->cook_queue);
+        free(sim->courier_queue);
+    }
+    free(sim->events);
+    free(sim->idle_cook_ids);
+    free(sim->free_cook_ids);
+    for (int i = 0; sim->ovens && i < sim->num_ovens; i++) {
+        oven_state_destroy(&sim->ovens[i]);
+    }
+    free(sim->ovens);
+    memset(sim, 0, sizeof(*sim));
+}
+
+static void sim_dispatch_cooks(Sim *sim) {
+    while (sim->idle_cooks > 0 && sim->cook_head != sim->cook_tail) {
+        int order = sim->cook_queue[sim->cook_head++];
+        sim->orders[order].cook = sim->idle_cook_ids[--sim->idle_cooks];
+        sim_schedule(sim, sim->now_ns + MS_TO_NS(SIM_PREP_MS), SIM_PREP_DONE, order);
+    }
+}
+
+static void sim_dispatch_oven(Sim *sim, OvenState *oven) {
+    OvenJob job;
+    while (oven_state_admit(oven, sim->now_ns, &job)) {
+        sim_schedule(sim, sim->now_ns + MS_TO_NS(OVEN_LOAD_MS), SIM_LOAD_DONE, (int)(long)job.ref);
+    }
+}
+
+static void sim_dispatch_couriers(Sim *sim) {
+    while (sim->idle_couriers > 0 && sim->courier_head != sim->courier_tail) {
+        int order = sim->courier_queue[sim->courier_head++];
+        SimOrder *o = &sim->orders[order];
+        sim->idle_couriers--;
+        // Same travel time as delivery_time_ms(): distance over speed per second
+        double velocity = sim->config.speed / 60.0;
+        double seconds = sqrt(o->x * o->x + o->y * o->y) / velocity;
+        sim_schedule(sim, sim->now_ns + SEC_TO_NS(seconds), SIM_DELIVERED, order);
+    }
+}
+
+// Same placement as choose_oven() in cook.c
+static int sim_place(Sim *sim, int cook) {
+    if (sim->num_ovens == 1) {
+        return 0;
+    }
+    OvenLoad loads[sim->num_ovens];
+    for (int i = 0; i < sim->num_ovens; i++) {
+        oven_state_load(&sim->ovens[i], sim->now_ns, &loads[i]);
+    }
+    int preferred = sim->config.oven_affinity ? cook % sim->num_ovens : -1;
+    return oven_place(loads, sim->num_ovens, sim->config.oven_placement, preferred);
+}
+
+static OvenJob sim_oven_job(Sim *sim, int order) {
+    const PideType *pide = &menu[sim->orders[order].type];
+    OvenJob job = {(void *)(long)order, sim->orders[order].type, pide->footprint,
+                   MS_TO_NS(pide->bake_ms), sim->now_ns};
+    return job;
+}
+
+static void sim_handle(Sim *sim, const SimEvent *ev) {
+    SimOrder *o = &sim->orders[ev->order];
+    OvenJob job;
+
+    switch (ev->type) {
+    case SIM_ARRIVAL:
+        o->type = menu_pick(sim_random(sim));
+        o->x = (float)(int)(sim_random(sim) * (sim->config.town_width + 1));
+        o->y = (float)(int)(sim_random(sim) * (sim->config.town_height + 1));
+        o->created_ns = sim->now_ns;
+        sim->arrived++;
+        sim->cook_queue[sim->cook_tail++] = ev->order;
+        sim_dispatch_cooks(sim);
+        if (sim->arrived < sim->config.orders) {
+            long long gap = SEC_TO_NS(sim_exponential(sim, 1.0 / sim->config.arrival_rate));
+            sim_schedule(sim, sim->now_ns + gap, SIM_ARRIVAL, sim->arrived);
+        }
+        break;
+    case SIM_PREP_DONE:
+        o->oven = sim_place(sim, o->cook);
+        job = sim_oven_job(sim, ev->order);
+        oven_state_add(&sim->ovens[o->oven], &job);
+        sim_dispatch_oven(sim, &sim->ovens[o->oven]);
+        // The cook hands the pide to the oven timers and takes the next order, or leaves
+        if (sim->cook_retire > 0) {
+            sim->cook_retire--;
+            sim->free_cook_ids[sim->free_cooks++] = o->cook;
+        } else {
+            sim->idle_cook_ids[sim->idle_cooks++] = o->cook;
+        }
+        sim_dispatch_cooks(sim);
+        break;
+    case SIM_LOAD_DONE:
+        oven_state_loaded(&sim->ovens[o->oven], sim->now_ns);
+        sim_schedule(sim, sim->now_ns + MS_TO_NS(menu[o->type].bake_ms), SIM_BAKE_DONE, ev->order);
+        sim_dispatch_oven(sim, &sim->ovens[o->oven]);
+        break;
+    case SIM_BAKE_DONE:
+        job = sim_oven_job(sim, ev->order);
+        oven_state_done(&sim->ovens[o->oven], &job, sim->now_ns);
+        sim_dispatch_oven(sim, &sim->ovens[o->oven]);
+        // The manager relays it to the couriers
+        sim->courier_queue[sim->courier_tail++] = ev->order;
+        sim_dispatch_couriers(sim);
+        break;
+    case SIM_DELIVERED:
+        o->delivered_ns = sim->now_ns;
+        sim->delivered++;
+        sim->idle_couriers++;
+        sim_dispatch_couriers(sim);
+        break;
+    }
+}
+
+void sim_run_until(Sim *sim, long long until_ns) {
+    while (sim->num_events > 0 && sim->events[0].time_ns <= until_ns) {
+        SimEvent ev = sim_next_event(sim);
+        long long dt = ev.time_ns - sim->now_ns;
+        int couriers_out = sim->idle_couriers < 0 ? -sim->idle_couriers : 0; // Removed, still on their trip
+        sim->cook_busy_ns += (long long)(sim->config.cooks + sim->cook_retire - sim->idle_cooks) * dt;
+        sim->courier_busy_ns += (long long)(sim->config.couriers - sim->idle_couriers) * dt;
+        sim->cook_staffed_ns += (long long)(sim->config.cooks + sim->cook_retire) * dt;
+        sim->courier_staffed_ns += (long long)(sim->config.couriers + couriers_out) * dt;
+        sim->now_ns = ev.time_ns;
+        sim_handle(sim, &ev);
+    }
+}
+
+void sim_run(Sim *sim) {
+    sim_run_until(sim, LLONG_MAX);
+}
+
+/*
+ * Change the staffing and the oven policy of a running simulation.
+ * Side effects:
+ * - New cooks and couriers start on the queued orders at the current time.
+ * - Removed cooks leave at once if idle, otherwise when they finish their pide;
+ *   removed couriers leave as they come back.
+ * Returns -1 with errno set if a pool is empty or memory runs out.
+ */
+int sim_reconfigure(Sim *sim, int cooks, int couriers, int oven_policy) {
+    if (cooks <= 0 || couriers <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cooks > sim->config.cooks) {
+        // Every id below 'hired' is on the staff, about to leave, or free
+        int grow = cooks - sim->config.cooks;
+        int hired = sim->config.cooks + sim->cook_retire + sim->free_cooks;
+        int *grown = realloc(sim->idle_cook_ids, (hired + grow) * sizeof(int));
+        if (!grown) {
+            return -1;
+        }
+        sim->idle_cook_ids = grown;
+        grown = realloc(sim->free_cook_ids, (hired + grow) * sizeof(int));
+        if (!grown) {
+            return -1;
+        }
+        sim->free_cook_ids = grown;
+        // Cooks about to leave stay instead, then the ones who left come back before new ones are hired
+        int stay = grow < sim->cook_retire ? grow : sim->cook_retire;
+        sim->cook_retire -= stay;
+        for (int i = stay; i < grow; i++) {
+            sim->idle_cook_ids[sim->idle_cooks++] = sim->free_cooks > 0 ? sim->free_cook_ids[--sim->free_cooks] : hired++;
+        }
+    } else {
+        int shrink = sim->config.cooks - cooks;
+        int idle = shrink < sim->idle_cooks ? shrink : sim->idle_cooks;
+        for (int i = 0; i < idle; i++) {
+            sim->free_cook_ids[sim->free_cooks++] = sim->idle_cook_ids[--sim->idle_cooks];
+        }
+        sim->cook_retire += shrink - idle;
+    }
+    sim->config.cooks = cooks;
+
+    sim->idle_couriers += couriers - sim->config.couriers;
+    sim->config.couriers = couriers;
+
+    sim->config.oven_policy = oven_policy;
+    for (int i = 0; i < sim->num_ovens; i++) {
+        sim->ovens[i].policy = oven_policy;
+        sim_dispatch_oven(sim, &sim->ovens[i]);
+    }
+    sim_dispatch_cooks(sim);
+    sim_dispatch_couriers(sim);
+    return 0;
+}
+
+/*
+ * Snapshot file: a header followed by the state arrays, each at an 8-byte
+ * aligned offset, in the layout of this build. The order table and the stage
+ * queues never grow, so a restore maps them in place; the event heap, the idle
+ * and free cook ids and the ovens, which do grow, are copied out of the mapping.
+ */
+#define SIM_SNAPSHOT_MAGIC "PIDESIM"
+#define SIM_SNAPSHOT_VERSION 3
+
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int order_size;   // Layout checks: a snapshot is only read by the same build
+    unsigned int oven_size;
+    unsigned int job_size;
+    unsigned long long file_size;
+
+    SimConfig config;
+    long long now_ns;
+    unsigned long long rng;
+    int arrived;
+    int delivered;
+    int num_events;
+    int cook_head, cook_tail;
+    int courier_head, courier_tail;
+    int idle_cooks;
+    int cook_retire;
+    int free_cooks;
+    int idle_couriers;
+    int num_ovens;
+    int num_jobs;              // Pides waiting in front of all the ovens
+    long long cook_busy_ns;
+    long long courier_busy_ns;
+    long long cook_staffed_ns;
+    long long courier_staffed_ns;
+
+    // Section offsets from the start of the file
+    unsigned long long orders_offset;
+    unsigned long long events_offset;
+    unsigned long long cook_queue_offset;
+    unsigned long long courier_queue_offset;
+    unsigned long long idle_cooks_offset;
+    unsigned long long free_cooks_offset;
+    unsigned long long ovens_offset;
+    unsigned long long jobs_offset;
+} SimSnapshotHeader;
+
+static unsigned long long snapshot_section(unsigned long long *end, size_t size) {
+    unsigned long long offset = (*end + 7) & ~7ULL;
+    *end = offset + size;
+    return offset;
+}
+
+static int snapshot_write(FILE *file, unsigned long long offset, const void *data, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    if (fseek(file, (long)offset, SEEK_SET) < 0 || fwrite(data, 1, size, file) != size) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Save the full state of the simulation to 'path'.
+ * Side effects:
+ * - Writes 'path'.tmp, syncs it and renames it over 'path', so a crash never
+ *   leaves a torn snapshot behind.
+ * Returns -1 with errno set on failure.
+ */
+int sim_checkpoint(const Sim *sim, const char *path) {
+    SimSnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SIM_SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SIM_SNAPSHOT_VERSION;
+    h.order_size = sizeof(SimOrder);
+    h.oven_size = sizeof(OvenState);
+    h.job_size = sizeof(OvenJob);
+    h.config = sim->config;
+    h.now_ns = sim->now_ns;
+    h.rng = sim->rng;
+    h.arrived = sim->arrived;
+    h.delivered = sim->delivered;
+    h.num_events = sim->num_events;
+    h.cook_head = sim->cook_head;
+    h.cook_tail = sim->cook_tail;
+    h.courier_head = sim->courier_head;
+    h.courier_tail = sim->courier_tail;
+    h.idle_cooks = sim->idle_cooks;
+    h.cook_retire = sim->cook_retire;
+    h.free_cooks = sim->free_cooks;
+    h.idle_couriers = sim->idle_couriers;
+    h.num_ovens = sim->num_ovens;
+    h.cook_busy_ns = sim->cook_busy_ns;
+    h.courier_busy_ns = sim->courier_busy_ns;
+    h.cook_staffed_ns = sim->cook_staffed_ns;
+    h.courier_staffed_ns = sim->courier_staffed_ns;
+    for (int i = 0; i < sim->num_ovens; i++) {
+        h.num_jobs += sim->ovens[i].num_waiting;
+    }
+
+    unsigned long long end = sizeof(h);
+    h.orders_offset = snapshot_section(&end, sim->config.orders * sizeof(SimOrder));
+    h.events_offset = snapshot_section(&end, sim->num_events * sizeof(SimEvent));
+    h.cook_queue_offset = snapshot_section(&end, sim->config.orders * sizeof(int));
+    h.courier_queue_offset = snapshot_section(&end, sim->config.orders * sizeof(int));
+    h.idle_cooks_offset = snapshot_section(&end, sim->config.cooks * sizeof(int));
+    h.free_cooks_offset = snapshot_section(&end, sim->free_cooks * sizeof(int));
+    h.ovens_offset = snapshot_section(&end, sim->num_ovens * sizeof(OvenState));
+    h.jobs_offset = snapshot_section(&end, h.num_jobs * sizeof(OvenJob));
+    h.file_size = end;
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        return -1;
+    }
+    int status = snapshot_write(file, 0, &h, sizeof(h));
+    status |= snapshot_write(file, h.orders_offset, sim->orders, sim->config.orders * sizeof(SimOrder));
+    status |= snapshot_write(file, h.events_offset, sim->events, sim->num_events * sizeof(SimEvent));
+    status |= snapshot_write(file, h.cook_queue_offset, sim->cook_queue, sim->config.orders * sizeof(int));
+    status |= snapshot_write(file, h.courier_queue_offset, sim->courier_queue, sim->config.orders * sizeof(int));
+    status |= snapshot_write(file, h.idle_cooks_offset, sim->idle_cook_ids, sim->config.cooks * sizeof(int));
+    status |= snapshot_write(file, h.free_cooks_offset, sim->free_cook_ids, sim->free_cooks * sizeof(int));
+    unsigned long long job_offset = h.jobs_offset;
+    for (int i = 0; status == 0 && i < sim->num_ovens; i++) {
+        OvenState oven = sim->ovens[i];
+        oven.waiting = NULL;
+        oven.waiting_size = oven.num_waiting;
+        status |= snapshot_write(file, h.ovens_offset + i * sizeof(OvenState), &oven, sizeof(oven));
+        status |= snapshot_write(file, job_offset, sim->ovens[i].waiting, oven.num_waiting * sizeof(OvenJob));
+        job_offset += oven.num_waiting * sizeof(OvenJob);
+    }
+    if (status == 0 && (fflush(file) != 0 || fsync(fileno(file)) < 0)) {
+        status = -1;
+    }
+    if (fclose(file) != 0) {
+        status = -1;
+    }
+    if (status < 0 || rename(tmp_path, path) < 0) {
+        int saved = errno;
+        unlink(tmp_path);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+static int snapshot_valid(const SimSnapshotHeader *h, size_t file_size) {
+    if (file_size < sizeof(*h) || memcmp(h->magic, SIM_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != SIM_SNAPSHOT_VERSION || h->order_size != sizeof(SimOrder) ||
+        h->oven_size != sizeof(OvenState) || h->job_size != sizeof(OvenJob) || h->file_size != file_size) {
+        return 0;
+    }
+    const SimConfig *c = &h->config;
+    if (c->orders <= 0 || c->cooks <= 0 || h->num_ovens <= 0 || h->num_events < 0 || h->num_jobs < 0 ||
+        h->idle_cooks < 0 || h->idle_cooks > c->cooks || h->cook_retire < 0 || h->free_cooks < 0) {
+        return 0;
+    }
+    struct {
+        unsigned long long offset;
+        unsigned long long size;
+    } sections[] = {
+        {h->orders_offset, (unsigned long long)c->orders * sizeof(SimOrder)},
+        {h->events_offset, (unsigned long long)h->num_events * sizeof(SimEvent)},
+        {h->cook_queue_offset, (unsigned long long)c->orders * sizeof(int)},
+        {h->courier_queue_offset, (unsigned long long)c->orders * sizeof(int)},
+        {h->idle_cooks_offset, (unsigned long long)c->cooks * sizeof(int)},
+        {h->free_cooks_offset, (unsigned long long)h->free_cooks * sizeof(int)},
+        {h->ovens_offset, (unsigned long long)h->num_ovens * sizeof(OvenState)},
+        {h->jobs_offset, (unsigned long long)h->num_jobs * sizeof(OvenJob)},
+    };
+    for (size_t i = 0; i < sizeof(sections) / sizeof(sections[0]); i++) {
+        if (sections[i].offset % 8 != 0 || sections[i].offset > file_size ||
+            sections[i].size > file_size - sections[i].offset) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Restore a simulation saved by sim_checkpoint().
+ * Side effects:
+ * - Maps the snapshot privately: the order table and the stage queues are used
+ *   in place and only the pages the run writes to are copied, so several
+ *   branches restored from the same snapshot share the rest.
+ * Returns -1 with errno set if the file cannot be read or is not a snapshot of this build.
+ */
+int sim_restore(Sim *sim, const char *path) {
+    memset(sim, 0, sizeof(*sim));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    char *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    const SimSnapshotHeader *h = (const SimSnapshotHeader *)base;
+    if (!snapshot_valid(h, st.st_size)) {
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    sim->snapshot = base;
+    sim->snapshot_size = st.st_size;
+    sim->config = h->config;
+    sim->config.ovens = h->num_ovens; // The pool is fixed from here on
+    sim->now_ns = h->now_ns;
+    sim->rng = h->rng;
+    sim->arrived = h->arrived;
+    sim->delivered = h->delivered;
+    sim->cook_head = h->cook_head;
+    sim->cook_tail = h->cook_tail;
+    sim->courier_head = h->courier_head;
+    sim->courier_tail = h->courier_tail;
+    sim->idle_cooks = h->idle_cooks;
+    sim->cook_retire = h->cook_retire;
+    sim->free_cooks = h->free_cooks;
+    sim->idle_couriers = h->idle_couriers;
+    sim->cook_busy_ns = h->cook_busy_ns;
+    sim->courier_busy_ns = h->courier_busy_ns;
+    sim->cook_staffed_ns = h->cook_staffed_ns;
+    sim->courier_staffed_ns = h->courier_staffed_ns;
+    sim->orders = (SimOrder *)(base + h->orders_offset);
+    sim->cook_queue = (int *)(base + h->cook_queue_offset);
+    sim->courier_queue = (int *)(base + h->courier_queue_offset);
+
+    sim->events_size = h->num_events > 256 ? h->num_events : 256;
+    sim->num_events = h->num_events;
+    sim->events = malloc(sim->events_size * sizeof(SimEvent));
+    int hired = sim->config.cooks + sim->cook_retire + sim->free_cooks;
+    sim->idle_cook_ids = malloc(hired * sizeof(int));
+    sim->free_cook_ids = malloc(hired * sizeof(int));
+    sim->ovens = calloc(h->num_ovens, sizeof(OvenState));
+    if (!sim->events || !sim->idle_cook_ids || !sim->free_cook_ids || !sim->ovens) {
+        sim_destroy(sim);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(sim->events, base + h->events_offset, h->num_events * sizeof(SimEvent));
+    memcpy(sim->idle_cook_ids, base + h->idle_cooks_offset, sim->config.cooks * sizeof(int));
+    memcpy(sim->free_cook_ids, base + h->free_cooks_offset, sim->free_cooks * sizeof(int));
+
+    const OvenState *ovens = (const OvenState *)(base + h->ovens_offset);
+    const OvenJob *jobs = (const OvenJob *)(base + h->jobs_offset);
+    int jobs_left = h->num_jobs;
+    for (int i = 0; i < h->num_ovens; i++) {
+        OvenState *oven = &sim->ovens[i];
+        *oven = ovens[i];
+        oven->waiting = NULL;
+        if (oven->num_waiting < 0 || oven->num_waiting > jobs_left) {
+            sim->num_ovens = i;
+            sim_destroy(sim);
+            errno = EINVAL;
+            return -1;
+        }
+        oven->waiting_size = oven->num_waiting > 16 ? oven->num_waiting : 16;
+        oven->waiting = malloc(oven->waiting_size * sizeof(OvenJob));
+        sim->num_ovens = i + 1;
+        if (!oven->waiting) {
+            sim_destroy(sim);
+            errno = ENOMEM;
+            return -1;
+        }
+        memcpy(oven->waiting, jobs, oven->num_waiting * sizeof(OvenJob));
+        jobs += oven->num_waiting;
+        jobs_left -= oven->num_waiting;
+    }
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void sim_result(Sim *sim, SimResult *r) {
+    memset(r, 0, sizeof(*r));
+    r->delivered = sim->delivered;
+    r->sim_seconds = sim->now_ns / 1e9;
+    if (sim->now_ns <= 0 || sim->delivered == 0) {
+        return;
+    }
+    r->throughput = sim->delivered / r->sim_seconds;
+
+    double *latency = malloc(sim->delivered * sizeof(double));
+    if (latency) {
+        int n = 0;
+        double total = 0;
+        for (int i = 0; i < sim->arrived; i++) {
+            if (sim->orders[i].delivered_ns > 0) {
+                latency[n] = (sim->orders[i].delivered_ns - sim->orders[i].created_ns) / 1e9;
+                total += latency[n++];
+            }
+        }
+        qsort(latency, n, sizeof(double), compare_double);
+        r->latency_mean_s = total / n;
+        r->latency_p50_s = latency[n / 2];
+        r->latency_p99_s = latency[(int)(0.99 * (n - 1))];
+        free(latency);
+    }
+
+    unsigned long baked = 0, loaded = 0;
+    long long wait_ns = 0;
+    for (int i = 0; i < sim->num_ovens; i++) {
+        r->oven_utilisation += oven_state_utilisation(&sim->ovens[i], sim->now_ns) / sim->num_ovens;
+        baked += sim->ovens[i].baked;
+        loaded += sim->ovens[i].loaded;
+        wait_ns += sim->ovens[i].total_wait_ns;
+    }
+    r->oven_throughput = baked / r->sim_seconds;
+    r->oven_wait_ms = loaded ? wait_ns / 1e6 / loaded : 0.0;
+    r->cook_utilisation = sim->cook_staffed_ns > 0 ? (double)sim->cook_busy_ns / sim->cook_staffed_ns : 0.0;
+    r->courier_utilisation = sim->courier_staffed_ns > 0 ? (double)sim->courier_busy_ns / sim->courier_staffed_ns : 0.0;
+}
+
+int sim_simulate(const SimConfig *config, SimResult *result) {
+    Sim sim;
+    if (sim_init(&sim, config) < 0) {
+        return -1;
+    }
+    sim_run(&sim);
+    sim_result(&sim, result);
+    sim_destroy(&sim);
+    return 0;
+}
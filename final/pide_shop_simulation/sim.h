@@ -0,0 +1,131 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "oven.h"
+#include <stddef.h>
+
+/*
+ * Discrete-event simulator of the pide shop.
+ * It models the same stages as the live server (cooks, oven, manager relay,
+ * couriers) in virtual time, with the same menu and oven scheduler, so that
+ * configurations can be compared quickly and reproducibly.
+ * All times are in nanoseconds of virtual time.
+ */
+
+#define SIM_PREP_MS 2000 // Preparation time of one pide, as compute_pseudo_inverse() in cook.c
+
+typedef struct {
+    int cooks;
+    int couriers;
+    int ovens;                 // 0 sizes the pool from the number of cooks
+    int oven_capacity;
+    int oven_openings;
+    int oven_policy;
+    int oven_placement;
+    int oven_affinity;
+    double arrival_rate;       // Orders per second (Poisson arrivals)
+    int orders;                // Orders to simulate
+    double speed;              // Courier speed in m/min, as given to the server
+    int town_width;
+    int town_height;
+    unsigned long long seed;
+} SimConfig;
+
+typedef struct {
+    int type;
+    int cook;
+    int oven;
+    float x, y;
+    long long created_ns;
+    long long delivered_ns;
+} SimOrder;
+
+typedef struct {
+    long long time_ns;
+    int type;
+    int order;
+} SimEvent;
+
+typedef struct {
+    SimConfig config;
+    long long now_ns;
+    unsigned long long rng;
+
+    SimOrder *orders;
+    int arrived;
+    int delivered;
+
+    // Event queue (binary min-heap on time)
+    SimEvent *events;
+    int num_events;
+    int events_size;
+
+    // FIFO queues in front of the cooks and couriers
+    int *cook_queue;
+    int cook_head, cook_tail;
+    int *courier_queue;
+    int courier_head, courier_tail;
+
+    int *idle_cook_ids;        // Stack of idle cooks
+    int idle_cooks;
+    int cook_retire;           // Busy cooks to drop as they finish, after the kitchen shrank
+    int *free_cook_ids;        // Ids of the cooks who left, hired again first
+    int free_cooks;
+    int idle_couriers;         // Negative while couriers still out exceed the pool
+    OvenState *ovens;
+    int num_ovens;
+
+    // Busy and staffed time integrals for utilisation, as the pools may be resized
+    long long cook_busy_ns;
+    long long courier_busy_ns;
+    long long cook_staffed_ns;
+    long long courier_staffed_ns;
+
+    // Mapping of the snapshot holding 'orders' and the stage queues after sim_restore()
+    void *snapshot;
+    size_t snapshot_size;
+} Sim;
+
+typedef struct {
+    int delivered;
+    double sim_seconds;
+    double throughput;          // Orders delivered per second
+    double latency_mean_s;      // Order accepted -> delivered
+    double latency_p50_s;
+    double latency_p99_s;
+    double oven_utilisation;
+    double oven_throughput;     // Pides baked per second
+    double oven_wait_ms;        // Average wait for an oven opening
+    double cook_utilisation;
+    double courier_utilisation;
+} SimResult;
+
+void sim_default_config(SimConfig *config);
+int sim_init(Sim *sim, const SimConfig *config);
+void sim_destroy(Sim *sim);
+
+// Run until every order is delivered
+void sim_run(Sim *sim);
+
+// Handle the events due up to 'until_ns' of virtual time
+void sim_run_until(Sim *sim, long long until_ns);
+void sim_result(Sim *sim, SimResult *result);
+
+// Convenience: init, run, collect the result and destroy. Returns -1 on allocation failure.
+int sim_simulate(const SimConfig *config, SimResult *result);
+
+/*
+ * Checkpoint and restore.
+ * A snapshot holds the whole state (order table, stage queues, event heap, ovens
+ * and their waiting pides, idle staff, RNG, virtual clock), so a restored run
+ * continues exactly as the original one would have. One warm-up can then be
+ * branched into many what-if runs, each restored from the same file.
+ * Both return -1 with errno set on failure.
+ */
+int sim_checkpoint(const Sim *sim, const char *path);
+int sim_restore(Sim *sim, const char *path);
+
+// Change the staffing and the oven policy of a restored run before resuming it
+int sim_reconfigure(Sim *sim, int cooks, int couriers, int oven_policy);
+
+#endif // SIM_H
@@ -0,0 +1,216 @@
+#include "sim.h"
+#include "model.h"
+#include "oven.h"
+#include "menu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <getopt.h>
+
+/*
+ * Command line front end of the shop simulator.
+ * Side effects:
+ * - Prints the results of the simulated run(s) to standard output.
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c cooks] [-d couriers] [-N ovens] [-k ovenCapacity] [-p ovenOpenings] [-o fcfs|pack]\n"
+            "          [-L least|wait] [-A]\n"
+            "          [-r ordersPerSecond] [-n orders] [-s speed (m/min)] [-w townWidth] [-t townHeight]\n"
+            "          [-S seed] [-C] [-T seconds -W snapshot] [-R snapshot] [-Q | -V]\n"
+            "  -C  compare the oven policies on the same workload\n"
+            "  -Q  print the analytic queueing model's prediction instead of simulating\n"
+            "  -V  validate the analytic model against the simulation\n"
+            "  -W  save the state after -T seconds of virtual time, then finish the run\n"
+            "  -R  resume from a snapshot; -c, -d and -o (or -C) change the branch, the\n"
+            "      rest of the configuration comes from the snapshot\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+static void print_result(const SimConfig *config, const SimResult *r) {
+    printf("policy=%s cooks=%d couriers=%d ovens=%d oven=%d/%d rate=%.2f/s: delivered=%d in %.1fs, "
+           "throughput=%.3f orders/s, latency mean=%.2fs p50=%.2fs p99=%.2fs, "
+           "oven util=%.1f%% baked=%.3f/s wait=%.0fms, cook util=%.1f%%, courier util=%.1f%%\n",
+           oven_policy_name(config->oven_policy), config->cooks, config->couriers,
+           config->ovens > 0 ? config->ovens : oven_pool_default_size(config->cooks),
+           config->oven_capacity, config->oven_openings, config->arrival_rate,
+           r->delivered, r->sim_seconds, r->throughput,
+           r->latency_mean_s, r->latency_p50_s, r->latency_p99_s,
+           100.0 * r->oven_utilisation, r->oven_throughput, r->oven_wait_ms,
+           100.0 * r->cook_utilisation, 100.0 * r->courier_utilisation);
+}
+
+static void print_model(const SimConfig *config, const ModelResult *m) {
+    printf("model cooks=%d couriers=%d oven=%d/%d rate=%.2f/s: %s, throughput=%.3f orders/s, "
+           "latency mean=%.0fus, bottleneck %s\n",
+           config->cooks, config->couriers, config->oven_capacity, config->oven_openings, config->arrival_rate,
+           m->stable ? "stable" : "overloaded", m->throughput, m->latency_mean_us,
+           model_station_name(m->bottleneck));
+    for (int i = 0; i < MODEL_STATIONS; i++) {
+        const ModelStation *s = &m->stations[i];
+        printf("  %-13s servers=%-4d service=%.0fus cs2=%.2f util=%.1f%% wait=%.0fus\n", model_station_name(i),
+               s->servers, s->service_us, s->scv, 100.0 * s->utilisation, s->wait_us);
+    }
+}
+
+static void print_check(const char *name, double model, double sim) {
+    printf("  %-20s model %12.3f  sim %12.3f  error %+6.1f%%\n", name, model, sim,
+           sim != 0 ? 100.0 * (model - sim) / sim : 0.0);
+}
+
+// Model and simulation side by side on the same configuration
+static void print_validation(const ModelResult *m, const SimResult *r) {
+    print_check("throughput (1/s)", m->throughput, r->throughput);
+    print_check("cook util", m->stations[MODEL_COOKS].utilisation, r->cook_utilisation);
+    print_check("oven util", m->oven_utilisation, r->oven_utilisation);
+    print_check("courier util", m->stations[MODEL_COURIERS].utilisation, r->courier_utilisation);
+    print_check("oven wait (us)", m->oven_wait_us, r->oven_wait_ms * 1e3);
+    print_check("latency mean (us)", m->latency_mean_us, r->latency_mean_s * 1e6);
+}
+
+/*
+ * Run one branch from a snapshot with the staffing and policy given on the
+ * command line (0 or -1 keep those of the snapshot).
+ */
+static int resume_branch(const char *path, int cooks, int couriers, int policy) {
+    Sim sim;
+    if (sim_restore(&sim, path) < 0) {
+        perror("Failed to restore the snapshot");
+        return -1;
+    }
+    double resumed_at = sim.now_ns / 1e9;
+    if (sim_reconfigure(&sim, cooks > 0 ? cooks : sim.config.cooks, couriers > 0 ? couriers : sim.config.couriers,
+                        policy >= 0 ? policy : sim.config.oven_policy) < 0) {
+        perror("Failed to reconfigure the restored run");
+        sim_destroy(&sim);
+        return -1;
+    }
+    sim_run(&sim);
+    SimResult result;
+    sim_result(&sim, &result);
+    printf("resumed at %.1fs: ", resumed_at);
+    print_result(&sim.config, &result);
+    sim_destroy(&sim);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    SimConfig config;
+    sim_default_config(&config);
+    int compare = 0;
+    int model = 0, validate = 0;
+    double checkpoint_s = -1;
+    const char *checkpoint_path = NULL;
+    const char *resume_path = NULL;
+    int cooks_given = 0, couriers_given = 0, policy_given = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:N:k:p:o:L:Ar:n:s:w:t:S:CT:W:R:QV")) != -1) {
+        switch (opt) {
+        case 'c': config.cooks = cooks_given = atoi(optarg); break;
+        case 'd': config.couriers = couriers_given = atoi(optarg); break;
+        case 'N': config.ovens = atoi(optarg); break;
+        case 'k': config.oven_capacity = atoi(optarg); break;
+        case 'p': config.oven_openings = atoi(optarg); break;
+        case 'o':
+            config.oven_policy = oven_policy_from_name(optarg);
+            if (config.oven_policy < 0) {
+                usage(argv[0]);
+            }
+            policy_given = config.oven_policy;
+            break;
+        case 'L':
+            config.oven_placement = oven_placement_from_name(optarg);
+            if (config.oven_placement < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'A': config.oven_affinity = 1; break;
+        case 'r': config.arrival_rate = atof(optarg); break;
+        case 'n': config.orders = atoi(optarg); break;
+        case 's': config.speed = atof(optarg); break;
+        case 'w': config.town_width = atoi(optarg); break;
+        case 't': config.town_height = atoi(optarg); break;
+        case 'S': config.seed = strtoull(optarg, NULL, 10); break;
+        case 'C': compare = 1; break;
+        case 'T': checkpoint_s = atof(optarg); break;
+        case 'W': checkpoint_path = optarg; break;
+        case 'R': resume_path = optarg; break;
+        case 'Q': model = 1; break;
+        case 'V': validate = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    int policies[] = {OVEN_POLICY_FCFS, OVEN_POLICY_PACK};
+    if ((model || validate) && (resume_path || checkpoint_path || (model && validate))) {
+        usage(argv[0]);
+    }
+    if (resume_path) {
+        if (checkpoint_path || cooks_given < 0 || couriers_given < 0) {
+            usage(argv[0]);
+        }
+        for (int i = 0; i < (compare ? 2 : 1); i++) {
+            if (resume_branch(resume_path, cooks_given, couriers_given, compare ? policies[i] : policy_given) < 0) {
+                return EXIT_FAILURE;
+            }
+        }
+        return 0;
+    }
+    if ((checkpoint_path != NULL) != (checkpoint_s >= 0) || (checkpoint_path && compare)) {
+        usage(argv[0]);
+    }
+    if (config.cooks <= 0 || config.couriers <= 0 || config.ovens < 0 || config.oven_capacity < menu_max_footprint() ||
+        config.oven_openings <= 0 || config.arrival_rate <= 0 || config.orders <= 0 || config.speed <= 0) {
+        usage(argv[0]);
+    }
+
+    if (model) {
+        ModelResult prediction;
+        model_predict(&config, &prediction);
+        print_model(&config, &prediction);
+        return 0;
+    }
+
+    if (checkpoint_path) {
+        Sim sim;
+        if (sim_init(&sim, &config) < 0) {
+            perror("Simulation failed");
+            return EXIT_FAILURE;
+        }
+        sim_run_until(&sim, (long long)(checkpoint_s * 1e9));
+        if (sim_checkpoint(&sim, checkpoint_path) < 0) {
+            perror("Failed to write the snapshot");
+            sim_destroy(&sim);
+            return EXIT_FAILURE;
+        }
+        printf("Snapshot at %.1fs written to %s: %d orders arrived, %d delivered\n",
+               sim.now_ns / 1e9, checkpoint_path, sim.arrived, sim.delivered);
+        sim_run(&sim);
+        SimResult result;
+        sim_result(&sim, &result);
+        print_result(&config, &result);
+        sim_destroy(&sim);
+        return 0;
+    }
+
+    int first = compare ? 0 : (config.oven_policy == OVEN_POLICY_PACK);
+    int last = compare ? 1 : first;
+    for (int i = first; i <= last; i++) {
+        SimResult result;
+        config.oven_policy = policies[i];
+        if (sim_simulate(&config, &result) < 0) {
+            perror("Simulation failed");
+            return EXIT_FAILURE;
+        }
+        print_result(&config, &result);
+        if (validate) {
+            ModelResult prediction;
+            model_predict(&config, &prediction);
+            print_validation(&prediction, &result);
+        }
+    }
+    return 0;
+}
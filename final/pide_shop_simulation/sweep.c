@@ -0,0 +1,318 @@
+#include "sim.h"
+#include "model.h"
+#include "oven.h"
+#include "menu.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+/*
+ * Capacity-planning sweep.
+ * Simulates every point of a grid of cook count x courier count x oven
+ * capacity x arrival rate, in parallel on all cores, writes throughput,
+ * latency and utilisation per point as CSV or JSON, and reports for each
+ * arrival rate the cheapest staffing that meets the p99 latency SLO.
+ * The analytic model is evaluated on every point too; with -a, points it
+ * predicts to be overloaded are not simulated.
+ * Side effects:
+ * - Writes the table to standard output (or -O file), the summary to standard error.
+ */
+
+#define SWEEP_MAX_VALUES 256
+
+typedef struct {
+    double values[SWEEP_MAX_VALUES];
+    int count;
+} SweepAxis;
+
+typedef struct {
+    SimConfig config;
+    SimResult result;
+    ModelResult model;
+    double cost;
+    int status;          // 0 once simulated, -1 if the simulation could not allocate, 1 if screened out
+} SweepPoint;
+
+// Work shared by the sweep threads
+static SweepPoint *points;
+static int num_points;
+static int next_point = 0;
+static int points_done = 0;
+static int screen = 0;
+
+// Unit costs of a cook, a courier and one unit of oven shelf capacity
+static double cook_cost = 1.0;
+static double courier_cost = 1.0;
+static double capacity_cost = 0.25;
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-c cooks] [-d couriers] [-k ovenCapacity] [-r ordersPerSecond]\n"
+            "          [-N ovens] [-p ovenOpenings] [-o fcfs|pack] [-n orders] [-s speed (m/min)] [-S seed]\n"
+            "          [-P p99SloSeconds] [-u cook:courier:capacityUnit] [-J threads] [-j] [-a] [-O file]\n"
+            "  Grid axes take a list (2,4,8) or a range (from:to:step).\n"
+            "  -u  unit costs used to rank the configurations (default 1:1:0.25)\n"
+            "  -j  write JSON instead of CSV\n"
+            "  -a  skip the points the analytic model predicts to be overloaded\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+// Parse "a,b,c" or "from:to:step" into 'axis'. Returns -1 on a malformed or empty axis.
+static int parse_axis(const char *text, SweepAxis *axis) {
+    double from, to, step;
+    axis->count = 0;
+    if (sscanf(text, "%lf:%lf:%lf", &from, &to, &step) == 3) {
+        if (step <= 0 || to < from) {
+            return -1;
+        }
+        for (double v = from; v <= to + step * 1e-9 && axis->count < SWEEP_MAX_VALUES; v += step) {
+            axis->values[axis->count++] = v;
+        }
+        return 0;
+    }
+    char *copy = strdup(text);
+    if (!copy) {
+        return -1;
+    }
+    char *save = NULL;
+    for (char *token = strtok_r(copy, ",", &save); token && axis->count < SWEEP_MAX_VALUES;
+         token = strtok_r(NULL, ",", &save)) {
+        char *end;
+        axis->values[axis->count] = strtod(token, &end);
+        if (end == token || *end != '\0') {
+            free(copy);
+            return -1;
+        }
+        axis->count++;
+    }
+    free(copy);
+    return axis->count > 0 ? 0 : -1;
+}
+
+static int config_ovens(const SimConfig *config) {
+    return config->ovens > 0 ? config->ovens : oven_pool_default_size(config->cooks);
+}
+
+static double config_cost(const SimConfig *config) {
+    return config->cooks * cook_cost + config->couriers * courier_cost +
+           config_ovens(config) * config->oven_capacity * capacity_cost;
+}
+
+/*
+ * Sweep thread: simulates points until none are left.
+ * Side effects:
+ * - Reports progress on standard error.
+ */
+static void *sweep_thread(void *arg) {
+    while (1) {
+        int i = __atomic_fetch_add(&next_point, 1, __ATOMIC_RELAXED);
+        if (i >= num_points) {
+            break;
+        }
+        if (screen && !points[i].model.stable) {
+            points[i].status = 1;
+        } else {
+            points[i].status = sim_simulate(&points[i].config, &points[i].result);
+        }
+        int done = __atomic_add_fetch(&points_done, 1, __ATOMIC_RELAXED);
+        if (done % 64 == 0 || done == num_points) {
+            fprintf(stderr, "\rSimulated %d/%d points", done, num_points);
+        }
+    }
+    return NULL;
+}
+
+static int meets_slo(const SweepPoint *p, double slo_s) {
+    return p->status == 0 && p->result.delivered == p->config.orders && p->result.latency_p99_s <= slo_s;
+}
+
+static void write_csv(FILE *out, double slo_s) {
+    fprintf(out, "cooks,couriers,ovens,oven_capacity,arrival_rate,delivered,throughput,latency_mean_s,"
+                 "latency_p50_s,latency_p99_s,cook_util,courier_util,oven_util,oven_wait_ms,model_throughput,"
+                 "model_latency_mean_us,simulated,cost,meets_slo\n");
+    for (int i = 0; i < num_points; i++) {
+        const SweepPoint *p = &points[i];
+        const SimResult *r = &p->result;
+        fprintf(out, "%d,%d,%d,%d,%g,%d,%.4f,%.3f,%.3f,%.3f,%.4f,%.4f,%.4f,%.1f,%.4f,%.0f,%d,%.2f,%d\n",
+                p->config.cooks, p->config.couriers, config_ovens(&p->config), p->config.oven_capacity,
+                p->config.arrival_rate, r->delivered, r->throughput, r->latency_mean_s, r->latency_p50_s,
+                r->latency_p99_s, r->cook_utilisation, r->courier_utilisation, r->oven_utilisation,
+                r->oven_wait_ms, p->model.throughput, p->model.latency_mean_us, p->status == 0, p->cost,
+                meets_slo(p, slo_s));
+    }
+}
+
+static void write_json_point(FILE *out, const SweepPoint *p, double slo_s) {
+    const SimResult *r = &p->result;
+    fprintf(out, "{\"cooks\": %d, \"couriers\": %d, \"ovens\": %d, \"oven_capacity\": %d, \"arrival_rate\": %g, "
+                 "\"delivered\": %d, \"throughput\": %.4f, \"latency_mean_s\": %.3f, \"latency_p50_s\": %.3f, "
+                 "\"latency_p99_s\": %.3f, \"cook_util\": %.4f, \"courier_util\": %.4f, \"oven_util\": %.4f, "
+                 "\"oven_wait_ms\": %.1f, \"model_throughput\": %.4f, \"model_latency_mean_us\": ",
+            p->config.cooks, p->config.couriers, config_ovens(&p->config), p->config.oven_capacity,
+            p->config.arrival_rate, r->delivered, r->throughput, r->latency_mean_s, r->latency_p50_s,
+            r->latency_p99_s, r->cook_utilisation, r->courier_utilisation, r->oven_utilisation, r->oven_wait_ms,
+            p->model.throughput);
+    // JSON has no infinity: an overloaded shop has no mean latency
+    if (p->model.stable) {
+        fprintf(out, "%.0f", p->model.latency_mean_us);
+    } else {
+        fprintf(out, "null");
+    }
+    fprintf(out, ", \"simulated\": %s, \"cost\": %.2f, \"meets_slo\": %s}", p->status == 0 ? "true" : "false",
+            p->cost, meets_slo(p, slo_s) ? "true" : "false");
+}
+
+int main(int argc, char *argv[]) {
+    SimConfig base;
+    sim_default_config(&base);
+    SweepAxis cooks, couriers, capacities, rates;
+    parse_axis("2:12:2", &cooks);
+    parse_axis("2:12:2", &couriers);
+    parse_axis("6", &capacities);
+    parse_axis("0.5,1,2", &rates);
+    double slo_s = 30.0;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int json = 0;
+    const char *output_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:k:r:N:p:o:n:s:S:P:u:J:jaO:")) != -1) {
+        switch (opt) {
+        case 'c': if (parse_axis(optarg, &cooks) < 0) usage(argv[0]); break;
+        case 'd': if (parse_axis(optarg, &couriers) < 0) usage(argv[0]); break;
+        case 'k': if (parse_axis(optarg, &capacities) < 0) usage(argv[0]); break;
+        case 'r': if (parse_axis(optarg, &rates) < 0) usage(argv[0]); break;
+        case 'N': base.ovens = atoi(optarg); break;
+        case 'p': base.oven_openings = atoi(optarg); break;
+        case 'o':
+            base.oven_policy = oven_policy_from_name(optarg);
+            if (base.oven_policy < 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'n': base.orders = atoi(optarg); break;
+        case 's': base.speed = atof(optarg); break;
+        case 'S': base.seed = strtoull(optarg, NULL, 10); break;
+        case 'P': slo_s = atof(optarg); break;
+        case 'u':
+            if (sscanf(optarg, "%lf:%lf:%lf", &cook_cost, &courier_cost, &capacity_cost) != 3) {
+                usage(argv[0]);
+            }
+            break;
+        case 'J': threads = atoi(optarg); break;
+        case 'j': json = 1; break;
+        case 'a': screen = 1; break;
+        case 'O': output_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (base.ovens < 0 || base.oven_openings <= 0 || base.orders <= 0 || base.speed <= 0 || slo_s <= 0 ||
+        threads <= 0) {
+        usage(argv[0]);
+    }
+
+    num_points = cooks.count * couriers.count * capacities.count * rates.count;
+    points = calloc(num_points, sizeof(SweepPoint));
+    if (!points) {
+        perror("Failed to allocate sweep points");
+        return EXIT_FAILURE;
+    }
+    int n = 0;
+    for (int r = 0; r < rates.count; r++) {
+        for (int k = 0; k < capacities.count; k++) {
+            for (int c = 0; c < cooks.count; c++) {
+                for (int d = 0; d < couriers.count; d++) {
+                    SimConfig *config = &points[n].config;
+                    *config = base;
+                    config->arrival_rate = rates.values[r];
+                    config->oven_capacity = (int)capacities.values[k];
+                    config->cooks = (int)cooks.values[c];
+                    config->couriers = (int)couriers.values[d];
+                    if (config->cooks <= 0 || config->couriers <= 0 || config->arrival_rate <= 0 ||
+                        config->oven_capacity < menu_max_footprint()) {
+                        usage(argv[0]);
+                    }
+                    model_predict(config, &points[n].model);
+                    points[n++].cost = config_cost(config);
+                }
+            }
+        }
+    }
+
+    if (threads > num_points) {
+        threads = num_points;
+    }
+    pthread_t workers[threads];
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&workers[i], NULL, sweep_thread, NULL) != 0) {
+            perror("Failed to create sweep thread");
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    int screened = 0;
+    for (int i = 0; i < num_points; i++) {
+        screened += points[i].status == 1;
+    }
+    fprintf(stderr, " on %d thread(s), %d screened out as overloaded\n", threads, screened);
+
+    FILE *out = output_path ? fopen(output_path, "w") : stdout;
+    if (!out) {
+        perror("Failed to open output file");
+        return EXIT_FAILURE;
+    }
+    if (json) {
+        fprintf(out, "{\"slo_p99_s\": %g, \"points\": [\n", slo_s);
+        for (int i = 0; i < num_points; i++) {
+            fprintf(out, "  ");
+            write_json_point(out, &points[i], slo_s);
+            fprintf(out, "%s\n", i + 1 < num_points ? "," : "");
+        }
+        fprintf(out, "], \"cheapest\": [\n");
+    } else {
+        write_csv(out, slo_s);
+    }
+
+    // Cheapest point meeting the SLO for each arrival rate; ties go to the lower p99
+    int per_rate = num_points / rates.count;
+    for (int r = 0; r < rates.count; r++) {
+        const SweepPoint *best = NULL;
+        for (int i = r * per_rate; i < (r + 1) * per_rate; i++) {
+            const SweepPoint *p = &points[i];
+            if (meets_slo(p, slo_s) && (!best || p->cost < best->cost ||
+                                        (p->cost == best->cost && p->result.latency_p99_s < best->result.latency_p99_s))) {
+                best = p;
+            }
+        }
+        if (best) {
+            fprintf(stderr, "rate=%g/s: cheapest within p99 <= %gs is cooks=%d couriers=%d ovens=%d oven=%d "
+                            "(cost %.2f, p99 %.2fs, throughput %.3f/s)\n",
+                    rates.values[r], slo_s, best->config.cooks, best->config.couriers, config_ovens(&best->config),
+                    best->config.oven_capacity, best->cost, best->result.latency_p99_s, best->result.throughput);
+        } else {
+            fprintf(stderr, "rate=%g/s: no configuration meets p99 <= %gs\n", rates.values[r], slo_s);
+        }
+        if (json) {
+            fprintf(out, "  {\"arrival_rate\": %g, \"point\": ", rates.values[r]);
+            if (best) {
+                write_json_point(out, best, slo_s);
+            } else {
+                fprintf(out, "null");
+            }
+            fprintf(out, "}%s\n", r + 1 < rates.count ? "," : "");
+        }
+    }
+    if (json) {
+        fprintf(out, "]}\n");
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(points);
+    return 0;
+}
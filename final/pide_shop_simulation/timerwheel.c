@@ -0,0 +1,220 @@
+#include "timerwheel.h"
+#include "utils.h"
+#include "lockprof.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+static void list_init(Timer *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void list_append(Timer *head, Timer *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_unlink(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+void tw_init(TimerWheel *tw, unsigned long long now) {
+    for (int level = 0; level < TW_LEVELS; level++) {
+        for (int slot = 0; slot < TW_SLOTS; slot++) {
+            list_init(&tw->slots[level][slot]);
+        }
+    }
+    tw->now = now;
+    tw->pending = 0;
+}
+
+// Link a timer into the slot matching its distance from the current tick
+static void tw_place(TimerWheel *tw, Timer *timer) {
+    unsigned long long expires = timer->expires;
+    long long delta = (long long)(expires - tw->now);
+    Timer *head;
+
+    if (delta < 0) {
+        // Already due: fire on the next processed tick
+        head = &tw->slots[0][tw->now & TW_MASK];
+    } else if (delta < (1LL << TW_BITS)) {
+        head = &tw->slots[0][expires & TW_MASK];
+    } else if (delta < (1LL << (2 * TW_BITS))) {
+        head = &tw->slots[1][(expires >> TW_BITS) & TW_MASK];
+    } else if (delta < (1LL << (3 * TW_BITS))) {
+        head = &tw->slots[2][(expires >> (2 * TW_BITS)) & TW_MASK];
+    } else {
+        if (delta >= (1LL << (4 * TW_BITS))) {
+            // Beyond the wheel: park at its far end, it is cascaded again from there
+            expires = tw->now + (1ULL << (4 * TW_BITS)) - 1;
+        }
+        head = &tw->slots[3][(expires >> (3 * TW_BITS)) & TW_MASK];
+    }
+    list_append(head, timer);
+}
+
+void tw_add(TimerWheel *tw, Timer *timer, unsigned long long expires, TimerCallback callback) {
+    timer->expires = expires;
+    timer->callback = callback;
+    tw_place(tw, timer);
+    tw->pending++;
+}
+
+void tw_cancel(TimerWheel *tw, Timer *timer) {
+    if (timer->next) {
+        list_unlink(timer);
+        tw->pending--;
+    }
+}
+
+// Move every timer of a higher level slot down to where it now belongs
+static int tw_cascade(TimerWheel *tw, int level) {
+    int index = (tw->now >> (level * TW_BITS)) & TW_MASK;
+    Timer *head = &tw->slots[level][index];
+    Timer *timer = head->next;
+    list_init(head);
+    while (timer != head) {
+        Timer *next = timer->next;
+        tw_place(tw, timer);
+        timer = next;
+    }
+    return index;
+}
+
+Timer *tw_advance(TimerWheel *tw, unsigned long long until) {
+    Timer *expired = NULL;
+    Timer **tail = &expired;
+
+    while ((long long)(until - tw->now) >= 0) {
+        int index = tw->now & TW_MASK;
+        if (index == 0) {
+            for (int level = 1; level < TW_LEVELS && tw_cascade(tw, level) == 0; level++) {
+            }
+        }
+
+        Timer *head = &tw->slots[0][index];
+        while (head->next != head) {
+            Timer *timer = head->next;
+            list_unlink(timer);
+            tw->pending--;
+            *tail = timer;
+            tail = &timer->next;
+        }
+        tw->now++;
+    }
+    *tail = NULL;
+    return expired;
+}
+
+/*
+ * Live timer service.
+ * Side effects:
+ * - Shared by the cooks, ovens and couriers; the wheel is guarded by 'service_mutex'.
+ */
+static TimerWheel service_wheel;
+static pthread_mutex_t service_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LockProfile service_profile = LOCK_PROFILE_INITIALIZER("timer service_mutex");
+static pthread_cond_t service_cond;
+static unsigned long long service_start_ms;
+static unsigned long timers_fired = 0;
+static unsigned long max_pending = 0;
+
+static unsigned long long now_ms(void) {
+    return now_ns() / 1000000ULL;
+}
+
+/*
+ * Timer thread: processes elapsed ticks and runs the expired callbacks.
+ * Side effects:
+ * - Wakes every tick while timers are pending, sleeps on the condition variable otherwise.
+ */
+static void *timer_thread(void *arg) {
+    PROFILED_LOCK(&service_mutex, &service_profile);
+    while (1) {
+        while (service_wheel.pending == 0) {
+            PROFILED_COND_WAIT(&service_cond, &service_mutex, &service_profile);
+        }
+
+        Timer *expired = tw_advance(&service_wheel, now_ms() - service_start_ms);
+        PROFILED_UNLOCK(&service_mutex, &service_profile);
+
+        while (expired) {
+            Timer *next = expired->next;
+            expired->next = expired->prev = NULL;
+            expired->callback(expired);
+            __atomic_add_fetch(&timers_fired, 1, __ATOMIC_RELAXED);
+            expired = next;
+        }
+
+        // Sleep until the next tick
+        struct timespec next_tick;
+        unsigned long long target_ns = (service_start_ms + service_wheel.now) * 1000000ULL;
+        next_tick.tv_sec = target_ns / 1000000000ULL;
+        next_tick.tv_nsec = target_ns % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_tick, NULL);
+        PROFILED_LOCK(&service_mutex, &service_profile);
+    }
+    return NULL;
+}
+
+/*
+ * Start the timer thread.
+ * Side effects:
+ * - Creates and detaches one thread.
+ */
+void timer_service_start(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&service_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    service_start_ms = now_ms();
+    tw_init(&service_wheel, 0);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, timer_thread, NULL) != 0) {
+        handle_error("Failed to create timer thread");
+    }
+    pthread_detach(thread);
+}
+
+/*
+ * Fire 'callback' on the timer thread in 'delay_ms' milliseconds.
+ * Side effects:
+ * - Wakes the timer thread if it was idle.
+ */
+void timer_schedule(Timer *timer, unsigned long delay_ms, TimerCallback callback) {
+    PROFILED_LOCK(&service_mutex, &service_profile);
+    unsigned long long expires = now_ms() - service_start_ms + delay_ms;
+    tw_add(&service_wheel, timer, expires, callback);
+    if (service_wheel.pending > max_pending) {
+        max_pending = service_wheel.pending;
+    }
+    if (service_wheel.pending == 1) {
+        pthread_cond_signal(&service_cond);
+    }
+    PROFILED_UNLOCK(&service_mutex, &service_profile);
+}
+
+/*
+ * Log timer statistics.
+ * Side effects:
+ * - Logs one line.
+ */
+void timer_service_report(void) {
+    PROFILED_LOCK(&service_mutex, &service_profile);
+    unsigned long pending = service_wheel.pending;
+    unsigned long max = max_pending;
+    PROFILED_UNLOCK(&service_mutex, &service_profile);
+
+    char message[256];
+    snprintf(message, sizeof(message), "Timer wheel: %lu timers fired, %lu pending, at most %lu in flight",
+             __atomic_load_n(&timers_fired, __ATOMIC_RELAXED), pending, max);
+    log_message(message);
+}
@@ -0,0 +1,53 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+/*
+ * Hierarchical timing wheel.
+ * Four levels of 256 slots; level 0 has one slot per tick and each higher level
+ * covers 256 slots of the level below, so adding and expiring a timer are O(1)
+ * and timers far in the future are cascaded down as their time approaches.
+ * The live server runs one wheel with a 1 ms tick on a single timer thread.
+ */
+
+#define TW_LEVELS 4
+#define TW_BITS 8
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+
+typedef struct Timer Timer;
+typedef void (*TimerCallback)(Timer *timer);
+
+// Intrusive timer, embedded in the object it belongs to
+struct Timer {
+    Timer *next;
+    Timer *prev;
+    unsigned long long expires;  // Tick at which the timer fires
+    TimerCallback callback;
+};
+
+typedef struct {
+    Timer slots[TW_LEVELS][TW_SLOTS]; // List heads
+    unsigned long long now;           // Next tick to process
+    unsigned long pending;
+} TimerWheel;
+
+void tw_init(TimerWheel *tw, unsigned long long now);
+void tw_add(TimerWheel *tw, Timer *timer, unsigned long long expires, TimerCallback callback);
+void tw_cancel(TimerWheel *tw, Timer *timer);
+
+/*
+ * Process every tick up to and including 'until'.
+ * Expired timers are unlinked and chained through 'next' into the returned list;
+ * the caller runs their callbacks.
+ */
+Timer *tw_advance(TimerWheel *tw, unsigned long long until);
+
+/*
+ * Live timer service: one thread driving a wheel with a 1 ms tick.
+ * Callbacks run on the timer thread and must not block.
+ */
+void timer_service_start(void);
+void timer_schedule(Timer *timer, unsigned long delay_ms, TimerCallback callback);
+void timer_service_report(void);
+
+#endif // TIMERWHEEL_H
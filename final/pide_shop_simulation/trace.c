@@ -0,0 +1,159 @@
+#include "trace.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    const char *name;
+    const char *arg_name;
+    int arg;
+    int order_id;
+    int whole;                     // Span of the whole order, which also names its row
+    unsigned long long begin_ns;
+    unsigned long long end_ns;
+} TraceEvent;
+
+// A thread's buffer is a list of chunks; 'count' is published after each event is written
+typedef struct TraceChunk {
+    struct TraceChunk *next;
+    int count;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+} TraceChunk;
+
+/*
+ * Tracing state
+ * Side effects:
+ * - Every chunk of every thread is linked in 'chunks' under 'chunks_mutex',
+ *   taken once per TRACE_CHUNK_EVENTS spans; recording itself takes no lock.
+ */
+static unsigned long trace_every = 0;
+static const char *trace_path = TRACE_DEFAULT_PATH;
+static unsigned long long trace_start_ns;
+static TraceChunk *chunks = NULL;
+static int num_chunks = 0;
+static unsigned long dropped = 0;
+static pthread_mutex_t chunks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread TraceChunk *thread_chunk = NULL;
+
+void trace_init(unsigned long sample_every, const char *path) {
+    trace_every = sample_every;
+    trace_path = path ? path : TRACE_DEFAULT_PATH;
+    trace_start_ns = now_ns();
+    if (trace_every > 0) {
+        printf("Tracing 1 in %lu orders to %s\n", trace_every, trace_path);
+    }
+}
+
+void trace_order_start(ShopOrder *order) {
+    order->traced = trace_every > 0 && order->order.order_id % trace_every == 0;
+    order->phase_ns = order->created_ns;
+}
+
+static TraceEvent *trace_slot(void) {
+    TraceChunk *chunk = thread_chunk;
+    if (!chunk || chunk->count == TRACE_CHUNK_EVENTS) {
+        pthread_mutex_lock(&chunks_mutex);
+        if (num_chunks * TRACE_CHUNK_EVENTS >= TRACE_MAX_EVENTS) {
+            pthread_mutex_unlock(&chunks_mutex);
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        chunk = calloc(1, sizeof(TraceChunk));
+        if (chunk) {
+            chunk->next = chunks;
+            chunks = chunk;
+            num_chunks++;
+        }
+        pthread_mutex_unlock(&chunks_mutex);
+        if (!chunk) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        thread_chunk = chunk;
+    }
+    return &chunk->events[chunk->count];
+}
+
+static void trace_span(const char *name, const char *arg_name, int arg, int order_id, int whole,
+                       unsigned long long begin_ns, unsigned long long end_ns) {
+    TraceEvent *event = trace_slot();
+    if (!event) {
+        return;
+    }
+    event->name = name;
+    event->arg_name = arg_name;
+    event->arg = arg;
+    event->order_id = order_id;
+    event->whole = whole;
+    event->begin_ns = begin_ns;
+    event->end_ns = end_ns;
+    // Pairs with the acquire load in trace_write()
+    __atomic_store_n(&thread_chunk->count, thread_chunk->count + 1, __ATOMIC_RELEASE);
+}
+
+void trace_record(ShopOrder *order, const char *phase, const char *arg_name, int arg) {
+    unsigned long long now = now_ns();
+    trace_span(phase, arg_name, arg, order->order.order_id, 0, order->phase_ns, now);
+    order->phase_ns = now;
+}
+
+// The whole life of the order, enclosing its phases on the timeline
+void trace_order_end(ShopOrder *order) {
+    if (order->traced) {
+        trace_span(order->order.status == ORDER_DELIVERED ? "order delivered" : "order cancelled", NULL, 0,
+                   order->order.order_id, 1, order->created_ns, now_ns());
+    }
+}
+
+static void write_event(FILE *file, const TraceEvent *e) {
+    fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+            e->name, e->order_id, (e->begin_ns - trace_start_ns) / 1e3,
+            (e->end_ns - e->begin_ns) / 1e3);
+    if (e->arg_name) {
+        fprintf(file, ", \"args\": {\"%s\": %d}", e->arg_name, e->arg);
+    }
+    fprintf(file, "}");
+    // Name the row of the order once, with its enclosing span
+    if (e->whole) {
+        fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                      "\"args\": {\"name\": \"order %d\"}}", e->order_id, e->order_id);
+    }
+}
+
+/*
+ * Export the trace.
+ * Side effects:
+ * - Overwrites the trace file. Spans of orders still in flight are included;
+ *   their rows simply have no enclosing order span.
+ */
+void trace_write(void) {
+    if (trace_every == 0) {
+        return;
+    }
+    FILE *file = fopen(trace_path, "w");
+    if (!file) {
+        perror("Failed to open trace file");
+        return;
+    }
+    pthread_mutex_lock(&chunks_mutex);
+    TraceChunk *list = chunks;
+    pthread_mutex_unlock(&chunks_mutex);
+
+    unsigned long spans = 0;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"pide shop\"}}");
+    for (TraceChunk *chunk = list; chunk; chunk = chunk->next) {
+        int count = __atomic_load_n(&chunk->count, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < count; i++) {
+            write_event(file, &chunk->events[i]);
+        }
+        spans += count;
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    char message[256];
+    snprintf(message, sizeof(message), "Trace: %lu spans of 1 in %lu orders written to %s, %lu dropped",
+             spans, trace_every, trace_path, __atomic_load_n(&dropped, __ATOMIC_RELAXED));
+    log_message(message);
+}
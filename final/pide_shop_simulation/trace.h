@@ -0,0 +1,45 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "pipeline.h"
+
+/*
+ * Per-order span tracing.
+ * One order in every N is traced. Each phase of its path (accepted, queued,
+ * prepared by a cook, waiting for an oven opening, loading, baking, waiting for
+ * the manager, waiting for and travelling with a courier) becomes a span
+ * ending where the next one starts. Spans go into per-thread buffers without
+ * locks and are written at shutdown as Chrome trace-event JSON, one timeline
+ * row per order, which chrome://tracing and Perfetto load directly.
+ */
+
+#define TRACE_DEFAULT_PATH "pide_shop_trace.json"
+#define TRACE_CHUNK_EVENTS 1024
+#define TRACE_MAX_EVENTS (1 << 20) // Spans kept in memory; later ones are counted and dropped
+
+// Trace one order in 'sample_every' (0 disables tracing)
+void trace_init(unsigned long sample_every, const char *path);
+
+// Sampling decision for a new order; its first phase starts at creation
+void trace_order_start(ShopOrder *order);
+
+void trace_record(ShopOrder *order, const char *phase, const char *arg_name, int arg);
+
+// The order left the pipeline, delivered or cancelled
+void trace_order_end(ShopOrder *order);
+
+/*
+ * End the current phase of 'order' now and start the next one.
+ * 'arg_name' and 'arg' label the span with the cook, oven or courier; NULL for none.
+ * Costs one branch for orders that are not sampled.
+ */
+static inline void trace_phase(ShopOrder *order, const char *phase, const char *arg_name, int arg) {
+    if (order->traced) {
+        trace_record(order, phase, arg_name, arg);
+    }
+}
+
+// Write the spans recorded so far to the trace file and log a summary
+void trace_write(void);
+
+#endif // TRACE_H
@@ -22,3 +22,10 @@ void log_message(const char *message) {
         perror("Failed to open log file");
     }
 }
+
+// Monotonic clock in nanoseconds, used to time stage handoffs
+unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
@@ -16,4 +16,7 @@
 void handle_error(const char *message);
 void log_message(const char *message);
 
+// Monotonic clock in nanoseconds
+unsigned long long now_ns(void);
+
 #endif // UTILS_H
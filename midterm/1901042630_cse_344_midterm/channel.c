@@ -0,0 +1,220 @@
+#define _GNU_SOURCE // splice() and F_SETPIPE_SZ
+#include "channel.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+static int zero_copy = 1;
+
+int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int send_frame(int fd, uint32_t type, uint32_t stream, const void *payload, size_t length) {
+    FrameHeader header = {type, stream, (uint32_t)length};
+    struct iovec iov[2] = {{&header, sizeof(header)}, {(void *)payload, length}};
+    ssize_t total = sizeof(header) + length;
+    ssize_t n = writev(fd, iov, length > 0 ? 2 : 1);
+    while (n < 0 && errno == EINTR) {
+        n = writev(fd, iov, length > 0 ? 2 : 1);
+    }
+    if (n < 0) {
+        return -1;
+    }
+    if (n == total) {
+        return 0;
+    }
+    // Short write on a full pipe: finish the header, then the payload
+    if ((size_t)n < sizeof(header)) {
+        if (write_full(fd, (char *)&header + n, sizeof(header) - n) < 0) {
+            return -1;
+        }
+        n = sizeof(header);
+    }
+    return write_full(fd, (const char *)payload + (n - sizeof(header)), total - n);
+}
+
+int send_text(int fd, uint32_t type, uint32_t stream, const char *text) {
+    return send_frame(fd, type, stream, text, strlen(text));
+}
+
+int recv_header(int fd, FrameHeader *header) {
+    ssize_t n;
+    do {
+        n = read(fd, header, sizeof(*header));
+    } while (n < 0 && errno == EINTR);
+    if (n == 0) {
+        return 0;
+    }
+    if (n < 0) {
+        return -1;
+    }
+    if ((size_t)n < sizeof(*header) && read_full(fd, (char *)header + n, sizeof(*header) - n) < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+int recv_frame(int fd, FrameHeader *header, void *payload, size_t size) {
+    int status = recv_header(fd, header);
+    if (status <= 0) {
+        return status;
+    }
+    if (header->length > size || header->length > FRAME_MAX_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (read_full(fd, payload, header->length) < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+static int pwrite_full(int fd, const char *buf, size_t len, off_t at) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, at);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        at += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Move 'length' bytes from 'in' to 'out', one of them a pipe; offsets as for splice().
+ * Splices unless that is off or the descriptors do not support it, in which case the
+ * rest goes through a buffer. '*moved' is what was moved before the end of input or
+ * an error.
+ */
+static int transfer(int in, off_t *in_off, int out, off_t *out_off, size_t length, size_t *moved) {
+    static char buffer[CHANNEL_CHUNK_SIZE];
+    int use_splice = zero_copy;
+    *moved = 0;
+    while (*moved < length) {
+        size_t want = length - *moved;
+        ssize_t n;
+        if (use_splice) {
+            n = splice(in, in_off, out, out_off, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                use_splice = 0;
+                continue;
+            }
+        } else {
+            want = want < sizeof(buffer) ? want : sizeof(buffer);
+            n = in_off ? pread(in, buffer, want, *in_off) : read(in, buffer, want);
+            if (n > 0) {
+                if ((out_off ? pwrite_full(out, buffer, n, *out_off) : write_full(out, buffer, n)) < 0) {
+                    return -1;
+                }
+                if (in_off) {
+                    *in_off += n;
+                }
+                if (out_off) {
+                    *out_off += n;
+                }
+            }
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n;
+        }
+        *moved += n;
+    }
+    return 0;
+}
+
+int send_file_frame(int fd, uint32_t type, uint32_t stream, int file_fd, off_t *offset, size_t length) {
+    FrameHeader header = {type, stream, (uint32_t)length};
+    if (write_full(fd, &header, sizeof(header)) < 0) {
+        return -1;
+    }
+    size_t moved;
+    if (transfer(file_fd, offset, fd, NULL, length, &moved) < 0) {
+        return -1;
+    }
+    if (moved == length) {
+        return 0;
+    }
+    // The header promised 'length' bytes
+    static const char zeros[4096];
+    while (moved < length) {
+        size_t len = length - moved < sizeof(zeros) ? length - moved : sizeof(zeros);
+        if (write_full(fd, zeros, len) < 0) {
+            return -1;
+        }
+        moved += len;
+    }
+    errno = EIO;
+    return -1;
+}
+
+int recv_to_file(int fd, int file_fd, off_t *offset, size_t length) {
+    size_t moved;
+    int status = transfer(fd, NULL, file_fd, offset, length, &moved);
+    if (status == 0 && moved == length) {
+        return 0;
+    }
+    // Drop the rest of the payload so the next read starts at a frame header
+    int saved = status < 0 ? errno : EIO;
+    discard_payload(fd, length - moved);
+    errno = saved;
+    return -1;
+}
+
+int discard_payload(int fd, size_t length) {
+    static char scratch[CHANNEL_CHUNK_SIZE];
+    while (length > 0) {
+        size_t len = length < sizeof(scratch) ? length : sizeof(scratch);
+        if (read_full(fd, scratch, len) < 0) {
+            return -1;
+        }
+        length -= len;
+    }
+    return 0;
+}
+
+void channel_set_zero_copy(int enabled) {
+    zero_copy = enabled;
+}
+
+void channel_set_pipe_size(int fd) {
+    fcntl(fd, F_SETPIPE_SZ, CHANNEL_PIPE_SIZE); // Past the user's pipe limit it just keeps its size
+}
@@ -0,0 +1,82 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Session channel between a client and the file server.
+ * The client creates two FIFOs, one per direction, and announces itself with a
+ * FRAME_CONNECT frame on the server's well-known FIFO. Both sides then keep the
+ * FIFOs open for the whole session. Every message is a frame: a fixed header and
+ * 'length' bytes of payload. The client tags each command with a stream id, and
+ * every frame of the reply carries the same id; a reply ends with FRAME_END or
+ * FRAME_ERROR.
+ * File contents move between a file and the FIFOs with splice(), so the bytes
+ * never pass through a user buffer: a frame header is written, then its payload
+ * is spliced straight behind it.
+ */
+
+#define SERVER_FIFO_TEMPLATE "/tmp/server_fifo_%d"
+#define CLIENT_REQUEST_FIFO_TEMPLATE "/tmp/client_fifo_%d.req"
+#define CLIENT_RESPONSE_FIFO_TEMPLATE "/tmp/client_fifo_%d.resp"
+#define FIFO_NAME_LEN 256
+
+// Frame types
+#define FRAME_CONNECT 1   // Server FIFO: a client is waiting, 'stream' is its PID
+#define FRAME_COMMAND 2   // Command line of the client
+#define FRAME_TEXT    3   // Part of a text reply
+#define FRAME_DATA    4   // File contents
+#define FRAME_END     5   // Last frame of a reply or of an upload, optional status text
+#define FRAME_ERROR   6   // Last frame of a failed reply, error text
+#define FRAME_CHUNK   7   // Checksummed chunk of a file at an offset, see transfer.h
+#define FRAME_ZDATA   8   // Compressed file contents, see lz.h
+
+#define FRAME_COMMAND_MAX 1024        // Longest command line
+#define FRAME_MAX_PAYLOAD (1 << 20)   // Larger frames are a protocol error
+#define CHANNEL_CHUNK_SIZE 65536      // Data frame size, one default pipe buffer
+#define CHANNEL_FILE_CHUNK (1 << 20)  // Data frame size of file transfers
+#define CHANNEL_PIPE_SIZE (1 << 20)   // Pipe buffer asked for, so a whole file frame fits
+
+typedef struct {
+    uint32_t type;
+    uint32_t stream;
+    uint32_t length;
+} FrameHeader;
+
+// Write or read exactly 'len' bytes, retrying short transfers; -1 on error or early EOF
+int write_full(int fd, const void *buf, size_t len);
+int read_full(int fd, void *buf, size_t len);
+
+// Send one frame with a single writev(); -1 on error
+int send_frame(int fd, uint32_t type, uint32_t stream, const void *payload, size_t length);
+int send_text(int fd, uint32_t type, uint32_t stream, const char *text);
+
+// Receive one frame into 'payload' (at most 'size' bytes); 1 on success, 0 on EOF, -1 on error
+int recv_frame(int fd, FrameHeader *header, void *payload, size_t size);
+
+// Receive only a frame header, leaving the payload in the pipe; same results as recv_frame
+int recv_header(int fd, FrameHeader *header);
+
+/*
+ * Send a frame whose payload is 'length' bytes of 'file_fd', read at '*offset' and
+ * advancing it, or from the file position if 'offset' is NULL. Should the file end
+ * early, the payload is padded with zeros to keep the channel in step and -1 is
+ * returned with errno EIO.
+ */
+int send_file_frame(int fd, uint32_t type, uint32_t stream, int file_fd, off_t *offset, size_t length);
+
+// Move the next 'length' payload bytes of 'fd' into 'file_fd', at '*offset' or the file position
+int recv_to_file(int fd, int file_fd, off_t *offset, size_t length);
+
+// Read and drop the next 'length' payload bytes of 'fd'
+int discard_payload(int fd, size_t length);
+
+// Off: the two calls above copy through a buffer instead of splicing
+void channel_set_zero_copy(int enabled);
+
+// Grow the pipe buffer of a FIFO to CHANNEL_PIPE_SIZE if the system allows it
+void channel_set_pipe_size(int fd);
+
+#endif // CHANNEL_H
@@ -5,99 +5,761 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include "channel.h"
+#include "transfer.h"
+#include "lz.h"
 
-#define SERVER_FIFO_TEMPLATE "/tmp/server_fifo_%d"
-#define CLIENT_FIFO_TEMPLATE "/tmp/client_fifo_%d"
-#define CLIENT_FIFO_NAME_LEN 256
+#define BENCH_LINES 1000 // Lines the mixed load reads and writes
+#define UPLOAD_MAX 8      // Files one upload sends at once, the server's limit per session
+#define FETCH_RUN_MAX 64  // Chunks asked for by one command of a fetch
+#define FETCH_WINDOW 4    // Commands of a fetch in flight on a session
+#define FETCH_CONNECT_MS 500 // Wait for a worker to take an extra session of a fetch
+#define FETCH_NO_SESSION 255 // Exit status of a fetch child no worker took
 
-void connect_server(const char *server_fifo, const char *client_fifo);
-void send_command(const char *server_fifo, const char *message);
-void read_response(const char *client_fifo);
+// Session with the server: our two FIFOs, open for the whole session
+typedef struct {
+    char server_fifo[FIFO_NAME_LEN];
+    char request_name[FIFO_NAME_LEN];
+    char response_name[FIFO_NAME_LEN];
+    int request_fd;
+    int response_fd;
+    uint32_t next_stream;
+    int compress;           // The server agreed to compressed data frames
+} Connection;
+
+void connect_server(const char *server_fifo, Connection *conn);
+int try_connect_server(const char *server_fifo, Connection *conn, int timeout_ms);
+uint32_t send_command(Connection *conn, const char *message);
+void set_compression(Connection *conn, const char *codec);
+int read_response(Connection *conn, uint32_t stream, int download_fd);
+int upload(Connection *conn, char *const *paths, int count, int verbose);
+void download(Connection *conn, const char *command, const char *filename);
+void fetch(Connection *conn, const char *filename, int streams);
+void put(Connection *conn, const char *path);
+void benchmark(Connection *conn, int iterations, const char *file, int write_percent);
+void benchmark_download(Connection *conn, int iterations, const char *command);
+void benchmark_upload(Connection *conn, int iterations, char *path);
+
+static void close_session(Connection *conn) {
+    close(conn->request_fd);
+    close(conn->response_fd);
+    unlink(conn->request_name);
+    unlink(conn->response_name);
+}
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <ServerPID>\n", argv[0]);
+    int iterations = 0;
+    int write_percent = 0;
+    const char *bench_file = NULL;
+    const char *bench_download = NULL;
+    int bench_archive = 0;
+    int compress = 0;
+    char *bench_upload = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:f:w:D:U:Az")) != -1) {
+        if (opt == 'b') {
+            iterations = atoi(optarg);
+        } else if (opt == 'f') {
+            bench_file = optarg;
+        } else if (opt == 'w') {
+            write_percent = atoi(optarg);
+        } else if (opt == 'D') {
+            bench_download = optarg;
+        } else if (opt == 'U') {
+            bench_upload = optarg;
+        } else if (opt == 'A') {
+            bench_archive = 1;
+        } else if (opt == 'z') {
+            compress = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-z] [-b iterations [-f file [-w writePercent] | -D file | -U file | -A]] <ServerPID>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-z] [-b iterations [-f file [-w writePercent] | -D file | -U file | -A]] <ServerPID>\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    int server_pid = atoi(argv[1]);
+    int server_pid = atoi(argv[optind]);
     char server_fifo_name[256];
-    char client_fifo_name[CLIENT_FIFO_NAME_LEN];
-    
     snprintf(server_fifo_name, sizeof(server_fifo_name), SERVER_FIFO_TEMPLATE, server_pid);
-    snprintf(client_fifo_name, CLIENT_FIFO_NAME_LEN, CLIENT_FIFO_TEMPLATE, getpid());
 
-    if (mkfifo(client_fifo_name, 0666) == -1) {
-        perror("Client FIFO creation failed");
-        exit(EXIT_FAILURE);
+    Connection conn;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    connect_server(server_fifo_name, &conn);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (compress) {
+        set_compression(&conn, "lz");
     }
 
-    connect_server(server_fifo_name, client_fifo_name);
+    if (iterations > 0) {
+        printf("Connect: %.1f us\n", ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / 1e3);
+        if (bench_download) {
+            char command[FRAME_COMMAND_MAX];
+            snprintf(command, sizeof(command), "download %s", bench_download);
+            benchmark_download(&conn, iterations, command);
+        } else if (bench_archive) {
+            benchmark_download(&conn, iterations, "archive");
+        } else if (bench_upload) {
+            benchmark_upload(&conn, iterations, bench_upload);
+        } else {
+            benchmark(&conn, iterations, bench_file, write_percent);
+        }
+        read_response(&conn, send_command(&conn, "quit"), -1);
+        close_session(&conn);
+        return 0;
+    }
 
     char command[256];
     printf("Enter command (type 'exit' to quit): ");
+    fflush(stdout);
     while (fgets(command, sizeof(command), stdin) && strncmp(command, "exit", 4) != 0) {
-        send_command(server_fifo_name, command);
-        read_response(client_fifo_name);
+        command[strcspn(command, "\n")] = '\0';
+        char verb[32] = "", filename[256] = "";
+        sscanf(command, "%31s %255s", verb, filename);
+        if (strcmp(verb, "upload") == 0) {
+            char *paths[UPLOAD_MAX];
+            int count = 0;
+            for (char *path = strtok(command + 6, " \t"); path && count < UPLOAD_MAX; path = strtok(NULL, " \t")) {
+                paths[count++] = path;
+            }
+            upload(&conn, paths, count, 1);
+        } else if (strcmp(verb, "download") == 0 || strcmp(verb, "archive") == 0) {
+            download(&conn, command, filename);
+        } else if (strcmp(verb, "fetch") == 0) {
+            int streams = 1;
+            sscanf(command, "%*s %*s %d", &streams);
+            fetch(&conn, filename, streams);
+        } else if (strcmp(verb, "put") == 0) {
+            put(&conn, filename);
+        } else if (strcmp(verb, "compress") == 0) {
+            set_compression(&conn, filename);
+        } else {
+            read_response(&conn, send_command(&conn, command), -1);
+        }
+        if (strcmp(verb, "quit") == 0 || strcmp(verb, "killServer") == 0) {
+            break;
+        }
+        printf("Enter command (type 'exit' to quit): ");
+        fflush(stdout);
     }
 
-    unlink(client_fifo_name);
+    close_session(&conn);
     return 0;
 }
 
-void connect_server(const char *server_fifo, const char *client_fifo) {
+/*
+ * Create the session FIFOs, announce ourselves on the server FIFO and open our ends.
+ * The opens block until the server has picked up the session.
+ */
+void connect_server(const char *server_fifo, Connection *conn) {
+    try_connect_server(server_fifo, conn, -1);
+}
+
+/*
+ * Same, giving up after 'timeout_ms' if no worker has picked up the session, or
+ * never with a negative timeout. Returns -1 once the FIFOs are removed again, so a
+ * worker that takes the session later finds nothing to open.
+ */
+int try_connect_server(const char *server_fifo, Connection *conn, int timeout_ms) {
+    snprintf(conn->server_fifo, sizeof(conn->server_fifo), "%s", server_fifo);
+    snprintf(conn->request_name, sizeof(conn->request_name), CLIENT_REQUEST_FIFO_TEMPLATE, getpid());
+    snprintf(conn->response_name, sizeof(conn->response_name), CLIENT_RESPONSE_FIFO_TEMPLATE, getpid());
+    conn->next_stream = 1;
+    unlink(conn->request_name);
+    unlink(conn->response_name);
+    if (mkfifo(conn->request_name, 0666) == -1 || mkfifo(conn->response_name, 0666) == -1) {
+        perror("Client FIFO creation failed");
+        exit(EXIT_FAILURE);
+    }
+
     int server_fd = open(server_fifo, O_WRONLY);
     if (server_fd == -1) {
         perror("Failed to open server FIFO");
         exit(EXIT_FAILURE);
     }
-
-    // Notify server of new client FIFO
-    char message[1024];
-    snprintf(message, sizeof(message), "%s\n", client_fifo); // Ensure the message ends with a newline
-    if (write(server_fd, message, strlen(message)) != strlen(message)) {
+    // A header-only frame is far below PIPE_BUF, so it never interleaves with other clients'
+    if (send_frame(server_fd, FRAME_CONNECT, (uint32_t)getpid(), NULL, 0) < 0) {
         perror("Failed to write to server FIFO");
         close(server_fd);
         exit(EXIT_FAILURE);
     }
     close(server_fd);
+
+    if (timeout_ms < 0) {
+        conn->request_fd = open(conn->request_name, O_WRONLY);
+    } else {
+        // A write end opens without blocking only once the worker holds the read end
+        struct timespec poll_interval = {0, 10 * 1000000L};
+        for (int waited = 0;; waited += 10) {
+            conn->request_fd = open(conn->request_name, O_WRONLY | O_NONBLOCK);
+            if (conn->request_fd != -1 || errno != ENXIO) {
+                break;
+            }
+            if (waited >= timeout_ms) {
+                unlink(conn->request_name);
+                unlink(conn->response_name);
+                return -1;
+            }
+            nanosleep(&poll_interval, NULL);
+        }
+        if (conn->request_fd != -1) {
+            fcntl(conn->request_fd, F_SETFL, fcntl(conn->request_fd, F_GETFL) & ~O_NONBLOCK);
+        }
+    }
+    conn->response_fd = conn->request_fd == -1 ? -1 : open(conn->response_name, O_RDONLY);
+    if (conn->request_fd == -1 || conn->response_fd == -1) {
+        perror("Failed to open client FIFO");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
 }
 
-void send_command(const char *server_fifo, const char *message) {
-    int server_fd = open(server_fifo, O_WRONLY);
-    if (server_fd == -1) {
-        perror("Failed to open server FIFO");
+// Send a command on a new stream and return the stream id
+uint32_t send_command(Connection *conn, const char *message) {
+    uint32_t stream = conn->next_stream++;
+    if (send_text(conn->request_fd, FRAME_COMMAND, stream, message) < 0) {
+        perror("Failed to write to client FIFO");
         exit(EXIT_FAILURE);
     }
+    return stream;
+}
 
-    char full_message[1024]; // Yeterli büyüklükte bir tampon
-    snprintf(full_message, sizeof(full_message), "%s\n", message); // Mesaja newline ekleyin
+// Ask for compressed data frames with 'codec' "lz", or for none with "off"
+void set_compression(Connection *conn, const char *codec) {
+    char command[FRAME_COMMAND_MAX];
+    snprintf(command, sizeof(command), "compress %s", codec);
+    if (read_response(conn, send_command(conn, command), -1) == 0) {
+        conn->compress = strcmp(codec, "lz") == 0;
+    }
+}
 
-    if (write(server_fd, full_message, strlen(full_message)) != strlen(full_message)) {
-        perror("Failed to write to server FIFO");
-        close(server_fd);
+// Read the payload of the frame whose header was just received into 'payload', NUL-terminated
+static int frame_payload(Connection *conn, const FrameHeader *header, char *payload) {
+    if (header->length > FRAME_MAX_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (read_full(conn->response_fd, payload, header->length) < 0) {
+        return -1;
+    }
+    payload[header->length] = '\0';
+    return 0;
+}
+
+/*
+ * Read one frame; the payload of a data frame on 'stream' is spliced into 'data_fd'
+ * when there is one, decompressed first if it is a compressed one. Other payloads
+ * land in 'payload', NUL-terminated. Returns the data bytes written to 'data_fd'.
+ * Exits if the session is lost.
+ */
+static size_t next_frame(Connection *conn, FrameHeader *header, char *payload, uint32_t stream, int data_fd) {
+    int status = recv_header(conn->response_fd, header);
+    if (status == 0) {
+        fprintf(stderr, "Server closed the session\n");
         exit(EXIT_FAILURE);
     }
-    close(server_fd);
+    if (status > 0 && (header->type == FRAME_DATA || header->type == FRAME_ZDATA) && header->stream == stream &&
+        data_fd >= 0 && header->length <= FRAME_MAX_PAYLOAD) {
+        if (header->type == FRAME_DATA && recv_to_file(conn->response_fd, data_fd, NULL, header->length) == 0) {
+            return header->length;
+        }
+        ssize_t n = header->type == FRAME_ZDATA ? lz_recv(conn->response_fd, header->length, data_fd, NULL) : -1;
+        if (n >= 0) {
+            return n;
+        }
+        perror("Failed to write downloaded file");
+        exit(EXIT_FAILURE);
+    }
+    if (status < 0 || frame_payload(conn, header, payload) < 0) {
+        perror("Failed to read from client FIFO");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
 }
 
+/*
+ * Print the reply to 'stream' up to its last frame; data frames go to 'download_fd'.
+ * Returns 0 for FRAME_END, -1 for FRAME_ERROR.
+ */
+int read_response(Connection *conn, uint32_t stream, int download_fd) {
+    static char payload[FRAME_MAX_PAYLOAD + 1];
+    FrameHeader header;
+    int printed = 0;
+    for (;;) {
+        next_frame(conn, &header, payload, stream, download_fd);
+        if (header.stream != stream) {
+            fprintf(stderr, "Ignoring frame for stream %u\n", header.stream);
+            continue;
+        }
+        if (header.type == FRAME_DATA || header.type == FRAME_ZDATA) {
+            continue;
+        }
+        if (header.length > 0) {
+            printf("%s%s", printed++ ? "" : "Server response:\n", payload);
+        }
+        if (header.type == FRAME_END || header.type == FRAME_ERROR) {
+            return header.type == FRAME_END ? 0 : -1;
+        }
+    }
+}
 
-void read_response(const char *client_fifo) {
-    int client_fd = open(client_fifo, O_RDONLY);
-    if (client_fd == -1) {
-        perror("Failed to open client FIFO");
+/*
+ * Upload local files, all in flight at once: each gets an upload command with its
+ * size on a stream of its own, then the files take turns sending a data frame,
+ * spliced from the file, and each ends with FRAME_END. The replies are read after
+ * all the data went out. Returns the number of uploads that failed.
+ */
+int upload(Connection *conn, char *const *paths, int count, int verbose) {
+    int fds[UPLOAD_MAX];
+    uint32_t streams[UPLOAD_MAX];
+    off_t left[UPLOAD_MAX];
+    int active = 0;
+    char command[FRAME_COMMAND_MAX];
+    for (int i = 0; i < count && active < UPLOAD_MAX; i++) {
+        struct stat st;
+        int fd = open(paths[i], O_RDONLY);
+        if (fd == -1 || fstat(fd, &st) != 0) {
+            perror("Failed to open file for upload");
+            if (fd != -1) {
+                close(fd);
+            }
+            continue;
+        }
+        const char *base = strrchr(paths[i], '/');
+        snprintf(command, sizeof(command), "upload %s %lld", base ? base + 1 : paths[i], (long long)st.st_size);
+        fds[active] = fd;
+        left[active] = st.st_size;
+        streams[active++] = send_command(conn, command);
+    }
+
+    // Compressed, a round takes one chunk of each file and compresses them side by side
+    LzBatch batch;
+    lz_batch_open(&batch, conn->request_fd, active);
+    for (int sending = active; sending > 0; ) {
+        sending = 0;
+        for (int i = 0; i < active; i++) {
+            if (fds[i] == -1) {
+                continue;
+            }
+            size_t chunk = left[i] < CHANNEL_FILE_CHUNK ? (size_t)left[i] : CHANNEL_FILE_CHUNK;
+            int status = 0;
+            if (chunk > 0 && !conn->compress) {
+                status = send_file_frame(conn->request_fd, FRAME_DATA, streams[i], fds[i], NULL, chunk);
+            } else if (chunk > 0) {
+                char *buffer = lz_batch_buffer(&batch);
+                status = buffer && read_full(fds[i], buffer, chunk) == 0 ? lz_batch_add(&batch, streams[i], chunk) : -1;
+            }
+            left[i] -= chunk;
+            // All of a file's data goes out before its end frame
+            if (status == 0 && left[i] == 0 && conn->compress) {
+                status = lz_batch_send(&batch);
+            }
+            if (status < 0) {
+                perror("Failed to send file data");
+                exit(EXIT_FAILURE);
+            }
+            if (left[i] > 0) {
+                sending++;
+                continue;
+            }
+            send_frame(conn->request_fd, FRAME_END, streams[i], NULL, 0);
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+    lz_batch_close(&batch);
+
+    static char payload[FRAME_MAX_PAYLOAD + 1];
+    int failed = 0;
+    int printed = 0;
+    for (int pending = active; pending > 0; ) {
+        FrameHeader header;
+        next_frame(conn, &header, payload, 0, -1);
+        int i = 0;
+        while (i < active && streams[i] != header.stream) {
+            i++;
+        }
+        if (i == active) {
+            fprintf(stderr, "Ignoring frame for stream %u\n", header.stream);
+            continue;
+        }
+        if (verbose && header.length > 0) {
+            printf("%s%s", printed++ ? "" : "Server response:\n", payload);
+        }
+        if (header.type == FRAME_END || header.type == FRAME_ERROR) {
+            failed += header.type == FRAME_ERROR;
+            pending--;
+        }
+    }
+    return failed;
+}
+
+void download(Connection *conn, const char *command, const char *filename) {
+    const char *base = strrchr(filename, '/');
+    int fd = open(base ? base + 1 : filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Failed to create downloaded file");
+        return;
+    }
+    read_response(conn, send_command(conn, command), fd);
+    close(fd);
+}
+
+/*
+ * Read the reply to 'stream' up to the manifest it opens with. Returns the chunk
+ * checksums, malloc'd, or NULL once the error is printed.
+ */
+static uint32_t *recv_manifest(Connection *conn, uint32_t stream, ManifestHeader *manifest) {
+    static char payload[FRAME_MAX_PAYLOAD + 1];
+    FrameHeader header;
+    do {
+        next_frame(conn, &header, payload, stream, -1);
+        if (header.stream == stream && (header.type == FRAME_ERROR || header.type == FRAME_END)) {
+            printf("Server response:\n%s", payload);
+            return NULL;
+        }
+    } while (header.stream != stream || header.type != FRAME_DATA);
+    memcpy(manifest, payload, header.length < sizeof(*manifest) ? header.length : sizeof(*manifest));
+    if (header.length < sizeof(*manifest) || manifest->chunk_size != TRANSFER_CHUNK_SIZE ||
+        manifest->count != transfer_chunk_count(manifest->size) ||
+        header.length != sizeof(*manifest) + manifest->count * sizeof(uint32_t)) {
+        fprintf(stderr, "Invalid manifest from the server\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t *crcs = malloc((manifest->count ? manifest->count : 1) * sizeof(uint32_t));
+    if (!crcs) {
+        perror("malloc failed");
         exit(EXIT_FAILURE);
     }
+    memcpy(crcs, payload + sizeof(*manifest), manifest->count * sizeof(uint32_t));
+    return crcs;
+}
 
-    char response[1024];
-    ssize_t numBytes = read(client_fd, response, sizeof(response) - 1);
-    if (numBytes == -1) {
-        perror("Failed to read from client FIFO");
-        close(client_fd);
+/*
+ * Fetch the 'count' chunks in 'list' into 'fd', asking for runs of consecutive
+ * chunks with FETCH_WINDOW commands in flight. Each chunk is checked against its
+ * own checksum and against the manifest, in case the file changed since.
+ * Returns the number of chunks that did not arrive intact.
+ */
+static int fetch_chunks(Connection *conn, const char *filename, int fd, const uint32_t *remote,
+                        const uint32_t *list, int count) {
+    static char payload[FRAME_MAX_PAYLOAD + 1];
+    char command[FRAME_COMMAND_MAX];
+    int failed = 0, fetched = 0, next = 0, in_flight = 0;
+    while (next < count || in_flight > 0) {
+        while (next < count && in_flight < FETCH_WINDOW) {
+            int last = next;
+            while (last + 1 < count && list[last + 1] == list[last] + 1 && last + 1 - next < FETCH_RUN_MAX) {
+                last++;
+            }
+            snprintf(command, sizeof(command), "chunks %s %u-%u", filename, list[next], list[last]);
+            send_command(conn, command);
+            in_flight++;
+            next = last + 1;
+        }
+
+        FrameHeader header;
+        int status = recv_header(conn->response_fd, &header);
+        if (status <= 0) {
+            fprintf(stderr, "Lost the session during the fetch\n");
+            exit(EXIT_FAILURE);
+        }
+        if (header.type == FRAME_CHUNK) {
+            ChunkHeader chunk;
+            status = recv_chunk(conn->response_fd, header.length, fd, &chunk);
+            if (status < 0) {
+                perror("Failed to write fetched chunk");
+                exit(EXIT_FAILURE);
+            }
+            if (status > 0 || chunk.crc != remote[chunk.offset / TRANSFER_CHUNK_SIZE]) {
+                failed++;
+            }
+            fetched++;
+            continue;
+        }
+        if (frame_payload(conn, &header, payload) < 0) {
+            perror("Failed to read from client FIFO");
+            exit(EXIT_FAILURE);
+        }
+        if (header.type == FRAME_ERROR) {
+            fprintf(stderr, "%s", payload);
+        }
+        if (header.type == FRAME_END || header.type == FRAME_ERROR) {
+            in_flight--;
+        }
+    }
+    return failed + (count - fetched);
+}
+
+/*
+ * Download a file in checksummed chunks, fetching only the chunks whose checksum
+ * differs from the manifest; a local copy left by an interrupted fetch is resumed.
+ * With several streams, the missing chunks are split into contiguous shares written
+ * with pwrite(): the first goes over this session, each other one over a session of
+ * its own opened by a child process. A share whose session no worker takes within
+ * FETCH_CONNECT_MS is fetched over this session afterwards, so a busy server only
+ * makes the fetch use fewer streams.
+ */
+void fetch(Connection *conn, const char *filename, int streams) {
+    char command[FRAME_COMMAND_MAX];
+    snprintf(command, sizeof(command), "manifest %s", filename);
+    uint32_t stream = send_command(conn, command);
+    ManifestHeader manifest;
+    uint32_t *remote = recv_manifest(conn, stream, &manifest);
+    if (!remote) {
+        return;
+    }
+    read_response(conn, stream, -1);
+
+    const char *base = strrchr(filename, '/');
+    int fd = open(base ? base + 1 : filename, O_RDWR | O_CREAT, 0644);
+    uint32_t *local = NULL;
+    uint32_t *missing = malloc((manifest.count ? manifest.count : 1) * sizeof(uint32_t));
+    if (fd == -1 || ftruncate(fd, manifest.size) != 0 || !missing ||
+        !(local = transfer_checksums(fd, manifest.size))) {
+        perror("Failed to prepare the fetched file");
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    for (uint32_t i = 0; i < manifest.count; i++) {
+        if (local[i] != remote[i]) {
+            missing[count++] = i;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    streams = streams < 1 ? 1 : streams > TRANSFER_MAX_STREAMS ? TRANSFER_MAX_STREAMS : streams;
+    streams = streams > count ? (count > 0 ? count : 1) : streams;
+    int failed = 0, sessions = 1;
+    if (streams == 1) {
+        failed = count > 0 ? fetch_chunks(conn, filename, fd, remote, missing, count) : 0;
+    } else {
+        fflush(stdout);
+        pid_t children[TRANSFER_MAX_STREAMS];
+        for (int s = 1; s < streams; s++) {
+            int first = (long long)count * s / streams, last = (long long)count * (s + 1) / streams;
+            children[s] = fork();
+            if (children[s] == 0) {
+                Connection share;
+                if (try_connect_server(conn->server_fifo, &share, FETCH_CONNECT_MS) < 0) {
+                    exit(FETCH_NO_SESSION);
+                }
+                int share_failed = fetch_chunks(&share, filename, fd, remote, missing + first, last - first);
+                read_response(&share, send_command(&share, "quit"), -1);
+                close_session(&share);
+                exit(share_failed >= FETCH_NO_SESSION ? FETCH_NO_SESSION - 1 : share_failed);
+            } else if (children[s] < 0) {
+                perror("fork failed");
+            }
+        }
+        failed = fetch_chunks(conn, filename, fd, remote, missing, (long long)count / streams);
+        for (int s = 1; s < streams; s++) {
+            int first = (long long)count * s / streams, last = (long long)count * (s + 1) / streams;
+            int status = 0;
+            if (children[s] > 0 && waitpid(children[s], &status, 0) > 0 &&
+                !(WIFEXITED(status) && WEXITSTATUS(status) == FETCH_NO_SESSION)) {
+                failed += WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+                sessions++;
+            } else {
+                failed += fetch_chunks(conn, filename, fd, remote, missing + first, last - first);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double fetched_bytes = (double)count * TRANSFER_CHUNK_SIZE;
+    if (count > 0 && missing[count - 1] == manifest.count - 1) {
+        fetched_bytes -= (double)manifest.count * TRANSFER_CHUNK_SIZE - manifest.size; // Short last chunk
+    }
+
+    if (failed > 0) {
+        printf("Fetch of '%s': %d chunks did not arrive intact, fetch it again to retry them.\n", filename, failed);
+    } else {
+        printf("Fetched %d of %u chunks of '%s' (%u already present) over %d stream%s in %.1f ms, %.1f MB/s\n",
+               count, manifest.count, filename, manifest.count - count, sessions, sessions > 1 ? "s" : "",
+               seconds * 1e3, seconds > 0 ? fetched_bytes / seconds / 1e6 : 0.0);
+    }
+    close(fd);
+    free(local);
+    free(remote);
+    free(missing);
+}
+
+/*
+ * Upload a file in checksummed chunks: the server answers with the manifest of the
+ * partial copy it holds, and only the chunks that differ are sent.
+ */
+void put(Connection *conn, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        perror("Failed to open file for upload");
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    char command[FRAME_COMMAND_MAX];
+    const char *base = strrchr(path, '/');
+    snprintf(command, sizeof(command), "put %s %lld", base ? base + 1 : path, (long long)st.st_size);
+    uint32_t stream = send_command(conn, command);
+    ManifestHeader manifest;
+    uint32_t *remote = recv_manifest(conn, stream, &manifest);
+    uint32_t *local = remote ? transfer_checksums(fd, st.st_size) : NULL;
+    if (!local) {
+        if (remote) {
+            perror("Failed to read file for upload");
+            exit(EXIT_FAILURE); // The server waits for the chunks
+        }
+        close(fd);
+        return;
+    }
+    uint32_t sent = 0;
+    for (uint32_t i = 0; i < manifest.count; i++) {
+        if (local[i] == remote[i]) {
+            continue;
+        }
+        uint64_t offset = (uint64_t)i * TRANSFER_CHUNK_SIZE;
+        size_t length = st.st_size - offset < TRANSFER_CHUNK_SIZE ? st.st_size - offset : TRANSFER_CHUNK_SIZE;
+        if (send_chunk(conn->request_fd, stream, fd, offset, length) < 0) {
+            perror("Failed to send file data");
+            exit(EXIT_FAILURE);
+        }
+        sent++;
+    }
+    send_frame(conn->request_fd, FRAME_END, stream, NULL, 0);
+    if (read_response(conn, stream, -1) == 0) {
+        printf("Sent %u of %u chunks (%u already on the server)\n", sent, manifest.count, manifest.count - sent);
+    }
+    close(fd);
+    free(local);
+    free(remote);
+}
+
+static int compare_ns(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Measure command round trips on the open session: 'iterations' commands, each sent
+ * only after the previous reply ended. Without a file they are help commands; with
+ * one they are readF and writeT of random lines among the first BENCH_LINES, with
+ * 'write_percent' of them writes, so several clients at once make a mixed load.
+ */
+void benchmark(Connection *conn, int iterations, const char *file, int write_percent) {
+    long long *samples = malloc(iterations * sizeof(long long));
+    if (!samples) {
+        perror("malloc failed");
         exit(EXIT_FAILURE);
     }
+    // The replies are not printed: read them here
+    static char payload[FRAME_MAX_PAYLOAD];
+    char command[FRAME_COMMAND_MAX];
+    long long total = 0;
+    srand(getpid());
+    for (int i = 0; i < iterations; i++) {
+        int line = rand() % BENCH_LINES + 1;
+        if (!file) {
+            strcpy(command, "help");
+        } else if (rand() % 100 < write_percent) {
+            snprintf(command, sizeof(command), "writeT %s %d client %d write %d", file, line, getpid(), i);
+        } else {
+            snprintf(command, sizeof(command), "readF %s %d", file, line);
+        }
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint32_t stream = send_command(conn, command);
+        FrameHeader header;
+        do {
+            if (recv_frame(conn->response_fd, &header, payload, sizeof(payload)) <= 0) {
+                perror("Failed to read from client FIFO");
+                exit(EXIT_FAILURE);
+            }
+        } while (header.stream != stream || (header.type != FRAME_END && header.type != FRAME_ERROR));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        samples[i] = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+        total += samples[i];
+    }
+    qsort(samples, iterations, sizeof(long long), compare_ns);
+    if (file) {
+        printf("Mixed load on '%s' with %d%% writes: %.0f ops/s\n", file, write_percent, iterations / (total / 1e9));
+    }
+    printf("Round trip over %d commands: avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n", iterations,
+           total / 1e3 / iterations, samples[iterations / 2] / 1e3, samples[(int)(iterations * 0.99)] / 1e3,
+           samples[iterations - 1] / 1e3);
+    free(samples);
+}
 
-    response[numBytes] = '\0';
-    printf("Server response:\n%s\n", response);
-    close(client_fd);
+/*
+ * Measure download throughput: run 'command', a download or an archive, 'iterations'
+ * times with its data going to /dev/null, so only the server and the channel are
+ * timed, not the local disk.
+ */
+void benchmark_download(Connection *conn, int iterations, const char *command) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1) {
+        perror("Failed to open /dev/null");
+        exit(EXIT_FAILURE);
+    }
+    static char payload[FRAME_MAX_PAYLOAD + 1];
+    long long bytes = 0, wire = 0, best = 0, total = 0;
+    for (int i = 0; i < iterations; i++) {
+        struct timespec start, end;
+        long long size = 0;
+        wire = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint32_t stream = send_command(conn, command);
+        FrameHeader header;
+        do {
+            size += next_frame(conn, &header, payload, stream, null_fd);
+            if (header.stream == stream && (header.type == FRAME_DATA || header.type == FRAME_ZDATA)) {
+                wire += header.length;
+            }
+        } while (header.stream != stream || (header.type != FRAME_END && header.type != FRAME_ERROR));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (header.type == FRAME_ERROR) {
+            fprintf(stderr, "Download failed: %s", payload);
+            exit(EXIT_FAILURE);
+        }
+        long long ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+        best = best == 0 || ns < best ? ns : best;
+        total += ns;
+        bytes = size;
+    }
+    close(null_fd);
+    printf("Reply to '%s' (%lld bytes, %lld sent, %.2fx) over %d runs: avg %.1f MB/s, best %.1f MB/s\n", command, bytes,
+           wire, wire ? (double)bytes / wire : 1.0, iterations, bytes * (double)iterations / (total / 1e9) / 1e6,
+           bytes / (best / 1e9) / 1e6);
+}
+
+// Measure upload throughput: send 'path' 'iterations' times, each stored on the server's disk
+void benchmark_upload(Connection *conn, int iterations, char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror("Failed to open file for upload");
+        exit(EXIT_FAILURE);
+    }
+    long long best = 0, total = 0;
+    for (int i = 0; i < iterations; i++) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (upload(conn, &path, 1, 0) != 0) {
+            fprintf(stderr, "Upload failed\n");
+            exit(EXIT_FAILURE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        long long ns = (end.tv_sec - start.tv_sec) * 1000000000LL + (end.tv_nsec - start.tv_nsec);
+        best = best == 0 || ns < best ? ns : best;
+        total += ns;
+    }
+    printf("Upload of '%s' (%lld bytes) over %d runs: avg %.1f MB/s, best %.1f MB/s\n", path, (long long)st.st_size,
+           iterations, st.st_size * (double)iterations / (total / 1e9) / 1e6, st.st_size / (best / 1e9) / 1e6);
 }
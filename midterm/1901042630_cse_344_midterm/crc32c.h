@@ -0,0 +1,19 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * CRC32C (Castagnoli), the checksum of chunked transfers.
+ * Uses the SSE4.2 crc32 instruction when the CPU has it, checked once at run time,
+ * and a slicing-by-8 table otherwise; both give the same result.
+ */
+
+// Continue 'crc' (0 to start) over 'len' bytes
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+// 1 if the hardware instruction is used
+int crc32c_hardware(void);
+
+#endif // CRC32C_H
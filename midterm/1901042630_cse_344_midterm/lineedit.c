@@ -0,0 +1,121 @@
+#include "lineedit.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+static char chunk[LINE_EDIT_CHUNK];
+
+static int pwrite_full(int fd, const void *buf, size_t len, off_t at) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, at);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        at += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * Move the bytes [from, size) so they start at 'to'.
+ * Copies front to back when moving down and back to front when moving up, so a
+ * chunk is always read before the move overwrites it.
+ */
+static int move_tail(int fd, off_t from, off_t to, off_t size) {
+    if (to < from) {
+        for (off_t off = from; off < size; ) {
+            size_t len = size - off < (off_t)sizeof(chunk) ? (size_t)(size - off) : sizeof(chunk);
+            ssize_t n = pread(fd, chunk, len, off);
+            if (n <= 0 || pwrite_full(fd, chunk, n, to + (off - from)) < 0) {
+                return -1;
+            }
+            off += n;
+        }
+    } else if (to > from) {
+        for (off_t off = size; off > from; ) {
+            size_t len = off - from < (off_t)sizeof(chunk) ? (size_t)(off - from) : sizeof(chunk);
+            off -= len;
+            if (pread(fd, chunk, len, off) != (ssize_t)len || pwrite_full(fd, chunk, len, off + (to - from)) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Append 'text' as new line(s) at the end, after 'padding' empty lines
+static int append_line(LineIndex *index, int fd, const char *text, uint64_t padding) {
+    off_t size = index->file_size;
+    char last = '\n';
+    if (size > 0 && pread(fd, &last, 1, size - 1) != 1) {
+        return -1;
+    }
+    size_t text_len = strlen(text);
+    size_t len = (last != '\n') + padding + text_len + 1;
+    char *buf = malloc(len);
+    if (!buf) {
+        return -1;
+    }
+    char *p = buf;
+    if (last != '\n') {
+        *p++ = '\n'; // Finish a last line without a newline
+    }
+    memset(p, '\n', padding);
+    p += padding;
+    memcpy(p, text, text_len);
+    p[text_len] = '\n';
+
+    int status = pwrite_full(fd, buf, len, size);
+    free(buf);
+    if (status < 0) {
+        return -1;
+    }
+    return line_index_update(index, fd, size);
+}
+
+int line_edit(LineIndex *index, int fd, uint64_t line, const char *text, int mode) {
+    off_t size = index->file_size;
+    if (line == 0) {
+        return append_line(index, fd, text, 0);
+    }
+    off_t start = line_index_find(index, fd, line);
+    if (start >= size) {
+        // Past the last line: complete lines so far, counting one without a newline
+        char last = '\n';
+        uint64_t lines = index->lines;
+        if (size > 0 && pread(fd, &last, 1, size - 1) == 1 && last != '\n') {
+            lines++;
+        }
+        return append_line(index, fd, text, line > lines + 1 ? line - lines - 1 : 0);
+    }
+    off_t end = mode == LINE_EDIT_INSERT ? start : line_index_find(index, fd, line + 1);
+
+    size_t text_len = strlen(text);
+    off_t new_len = text_len + 1;
+    off_t delta = new_len - (end - start);
+    if (delta < 0) {
+        if (pwrite_full(fd, text, text_len, start) < 0 || pwrite_full(fd, "\n", 1, start + text_len) < 0 ||
+            move_tail(fd, end, end + delta, size) < 0 || ftruncate(fd, size + delta) != 0) {
+            return -1;
+        }
+    } else {
+        if (move_tail(fd, end, end + delta, size) < 0 ||
+            pwrite_full(fd, text, text_len, start) < 0 || pwrite_full(fd, "\n", 1, start + text_len) < 0) {
+            return -1;
+        }
+    }
+
+    // A replaced line keeps the line count, so the checkpoints after it just move;
+    // a last line that had no newline gained one, which the rescan counts
+    if (mode == LINE_EDIT_REPLACE && end < size && !memchr(text, '\n', text_len)) {
+        return line_index_shift(index, fd, start, delta);
+    }
+    return line_index_update(index, fd, start);
+}
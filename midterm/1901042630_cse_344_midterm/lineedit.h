@@ -0,0 +1,27 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include "lineindex.h"
+
+/*
+ * Line edits for writeT and insertT.
+ * An edit writes the new line where the old one started and moves only the tail of
+ * the file by the difference in length, in large chunks: forward for a shorter
+ * line, backward from the end for a longer one, then the file is truncated or was
+ * extended by the move. The cost is the tail of the file, never its head. The line
+ * index follows: checkpoints after the edit are shifted when the line count did not
+ * change, and rescanned from the edit otherwise.
+ */
+
+#define LINE_EDIT_REPLACE 0   // The text replaces the line
+#define LINE_EDIT_INSERT  1   // The text becomes the line, the old one moves down
+#define LINE_EDIT_CHUNK (1 << 20)
+
+/*
+ * Write 'text' plus a newline as line 'line' (1-based), or append it as a new last
+ * line when 'line' is 0. A file with fewer lines is padded with empty lines.
+ * Returns 0, or -1 with errno set.
+ */
+int line_edit(LineIndex *index, int fd, uint64_t line, const char *text, int mode);
+
+#endif // LINEEDIT_H
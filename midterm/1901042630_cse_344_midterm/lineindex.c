@@ -0,0 +1,316 @@
+#include "lineindex.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define LINE_INDEX_MAGIC "LINEIDX2"
+
+// Sidecar layout: this header, then 'count' 64-bit offsets
+typedef struct {
+    char magic[8];
+    uint32_t every;
+    int32_t tail;
+    uint64_t file_size;
+    uint64_t mtime_ns;
+    uint64_t ctime_ns;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t lines;
+    uint64_t count;
+} LineIndexHeader;
+
+static char block[LINE_INDEX_BLOCK];
+
+// Sidecar path of a file; '/' and '%' are escaped so every file maps to one flat name
+static void sidecar_path(const char *filename, char *path, size_t size) {
+    size_t len = snprintf(path, size, "%s/", LINE_INDEX_DIR);
+    for (const char *p = filename; *p && len + 3 < size; p++) {
+        if (*p == '/' || *p == '%') {
+            len += snprintf(path + len, size - len, "%%%02x", (unsigned char)*p);
+        } else {
+            path[len++] = *p;
+        }
+    }
+    path[len] = '\0';
+}
+
+static int reserve(LineIndex *index, uint64_t count) {
+    if (count <= index->capacity) {
+        return 0;
+    }
+    uint64_t capacity = index->capacity ? index->capacity * 2 : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    uint64_t *offsets = realloc(index->offsets, capacity * sizeof(uint64_t));
+    if (!offsets) {
+        return -1;
+    }
+    index->offsets = offsets;
+    index->capacity = capacity;
+    return 0;
+}
+
+/*
+ * Write the checkpoints from 'first' on and then the header, so a crash in between
+ * leaves a header that still describes valid checkpoints.
+ */
+static void persist(LineIndex *index, uint64_t first) {
+    if (index->fd < 0) {
+        return;
+    }
+    size_t bytes = (index->count - first) * sizeof(uint64_t);
+    off_t at = sizeof(LineIndexHeader) + first * sizeof(uint64_t);
+    if (bytes > 0 && pwrite(index->fd, index->offsets + first, bytes, at) != (ssize_t)bytes) {
+        perror("Failed to write line index");
+        return;
+    }
+    if (ftruncate(index->fd, at + bytes) != 0) {
+        perror("Failed to truncate line index");
+    }
+    LineIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LINE_INDEX_MAGIC, sizeof(header.magic));
+    header.every = LINE_INDEX_EVERY;
+    header.file_size = index->file_size;
+    header.mtime_ns = index->mtime_ns;
+    header.ctime_ns = index->ctime_ns;
+    header.dev = index->dev;
+    header.ino = index->ino;
+    header.tail = index->tail;
+    header.lines = index->lines;
+    header.count = index->count;
+    if (pwrite(index->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        perror("Failed to write line index");
+    }
+}
+
+static uint64_t mtime_ns(const struct stat *st) {
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000ULL + st->st_mtim.tv_nsec;
+}
+
+static uint64_t ctime_ns(const struct stat *st) {
+    return (uint64_t)st->st_ctim.tv_sec * 1000000000ULL + st->st_ctim.tv_nsec;
+}
+
+// Last byte of the first 'size' bytes of the file, -1 if there is none
+static int byte_before(int file_fd, uint64_t size) {
+    unsigned char byte;
+    if (size == 0 || pread(file_fd, &byte, 1, size - 1) != 1) {
+        return -1;
+    }
+    return byte;
+}
+
+// Record the file the index now describes
+static int stamp(LineIndex *index, int file_fd) {
+    struct stat st;
+    if (fstat(file_fd, &st) != 0) {
+        return -1;
+    }
+    index->mtime_ns = mtime_ns(&st);
+    index->ctime_ns = ctime_ns(&st);
+    index->dev = st.st_dev;
+    index->ino = st.st_ino;
+    index->tail = byte_before(file_fd, index->file_size);
+    return 0;
+}
+
+int line_index_update(LineIndex *index, int file_fd, off_t changed_from) {
+    // Keep the checkpoints at or before the change; the bytes before it did not move
+    uint64_t keep = 0;
+    uint64_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        if (index->offsets[mid] <= (uint64_t)changed_from) {
+            keep = mid + 1;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (keep == 0) {
+        if (reserve(index, 1) < 0) {
+            return -1;
+        }
+        index->offsets[0] = 0;
+        keep = 1;
+    }
+    index->count = keep;
+    index->lines = (keep - 1) * LINE_INDEX_EVERY;
+
+    // Rescan from the last kept checkpoint to the end of the file
+    uint64_t pos = index->offsets[keep - 1];
+    ssize_t n;
+    while ((n = pread(file_fd, block, sizeof(block), pos)) > 0) {
+        for (char *p = block, *end = block + n; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+            if (++index->lines % LINE_INDEX_EVERY == 0) {
+                if (reserve(index, index->count + 1) < 0) {
+                    return -1;
+                }
+                index->offsets[index->count++] = pos + (p - block) + 1;
+            }
+        }
+        pos += n;
+    }
+    if (n < 0) {
+        return -1;
+    }
+
+    index->file_size = pos;
+    if (stamp(index, file_fd) < 0) {
+        return -1;
+    }
+    persist(index, keep);
+    return 0;
+}
+
+int line_index_shift(LineIndex *index, int file_fd, off_t at, off_t delta) {
+    uint64_t first = index->count;
+    for (uint64_t i = index->count; i > 0 && index->offsets[i - 1] > (uint64_t)at; i--) {
+        index->offsets[i - 1] += delta;
+        first = i - 1;
+    }
+    index->file_size += delta;
+    if (stamp(index, file_fd) < 0) {
+        return -1;
+    }
+    persist(index, first);
+    return 0;
+}
+
+int line_index_open(LineIndex *index, const char *filename, int file_fd) {
+    memset(index, 0, sizeof(*index));
+    if (mkdir(LINE_INDEX_DIR, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create line index directory");
+    }
+    char path[512];
+    sidecar_path(filename, path, sizeof(path));
+    index->fd = open(path, O_RDWR | O_CREAT, 0644); // Without it the index just is not kept
+
+    // Load the sidecar if it is ours and complete
+    LineIndexHeader header;
+    struct stat side;
+    if (index->fd >= 0 && pread(index->fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, LINE_INDEX_MAGIC, sizeof(header.magic)) == 0 && header.every == LINE_INDEX_EVERY &&
+        fstat(index->fd, &side) == 0 &&
+        (uint64_t)side.st_size >= sizeof(header) + header.count * sizeof(uint64_t) && header.count > 0 &&
+        reserve(index, header.count) == 0 &&
+        pread(index->fd, index->offsets, header.count * sizeof(uint64_t), sizeof(header)) ==
+            (ssize_t)(header.count * sizeof(uint64_t))) {
+        index->file_size = header.file_size;
+        index->mtime_ns = header.mtime_ns;
+        index->ctime_ns = header.ctime_ns;
+        index->dev = header.dev;
+        index->ino = header.ino;
+        index->tail = header.tail;
+        index->lines = header.lines;
+        index->count = header.count;
+    }
+
+    struct stat st;
+    if (fstat(file_fd, &st) != 0) {
+        line_index_close(index);
+        return -1;
+    }
+    int same_file = index->count > 0 && (uint64_t)st.st_dev == index->dev && (uint64_t)st.st_ino == index->ino;
+    if (same_file && (uint64_t)st.st_size == index->file_size && mtime_ns(&st) == index->mtime_ns &&
+        ctime_ns(&st) == index->ctime_ns) {
+        return 0; // Up to date
+    }
+    // Appended to: index the new tail only; anything else: rebuild
+    int appended = same_file && (uint64_t)st.st_size > index->file_size &&
+                   byte_before(file_fd, index->file_size) == index->tail;
+    off_t from = appended ? (off_t)index->file_size : 0;
+    if (line_index_update(index, file_fd, from) < 0) {
+        line_index_close(index);
+        return -1;
+    }
+    return 0;
+}
+
+void line_index_remove(const char *filename) {
+    char path[512];
+    sidecar_path(filename, path, sizeof(path));
+    if (unlink(path) != 0 && errno != ENOENT) {
+        perror("Failed to remove line index");
+    }
+}
+
+void line_index_close(LineIndex *index) {
+    if (index->fd >= 0) {
+        close(index->fd);
+    }
+    free(index->offsets);
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+}
+
+off_t line_index_find(LineIndex *index, int file_fd, uint64_t line) {
+    if (line == 0) {
+        line = 1;
+    }
+    uint64_t checkpoint = (line - 1) / LINE_INDEX_EVERY;
+    if (checkpoint >= index->count) {
+        return index->file_size; // Past the last line
+    }
+    uint64_t skip = (line - 1) % LINE_INDEX_EVERY;
+    uint64_t pos = index->offsets[checkpoint];
+    ssize_t n;
+    while (skip > 0 && (n = pread(file_fd, block, sizeof(block), pos)) > 0) {
+        char *p = block, *end = block + n;
+        while (skip > 0 && (p = memchr(p, '\n', end - p)) != NULL) {
+            p++;
+            skip--;
+        }
+        pos += skip == 0 ? (uint64_t)(p - block) : (uint64_t)n;
+        if (skip > 0 && n < (ssize_t)sizeof(block)) {
+            break;
+        }
+    }
+    return skip == 0 ? (off_t)pos : (off_t)index->file_size;
+}
+
+ssize_t line_index_read_line(LineIndex *index, int file_fd, uint64_t line, char *buf, size_t size) {
+    if (line == 0 || (line - 1) / LINE_INDEX_EVERY >= index->count) {
+        return -1;
+    }
+    // Usual case: the checkpoint, the skipped lines and the line itself fit in one block
+    uint64_t pos = index->offsets[(line - 1) / LINE_INDEX_EVERY];
+    uint64_t skip = (line - 1) % LINE_INDEX_EVERY;
+    ssize_t n = pread(file_fd, block, sizeof(block), pos);
+    if (n < 0) {
+        return -1;
+    }
+    char *p = block, *end = block + n;
+    while (skip > 0 && p && (p = memchr(p, '\n', end - p)) != NULL) {
+        p++;
+        skip--;
+    }
+    char *eol = p ? memchr(p, '\n', end - p) : NULL;
+    if (skip == 0 && (eol || n < (ssize_t)sizeof(block))) {
+        size_t len = eol ? (size_t)(eol - p + 1) : (size_t)(end - p);
+        if (len == 0) {
+            return -1; // Starts at the end of the file
+        }
+        len = len < size ? len : size;
+        memcpy(buf, p, len);
+        return len;
+    }
+
+    // Long lines: locate the start, then read up to the end of the line
+    off_t start = line_index_find(index, file_fd, line);
+    if ((uint64_t)start >= index->file_size) {
+        return -1;
+    }
+    n = pread(file_fd, buf, size, start);
+    if (n <= 0) {
+        return -1;
+    }
+    eol = memchr(buf, '\n', n);
+    return eol ? eol - buf + 1 : n;
+}
@@ -0,0 +1,60 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Sparse line index of a file, kept in a sidecar under LINE_INDEX_DIR.
+ * The sidecar holds the byte offset of every LINE_INDEX_EVERY-th line, so reaching
+ * line N costs one read from the checkpoint before it instead of a scan from the
+ * start of the file. It is built on first use and checked against the file's
+ * device, inode, size, mtime and ctime on every open: the same file that only grew,
+ * with its old last byte still in place, is indexed from its last checkpoint, and
+ * anything else, a file replaced by a rename included, rebuilds the index. Writers
+ * call line_index_update() with the first offset they changed, which rescans from
+ * the checkpoint before it; line_index_remove() drops the sidecar of a file that is
+ * about to be replaced.
+ */
+
+#define LINE_INDEX_DIR ".lineindex"
+#define LINE_INDEX_EVERY 256        // Lines between checkpoints
+#define LINE_INDEX_BLOCK 65536      // Read size when scanning
+
+typedef struct {
+    int fd;                 // Sidecar, -1 when the index only lives in memory
+    uint64_t file_size;     // Bytes of the file covered by the index
+    uint64_t mtime_ns;      // File mtime when the index was last brought up to date
+    uint64_t ctime_ns;
+    uint64_t dev;           // Identity of the indexed file
+    uint64_t ino;
+    int tail;               // Last covered byte, -1 for an empty file
+    uint64_t lines;         // Newlines in the covered bytes
+    uint64_t count;         // Checkpoints: offsets[i] is where line i * LINE_INDEX_EVERY + 1 starts
+    uint64_t capacity;
+    uint64_t *offsets;
+} LineIndex;
+
+// Load or build the index of 'filename', open as 'file_fd'; -1 on error
+int line_index_open(LineIndex *index, const char *filename, int file_fd);
+void line_index_close(LineIndex *index);
+
+// Drop the sidecar of 'filename'; called under its write lock before the file is replaced
+void line_index_remove(const char *filename);
+
+// Byte offset where 'line' (1-based) starts; the file size if the file has fewer lines
+off_t line_index_find(LineIndex *index, int file_fd, uint64_t line);
+
+/*
+ * Read 'line' into 'buf' with its newline, with a single pread when it lies within
+ * a block of its checkpoint. Returns its length, -1 if the file has fewer lines.
+ */
+ssize_t line_index_read_line(LineIndex *index, int file_fd, uint64_t line, char *buf, size_t size);
+
+// Bring the index up to date after the file changed at or after 'changed_from'
+int line_index_update(LineIndex *index, int file_fd, off_t changed_from);
+
+// Same, without reading the file, when a line starting at 'at' changed length by 'delta' bytes
+int line_index_shift(LineIndex *index, int file_fd, off_t at, off_t delta);
+
+#endif // LINEINDEX_H
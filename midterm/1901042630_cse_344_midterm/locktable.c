@@ -0,0 +1,202 @@
+#include "locktable.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+typedef struct {
+    pthread_mutex_t mutex;      // Process-shared and robust
+    pthread_cond_t cond;
+    int readers;
+    int writer;
+    int writers_waiting;
+} FileLock;
+
+// Lock held or waited for by a worker slot, so the parent can release it if the worker dies
+typedef struct {
+    int bucket;                 // -1 when nothing is held
+    int mode;
+    int waiting;                // Counted in writers_waiting, not holding the lock yet
+} HeldLock;
+
+typedef struct {
+    FileLock locks[LOCK_TABLE_SIZE];
+    int workers;
+    HeldLock held[];
+} LockTable;
+
+static LockTable *table = NULL;
+static size_t table_size = 0;
+static int worker_slot = -1;
+
+// Lock a table entry; a holder that died left counters only it could have changed mid-update
+static void entry_lock(FileLock *lock) {
+    if (pthread_mutex_lock(&lock->mutex) == EOWNERDEAD) {
+        pthread_mutex_consistent(&lock->mutex);
+    }
+}
+
+static void entry_wait(FileLock *lock) {
+    if (pthread_cond_wait(&lock->cond, &lock->mutex) == EOWNERDEAD) {
+        pthread_mutex_consistent(&lock->mutex);
+    }
+}
+
+int lock_table_create(int workers) {
+    char name[64];
+    snprintf(name, sizeof(name), "/fileserver_locks_%d", getpid());
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        perror("shm_open failed");
+        return -1;
+    }
+    // The workers inherit the mapping, so the name is not needed past this point
+    shm_unlink(name);
+    table_size = sizeof(LockTable) + workers * sizeof(HeldLock);
+    if (ftruncate(fd, table_size) != 0) {
+        perror("ftruncate failed");
+        close(fd);
+        return -1;
+    }
+    table = mmap(NULL, table_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (table == MAP_FAILED) {
+        perror("mmap failed");
+        table = NULL;
+        return -1;
+    }
+
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    for (int i = 0; i < LOCK_TABLE_SIZE; i++) {
+        pthread_mutex_init(&table->locks[i].mutex, &mutex_attr);
+        pthread_cond_init(&table->locks[i].cond, &cond_attr);
+    }
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    table->workers = workers;
+    for (int i = 0; i < workers; i++) {
+        table->held[i].bucket = -1;
+    }
+    return 0;
+}
+
+void lock_table_destroy(void) {
+    if (table) {
+        munmap(table, table_size);
+        table = NULL;
+    }
+}
+
+void lock_table_set_worker(int slot) {
+    worker_slot = slot;
+}
+
+// FNV-1a
+static int bucket_of(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash % LOCK_TABLE_SIZE;
+}
+
+/*
+ * The name a file is locked under: the real path of its directory and its base name,
+ * so "a.txt", "./a.txt" and "dir/../a.txt" share a lock. The file itself need not
+ * exist yet. A directory that cannot be resolved leaves the path as it is.
+ */
+static void canonical_name(const char *path, char *name, size_t size) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    const char *base = slash ? slash + 1 : path;
+    if (!slash) {
+        strcpy(dir, ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    }
+    char resolved[PATH_MAX];
+    if (!realpath(dir, resolved)) {
+        snprintf(name, size, "%s", path);
+    } else {
+        snprintf(name, size, "%s/%s", strcmp(resolved, "/") == 0 ? "" : resolved, base);
+    }
+}
+
+int file_lock(const char *path, int mode) {
+    HeldLock *held = &table->held[worker_slot];
+    if (held->bucket != -1) {
+        return -1;
+    }
+    char name[PATH_MAX + NAME_MAX + 2];
+    canonical_name(path, name, sizeof(name));
+    int bucket = bucket_of(name);
+    FileLock *lock = &table->locks[bucket];
+    entry_lock(lock);
+    held->mode = mode;
+    if (mode == FILE_LOCK_WRITE) {
+        // Recorded first, so a worker killed while it waits has its count taken back
+        held->waiting = 1;
+        held->bucket = bucket;
+        lock->writers_waiting++;
+        while (lock->writer || lock->readers > 0) {
+            entry_wait(lock);
+        }
+        lock->writers_waiting--;
+        held->waiting = 0;
+        lock->writer = 1;
+    } else {
+        while (lock->writer || lock->writers_waiting > 0) {
+            entry_wait(lock);
+        }
+        lock->readers++;
+        held->bucket = bucket;
+    }
+    pthread_mutex_unlock(&lock->mutex);
+    return 0;
+}
+
+static void release(HeldLock *held) {
+    if (held->bucket == -1) {
+        return;
+    }
+    FileLock *lock = &table->locks[held->bucket];
+    entry_lock(lock);
+    if (held->waiting) {
+        if (lock->writers_waiting > 0) {
+            lock->writers_waiting--;
+        }
+        held->waiting = 0;
+    } else if (held->mode == FILE_LOCK_WRITE) {
+        lock->writer = 0;
+    } else if (lock->readers > 0) {
+        lock->readers--;
+    }
+    held->bucket = -1;
+    pthread_cond_broadcast(&lock->cond);
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+void file_unlock(void) {
+    release(&table->held[worker_slot]);
+}
+
+void lock_table_release_worker(int slot) {
+    if (table && slot >= 0 && slot < table->workers) {
+        release(&table->held[slot]);
+    }
+}
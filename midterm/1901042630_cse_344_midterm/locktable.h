@@ -0,0 +1,34 @@
+#ifndef LOCKTABLE_H
+#define LOCKTABLE_H
+
+/*
+ * Reader/writer locks on files, shared by the worker processes.
+ * The table lives in POSIX shared memory mapped before the workers are forked.
+ * A file hashes by its canonical name, the real path of its directory and its
+ * base name, to one of LOCK_TABLE_SIZE locks, so readers of any file and
+ * writers of different files run in parallel, while a writer excludes everyone
+ * else on its file. Waiting writers hold back new readers so they are not starved.
+ * A worker holds or waits for at most one file lock at a time and records it in the
+ * table; if it dies, the parent releases that lock, or withdraws its wait, for it.
+ */
+
+#define LOCK_TABLE_SIZE 256
+
+#define FILE_LOCK_READ  1
+#define FILE_LOCK_WRITE 2
+
+// Parent: map the table for 'workers' worker slots; -1 on error
+int lock_table_create(int workers);
+void lock_table_destroy(void);
+
+// Worker: the slot its locks are recorded under
+void lock_table_set_worker(int slot);
+
+// Worker: lock 'path' for reading or writing, blocking; -1 if a lock is already held
+int file_lock(const char *path, int mode);
+void file_unlock(void);
+
+// Parent: release whatever lock a dead worker held
+void lock_table_release_worker(int slot);
+
+#endif // LOCKTABLE_H
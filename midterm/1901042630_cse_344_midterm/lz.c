@@ -0,0 +1,387 @@
+#include "lz.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5      // The block always ends with this many literals
+#define LZ_MATCH_LIMIT 12       // No match starts within this many bytes of the end
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 16
+#define LZ_SKIP_TRIGGER 6       // Past 2^6 misses in a row, the search steps over more bytes
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint64_t read64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Length past the 15 a token holds: bytes of 255, then the rest
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// Literals, then a match of 'match' bytes 'offset' back, none for the last sequence; NULL if out of room
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *literals, size_t lit, size_t offset,
+                             size_t match) {
+    if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1 + 2 + match / 255 + 1) {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15) {
+        op = put_length(op, lit - 15);
+    }
+    memcpy(op, literals, lit);
+    op += lit;
+    if (match == 0) {
+        return op;
+    }
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    match -= LZ_MIN_MATCH;
+    *token |= match < 15 ? match : 15;
+    if (match >= 15) {
+        op = put_length(op, match - 15);
+    }
+    return op;
+}
+
+/*
+ * Greedy parse: each position is looked up by the hash of its next four bytes,
+ * the table keeping the last position seen with that hash. A hit is checked,
+ * then the match is grown backwards over pending literals and forwards.
+ */
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap) {
+    const uint8_t *in = src;
+    const uint8_t *end = in + len;
+    const uint8_t *ip = in;
+    const uint8_t *anchor = in;   // Start of the literals not yet written
+    uint8_t *op = dst;
+    const uint8_t *oend = op + cap;
+
+    if (len >= LZ_MATCH_LIMIT) {
+        uint32_t table[1 << LZ_HASH_BITS];
+        memset(table, 0, sizeof(table));
+        const uint8_t *limit = end - LZ_MATCH_LIMIT;
+        const uint8_t *match_end = end - LZ_LAST_LITERALS;
+        unsigned misses = 0;
+        while (ip <= limit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash(sequence);
+            const uint8_t *ref = in + table[h];
+            table[h] = (uint32_t)(ip - in);
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence) {
+                ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *mp = ip + LZ_MIN_MATCH;
+            const uint8_t *mr = ref + LZ_MIN_MATCH;
+            while (mp < match_end) {
+                if (mp + 8 <= match_end) {
+                    uint64_t diff = read64(mp) ^ read64(mr);
+                    if (diff) {
+                        mp += __builtin_ctzll(diff) >> 3; // Little-endian: the first differing byte
+                        break;
+                    }
+                    mp += 8;
+                    mr += 8;
+                } else if (*mp == *mr) {
+                    mp++;
+                    mr++;
+                } else {
+                    break;
+                }
+            }
+            op = put_sequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip);
+            if (!op) {
+                return 0;
+            }
+            ip = anchor = mp;
+            if (ip <= limit) {
+                table[hash(read32(ip - 2))] = (uint32_t)(ip - 2 - in);
+            }
+        }
+    }
+    op = put_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (size_t)(op - (uint8_t *)dst) : 0;
+}
+
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+    unsigned byte;
+    do {
+        if (*ip >= iend) {
+            return -1;
+        }
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return 0;
+}
+
+ssize_t lz_decompress(const void *src, size_t len, void *dst, size_t cap) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = ip + len;
+    uint8_t *out = dst;
+    uint8_t *op = out;
+    const uint8_t *oend = out + cap;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15 && get_length(&ip, iend, &lit) < 0) {
+            return -1;
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) {
+            return op - out; // The last sequence has no match
+        }
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && get_length(&ip, iend, &match) < 0) {
+            return -1;
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - out) || match > (size_t)(oend - op)) {
+            return -1;
+        }
+        const uint8_t *ref = op - offset;
+        if (match + 8 <= (size_t)(oend - op)) {
+            // A match repeats every 'offset' bytes, so it can be copied from any multiple
+            // of it back: from eight or more back, eight bytes at a time
+            size_t distance = offset;
+            while (distance < 8) {
+                distance += offset;
+            }
+            size_t i = 0;
+            for (; i < distance - offset && i < match; i++) {
+                op[i] = ref[i];
+            }
+            for (; i < match; i += 8) {
+                memcpy(op + i, op + i - distance, 8);
+            }
+            op += match;
+        } else {
+            for (size_t i = 0; i < match; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+    return -1;
+}
+
+int lz_batch_open(LzBatch *batch, int fd, int size) {
+    memset(batch, 0, sizeof(*batch));
+    batch->fd = fd;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (size <= 0) {
+        size = cpus;
+    }
+    batch->size = size < 1 ? 1 : size > LZ_BATCH_MAX ? LZ_BATCH_MAX : size;
+    batch->threads = cpus < 1 ? 1 : cpus < batch->size ? (int)cpus : batch->size;
+    return 0;
+}
+
+void lz_batch_close(LzBatch *batch) {
+    for (int i = 0; i < LZ_BATCH_MAX; i++) {
+        free(batch->raw[i]);
+        free(batch->packed[i]);
+        batch->raw[i] = batch->packed[i] = NULL;
+    }
+}
+
+char *lz_batch_buffer(LzBatch *batch) {
+    int i = batch->count;
+    if (!batch->raw[i]) {
+        batch->raw[i] = malloc(LZ_CHUNK);
+    }
+    return batch->raw[i];
+}
+
+void lz_batch_restart(LzBatch *batch) {
+    batch->restart[batch->count] = 1;
+}
+
+int lz_batch_add(LzBatch *batch, uint32_t stream, size_t length) {
+    batch->stream[batch->count] = stream;
+    batch->length[batch->count] = length;
+    if (++batch->count == batch->size) {
+        return lz_batch_send(batch);
+    }
+    return 0;
+}
+
+// Countdown of a stream sending its chunks as they are; NULL if it has none and 'create' is 0
+static int *skip_left(LzBatch *batch, uint32_t stream, int create) {
+    int free_slot = -1;
+    for (int i = 0; i < LZ_BATCH_MAX; i++) {
+        if (batch->skip_left[i] > 0 && batch->skip_stream[i] == stream) {
+            return &batch->skip_left[i];
+        }
+        if (batch->skip_left[i] == 0 && free_slot == -1) {
+            free_slot = i;
+        }
+    }
+    if (!create || free_slot == -1) {
+        return NULL;
+    }
+    batch->skip_stream[free_slot] = stream;
+    return &batch->skip_left[free_slot];
+}
+
+typedef struct {
+    LzBatch *batch;
+    const int *tried;
+    int first;
+    int step;
+} CompressJob;
+
+// Compress every 'step'-th chunk; a block must save an eighth, or the chunk goes as it is
+static void *compress_chunks(void *arg) {
+    CompressJob *job = arg;
+    LzBatch *batch = job->batch;
+    for (int i = job->first; i < batch->count; i += job->step) {
+        batch->packed_length[i] = 0;
+        if (!job->tried[i]) {
+            continue;
+        }
+        uint32_t raw_length = batch->length[i];
+        size_t n = lz_compress(batch->raw[i], raw_length, batch->packed[i] + sizeof(raw_length),
+                               raw_length - raw_length / 8 - sizeof(raw_length));
+        if (n > 0) {
+            memcpy(batch->packed[i], &raw_length, sizeof(raw_length));
+            batch->packed_length[i] = n + sizeof(raw_length);
+        }
+    }
+    return NULL;
+}
+
+int lz_batch_send(LzBatch *batch) {
+    int tried[LZ_BATCH_MAX];
+    if (batch->count == 0) {
+        return 0;
+    }
+    for (int i = 0; i < batch->count; i++) {
+        int *left = skip_left(batch, batch->stream[i], 0);
+        if (left && batch->restart[i]) {
+            *left = 0;
+            left = NULL;
+        }
+        tried[i] = batch->length[i] >= LZ_MIN_SIZE && !left;
+        if (left) {
+            (*left)--;
+        }
+        if (tried[i] && !batch->packed[i] && !(batch->packed[i] = malloc(LZ_CHUNK))) {
+            tried[i] = 0;
+        }
+    }
+
+    // The calling thread takes its share alongside the others
+    int threads = batch->threads < batch->count ? batch->threads : batch->count;
+    pthread_t workers[LZ_BATCH_MAX];
+    int started[LZ_BATCH_MAX] = {0};
+    CompressJob jobs[LZ_BATCH_MAX];
+    for (int t = 0; t < threads; t++) {
+        jobs[t] = (CompressJob){batch, tried, t, threads};
+        if (t > 0) {
+            started[t] = pthread_create(&workers[t], NULL, compress_chunks, &jobs[t]) == 0;
+        }
+    }
+    compress_chunks(&jobs[0]);
+    for (int t = 1; t < threads; t++) {
+        if (started[t]) {
+            pthread_join(workers[t], NULL);
+        } else {
+            compress_chunks(&jobs[t]);
+        }
+    }
+
+    int status = 0;
+    batch->last_packed = 0;
+    for (int i = 0; i < batch->count && status == 0; i++) {
+        // A chunk starting new data may hold the tail of data that did not shrink, so only the next one counts
+        int *left = skip_left(batch, batch->stream[i], batch->restart[i] == 0);
+        if (left && batch->restart[i]) {
+            *left = 0;
+        } else if (left && tried[i] && batch->packed_length[i] == 0) {
+            *left = LZ_SKIP_CHUNKS;
+        }
+        if (batch->packed_length[i] > 0) {
+            status = send_frame(batch->fd, FRAME_ZDATA, batch->stream[i], batch->packed[i], batch->packed_length[i]);
+            batch->wire_bytes += batch->packed_length[i];
+            batch->last_packed++;
+        } else {
+            status = send_frame(batch->fd, FRAME_DATA, batch->stream[i], batch->raw[i], batch->length[i]);
+            batch->wire_bytes += batch->length[i];
+        }
+        batch->raw_bytes += batch->length[i];
+    }
+    memset(batch->restart, 0, sizeof(batch->restart));
+    batch->count = 0;
+    return status;
+}
+
+ssize_t lz_recv(int fd, size_t length, int file_fd, off_t *offset) {
+    static char packed[FRAME_MAX_PAYLOAD];
+    static char raw[LZ_CHUNK];
+    uint32_t raw_length;
+    if (length < sizeof(raw_length) || length > sizeof(packed)) {
+        if (discard_payload(fd, length) == 0) {
+            errno = EBADMSG;
+        }
+        return -1;
+    }
+    if (read_full(fd, packed, length) < 0) {
+        return -1;
+    }
+    memcpy(&raw_length, packed, sizeof(raw_length));
+    ssize_t n = lz_decompress(packed + sizeof(raw_length), length - sizeof(raw_length), raw, sizeof(raw));
+    if (n < 0 || (size_t)n != raw_length) {
+        errno = EBADMSG;
+        return -1;
+    }
+    for (ssize_t done = 0; done < n; ) {
+        ssize_t written = offset ? pwrite(file_fd, raw + done, n - done, *offset) : write(file_fd, raw + done, n - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            return -1;
+        }
+        done += written;
+        if (offset) {
+            *offset += written;
+        }
+    }
+    return n;
+}
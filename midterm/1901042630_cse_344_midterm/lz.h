@@ -0,0 +1,76 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "channel.h"
+
+/*
+ * Optional compression of file data on a session.
+ * The codec is a byte-oriented LZ77 in the style of LZ4: sequences of a token,
+ * literals and a 16-bit back offset, with no entropy coding, trading ratio for speed.
+ * A session turns it on with the "compress lz" command. File data then moves in
+ * batches of up to LZ_BATCH_MAX chunks, compressed in parallel threads and sent in
+ * order: a chunk that shrank goes as a FRAME_ZDATA frame, its raw length then the
+ * compressed block; any other chunk goes as a plain FRAME_DATA frame. Chunks below
+ * LZ_MIN_SIZE are not tried, and a stream whose chunk did not shrink sends its next
+ * LZ_SKIP_CHUNKS chunks as they are, so small and incompressible files cost nothing.
+ * A stream carrying several files, an archive, restarts that count at each file.
+ */
+
+#define LZ_CHUNK CHANNEL_FILE_CHUNK   // Raw bytes compressed as one block
+#define LZ_MIN_SIZE 4096
+#define LZ_SKIP_CHUNKS 16
+#define LZ_BATCH_MAX 8
+
+// Compress into at most 'cap' bytes; the compressed size, or 0 if it does not fit
+size_t lz_compress(const void *src, size_t len, void *dst, size_t cap);
+
+// Decompress into at most 'cap' bytes; the decompressed size, or -1 if the block is corrupt
+ssize_t lz_decompress(const void *src, size_t len, void *dst, size_t cap);
+
+// Chunks waiting to be compressed and sent
+typedef struct {
+    int fd;                     // Channel the frames go to
+    int size;                   // Chunks per batch
+    int threads;
+    int count;                  // Chunks filled
+    int last_packed;            // Chunks the last send compressed
+    uint32_t stream[LZ_BATCH_MAX];
+    size_t length[LZ_BATCH_MAX];
+    size_t packed_length[LZ_BATCH_MAX];   // 0 when sent as they are
+    char *raw[LZ_BATCH_MAX];
+    char *packed[LZ_BATCH_MAX];
+    int restart[LZ_BATCH_MAX];  // Chunks starting new data, tried whatever came before
+    uint32_t skip_stream[LZ_BATCH_MAX];   // Streams sending chunks uncompressed for a while
+    int skip_left[LZ_BATCH_MAX];
+    uint64_t raw_bytes;         // Data bytes sent
+    uint64_t wire_bytes;        // Payload bytes of their frames
+} LzBatch;
+
+// Batches of 'size' chunks to 'fd', up to LZ_BATCH_MAX or 0 for one per CPU, compressed by a thread per CPU
+int lz_batch_open(LzBatch *batch, int fd, int size);
+void lz_batch_close(LzBatch *batch);
+
+// Buffer of the next chunk, LZ_CHUNK bytes
+char *lz_batch_buffer(LzBatch *batch);
+
+// The next chunk holds 'length' bytes of 'stream'; a full batch is sent. -1 on error
+int lz_batch_add(LzBatch *batch, uint32_t stream, size_t length);
+
+// The next chunk starts new data, such as the next file of an archive: its stream stops skipping
+void lz_batch_restart(LzBatch *batch);
+
+// Compress and send the chunks filled so far; -1 on error
+int lz_batch_send(LzBatch *batch);
+
+/*
+ * Receive the payload of a FRAME_ZDATA frame of 'length' bytes and write the data
+ * to 'file_fd', at '*offset' and advancing it, or at the file position if 'offset'
+ * is NULL. Returns the data bytes written, or -1 with errno EBADMSG if the block
+ * is corrupt.
+ */
+ssize_t lz_recv(int fd, size_t length, int file_fd, off_t *offset);
+
+#endif // LZ_H
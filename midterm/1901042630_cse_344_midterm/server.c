@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // fallocate()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,43 +10,77 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <errno.h>
-#include <semaphore.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include "channel.h"
+#include "lineindex.h"
+#include "lineedit.h"
+#include "locktable.h"
+#include "transfer.h"
+#include "tarwriter.h"
+#include "lz.h"
 
 
 #define MAX_CLIENTS 10
-#define SERVER_FIFO_TEMPLATE "/tmp/server_fifo_%d"
+#define DEFAULT_SESSIONS_PER_WORKER 100
+#define UPLOAD_DIR ".uploads"   // Uploads in progress, renamed into place once complete
+#define SESSION_MAX_UPLOADS 8
 
 
-int client_count = 0;
+int client_count = 0; // Sessions in progress, kept by the parent
 char client_names[MAX_CLIENTS][256]; // Array to store unique client names
 
 
+// Upload in flight on a session, written to a temporary file until its last frame
+typedef struct {
+    uint32_t stream;  // Stream of the upload command, 0 for a free slot
+    int fd;           // -1 once writing failed, the rest of the data is dropped
+    int error;        // errno of the failure
+    off_t declared;   // Size announced by the client, -1 if none
+    off_t received;
+    int resumable;    // A put: checksummed chunks, the partial file outlives the session
+    int bad_chunks;   // Chunks of a put that failed their checksum
+    char filename[256];
+    char temp_name[512];
+} Upload;
+
+// One client session: the two FIFOs the client created, kept open until it quits
+typedef struct {
+    pid_t client_pid;
+    int request_fd;   // Commands and uploaded data from the client
+    int response_fd;  // Reply frames to the client
+    Upload uploads[SESSION_MAX_UPLOADS];
+    int compress;     // File data may go as compressed frames, agreed by "compress lz"
+} Session;
+
+// Pre-forked worker: serves one session at a time, recycled after a number of sessions
+typedef struct {
+    pid_t pid;
+    pid_t client_pid;  // Client of the session in progress, 0 while idle
+    int sessions;      // Sessions served by this slot since the server started
+} WorkerSlot;
+
+// Sent by a worker to the parent over the event pipe; small enough to be written atomically
+#define WORKER_SESSION_BEGIN 1
+#define WORKER_SESSION_END   2
+typedef struct {
+    int slot;
+    int event;
+    pid_t client_pid;
+} WorkerEvent;
+
+char server_fifo_name[256];
+volatile sig_atomic_t shutdown_requested = 0;
+
 // Function declarations
 extern int client_count;
-extern void handle_client(int client_pipe);
+extern void handle_client(Session *session);
 extern void cleanup();
 extern void setup_server_directory(const char *dirname);
-extern int create_pipe(const char *pipe_name);
-
-sem_t sem_client_count; // Semaphore for client count
-sem_t sem_file_access; // Semaphore for file access operations
+extern int open_session(Session *session, pid_t client_pid);
 
-void init_semaphores() {
-    if (sem_init(&sem_client_count, 0, 1) != 0) {
-        perror("Semaphore init failed");
-        exit(EXIT_FAILURE);
-    }
-    if (sem_init(&sem_file_access, 0, 1) != 0) {
-        perror("Semaphore init failed");
-        exit(EXIT_FAILURE);
-    }
-}
-
-void cleanup_semaphores() {
-    sem_destroy(&sem_client_count);
-    sem_destroy(&sem_file_access);
-}
 
 
 void list_files(char* response, int resp_size) {
@@ -55,6 +90,9 @@ void list_files(char* response, int resp_size) {
    if (d) {
        strcpy(response, "Directory contents:\n");
        while ((dir = readdir(d)) != NULL) {
+           if (strcmp(dir->d_name, LINE_INDEX_DIR) == 0 || strcmp(dir->d_name, UPLOAD_DIR) == 0) {
+               continue; // Line index sidecars and partial uploads are the server's own
+           }
            // Ensure we do not overflow the response buffer
            if (strlen(response) + strlen(dir->d_name) + 2 < resp_size) {
                strcat(response, dir->d_name);
@@ -72,190 +110,596 @@ void list_files(char* response, int resp_size) {
 }
 
 
-void read_file(const char* filename, int line_number, char* response, int resp_size) {
-   
-   sem_post(&sem_file_access);
-   FILE *file = fopen(filename, "r");
-   if (file == NULL) {
-       snprintf(response, resp_size, "Error: Unable to open file '%s'.\n", filename);
+/*
+ * Send lines 'first'..'last' of a file, the whole file if 'first' is 0.
+ * Lines are found through the file's line index, and the range is streamed in
+ * text frames, so neither a far line nor a long range costs a scan from the start.
+ */
+void read_file(const char* filename, int first, int last, Session *session, uint32_t stream) {
+   char response[2048];
+   file_lock(filename, FILE_LOCK_READ);
+   int fd = open(filename, O_RDONLY);
+   if (fd == -1) {
+       file_unlock();
+       snprintf(response, sizeof(response), "Error: Unable to open file '%s'.\n", filename);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
        return;
    }
 
-   char line[1024];
-   int current_line = 1;
-   if (line_number > 0) {
-       // Fetching a specific line
-       while (fgets(line, sizeof(line), file) != NULL) {
-           if (current_line == line_number) {
-               snprintf(response, resp_size, "Line %d: %s", line_number, line);
-               fclose(file);
-               return;
-           }
-           current_line++;
+   LineIndex index;
+   if (first > 0 && line_index_open(&index, filename, fd) < 0) {
+       close(fd);
+       file_unlock();
+       snprintf(response, sizeof(response), "Error: Unable to index file '%s'.\n", filename);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       return;
+   }
+
+   if (first > 0 && last == first) {
+       // Fetching a specific line: usually a single pread from its checkpoint
+       char line[1024];
+       ssize_t len = line_index_read_line(&index, fd, first, line, sizeof(line) - 1);
+       if (len < 0) {
+           snprintf(response, sizeof(response), "Error: Line %d not found in '%s'.\n", first, filename);
+       } else {
+           line[len] = '\0';
+           snprintf(response, sizeof(response), "Line %d: %s%s", first, line, line[len - 1] == '\n' ? "" : "\n");
+       }
+       send_text(session->response_fd, len < 0 ? FRAME_ERROR : FRAME_TEXT, stream, response);
+       if (len >= 0) {
+           send_frame(session->response_fd, FRAME_END, stream, NULL, 0);
        }
-       snprintf(response, resp_size, "Error: Line %d not found in '%s'.\n", line_number, filename);
    } else {
-       // Reading the whole file
-       strcpy(response, "File contents:\n");
-       while (fgets(line, sizeof(line), file) != NULL) {
-           // Ensure we do not overflow the response buffer
-           if (strlen(response) + strlen(line) < resp_size) {
-               strcat(response, line);
+       off_t start = 0, end = lseek(fd, 0, SEEK_END);
+       if (first > 0) {
+           start = line_index_find(&index, fd, first);
+           end = line_index_find(&index, fd, (uint64_t)last + 1);
+       }
+       if (first > 0 && start >= end) {
+           snprintf(response, sizeof(response), "Error: Line %d not found in '%s'.\n", first, filename);
+           send_text(session->response_fd, FRAME_ERROR, stream, response);
+       } else {
+           if (first > 0) {
+               snprintf(response, sizeof(response), "Lines %d-%d:\n", first, last);
            } else {
-               // Not enough space in buffer to add more lines
-               strcat(response, "...\n");
-               break;
+               strcpy(response, "File contents:\n");
            }
+           send_text(session->response_fd, FRAME_TEXT, stream, response);
+           static char buffer[CHANNEL_CHUNK_SIZE];
+           while (start < end) {
+               size_t want = end - start < (off_t)sizeof(buffer) ? (size_t)(end - start) : sizeof(buffer);
+               ssize_t n = pread(fd, buffer, want, start);
+               if (n <= 0 || send_frame(session->response_fd, FRAME_TEXT, stream, buffer, n) < 0) {
+                   break;
+               }
+               start += n;
+           }
+           send_frame(session->response_fd, FRAME_END, stream, NULL, 0);
        }
    }
-   sem_post(&sem_file_access);
-   fclose(file);
-}
 
-void write_to_file(const char* filename, int line_number, const char* text, char* response, int resp_size) {
+   if (first > 0) {
+       line_index_close(&index);
+   }
+   close(fd);
+   file_unlock();
+}
 
-	sem_wait(&sem_file_access);
-   // File operation code...
+/*
+ * Replace or insert a line through the line edit engine: only the tail of the file
+ * after the line is moved, and the line index is kept in step.
+ */
+int write_to_file(const char* filename, int line_number, const char* text, int mode, char* response, int resp_size) {
+   file_lock(filename, FILE_LOCK_WRITE);
 
    // Open file for reading and writing, create it if it does not exist
-   FILE *file = fopen(filename, "r+");
-   if (file == NULL) {
-       file = fopen(filename, "w+"); // Try to create the file if it doesn't exist
-       if (file == NULL) {
-           snprintf(response, resp_size, "Error: Unable to open or create file '%s'.\n", filename);
-           return;
-       }
+   int fd = open(filename, O_RDWR | O_CREAT, 0644);
+   if (fd == -1) {
+       snprintf(response, resp_size, "Error: Unable to open or create file '%s'.\n", filename);
+       file_unlock();
+       return -1;
    }
 
-   // Move to the correct line or to the end of the file
-   char line[1024];
-   int current_line = 1;
-   long last_pos = ftell(file);
-   if (line_number > 0) {
-       while (fgets(line, sizeof(line), file) != NULL) {
-           if (current_line == line_number) {
-               fseek(file, last_pos, SEEK_SET); // Move back to the beginning of the line
-               break;
-           }
-           last_pos = ftell(file);
-           current_line++;
-       }
-       if (current_line < line_number) {
-           // If the file has fewer lines than line_number, pad with newlines
-           while (current_line < line_number) {
-               fputs("\n", file);
-               current_line++;
-           }
-       }
-   } else {
-       // If no line number is specified, append to the end of the file
-       fseek(file, 0, SEEK_END);
+   LineIndex index;
+   int status = line_index_open(&index, filename, fd);
+   if (status == 0) {
+       status = line_edit(&index, fd, line_number, text, mode);
+       line_index_close(&index);
    }
-
-   // Write the provided text to the file
-   fprintf(file, "%s\n", text);
+   close(fd);
+   file_unlock();
 
    // Response to client
-   snprintf(response, resp_size, "Text written to '%s'.\n", filename);
-   sem_post(&sem_file_access);
-   fclose(file);
+   if (status < 0) {
+       snprintf(response, resp_size, "Error: Unable to write to file '%s': %s\n", filename, strerror(errno));
+       return -1;
+   }
+   snprintf(response, resp_size, "Text %s '%s'.\n", mode == LINE_EDIT_INSERT ? "inserted into" : "written to", filename);
+   return 0;
 }
 
 
-void download_file(const char* filename, int client_pipe) {
-   FILE *file = fopen(filename, "rb"); // Open the file in binary mode to handle all file types
-   if (!file) {
-       char response[1024];
+/*
+ * Send a file from its start as compressed data frames, a batch at a time. Returns
+ * the offset reached, or -1 on error. It stops short when a whole batch failed to
+ * compress: the rest of the file is then cheaper to splice as it is.
+ */
+static off_t send_compressed(Session *session, uint32_t stream, int fd, off_t size) {
+   LzBatch batch;
+   lz_batch_open(&batch, session->response_fd, 0);
+   off_t offset = 0;
+   while (offset < size) {
+       char *buffer = lz_batch_buffer(&batch);
+       size_t want = size - offset < LZ_CHUNK ? (size_t)(size - offset) : LZ_CHUNK;
+       ssize_t n = buffer ? pread(fd, buffer, want, offset) : -1;
+       if (n <= 0 || lz_batch_add(&batch, stream, n) < 0) {
+           offset = -1;
+           break;
+       }
+       offset += n;
+       if (batch.count == 0 && batch.last_packed == 0) {
+           break;
+       }
+   }
+   if (offset >= 0 && lz_batch_send(&batch) < 0) {
+       offset = -1;
+   }
+   lz_batch_close(&batch);
+   return offset;
+}
+
+/*
+ * Send a file as data frames of CHANNEL_FILE_CHUNK bytes. Each frame header is
+ * written and its payload spliced from the file into the client's FIFO, so the
+ * contents are never copied through the server. A session with compression on
+ * reads the file and sends it compressed instead, unless it does not compress.
+ * The read lock is only held to open the file: a put replaces it by a rename and
+ * leaves the open file as it was, while a line edit changes it in place, which the
+ * download then reports as an error rather than ending.
+ */
+void download_file(const char* filename, Session *session, uint32_t stream) {
+   char response[1024];
+   file_lock(filename, FILE_LOCK_READ);
+   int fd = open(filename, O_RDONLY);
+   struct stat st;
+   if (fd == -1 || fstat(fd, &st) != 0) {
+       if (fd != -1) {
+           close(fd);
+       }
+       file_unlock();
        snprintf(response, sizeof(response), "Error: Unable to open file '%s' for download.\n", filename);
-       write(client_pipe, response, strlen(response));
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
        return;
    }
+   file_unlock();
 
    // Inform client that file download is starting
-   char buffer[4096];
-   snprintf(buffer, sizeof(buffer), "Starting file download for '%s'...\n", filename);
-   write(client_pipe, buffer, strlen(buffer));
-
-   // Read the file in chunks and send it to the client
-   int bytes_read;
-   while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
-       if (write(client_pipe, buffer, bytes_read) != bytes_read) {
-           fprintf(stderr, "Error: Failed to send file data to client.\n");
+   snprintf(response, sizeof(response), "Starting file download for '%s'...\n", filename);
+   send_text(session->response_fd, FRAME_TEXT, stream, response);
+
+   off_t offset = 0;
+   if (session->compress && st.st_size >= LZ_MIN_SIZE) {
+       offset = send_compressed(session, stream, fd, st.st_size);
+   }
+   while (offset >= 0 && offset < st.st_size) {
+       size_t chunk = st.st_size - offset < CHANNEL_FILE_CHUNK ? (size_t)(st.st_size - offset) : CHANNEL_FILE_CHUNK;
+       if (send_file_frame(session->response_fd, FRAME_DATA, stream, fd, &offset, chunk) < 0) {
            break;
        }
    }
 
-   // Check for read error
-   if (ferror(file)) {
-       snprintf(buffer, sizeof(buffer), "Error: Failed to read file '%s'.\n", filename);
-       write(client_pipe, buffer, strlen(buffer));
+   // Check for read error, or an edit while the file was sent
+   struct stat after;
+   if (offset < st.st_size) {
+       snprintf(response, sizeof(response), "Error: Failed to read file '%s'.\n", filename);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+   } else if (fstat(fd, &after) != 0 || after.st_size != st.st_size ||
+              after.st_mtim.tv_sec != st.st_mtim.tv_sec || after.st_mtim.tv_nsec != st.st_mtim.tv_nsec) {
+       snprintf(response, sizeof(response), "Error: File '%s' changed during the download, download it again.\n", filename);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
    } else {
-       snprintf(buffer, sizeof(buffer), "File download completed successfully.\n");
-       write(client_pipe, buffer, strlen(buffer));
+       send_text(session->response_fd, FRAME_END, stream, "File download completed successfully.\n");
    }
 
-   fclose(file);
+   close(fd);
+}
+
+static Upload *find_upload(Session *session, uint32_t stream) {
+   for (int i = 0; i < SESSION_MAX_UPLOADS; i++) {
+       if (session->uploads[i].stream == stream) {
+           return &session->uploads[i];
+       }
+   }
+   return NULL;
+}
+
+// The partial file of a put stays, for the next put of the file to resume from
+static void free_upload(Upload *upload) {
+   if (upload->fd != -1) {
+       close(upload->fd);
+   }
+   if (!upload->resumable) {
+       unlink(upload->temp_name);
+   }
+   upload->stream = 0;
 }
 
-void upload_file(const char* filename, int client_pipe) {
-   FILE *file = fopen(filename, "wb"); // Open the file in binary mode for writing
-   if (!file) {
-       char response[1024];
+/*
+ * Start an upload: 'upload <file> [size]' is followed by data frames on the same
+ * stream and ends with the client's FRAME_END. Several uploads can be in flight on
+ * one session, their frames interleaved. The data is spliced into a temporary file,
+ * sized up front when the client declared the size, and renamed over the target
+ * only when complete, so readers never see a partial file and no lock is held while
+ * the client sends.
+ */
+void upload_begin(const char* filename, off_t declared, Session *session, uint32_t stream) {
+   char response[1024];
+   Upload *upload = find_upload(session, 0);
+   if (!upload || find_upload(session, stream)) {
+       send_text(session->response_fd, FRAME_ERROR, stream, "Error: Too many uploads in progress.\n");
+       return;
+   }
+   if (mkdir(UPLOAD_DIR, 0755) != 0 && errno != EEXIST) {
+       perror("Failed to create upload directory");
+   }
+   snprintf(upload->temp_name, sizeof(upload->temp_name), UPLOAD_DIR "/%d.%u", session->client_pid, stream);
+   upload->fd = open(upload->temp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (upload->fd == -1) {
        snprintf(response, sizeof(response), "Error: Unable to create or open file '%s'.\n", filename);
-       write(client_pipe, response, strlen(response));
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       return;
+   }
+   // Reserve the whole file now: a full disk fails before any data is sent
+   if (declared > 0 && fallocate(upload->fd, 0, 0, declared) != 0 && errno != EOPNOTSUPP) {
+       snprintf(response, sizeof(response), "Error: Unable to store file '%s': %s\n", filename, strerror(errno));
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       close(upload->fd);
+       unlink(upload->temp_name);
        return;
    }
+   upload->stream = stream;
+   upload->error = 0;
+   upload->declared = declared;
+   upload->received = 0;
+   upload->resumable = 0;
+   upload->bad_chunks = 0;
+   snprintf(upload->filename, sizeof(upload->filename), "%s", filename);
+
+   snprintf(response, sizeof(response), "Ready to receive file '%s'. Send data.\n", filename);
+   send_text(session->response_fd, FRAME_TEXT, stream, response);
+}
 
-   char buffer[4096];
-   snprintf(buffer, sizeof(buffer), "Ready to receive file '%s'. Send data.\n", filename);
-   write(client_pipe, buffer, strlen(buffer));
+// Data frame of an upload; frames of a failed or unknown upload are dropped
+int upload_data(Session *session, uint32_t stream, size_t length, int compressed) {
+   Upload *upload = find_upload(session, stream);
+   if (!upload || upload->fd == -1) {
+       return discard_payload(session->request_fd, length);
+   }
+   if ((compressed ? lz_recv(session->request_fd, length, upload->fd, &upload->received)
+                   : recv_to_file(session->request_fd, upload->fd, &upload->received, length)) < 0) {
+       upload->error = errno;
+       close(upload->fd);
+       upload->fd = -1;
+   }
+   return 0;
+}
 
-   // Read data from the client pipe and write to the file
-   int bytes_read;
-   while ((bytes_read = read(client_pipe, buffer, sizeof(buffer))) > 0) {
-       if (fwrite(buffer, 1, bytes_read, file) != bytes_read) {
-           fprintf(stderr, "Error writing to file: %s\n", filename);
-           break;
+// Last frame of an upload: check the size, then put the file in place
+void upload_end(Session *session, uint32_t stream) {
+   char response[1024];
+   Upload *upload = find_upload(session, stream);
+   if (!upload) {
+       return; // The upload was refused and has had its reply
+   }
+   if (upload->fd == -1) {
+       snprintf(response, sizeof(response), "Error: Failed to write file '%s': %s\n", upload->filename,
+                strerror(upload->error));
+   } else if (upload->bad_chunks > 0) {
+       snprintf(response, sizeof(response), "Error: %d chunks of '%s' failed their checksum, put it again to resend them.\n",
+                upload->bad_chunks, upload->filename);
+   } else if (!upload->resumable && upload->declared >= 0 && upload->received != upload->declared) {
+       snprintf(response, sizeof(response), "Error: Received %lld of %lld bytes for file '%s'.\n",
+                (long long)upload->received, (long long)upload->declared, upload->filename);
+   } else if (ftruncate(upload->fd, upload->resumable ? upload->declared : upload->received) != 0 ||
+              fsync(upload->fd) != 0) {
+       snprintf(response, sizeof(response), "Error: Failed to write file '%s': %s\n", upload->filename, strerror(errno));
+   } else {
+       // Under the write lock, so an edit in progress finishes on the old file first
+       file_lock(upload->filename, FILE_LOCK_WRITE);
+       line_index_remove(upload->filename); // It indexes the old file
+       int status = rename(upload->temp_name, upload->filename);
+       file_unlock();
+       if (status != 0) {
+           snprintf(response, sizeof(response), "Error: Unable to create file '%s': %s\n", upload->filename, strerror(errno));
+       } else {
+           snprintf(response, sizeof(response), "File '%s' uploaded successfully.\n", upload->filename);
        }
+       send_text(session->response_fd, status == 0 ? FRAME_END : FRAME_ERROR, stream, response);
+       free_upload(upload);
+       return;
    }
+   send_text(session->response_fd, FRAME_ERROR, stream, response);
+   free_upload(upload);
+}
 
-   if (bytes_read < 0) {
-       snprintf(buffer, sizeof(buffer), "Error: Failed to read data from client for file '%s'.\n", filename);
-       write(client_pipe, buffer, strlen(buffer));
+// Send the manifest of the first 'size' bytes of 'fd' as a data frame
+static int send_manifest_frame(Session *session, uint32_t stream, int fd, uint64_t size) {
+   ManifestHeader manifest = {size, TRANSFER_CHUNK_SIZE, transfer_chunk_count(size)};
+   uint32_t *crcs = transfer_checksums(fd, size);
+   char *payload = crcs ? malloc(sizeof(manifest) + manifest.count * sizeof(uint32_t)) : NULL;
+   if (!payload) {
+       free(crcs);
+       return -1;
+   }
+   memcpy(payload, &manifest, sizeof(manifest));
+   memcpy(payload + sizeof(manifest), crcs, manifest.count * sizeof(uint32_t));
+   int status = send_frame(session->response_fd, FRAME_DATA, stream, payload, sizeof(manifest) + manifest.count * sizeof(uint32_t));
+   free(payload);
+   free(crcs);
+   return status;
+}
+
+/*
+ * Reply with the manifest of a file, the checksum of each of its chunks, so the
+ * client can tell which chunks it is missing.
+ */
+void send_manifest(const char *filename, Session *session, uint32_t stream) {
+   char response[1024];
+   file_lock(filename, FILE_LOCK_READ);
+   int fd = open(filename, O_RDONLY);
+   struct stat st;
+   if (fd == -1 || fstat(fd, &st) != 0) {
+       snprintf(response, sizeof(response), "Error: Unable to open file '%s'.\n", filename);
+   } else if (transfer_chunk_count(st.st_size) > TRANSFER_MAX_CHUNKS) {
+       snprintf(response, sizeof(response), "Error: File '%s' is too large for a manifest.\n", filename);
+   } else if (send_manifest_frame(session, stream, fd, st.st_size) < 0) {
+       snprintf(response, sizeof(response), "Error: Failed to read file '%s'.\n", filename);
    } else {
-       snprintf(buffer, sizeof(buffer), "File '%s' uploaded successfully.\n", filename);
-       write(client_pipe, buffer, strlen(buffer));
+       response[0] = '\0';
+   }
+   if (fd != -1) {
+       close(fd);
+   }
+   file_unlock();
+   send_text(session->response_fd, response[0] ? FRAME_ERROR : FRAME_END, stream, response);
+}
+
+// Send chunks 'first' to 'last' of a file as checksummed chunk frames
+void send_chunks(const char *filename, uint32_t first, uint32_t last, Session *session, uint32_t stream) {
+   char response[1024] = "";
+   file_lock(filename, FILE_LOCK_READ);
+   int fd = open(filename, O_RDONLY);
+   struct stat st;
+   if (fd == -1 || fstat(fd, &st) != 0) {
+       snprintf(response, sizeof(response), "Error: Unable to open file '%s'.\n", filename);
+   }
+   for (uint32_t i = first; !response[0] && i <= last; i++) {
+       uint64_t offset = (uint64_t)i * TRANSFER_CHUNK_SIZE;
+       if (offset >= (uint64_t)st.st_size) {
+           snprintf(response, sizeof(response), "Error: Chunk %u is past the end of '%s'.\n", i, filename);
+       } else if (send_chunk(session->response_fd, stream, fd, offset,
+                             st.st_size - offset < TRANSFER_CHUNK_SIZE ? st.st_size - offset : TRANSFER_CHUNK_SIZE) < 0) {
+           snprintf(response, sizeof(response), "Error: Failed to read file '%s'.\n", filename);
+       }
+   }
+   if (fd != -1) {
+       close(fd);
    }
+   file_unlock();
+   send_text(session->response_fd, response[0] ? FRAME_ERROR : FRAME_END, stream, response);
+}
 
-   fclose(file);
+// Partial file of a put; '/' and '%' are escaped so every target maps to one flat name
+static void part_path(const char *filename, char *path, size_t size) {
+   size_t len = snprintf(path, size, "%s/", UPLOAD_DIR);
+   for (const char *p = filename; *p && len + 8 < size; p++) {
+       if (*p == '/' || *p == '%') {
+           len += snprintf(path + len, size - len, "%%%02x", (unsigned char)*p);
+       } else {
+           path[len++] = *p;
+       }
+   }
+   snprintf(path + len, size - len, ".part");
 }
 
-void archive_files(const char* tarname, int client_pipe) {
-   char command[1024];
-   char response[2048];
+/*
+ * Start a new partial file as a copy of the file it will replace, copied within the
+ * kernel, so a put of a modified file sends only the chunks that changed.
+ */
+static void seed_partial(const char *filename, int part_fd) {
+   file_lock(filename, FILE_LOCK_READ);
+   int fd = open(filename, O_RDONLY);
+   if (fd != -1) {
+       ssize_t n;
+       while ((n = copy_file_range(fd, NULL, part_fd, NULL, TRANSFER_CHUNK_SIZE * 64, 0)) > 0) {
+       }
+       if (n < 0 && ftruncate(part_fd, 0) != 0) {
+           perror("Failed to truncate partial file"); // Unsupported here: the put just sends everything
+       }
+       close(fd);
+   }
+   file_unlock();
+}
+
+/*
+ * Start a put, a resumable upload: the reply opens with the manifest of what the
+ * partial file of 'filename' already holds. The client sends the chunks that differ
+ * as chunk frames, then FRAME_END; the partial file is renamed into place once
+ * every chunk passed its checksum. A put cut short keeps the partial file, so the
+ * next put of the same file sends only what is still missing.
+ */
+void put_begin(const char *filename, long long size, Session *session, uint32_t stream) {
+   char response[1024];
+   Upload *upload = find_upload(session, 0);
+   if (!upload || find_upload(session, stream)) {
+       send_text(session->response_fd, FRAME_ERROR, stream, "Error: Too many uploads in progress.\n");
+       return;
+   }
+   if (size < 0 || transfer_chunk_count(size) > TRANSFER_MAX_CHUNKS) {
+       send_text(session->response_fd, FRAME_ERROR, stream, "Error: Invalid file size.\n");
+       return;
+   }
+   if (mkdir(UPLOAD_DIR, 0755) != 0 && errno != EEXIST) {
+       perror("Failed to create upload directory");
+   }
+   part_path(filename, upload->temp_name, sizeof(upload->temp_name));
+   upload->fd = open(upload->temp_name, O_RDWR | O_CREAT, 0644);
+   struct stat st;
+   if (upload->fd == -1 || fstat(upload->fd, &st) != 0) {
+       snprintf(response, sizeof(response), "Error: Unable to create or open file '%s'.\n", filename);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       if (upload->fd != -1) {
+           close(upload->fd);
+       }
+       return;
+   }
+   // A partial file of another size belongs to another version: start over from the current file
+   if (st.st_size != size && ftruncate(upload->fd, 0) == 0) {
+       seed_partial(filename, upload->fd);
+   }
+   if (st.st_size != size && ((size > 0 && fallocate(upload->fd, 0, 0, size) != 0 && errno != EOPNOTSUPP) ||
+                              ftruncate(upload->fd, size) != 0)) {
+       snprintf(response, sizeof(response), "Error: Unable to store file '%s': %s\n", filename, strerror(errno));
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       close(upload->fd);
+       return;
+   }
+   upload->stream = stream;
+   upload->error = 0;
+   upload->declared = size;
+   upload->received = 0;
+   upload->resumable = 1;
+   upload->bad_chunks = 0;
+   snprintf(upload->filename, sizeof(upload->filename), "%s", filename);
+   if (send_manifest_frame(session, stream, upload->fd, size) < 0) {
+       snprintf(response, sizeof(response), "Error: Failed to read partial file of '%s'.\n", filename);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       free_upload(upload);
+   }
+}
 
-   // Construct the tar command to create an archive of the current directory
-   snprintf(command, sizeof(command), "tar -cf %s *", tarname);
+// Chunk frame of a put; a chunk that fails its checksum is counted and dropped
+int upload_chunk(Session *session, uint32_t stream, size_t length) {
+   Upload *upload = find_upload(session, stream);
+   if (!upload || upload->fd == -1) {
+       return discard_payload(session->request_fd, length);
+   }
+   ChunkHeader chunk;
+   int status = recv_chunk(session->request_fd, length, upload->fd, &chunk);
+   if (status > 0) {
+       upload->bad_chunks++;
+   } else if (status < 0) {
+       upload->error = errno;
+       close(upload->fd);
+       upload->fd = -1;
+   }
+   return 0;
+}
+
+static double seconds_since(const struct timespec *start) {
+   struct timespec now;
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Archive the server's directory into 'tarname', written in-process by the tar
+ * writer. The archive is built under UPLOAD_DIR and renamed into place, so a
+ * reader never sees it half written and it does not end up inside itself.
+ */
+void archive_files(const char* tarname, Session *session, uint32_t stream) {
+   char response[2048];
+   char temp_name[512];
+   TarWriter tar;
+   struct timespec start;
 
-   // Execute the tar command
-   int result = system(command);
-   if (result != 0) {
+   if (tarname[0] == '\0' || strchr(tarname, '/')) {
+       send_text(session->response_fd, FRAME_ERROR, stream, "Error: Expected an archive name in the server's directory.\n");
+       return;
+   }
+   if (mkdir(UPLOAD_DIR, 0755) != 0 && errno != EEXIST) {
+       perror("Failed to create upload directory");
+   }
+   snprintf(temp_name, sizeof(temp_name), UPLOAD_DIR "/%d.%u.tar", session->client_pid, stream);
+   int fd = open(temp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd == -1 || tar_open(&tar, fd, 0, tarname) != 0) {
+       if (fd != -1) {
+           close(fd);
+           unlink(temp_name);
+       }
        snprintf(response, sizeof(response), "Error: Failed to create archive '%s'.\n", tarname);
-       write(client_pipe, response, strlen(response));
-   } else {
-       snprintf(response, sizeof(response), "Archive created successfully: '%s'\n", tarname);
-       write(client_pipe, response, strlen(response));
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       return;
    }
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   int status = tar_add_tree(&tar);
+   status = tar_close(&tar) < 0 ? -1 : status;
+   if (close(fd) != 0) {
+       status = -1;
+   }
+   if (status == 0) {
+       file_lock(tarname, FILE_LOCK_WRITE);
+       line_index_remove(tarname);
+       status = rename(temp_name, tarname);
+       file_unlock();
+   }
+   if (status != 0) {
+       snprintf(response, sizeof(response), "Error: Failed to create archive '%s': %s\n", tarname, strerror(errno));
+       unlink(temp_name);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+       return;
+   }
+   double elapsed = seconds_since(&start);
+   snprintf(response, sizeof(response),
+            "Archive created successfully: '%s' (%llu entries, %llu bytes, %.1f MB/s, %d skipped)\n", tarname,
+            (unsigned long long)tar.entries, (unsigned long long)tar.bytes, tar.bytes / elapsed / 1e6, tar.warnings);
+   send_text(session->response_fd, FRAME_END, stream, response);
 }
 
+// Archive the server's directory straight onto the channel, as data frames
+void send_archive(Session *session, uint32_t stream) {
+   char response[1024];
+   TarWriter tar;
+   LzBatch batch;
+   struct timespec start;
+
+   lz_batch_open(&batch, session->response_fd, 0);
+   if (tar_open(&tar, session->response_fd, stream, NULL) != 0 ||
+       (session->compress && tar_compress(&tar, &batch) != 0)) {
+       lz_batch_close(&batch);
+       send_text(session->response_fd, FRAME_ERROR, stream, "Error: Failed to start the archive.\n");
+       return;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   int status = tar_add_tree(&tar);
+   status = tar_close(&tar) < 0 ? -1 : status;
+   lz_batch_close(&batch);
+   if (status < 0) {
+       perror("Failed to send archive");
+       send_text(session->response_fd, FRAME_ERROR, stream, "Error: Failed to send the archive.\n");
+       return;
+   }
+   double elapsed = seconds_since(&start);
+   int length = snprintf(response, sizeof(response), "Archive sent: %llu entries, %llu bytes, %.1f MB/s, %d skipped",
+                         (unsigned long long)tar.entries, (unsigned long long)tar.bytes, tar.bytes / elapsed / 1e6,
+                         tar.warnings);
+   if (tar.lz && batch.wire_bytes > 0) {
+       snprintf(response + length, sizeof(response) - length, ", compressed to %llu bytes (%.2fx)",
+                (unsigned long long)batch.wire_bytes, (double)batch.raw_bytes / batch.wire_bytes);
+   }
+   strcat(response, "\n");
+   send_text(session->response_fd, FRAME_END, stream, response);
+}
+
+// Ask the parent to shut down; it takes its sessions with it
 void kill_server() {
-   // Add any cleanup needed before killing the server
    printf("Server is shutting down...\n");
-   exit(0); // Exit the application
+   kill(getppid(), SIGTERM);
+   exit(0);
 }
 
 
-void help(int client_pipe) {
+void help(Session *session, uint32_t stream) {
    const char* help_message = 
        "Available commands are:\n"
        "help\n"
@@ -264,39 +708,134 @@ void help(int client_pipe) {
        "   Lists all files in the server's directory.\n"
        "readF <file> <line #>\n"
        "   Displays the specified line of the file. If no line number is given, the whole file is displayed.\n"
+       "readF <file> <first #>-<last #>\n"
+       "   Displays the lines from 'first' to 'last' of the file.\n"
        "writeT <file> <line #> <string>\n"
        "   Writes the content of 'string' to the specified line number of the file. If no line number is given, writes to the end of the file.\n"
-       "upload <file>\n"
-       "   Uploads the specified file from the client to the server's directory.\n"
+       "insertT <file> <line #> <string>\n"
+       "   Inserts 'string' as the specified line of the file, moving the following lines down.\n"
+       "upload <file> [<file>...]\n"
+       "   Uploads the specified files from the client to the server's directory, all at once.\n"
        "download <file>\n"
        "   Downloads the specified file from the server's directory to the client.\n"
+       "fetch <file> [streams]\n"
+       "   Downloads the file in checksummed chunks, only those missing locally, over up to 8 parallel sessions.\n"
+       "   Run it again to resume an interrupted fetch.\n"
+       "put <file>\n"
+       "   Uploads the file in checksummed chunks, only those the server does not have yet.\n"
+       "   Run it again to resume an interrupted put.\n"
        "archServer <fileName>.tar\n"
        "   Archives all the files in the server's directory into the specified tar file.\n"
+       "archive <fileName>.tar\n"
+       "   Streams an archive of the server's directory to the client, saved as the specified tar file.\n"
+       "compress lz|off\n"
+       "   Turns compression of downloads, uploads and streamed archives on or off for this session.\n"
        "killServer\n"
        "   Sends a request to the server to terminate gracefully.\n"
        "quit\n"
        "   Disconnects the client from the server and closes the session.\n";
 
    // Send the help message to the client
-   write(client_pipe, help_message, strlen(help_message));
+   send_text(session->response_fd, FRAME_TEXT, stream, help_message);
+   send_frame(session->response_fd, FRAME_END, stream, NULL, 0);
+}
+
+void handle_shutdown(int sig) {
+    shutdown_requested = 1;
+}
+
+// Only there to interrupt poll() in the parent when a worker exits
+void handle_child(int sig) {
+}
+
+static void report_event(int events_fd, int slot, int event, pid_t client_pid) {
+    WorkerEvent ev = {slot, event, client_pid};
+    if (write(events_fd, &ev, sizeof(ev)) != sizeof(ev)) {
+        perror("Failed to report to the server");
+    }
+}
+
+/*
+ * Worker process: idle workers all block reading the server FIFO, and each
+ * connection frame is taken by exactly one of them. Exits after 'max_sessions'
+ * sessions so the parent replaces it with a fresh process.
+ */
+void worker_loop(int slot, int server_fifo, int events_fd, int max_sessions) {
+    for (int served = 0; served < max_sessions && !shutdown_requested; ) {
+        FrameHeader header;
+        char payload[FRAME_COMMAND_MAX];
+        int status = recv_frame(server_fifo, &header, payload, sizeof(payload));
+        if (status <= 0) {
+            if (status < 0 && errno != EINTR) {
+                perror("Failed to read from server FIFO");
+            }
+            continue;
+        }
+        if (header.type != FRAME_CONNECT) {
+            printf(">> Received non-connection frame of type %u\n", header.type);
+            continue;
+        }
+
+        Session session;
+        report_event(events_fd, slot, WORKER_SESSION_BEGIN, (pid_t)header.stream);
+        if (open_session(&session, (pid_t)header.stream) == 0) {
+            handle_client(&session);
+        }
+        report_event(events_fd, slot, WORKER_SESSION_END, (pid_t)header.stream);
+        served++;
+    }
+    exit(0);
+}
+
+pid_t spawn_worker(int slot, int server_fifo, int events[2], int max_sessions) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(events[0]);
+        prctl(PR_SET_PDEATHSIG, SIGTERM); // Sessions end with the server
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        lock_table_set_worker(slot);
+        worker_loop(slot, server_fifo, events[1], max_sessions);
+    } else if (pid < 0) {
+        perror("fork failed");
+    }
+    return pid;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n sessionsPerWorker] [-B] <dirname> <max_clients>\n", prog);
+    exit(1);
 }
 
 int main(int argc, char *argv[]) {
 
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <dirname> <max_clients>\n", argv[0]);
-        return 1;
+    int max_sessions = DEFAULT_SESSIONS_PER_WORKER;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:B")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0) {
+            max_sessions = atoi(optarg);
+        } else if (opt == 'B') {
+            channel_set_zero_copy(0); // Copy file data through a buffer instead of splicing
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
     }
 
-    const char* dirname = argv[1];
-    int max_clients = atoi(argv[2]);
+    const char* dirname = argv[optind];
+    int max_clients = atoi(argv[optind + 1]);
+    if (max_clients <= 0) {
+        usage(argv[0]);
+    }
     setup_server_directory(dirname);
     if (chdir(dirname) != 0) {
         perror("Failed to change directory");
         return 1;
     }
 
-    char server_fifo_name[256];
     snprintf(server_fifo_name, sizeof(server_fifo_name), SERVER_FIFO_TEMPLATE, getpid());
 
     unlink(server_fifo_name);
@@ -305,133 +844,287 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    int server_fifo = open(server_fifo_name, O_RDONLY | O_NONBLOCK);
+    // Opened for writing too, so the FIFO never reports EOF between clients
+    int server_fifo = open(server_fifo_name, O_RDWR);
     if (server_fifo == -1) {
         perror("Failed to open server FIFO");
         return 1;
     }
 
+    // Workers write events, the parent drains them without blocking
+    int events[2];
+    if (pipe(events) != 0) {
+        perror("Failed to create event pipe");
+        return 1;
+    }
+    fcntl(events[0], F_SETFL, O_NONBLOCK);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_shutdown;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = handle_child;
+    sigaction(SIGCHLD, &sa, NULL);
+
     printf("> Server Started PID %d…\n", getpid());
-    printf(">> waiting for clients...\n");
-
-    init_semaphores();
-
-    while (1) {
-        char buffer[1024];
-        int numBytes = read(server_fifo, buffer, sizeof(buffer) - 1);
-        if (numBytes > 0) {
-            buffer[numBytes] = '\0'; // Null-terminate the string
-
-            // Extracting the FIFO name properly, assuming it ends with a newline
-            char *newline = strchr(buffer, '\n');
-            if (newline) *newline = '\0';  // Trim the newline
-
-            if (strncmp(buffer, "/tmp/client_fifo_", 17) == 0) {
-                if (client_count < max_clients) {
-                    int client_fifo_fd = create_pipe(buffer);
-                    if (client_fifo_fd != -1) {
-                        printf(">> Client PID %d connected as “%s”\n", getpid(), buffer);
-                        pid_t pid = fork();
-                        if (pid == 0) {
-                            close(server_fifo);
-                            handle_client(client_fifo_fd);
-                            exit(0);
-                        } else if (pid > 0) {
-                            sem_wait(&sem_client_count);
-                            client_count++;
-                            sem_post(&sem_client_count);
-                            close(client_fifo_fd); // Parent doesn't communicate directly with clients
-                        }
-                    } else {
-                        printf(">> Failed to create or open client FIFO.\n");
-                    }
-                } else {
-                    printf(">> Max client count reached.\n");
+
+    // Mapped before the workers are forked, so they all share it
+    if (lock_table_create(max_clients) < 0) {
+        return 1;
+    }
+
+    // One worker per allowed session: max_clients bounds concurrent sessions
+    WorkerSlot *slots = calloc(max_clients, sizeof(WorkerSlot));
+    if (!slots) {
+        perror("calloc failed");
+        return 1;
+    }
+    for (int i = 0; i < max_clients; i++) {
+        slots[i].pid = spawn_worker(i, server_fifo, events, max_sessions);
+    }
+    printf(">> %d workers waiting for clients...\n", max_clients);
+
+    while (!shutdown_requested) {
+        struct pollfd pfd = {events[0], POLLIN, 0};
+        // The timeout only guards against a SIGCHLD landing just before poll()
+        int ready = poll(&pfd, 1, 1000);
+        if (ready < 0 && errno != EINTR) {
+            perror("poll failed");
+        }
+
+        // Drain every event before reaping, so a recycled worker's last session is closed first
+        WorkerEvent ev;
+        while (read(events[0], &ev, sizeof(ev)) == sizeof(ev)) {
+            if (ev.slot < 0 || ev.slot >= max_clients) {
+                continue;
+            }
+            if (ev.event == WORKER_SESSION_BEGIN) {
+                slots[ev.slot].client_pid = ev.client_pid;
+                client_count++;
+                printf(">> Client PID %d connected (%d/%d sessions)\n", ev.client_pid, client_count, max_clients);
+                if (client_count == max_clients) {
+                    printf(">> Max client count reached, new clients wait for a free worker.\n");
+                }
+            } else if (ev.event == WORKER_SESSION_END && slots[ev.slot].client_pid) {
+                slots[ev.slot].client_pid = 0;
+                slots[ev.slot].sessions++;
+                client_count--;
+                printf(">> Client PID %d disconnected (%d/%d sessions)\n", ev.client_pid, client_count, max_clients);
+            }
+        }
+
+        // Replace workers that were recycled or died; a session cut short frees its slot
+        pid_t pid;
+        while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+            for (int i = 0; i < max_clients; i++) {
+                if (slots[i].pid != pid) {
+                    continue;
+                }
+                lock_table_release_worker(i); // A worker killed mid-command must not leave its file locked
+                if (slots[i].client_pid) {
+                    printf(">> Worker of client PID %d exited during the session\n", slots[i].client_pid);
+                    slots[i].client_pid = 0;
+                    client_count--;
+                }
+                if (!shutdown_requested) {
+                    slots[i].pid = spawn_worker(i, server_fifo, events, max_sessions);
                 }
-            } else {
-                printf(">> Received non-FIFO message or command: '%s'\n", buffer);
             }
         }
     }
 
+    signal(SIGCHLD, SIG_DFL);
+    for (int i = 0; i < max_clients; i++) {
+        if (slots[i].pid > 0) {
+            kill(slots[i].pid, SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+    free(slots);
+    cleanup();
     return 0;
 }
 
 
-void handle_client(int client_pipe) {
-   char command[1024];
+/*
+ * Parse and run one command; every command ends its reply with FRAME_END or FRAME_ERROR.
+ * Returns -1 when the client asked to quit.
+ */
+int execute_command(Session *session, uint32_t stream, char *command) {
    char response[2048];
-   int nbytes;
-   
-   // Set the pipe to non-blocking mode
-	int flags = fcntl(client_pipe, F_GETFL, 0);
-	fcntl(client_pipe, F_SETFL, flags | O_NONBLOCK);
-
-    while ((nbytes = read(client_pipe, command, sizeof(command))) > 0) {
-        command[nbytes] = '\0'; // Ensure null termination
-        printf(">> Client PID %d command: '%s'\n", getpid(), command); // Print each command
-
-
-	   printf("Processed command: '%s'\n", command);
-
-       // Process the command
-       if (strncmp(command, "help", 4) == 0) {
-          help(client_pipe);
-       } else if (strncmp(command, "list", 4) == 0) {
-           list_files(response, sizeof(response));
-           write(client_pipe, response, strlen(response)); // Send list output back to client
-       } else if (strncmp(command, "readF", 5) == 0) {
-           char filename[256];
-           int line_number;
-           sscanf(command + 6, "%s %d", filename, &line_number);
-           read_file(filename, line_number, response, sizeof(response));
-           write(client_pipe, response, strlen(response));
-       } else if (strncmp(command, "writeT", 6) == 0) {
-           char filename[256];
-           int line_number;
-           char text[1024];
-           sscanf(command + 7, "%s %d %[^\n]", filename, &line_number, text);
-           write_to_file(filename, line_number, text, response, sizeof(response));
-           write(client_pipe, response, strlen(response));
-       } else if (strncmp(command, "download", 8) == 0) {
-           char filename[256];
-           sscanf(command + 9, "%s", filename);
-           download_file(filename, client_pipe);
-       } else if (strncmp(command, "upload", 6) == 0) {
-           char filename[256];
-           sscanf(command + 7, "%s", filename);
-           upload_file(filename, client_pipe);
-       } else if (strncmp(command, "archServer", 10) == 0) {
-           char tarname[256];
-           sscanf(command + 11, "%s", tarname);
-           archive_files(tarname, client_pipe);
-       } else if (strncmp(command, "killServer", 10) == 0) {
-           kill_server();
-       } else if (strncmp(command, "quit", 4) == 0) {
-           printf("Client requested to quit.\n");
-           break; // Exit the loop and close this client's connection
+
+   // Process the command
+   if (strncmp(command, "help", 4) == 0) {
+      help(session, stream);
+   } else if (strncmp(command, "list", 4) == 0) {
+       list_files(response, sizeof(response));
+       send_text(session->response_fd, FRAME_TEXT, stream, response); // Send list output back to client
+       send_frame(session->response_fd, FRAME_END, stream, NULL, 0);
+   } else if (strncmp(command, "readF", 5) == 0) {
+       // readF <file> [line | first-last]
+       char filename[256] = "";
+       int first = 0, last = 0;
+       int fields = sscanf(command + 5, "%255s %d-%d", filename, &first, &last);
+       if (fields < 3) {
+           last = first;
+       }
+       if (first < 0 || last < first) {
+           send_text(session->response_fd, FRAME_ERROR, stream, "Error: Invalid line range.\n");
+       } else {
+           read_file(filename, first, last, session, stream);
+       }
+   } else if (strncmp(command, "writeT", 6) == 0 || strncmp(command, "insertT", 7) == 0) {
+       int mode = command[0] == 'i' ? LINE_EDIT_INSERT : LINE_EDIT_REPLACE;
+       char filename[256] = "";
+       int line_number = 0;
+       char text[1024] = "";
+       // The line number is optional: writeT <file> <string> appends
+       char *args = command + (mode == LINE_EDIT_INSERT ? 7 : 6);
+       if (sscanf(args, "%255s %d %1023[^\n]", filename, &line_number, text) < 3) {
+           line_number = 0;
+           sscanf(args, "%255s %1023[^\n]", filename, text);
+       }
+       int status = line_number < 0 ? -1 : write_to_file(filename, line_number, text, mode, response, sizeof(response));
+       if (line_number < 0) {
+           snprintf(response, sizeof(response), "Error: Invalid line number.\n");
+       }
+       send_text(session->response_fd, status < 0 ? FRAME_ERROR : FRAME_END, stream, response);
+   } else if (strncmp(command, "download", 8) == 0) {
+       char filename[256] = "";
+       sscanf(command + 8, "%255s", filename);
+       download_file(filename, session, stream);
+   } else if (strncmp(command, "upload", 6) == 0) {
+       // upload <file> [size]; the data frames follow on this stream
+       char filename[256] = "";
+       long long declared = -1;
+       sscanf(command + 6, "%255s %lld", filename, &declared);
+       upload_begin(filename, declared, session, stream);
+   } else if (strncmp(command, "manifest", 8) == 0) {
+       char filename[256] = "";
+       sscanf(command + 8, "%255s", filename);
+       send_manifest(filename, session, stream);
+   } else if (strncmp(command, "chunks", 6) == 0) {
+       // chunks <file> <first>-<last>: part of a fetch
+       char filename[256] = "";
+       unsigned first = 0, last = 0;
+       if (sscanf(command + 6, "%255s %u-%u", filename, &first, &last) != 3 || last < first) {
+           send_text(session->response_fd, FRAME_ERROR, stream, "Error: Invalid chunk range.\n");
        } else {
-           snprintf(response, sizeof(response), "Unknown command: %s\n", command);
-           write(client_pipe, response, strlen(response));
+           send_chunks(filename, first, last, session, stream);
        }
+   } else if (strncmp(command, "put", 3) == 0) {
+       char filename[256] = "";
+       long long size = -1;
+       sscanf(command + 3, "%255s %lld", filename, &size);
+       put_begin(filename, size, session, stream);
+   } else if (strncmp(command, "archServer", 10) == 0) {
+       char tarname[256] = "";
+       sscanf(command + 10, "%255s", tarname);
+       archive_files(tarname, session, stream);
+   } else if (strncmp(command, "archive", 7) == 0) {
+       send_archive(session, stream);
+   } else if (strncmp(command, "compress", 8) == 0) {
+       char codec[16] = "";
+       sscanf(command + 8, "%15s", codec);
+       if (strcmp(codec, "lz") == 0 || strcmp(codec, "off") == 0) {
+           session->compress = strcmp(codec, "lz") == 0;
+           snprintf(response, sizeof(response), "Compression: %s\n", codec);
+           send_text(session->response_fd, FRAME_END, stream, response);
+       } else {
+           send_text(session->response_fd, FRAME_ERROR, stream, "Error: Unsupported compression, expected 'lz' or 'off'.\n");
+       }
+   } else if (strncmp(command, "killServer", 10) == 0) {
+       send_text(session->response_fd, FRAME_END, stream, "Server is shutting down...\n");
+       kill_server();
+   } else if (strncmp(command, "quit", 4) == 0) {
+       printf("Client requested to quit.\n");
+       send_text(session->response_fd, FRAME_END, stream, "Bye.\n");
+       return -1; // Exit the loop and close this client's connection
+   } else {
+       snprintf(response, sizeof(response), "Unknown command: %s\n", command);
+       send_text(session->response_fd, FRAME_ERROR, stream, response);
+   }
+   return 0;
+}
+
+
+/*
+ * Serve one session until the client quits or closes its FIFOs.
+ * Blocks in read() between commands instead of polling a non-blocking pipe.
+ */
+void handle_client(Session *session) {
+   char command[FRAME_COMMAND_MAX + 1];
+   FrameHeader header;
+   int status;
+
+   while ((status = recv_header(session->request_fd, &header)) > 0) {
+       // Uploads in flight send their data between commands
+       if (header.type == FRAME_DATA || header.type == FRAME_ZDATA) {
+           if (upload_data(session, header.stream, header.length, header.type == FRAME_ZDATA) < 0) {
+               status = -1;
+               break;
+           }
+           continue;
+       }
+       if (header.type == FRAME_CHUNK) {
+           if (upload_chunk(session, header.stream, header.length) < 0) {
+               status = -1;
+               break;
+           }
+           continue;
+       }
+       if (header.type == FRAME_END) {
+           if (discard_payload(session->request_fd, header.length) < 0) {
+               status = -1;
+               break;
+           }
+           upload_end(session, header.stream);
+           continue;
+       }
+       if (header.type != FRAME_COMMAND || header.length > FRAME_COMMAND_MAX) {
+           if (discard_payload(session->request_fd, header.length) < 0) {
+               status = -1;
+               break;
+           }
+           send_text(session->response_fd, FRAME_ERROR, header.stream, "Error: Expected a command.\n");
+           continue;
+       }
+       if (read_full(session->request_fd, command, header.length) < 0) {
+           status = -1;
+           break;
+       }
+       command[header.length] = '\0';
+       command[strcspn(command, "\r\n")] = '\0';
+       printf(">> Client PID %d command: '%s'\n", session->client_pid, command); // Print each command
 
+       if (execute_command(session, header.stream, command) < 0) {
+           break;
+       }
    }
 
-   if (nbytes < 0) {
+   if (status < 0) {
        perror("Failed to read from client FIFO");
    }
+   // Uploads the client never finished are dropped
+   for (int i = 0; i < SESSION_MAX_UPLOADS; i++) {
+       if (session->uploads[i].stream) {
+           free_upload(&session->uploads[i]);
+       }
+   }
 
-   close(client_pipe); // Close the client pipe when done
+   close(session->request_fd);
+   close(session->response_fd);
    printf("Client disconnected.\n");
 }
 
 
 
 void cleanup() {
-    cleanup_semaphores(); // Clean up semaphores
+    lock_table_destroy();
     printf("Server shutting down...\n");
-    // Perform cleanup, such as unlinking the server FIFO
-    unlink("/tmp/server_fifo"); // Adjust as necessary based on your actual server FIFO path
+    unlink(server_fifo_name);
     exit(0);
 }
 
@@ -445,17 +1138,31 @@ void setup_server_directory(const char *dirname) {
    }
 }
 
-int create_pipe(const char *pipe_name) {
-   printf("Creating pipe: %s\n", pipe_name);
-   unlink(pipe_name);
-   if (mkfifo(pipe_name, 0666) != 0) {
-       perror("Failed to create client FIFO");
+/*
+ * Open the FIFOs a client created for its session, in the order the client opens them.
+ * Blocks until the client has its ends open.
+ */
+int open_session(Session *session, pid_t client_pid) {
+   char request_name[FIFO_NAME_LEN];
+   char response_name[FIFO_NAME_LEN];
+   snprintf(request_name, sizeof(request_name), CLIENT_REQUEST_FIFO_TEMPLATE, client_pid);
+   snprintf(response_name, sizeof(response_name), CLIENT_RESPONSE_FIFO_TEMPLATE, client_pid);
+
+   memset(session, 0, sizeof(*session));
+   session->client_pid = client_pid;
+   session->request_fd = open(request_name, O_RDONLY);
+   if (session->request_fd == -1) {
+       perror("Failed to open client request FIFO");
        return -1;
    }
-   int pipe_fd = open(pipe_name, O_RDWR);
-   if (pipe_fd == -1) {
-       perror("Failed to open client FIFO");
+   session->response_fd = open(response_name, O_WRONLY);
+   if (session->response_fd == -1) {
+       perror("Failed to open client response FIFO");
+       close(session->request_fd);
        return -1;
    }
-   return pipe_fd;
+   // Room for a whole data frame per write, both ways
+   channel_set_pipe_size(session->request_fd);
+   channel_set_pipe_size(session->response_fd);
+   return 0;
 }
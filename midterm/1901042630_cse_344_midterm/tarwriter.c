@@ -0,0 +1,455 @@
+#define _GNU_SOURCE // scandir(), alphasort()
+#include "tarwriter.h"
+#include "channel.h"
+#include "locktable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/stat.h>
+
+// ustar header block
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} TarHeader;
+
+int tar_open(TarWriter *tar, int fd, uint32_t stream, const char *exclude) {
+    memset(tar, 0, sizeof(*tar));
+    tar->buffer = malloc(TAR_BUFFER_SIZE);
+    if (!tar->buffer) {
+        return -1;
+    }
+    tar->fd = fd;
+    tar->stream = stream;
+    tar->exclude = exclude;
+    tar->uid = (uid_t)-1;
+    tar->gid = (gid_t)-1;
+    return 0;
+}
+
+int tar_compress(TarWriter *tar, LzBatch *lz) {
+    char *buffer = lz_batch_buffer(lz);
+    if (!tar->stream || !buffer) {
+        return -1;
+    }
+    free(tar->buffer);
+    tar->buffer = buffer;
+    tar->lz = lz;
+    return 0;
+}
+
+static int flush(TarWriter *tar) {
+    if (tar->error) {
+        return -1;
+    }
+    if (tar->used == 0) {
+        return 0;
+    }
+    int status;
+    if (tar->lz) {
+        // The batch keeps the buffer, and hands out the next one
+        char *next = NULL;
+        status = lz_batch_add(tar->lz, tar->stream, tar->used);
+        if (status == 0 && !(next = lz_batch_buffer(tar->lz))) {
+            errno = ENOMEM;
+            status = -1;
+        }
+        if (next) {
+            tar->buffer = next;
+        }
+    } else {
+        status = tar->stream ? send_frame(tar->fd, FRAME_DATA, tar->stream, tar->buffer, tar->used)
+                             : write_full(tar->fd, tar->buffer, tar->used);
+    }
+    if (status < 0) {
+        tar->error = errno ? errno : EIO;
+        return -1;
+    }
+    tar->bytes += tar->used;
+    tar->used = 0;
+    return 0;
+}
+
+// Append 'len' bytes to the archive, zeros if 'data' is NULL
+static int emit(TarWriter *tar, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        if (tar->used == TAR_BUFFER_SIZE && flush(tar) < 0) {
+            return -1;
+        }
+        size_t n = len < TAR_BUFFER_SIZE - tar->used ? len : TAR_BUFFER_SIZE - tar->used;
+        if (p) {
+            memcpy(tar->buffer + tar->used, p, n);
+            p += n;
+        } else {
+            memset(tar->buffer + tar->used, 0, n);
+        }
+        tar->used += n;
+        len -= n;
+    }
+    return tar->error ? -1 : 0;
+}
+
+// Zeros up to the end of the block holding the last of 'size' bytes
+static int pad(TarWriter *tar, uint64_t size) {
+    return emit(tar, NULL, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+}
+
+static int fits(uint64_t value, size_t width) {
+    return value < 1ULL << (3 * (width - 1));
+}
+
+// Octal digits filling a field, with its terminating NUL
+static void octal(char *field, size_t width, uint64_t value) {
+    snprintf(field, width, "%0*llo", (int)width - 1, fits(value, width) ? (unsigned long long)value : 0ULL);
+}
+
+// Append "<length> <key>=<value>\n", where the length counts its own digits
+static size_t pax_record(char *pax, size_t len, size_t size, const char *key, const char *value) {
+    size_t body = strlen(key) + strlen(value) + 3;
+    size_t total = body;
+    while (body + snprintf(NULL, 0, "%zu", total) != total) {
+        total = body + snprintf(NULL, 0, "%zu", total);
+    }
+    return len + snprintf(pax + len, size - len, "%zu %s=%s\n", total, key, value);
+}
+
+// Fit 'name' in the name and prefix fields, split at a '/'; -1 if it does not fit
+static int split_name(TarHeader *header, const char *name) {
+    size_t len = strlen(name);
+    if (len <= sizeof(header->name)) {
+        memcpy(header->name, name, len);
+        return 0;
+    }
+    for (size_t i = len - sizeof(header->name) - 1; i < len && i <= sizeof(header->prefix); i++) {
+        if (name[i] == '/' && i > 0 && i + 1 < len) {
+            memcpy(header->prefix, name, i);
+            memcpy(header->name, name + i + 1, len - i - 1);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void owner_names(TarWriter *tar, uid_t uid, gid_t gid) {
+    if (uid != tar->uid) {
+        struct passwd *pw = getpwuid(uid);
+        snprintf(tar->uname, sizeof(tar->uname), "%s", pw ? pw->pw_name : "");
+        tar->uid = uid;
+    }
+    if (gid != tar->gid) {
+        struct group *gr = getgrgid(gid);
+        snprintf(tar->gname, sizeof(tar->gname), "%s", gr ? gr->gr_name : "");
+        tar->gid = gid;
+    }
+}
+
+static void fill_header(TarHeader *header, char type, mode_t mode, uint64_t size, const struct stat *st) {
+    octal(header->mode, sizeof(header->mode), mode & 07777);
+    octal(header->uid, sizeof(header->uid), st->st_uid);
+    octal(header->gid, sizeof(header->gid), st->st_gid);
+    octal(header->size, sizeof(header->size), size);
+    octal(header->mtime, sizeof(header->mtime), st->st_mtime > 0 ? (uint64_t)st->st_mtime : 0);
+    header->typeflag = type;
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+}
+
+static int emit_header(TarWriter *tar, TarHeader *header) {
+    unsigned int sum = 0;
+    memset(header->checksum, ' ', sizeof(header->checksum));
+    for (size_t i = 0; i < sizeof(*header); i++) {
+        sum += ((unsigned char *)header)[i];
+    }
+    snprintf(header->checksum, sizeof(header->checksum), "%06o", sum); // NUL, then the space left in place
+    return emit(tar, header, sizeof(*header));
+}
+
+/*
+ * Header of an entry of 'size' bytes; a pax extended header goes first for a
+ * name, link target, size or owner that the ustar fields cannot hold.
+ */
+static int add_header(TarWriter *tar, const char *path, char type, uint64_t size, const struct stat *st,
+                      const char *link) {
+    static char pax[2 * PATH_MAX + 256];
+    char name[PATH_MAX + 1];
+    char number[32];
+    size_t pax_len = 0;
+    TarHeader header;
+    memset(&header, 0, sizeof(header));
+
+    snprintf(name, sizeof(name), "%s%s", path, type == '5' ? "/" : "");
+    if (split_name(&header, name) < 0) {
+        pax_len = pax_record(pax, pax_len, sizeof(pax), "path", name);
+        memcpy(header.name, name, sizeof(header.name)); // Cut short, for readers without pax
+    }
+    if (link && strlen(link) > sizeof(header.linkname)) {
+        pax_len = pax_record(pax, pax_len, sizeof(pax), "linkpath", link);
+    }
+    if (!fits(size, sizeof(header.size))) {
+        snprintf(number, sizeof(number), "%llu", (unsigned long long)size);
+        pax_len = pax_record(pax, pax_len, sizeof(pax), "size", number);
+    }
+    if (!fits(st->st_uid, sizeof(header.uid))) {
+        snprintf(number, sizeof(number), "%lu", (unsigned long)st->st_uid);
+        pax_len = pax_record(pax, pax_len, sizeof(pax), "uid", number);
+    }
+    if (!fits(st->st_gid, sizeof(header.gid))) {
+        snprintf(number, sizeof(number), "%lu", (unsigned long)st->st_gid);
+        pax_len = pax_record(pax, pax_len, sizeof(pax), "gid", number);
+    }
+
+    if (pax_len > 0) {
+        TarHeader extended;
+        memset(&extended, 0, sizeof(extended));
+        const char *base = strrchr(path, '/');
+        snprintf(extended.name, sizeof(extended.name), "PaxHeaders/%s", base ? base + 1 : path);
+        fill_header(&extended, 'x', 0644, pax_len, st);
+        if (emit_header(tar, &extended) < 0 || emit(tar, pax, pax_len) < 0 || pad(tar, pax_len) < 0) {
+            return -1;
+        }
+    }
+
+    fill_header(&header, type, st->st_mode, size, st);
+    if (link) {
+        memcpy(header.linkname, link, strnlen(link, sizeof(header.linkname)));
+    }
+    owner_names(tar, st->st_uid, st->st_gid);
+    memcpy(header.uname, tar->uname, sizeof(header.uname));
+    memcpy(header.gname, tar->gname, sizeof(header.gname));
+    return emit_header(tar, &header);
+}
+
+static void warn(TarWriter *tar, const char *path, const char *reason) {
+    fprintf(stderr, "Archive: skipped '%s': %s\n", path, reason);
+    tar->warnings++;
+}
+
+// Copy 'size' bytes of 'fd' into the archive; a file that shrank is made up with zeros
+static int add_data(TarWriter *tar, int fd, uint64_t size) {
+    uint64_t offset = 0;
+    if (tar->stream && !tar->lz && size >= TAR_SPLICE_MIN) {
+        if (flush(tar) < 0) {
+            return -1;
+        }
+        while (offset < size) {
+            size_t chunk = size - offset < TAR_BUFFER_SIZE ? (size_t)(size - offset) : TAR_BUFFER_SIZE;
+            off_t at = offset;
+            int status = send_file_frame(tar->fd, FRAME_DATA, tar->stream, fd, &at, chunk);
+            if (status < 0 && errno != EIO) {
+                tar->error = errno;
+                return -1;
+            }
+            tar->bytes += chunk;
+            offset += chunk;
+            if (status < 0) {
+                tar->warnings++; // The frame was padded with zeros
+                if (emit(tar, NULL, size - offset) < 0) {
+                    return -1;
+                }
+                break;
+            }
+        }
+        return pad(tar, size);
+    }
+    if (tar->lz && size > 0) {
+        // The chunk the file starts in is compressed even if the previous file did not shrink
+        if (tar->used == TAR_BUFFER_SIZE && flush(tar) < 0) {
+            return -1;
+        }
+        lz_batch_restart(tar->lz);
+    }
+    while (offset < size) {
+        if (tar->used == TAR_BUFFER_SIZE && flush(tar) < 0) {
+            return -1;
+        }
+        size_t want = size - offset < TAR_BUFFER_SIZE - tar->used ? (size_t)(size - offset) : TAR_BUFFER_SIZE - tar->used;
+        ssize_t n = pread(fd, tar->buffer + tar->used, want, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            tar->warnings++;
+            if (emit(tar, NULL, size - offset) < 0) {
+                return -1;
+            }
+            break;
+        }
+        tar->used += n;
+        offset += n;
+    }
+    return pad(tar, size);
+}
+
+// Regular file, from 'fd' if the read-ahead already opened it; the file is closed
+static int add_file(TarWriter *tar, const char *path, int fd) {
+    file_lock(path, FILE_LOCK_READ);
+    if (fd == -1) {
+        fd = open(path, O_RDONLY);
+    }
+    struct stat st;
+    int status = 0;
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        warn(tar, path, strerror(errno));
+    } else if (!S_ISREG(st.st_mode)) {
+        warn(tar, path, "no longer a regular file");
+    } else if ((status = add_header(tar, path, '0', st.st_size, &st, NULL)) == 0) {
+        status = add_data(tar, fd, st.st_size);
+        tar->entries++;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    file_unlock();
+    return status;
+}
+
+static int visible(const struct dirent *entry) {
+    return entry->d_name[0] != '.';
+}
+
+static int not_dots(const struct dirent *entry) {
+    return strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+/*
+ * Archive the entries of directory 'path', "" for the current one, in name order.
+ * 'path' has room for PATH_MAX bytes and is extended in place for each entry.
+ */
+static int add_directory(TarWriter *tar, char *path, size_t len) {
+    const char *dirname = len ? path : ".";
+    struct dirent **names;
+    int count = scandir(dirname, &names, len ? not_dots : visible, alphasort);
+    int dir_fd = count < 0 ? -1 : open(dirname, O_RDONLY | O_DIRECTORY);
+    if (dir_fd == -1) {
+        warn(tar, dirname, strerror(errno));
+        for (int i = 0; i < count; i++) {
+            free(names[i]);
+        }
+        if (count >= 0) {
+            free(names);
+        }
+        return 0;
+    }
+    int fds[TAR_READAHEAD + 1]; // Files opened ahead, by entry index modulo the window
+    for (int i = 0; i <= TAR_READAHEAD; i++) {
+        fds[i] = -1;
+    }
+
+    int status = 0;
+    int ahead = 0;
+    for (int i = 0; i < count && status == 0; i++) {
+        // Start reading the next files while this one is copied
+        for (; ahead < count && ahead <= i + TAR_READAHEAD; ahead++) {
+            const char *name = names[ahead]->d_name;
+            if (names[ahead]->d_type == DT_REG && !(len == 0 && tar->exclude && strcmp(name, tar->exclude) == 0)) {
+                int fd = openat(dir_fd, name, O_RDONLY);
+                if (fd != -1) {
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+                }
+                fds[ahead % (TAR_READAHEAD + 1)] = fd;
+            }
+        }
+        int fd = fds[i % (TAR_READAHEAD + 1)];
+        fds[i % (TAR_READAHEAD + 1)] = -1;
+
+        const char *name = names[i]->d_name;
+        if (len == 0 && tar->exclude && strcmp(name, tar->exclude) == 0) {
+            continue;
+        }
+        size_t child = snprintf(path + len, PATH_MAX - len, "%s%s", len ? "/" : "", name) + len;
+        if (child >= PATH_MAX) {
+            path[len] = '\0';
+            warn(tar, name, "path too long");
+            if (fd != -1) {
+                close(fd);
+            }
+            continue;
+        }
+        struct stat st;
+        if (fd != -1 || names[i]->d_type == DT_REG) {
+            status = add_file(tar, path, fd);
+        } else if (lstat(path, &st) != 0) {
+            warn(tar, path, strerror(errno));
+        } else if (S_ISREG(st.st_mode)) {
+            status = add_file(tar, path, -1);
+        } else if (S_ISDIR(st.st_mode)) {
+            if ((status = add_header(tar, path, '5', 0, &st, NULL)) == 0) {
+                tar->entries++;
+                status = add_directory(tar, path, child);
+            }
+        } else if (S_ISLNK(st.st_mode)) {
+            char link[PATH_MAX];
+            ssize_t n = readlink(path, link, sizeof(link) - 1);
+            if (n < 0) {
+                warn(tar, path, strerror(errno));
+            } else {
+                link[n] = '\0';
+                status = add_header(tar, path, '2', 0, &st, link);
+                tar->entries++;
+            }
+        } else {
+            warn(tar, path, "not a file, directory or symbolic link");
+        }
+        path[len] = '\0';
+    }
+
+    for (int i = 0; i <= TAR_READAHEAD; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    close(dir_fd);
+    return status;
+}
+
+int tar_add_tree(TarWriter *tar) {
+    char path[PATH_MAX] = "";
+    return add_directory(tar, path, 0);
+}
+
+int tar_close(TarWriter *tar) {
+    // Two zero blocks end the archive, then it is padded to a whole record
+    if (!tar->error && emit(tar, NULL, 2 * TAR_BLOCK) == 0) {
+        uint64_t total = tar->bytes + tar->used;
+        if (emit(tar, NULL, (TAR_RECORD - total % TAR_RECORD) % TAR_RECORD) == 0 && flush(tar) == 0 && tar->lz &&
+            lz_batch_send(tar->lz) < 0) {
+            tar->error = errno;
+        }
+    }
+    if (!tar->lz) {
+        free(tar->buffer);
+    }
+    tar->buffer = NULL;
+    if (tar->error) {
+        errno = tar->error;
+        return -1;
+    }
+    return 0;
+}
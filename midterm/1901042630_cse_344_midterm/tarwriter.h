@@ -0,0 +1,59 @@
+#ifndef TARWRITER_H
+#define TARWRITER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "lz.h"
+
+/*
+ * Streaming tar writer, in POSIX ustar format with pax headers for what does not fit.
+ * The archive goes through one TAR_BUFFER_SIZE buffer, either written to a file or
+ * sent as data frames on a channel stream, so memory stays bounded whatever the
+ * size of the tree. Small files are read straight into that buffer; on a channel,
+ * larger ones are spliced behind a frame header, unless the frames are compressed,
+ * in which case the buffer is the next chunk of an LzBatch. Each file is read under
+ * its read lock. While one file is copied, the next TAR_READAHEAD files of the
+ * directory are already open with their reads started, so the disk works on them
+ * in parallel.
+ */
+
+#define TAR_BLOCK 512
+#define TAR_RECORD (TAR_BLOCK * 20)   // The archive is padded to whole records, as GNU tar does
+#define TAR_BUFFER_SIZE (1 << 20)     // One data frame of the channel
+#define TAR_SPLICE_MIN 65536          // Files at least this large are spliced onto a channel
+#define TAR_READAHEAD 16
+
+typedef struct {
+    int fd;                 // Archive file, or the channel
+    uint32_t stream;        // Stream of the data frames on the channel, 0 for a file
+    const char *exclude;    // Top-level name left out, the archive itself
+    LzBatch *lz;            // Compresses the data frames, NULL if they go as they are
+    char *buffer;
+    size_t used;
+    int error;              // errno of the first failure to write the archive, 0 if none
+    uint64_t bytes;         // Archive bytes written
+    uint64_t entries;
+    int warnings;           // Files skipped, or that changed while read
+    uid_t uid;              // Owner names of the last entry, looked up once per owner
+    gid_t gid;
+    char uname[32];
+    char gname[32];
+} TarWriter;
+
+// Start an archive on 'fd'; 'stream' 0 writes a file, otherwise data frames on that stream
+int tar_open(TarWriter *tar, int fd, uint32_t stream, const char *exclude);
+
+// Channel only: send the data frames through 'lz'; -1 on error
+int tar_compress(TarWriter *tar, LzBatch *lz);
+
+/*
+ * Archive everything in the current directory, subdirectories included, as
+ * "tar -cf archive *" would: entries starting with '.' at the top are left out.
+ * Returns -1 once the archive cannot be written; unreadable files only count as warnings.
+ */
+int tar_add_tree(TarWriter *tar);
+
+// Write the end of the archive and free the buffer; -1 if the archive is incomplete
+int tar_close(TarWriter *tar);
+
+#endif // TARWRITER_H
@@ -0,0 +1,93 @@
+#include "transfer.h"
+#include "crc32c.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+static char chunk_buffer[TRANSFER_CHUNK_SIZE];
+
+uint32_t *transfer_checksums(int fd, uint64_t size) {
+    uint32_t count = transfer_chunk_count(size);
+    uint32_t *crcs = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (!crcs) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t offset = (uint64_t)i * TRANSFER_CHUNK_SIZE;
+        size_t want = size - offset < TRANSFER_CHUNK_SIZE ? (size_t)(size - offset) : TRANSFER_CHUNK_SIZE;
+        ssize_t n = pread(fd, chunk_buffer, want, offset);
+        if (n < 0) {
+            free(crcs);
+            return NULL;
+        }
+        crcs[i] = crc32c(0, chunk_buffer, n);
+    }
+    return crcs;
+}
+
+int send_chunk(int fd, uint32_t stream, int file_fd, uint64_t offset, size_t length) {
+    size_t got = 0;
+    while (got < length) {
+        ssize_t n = pread(file_fd, chunk_buffer + got, length - got, offset + got);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO; // The file shrank
+            }
+            return -1;
+        }
+        got += n;
+    }
+    ChunkHeader chunk = {offset, crc32c(0, chunk_buffer, length), 0};
+    FrameHeader header = {FRAME_CHUNK, stream, (uint32_t)(sizeof(chunk) + length)};
+    struct iovec iov[3] = {{&header, sizeof(header)}, {&chunk, sizeof(chunk)}, {chunk_buffer, length}};
+    ssize_t n = writev(fd, iov, 3);
+    while (n < 0 && errno == EINTR) {
+        n = writev(fd, iov, 3);
+    }
+    if (n < 0) {
+        return -1;
+    }
+    // Short write on a full pipe: finish each part from where it stopped
+    for (int i = 0; i < 3; i++) {
+        if ((size_t)n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            continue;
+        }
+        if (write_full(fd, (char *)iov[i].iov_base + n, iov[i].iov_len - n) < 0) {
+            return -1;
+        }
+        n = 0;
+    }
+    return 0;
+}
+
+int recv_chunk(int fd, size_t length, int file_fd, ChunkHeader *chunk) {
+    if (length < sizeof(*chunk) || length - sizeof(*chunk) > TRANSFER_CHUNK_SIZE) {
+        discard_payload(fd, length);
+        errno = EMSGSIZE;
+        return -1;
+    }
+    length -= sizeof(*chunk);
+    if (read_full(fd, chunk, sizeof(*chunk)) < 0 || read_full(fd, chunk_buffer, length) < 0) {
+        return -1;
+    }
+    if (crc32c(0, chunk_buffer, length) != chunk->crc) {
+        return 1;
+    }
+    for (size_t done = 0; done < length; ) {
+        ssize_t n = pwrite(file_fd, chunk_buffer + done, length - done, chunk->offset + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
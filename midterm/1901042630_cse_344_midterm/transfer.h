@@ -0,0 +1,55 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "channel.h"
+
+/*
+ * Checksummed, resumable transfers.
+ * A file is cut into TRANSFER_CHUNK_SIZE chunks, and its manifest lists the
+ * CRC32C of each. Comparing manifests tells either side which chunks the other
+ * already has, so an interrupted transfer resends only what is missing. Chunks
+ * travel as FRAME_CHUNK frames: a ChunkHeader with the chunk's offset and
+ * checksum, then the data. The receiver checks the data and pwrite()s it at its
+ * offset, so chunks can arrive in any order and over several sessions at once.
+ */
+
+#define TRANSFER_CHUNK_SIZE (1 << 19)  // With its header, a chunk fits in one frame
+#define TRANSFER_MAX_STREAMS 8   // Parallel sessions of one fetch
+
+// Payload of a manifest: this header, then 'count' CRC32C values
+typedef struct {
+    uint64_t size;
+    uint32_t chunk_size;
+    uint32_t count;
+} ManifestHeader;
+
+// Start of a FRAME_CHUNK payload; the chunk's data follows
+typedef struct {
+    uint64_t offset;
+    uint32_t crc;
+    uint32_t reserved;
+} ChunkHeader;
+
+// Largest file whose manifest fits in one frame
+#define TRANSFER_MAX_CHUNKS ((FRAME_MAX_PAYLOAD - sizeof(ManifestHeader)) / sizeof(uint32_t))
+
+static inline uint32_t transfer_chunk_count(uint64_t size) {
+    return (size + TRANSFER_CHUNK_SIZE - 1) / TRANSFER_CHUNK_SIZE;
+}
+
+// Checksums of the chunks of the first 'size' bytes of 'fd'; a malloc'd array, or NULL
+uint32_t *transfer_checksums(int fd, uint64_t size);
+
+// Send bytes [offset, offset + length) of 'file_fd' as a FRAME_CHUNK frame; -1 on error
+int send_chunk(int fd, uint32_t stream, int file_fd, uint64_t offset, size_t length);
+
+/*
+ * Receive the payload of a FRAME_CHUNK frame of 'length' bytes and write it to
+ * 'file_fd' at its offset. The header goes to 'chunk'. Returns 0, 1 if the data did
+ * not match its checksum (and was not written), or -1 on error.
+ */
+int recv_chunk(int fd, size_t length, int file_fd, ChunkHeader *chunk);
+
+#endif // TRANSFER_H